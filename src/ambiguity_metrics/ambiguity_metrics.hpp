@@ -11,6 +11,7 @@
 namespace shrg {
     class ChartItem;
     class Generator;
+    class PackedForest;
 }
 
 namespace lexcxg {
@@ -56,6 +57,14 @@ double CountDerivationsLog(::shrg::ChartItem* root, ::shrg::Generator* generator
 
 ::shrg::ChartItem* GetCanonicalNode(::shrg::ChartItem* node);
 
+// The same metrics computed by sweeps over a packed forest, with no hashing or recursion.
+void ComputePartitionAndEntropyDP(
+    const ::shrg::PackedForest& forest,
+    double& out_log_Z,
+    double& out_entropy
+);
+double ComputeLogDerivationCount(const ::shrg::PackedForest& forest);
+
 inline double LogAdd(double a, double b) {
     if (a == -std::numeric_limits<double>::infinity()) return b;
     if (b == -std::numeric_limits<double>::infinity()) return a;
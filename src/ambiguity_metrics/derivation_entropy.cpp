@@ -30,16 +30,16 @@ void ComputeGammaLogWeightSum(
         visited.insert(ptr);
 
         double log_w = 0.0;
-        if (ptr->rule_ptr) {
-            log_w = ptr->rule_ptr->log_rule_weight;
+        if (ptr->Annotations().rule_ptr) {
+            log_w = ptr->Annotations().rule_ptr->log_rule_weight;
         }
         double log_alpha_item = log_w;
-        for (shrg::ChartItem* child : ptr->children) {
-            if (IsValidProb(child->log_inside_prob)) {
-                log_alpha_item += child->log_inside_prob;
+        for (shrg::ChartItem* child : ptr->Annotations().children) {
+            if (IsValidProb(child->Annotations().log_inside_prob)) {
+                log_alpha_item += child->Annotations().log_inside_prob;
             }
         }
-        double log_outside = ptr->log_outside_prob;
+        double log_outside = ptr->Annotations().log_outside_prob;
 
         if (IsValidProb(log_alpha_item) && IsValidProb(log_outside)) {
             double log_gamma = log_alpha_item + log_outside - log_Z;
@@ -50,7 +50,7 @@ void ComputeGammaLogWeightSum(
             }
         }
 
-        for (shrg::ChartItem* child : ptr->children) {
+        for (shrg::ChartItem* child : ptr->Annotations().children) {
             ComputeGammaLogWeightSum(child, log_Z, sum_gamma_log_w, visited);
         }
 
@@ -67,13 +67,13 @@ double ComputeDerivationEntropy(shrg::ChartItem* root, double log_partition, boo
 
     double log_Z = log_partition;
     if (!IsValidProb(log_Z)) {
-        log_Z = root->log_inside_prob;
+        log_Z = root->Annotations().log_inside_prob;
     }
 
     if (debug) {
         std::cerr << "[DEBUG] Derivation Entropy Computation\n";
         std::cerr << "[DEBUG] log_partition=" << log_partition
-                  << " root->log_inside=" << root->log_inside_prob
+                  << " root->log_inside=" << root->Annotations().log_inside_prob
                   << " log_Z=" << log_Z << "\n";
     }
 
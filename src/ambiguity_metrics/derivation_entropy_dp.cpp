@@ -1,4 +1,5 @@
 #include "ambiguity_metrics/ambiguity_metrics.hpp"
+#include "graph_parser/packed_forest.hpp"
 #include "graph_parser/parser_chart_item.hpp"
 
 #include <unordered_map>
@@ -65,15 +66,15 @@ OrNodeResult ComputeEntropyDP(
         alt.sum_child_entropy = 0.0;
 
         double log_rule_weight = 0.0;
-        if (ptr->rule_ptr) {
-            log_rule_weight = ptr->rule_ptr->log_rule_weight;
+        if (ptr->Annotations().rule_ptr) {
+            log_rule_weight = ptr->Annotations().rule_ptr->log_rule_weight;
         }
 
         // Compute log_w(a) = log p(rule) + sum_c log Z(c)
         // and accumulate child entropies
         alt.log_w = log_rule_weight;
 
-        for (shrg::ChartItem* child : ptr->children) {
+        for (shrg::ChartItem* child : ptr->Annotations().children) {
             OrNodeResult child_result = ComputeEntropyDP(child, memo, debug);
             alt.log_w += child_result.log_Z;
             alt.sum_child_entropy += child_result.entropy;
@@ -179,4 +180,51 @@ void ComputePartitionAndEntropyDP(
     out_entropy = result.entropy;
 }
 
+void ComputePartitionAndEntropyDP(
+    const shrg::PackedForest& forest,
+    double& out_log_Z,
+    double& out_entropy
+) {
+    out_log_Z = -std::numeric_limits<double>::infinity();
+    out_entropy = 0.0;
+    if (forest.Empty()) {
+        return;
+    }
+
+    auto rule_weight = [](const shrg::SHRG* rule) { return rule->log_rule_weight; };
+    std::vector<double> log_Z;
+    forest.Inside(rule_weight, log_Z);
+
+    // H(v) = log Z(v) - sum_a r(a|v) log_w(a) + sum_a r(a|v) sum_c H(c), children come first
+    const std::vector<uint32_t>& children = forest.Children();
+    std::vector<double> entropy(forest.NumNodes(), 0.0);
+    for (uint32_t i = 0; i < forest.NumNodes(); ++i) {
+        if (!IsValidProb(log_Z[i])) {
+            continue;
+        }
+        const shrg::PackedForest::Node& node = forest.GetNode(i);
+        double sum_r_log_w = 0.0;
+        double sum_r_child_entropy = 0.0;
+        for (uint32_t e = node.edge_begin; e < node.edge_end; ++e) {
+            const shrg::PackedForest::Hyperedge& edge = forest.GetEdge(e);
+            double log_w = rule_weight(edge.rule_ptr);
+            double sum_child_entropy = 0.0;
+            for (uint32_t c = edge.child_begin; c < edge.child_end; ++c) {
+                log_w += log_Z[children[c]];
+                sum_child_entropy += entropy[children[c]];
+            }
+            if (!std::isfinite(log_w)) {
+                continue;
+            }
+            double r = std::exp(log_w - log_Z[i]);
+            sum_r_log_w += r * log_w;
+            sum_r_child_entropy += r * sum_child_entropy;
+        }
+        entropy[i] = std::max(0.0, log_Z[i] - sum_r_log_w + sum_r_child_entropy);
+    }
+
+    out_log_Z = log_Z.back();
+    out_entropy = entropy.back();
+}
+
 }
@@ -1,6 +1,7 @@
 #include "ambiguity_metrics/ambiguity_metrics.hpp"
 #include "graph_parser/parser_chart_item.hpp"
 #include "graph_parser/generator.hpp"
+#include "graph_parser/packed_forest.hpp"
 
 #include <unordered_map>
 #include <queue>
@@ -15,7 +16,7 @@ void PopulateChildrenRecursive(
     shrg::ChartItem* root,
     shrg::Generator* generator
 ) {
-    if (!root || root->child_visited_status == CHILDREN_VISITED) {
+    if (!root || root->Annotations().child_visited_status == CHILDREN_VISITED) {
         return;
     }
 
@@ -23,19 +24,19 @@ void PopulateChildrenRecursive(
     shrg::ChartItem* ptr = start;
 
     do {
-        if (ptr->child_visited_status != CHILDREN_VISITED) {
+        if (ptr->Annotations().child_visited_status != CHILDREN_VISITED) {
             const shrg::SHRG* rule = ptr->attrs_ptr->grammar_ptr;
 
-            ptr->children.reserve(rule->nonterminal_edges.size());
+            ptr->Annotations().children.reserve(rule->nonterminal_edges.size());
             for (auto edge_ptr : rule->nonterminal_edges) {
                 shrg::ChartItem* child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                ptr->children.push_back(child);
+                ptr->Annotations().children.push_back(child);
                 PopulateChildrenRecursive(child, generator);
             }
 
-            ptr->child_visited_status = CHILDREN_VISITED;
+            ptr->Annotations().child_visited_status = CHILDREN_VISITED;
         } else {
-            for (auto child : ptr->children) {
+            for (auto child : ptr->Annotations().children) {
                 PopulateChildrenRecursive(child, generator);
             }
         }
@@ -73,10 +74,10 @@ double ComputeCountRecursive(
     do {
         double alt_count = 1.0;
 
-        if (ptr->children.empty()) {
+        if (ptr->Annotations().children.empty()) {
             alt_count = 1.0;
         } else {
-            for (shrg::ChartItem* child : ptr->children) {
+            for (shrg::ChartItem* child : ptr->Annotations().children) {
                 double child_count = ComputeCountRecursive(child, cache);
                 alt_count *= child_count;
 
@@ -152,8 +153,8 @@ double ComputeLogCountRecursive(
     do {
         double log_alt_count = 0.0;  // log(1) = 0
 
-        if (!ptr->children.empty()) {
-            for (shrg::ChartItem* child : ptr->children) {
+        if (!ptr->Annotations().children.empty()) {
+            for (shrg::ChartItem* child : ptr->Annotations().children) {
                 double log_child_count = ComputeLogCountRecursive(child, cache);
                 log_alt_count += log_child_count;
             }
@@ -197,4 +198,9 @@ double CountDerivationsLog(shrg::ChartItem* root, shrg::Generator* generator) {
     return ComputeLogDerivationCount(root);
 }
 
-}
\ No newline at end of file
+double ComputeLogDerivationCount(const shrg::PackedForest& forest) {
+    std::vector<double> log_count;
+    return forest.Inside([](const shrg::SHRG*) { return 0.0; }, log_count);
+}
+
+}
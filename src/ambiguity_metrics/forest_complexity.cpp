@@ -32,10 +32,10 @@ void ComputeStatsRecursive(
 
         visited.insert(ptr);
         stats.num_nodes++;
-        stats.num_edges += static_cast<int>(ptr->children.size());
+        stats.num_edges += static_cast<int>(ptr->Annotations().children.size());
         stats.max_depth = std::max(stats.max_depth, depth);
 
-        for (shrg::ChartItem* child : ptr->children) {
+        for (shrg::ChartItem* child : ptr->Annotations().children) {
             ComputeStatsRecursive(child, visited, stats, depth + 1);
         }
 
@@ -64,7 +64,6 @@ ForestStats ComputeForestComplexity(shrg::ChartItem* root) {
     return stats;
 }
 
-
 AmbiguityMetrics ComputeAllMetrics(shrg::ChartItem* root, double log_partition) {
     AmbiguityMetrics metrics;
 
@@ -74,7 +73,7 @@ AmbiguityMetrics ComputeAllMetrics(shrg::ChartItem* root, double log_partition)
 
     metrics.expected_count = ComputeExpectedDerivationCount(root);
 
-    if (IsValidProb(log_partition) || IsValidProb(root->log_inside_prob)) {
+    if (IsValidProb(log_partition) || IsValidProb(root->Annotations().log_inside_prob)) {
         metrics.entropy = ComputeDerivationEntropy(root, log_partition, false);
         metrics.has_valid_probabilities = true;
     }
@@ -97,7 +96,7 @@ AmbiguityMetrics ComputeAllMetrics(shrg::ChartItem* root, double log_partition)
             visited.insert(ptr);
             alt_count++;
 
-            for (shrg::ChartItem* child : ptr->children) {
+            for (shrg::ChartItem* child : ptr->Annotations().children) {
                 countAlternatives(child);
             }
 
@@ -21,6 +21,7 @@
 #include "ambiguity_metrics/ambiguity_metrics.hpp"
 #include "em_framework/find_derivations.hpp"
 #include "em_framework/em.hpp"
+#include "graph_parser/packed_forest.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -39,24 +40,10 @@
 #include <algorithm>
 #include <random>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <unistd.h>
-#include <csignal>
-#include <csetjmp>
 
 using namespace shrg;
 
-// ============================================================================
-// Timeout handling for parent process parses
-// ============================================================================
-static sigjmp_buf g_timeout_jmp;
-static volatile sig_atomic_t g_timeout_flag = 0;
-
-static void sigalrm_handler(int) {
-    g_timeout_flag = 1;
-    siglongjmp(g_timeout_jmp, 1);
-}
-
 // ============================================================================
 // Helper Functions
 // ============================================================================
@@ -172,7 +159,7 @@ float FindBestDerivationWeight(ChartItem *root_ptr, Generator *generator) {
     if (!root_ptr) return -std::numeric_limits<float>::infinity();
     // Use em_greedy_deriv for visited tracking (em_greedy_score is used by SampleDerivationTree)
     // This frees up 'status' to store the CFG rule index for generation
-    if (root_ptr->em_greedy_deriv == VISITED)
+    if (root_ptr->Annotations().em_greedy_deriv == VISITED)
         return root_ptr->score;
 
     ChartItem *ptr = root_ptr;
@@ -212,14 +199,14 @@ float FindBestDerivationWeight(ChartItem *root_ptr, Generator *generator) {
     if (max_subgraph_ptr != root_ptr)
         root_ptr->Swap(*max_subgraph_ptr);
 
-    root_ptr->em_greedy_deriv = VISITED;  // Mark as visited
+    root_ptr->Annotations().em_greedy_deriv = VISITED;  // Mark as visited
     root_ptr->score = static_cast<float>(max_weight);
     return root_ptr->score;
 }
 
 ChartItem* SampleDerivationTree(ChartItem* root_ptr, std::mt19937& gen) {
     if (!root_ptr) return nullptr;
-    if (root_ptr->em_greedy_score == VISITED)
+    if (root_ptr->Annotations().em_greedy_score == VISITED)
         return root_ptr;
 
     ChartItem* ptr = root_ptr;
@@ -240,13 +227,13 @@ ChartItem* SampleDerivationTree(ChartItem* root_ptr, std::mt19937& gen) {
         root_ptr->Swap(*chosen_ptr);
     }
 
-    for (auto child : root_ptr->children) {
+    for (auto child : root_ptr->Annotations().children) {
         if (child) {
             SampleDerivationTree(child, gen);
         }
     }
 
-    root_ptr->em_greedy_score = VISITED;
+    root_ptr->Annotations().em_greedy_score = VISITED;
     return root_ptr;
 }
 
@@ -944,7 +931,7 @@ int main(int argc, char* argv[]) {
     const int parse_timeout_seconds = 10;
 
     std::cout << "Processing " << num_graphs << " graphs...\n";
-    std::cout << "  (fork safety: timeout=" << parse_timeout_seconds << "s per graph)\n";
+    std::cout << "  (timeout=" << parse_timeout_seconds << "s per graph)\n";
 
     std::chrono::high_resolution_clock::time_point total_start = std::chrono::high_resolution_clock::now();
     int skipped_count = 0;
@@ -1006,9 +993,11 @@ int main(int argc, char* argv[]) {
             // CRITICAL: Set the graph pointer for the generator (needed for sentence generation)
             context->parser->SetGraph(&manager->edsgraphs[i]);
 
-            // 1. Compute Entropy
+            // 1. Compute Entropy, by sweeps over the packed forest
             double log_Z = 0, entropy = 0;
-            lexcxg::ComputePartitionAndEntropyDP(cached_root, log_Z, entropy);
+            PackedForest packed_forest;
+            packed_forest.BuildFromAnnotations(cached_root);
+            lexcxg::ComputePartitionAndEntropyDP(packed_forest, log_Z, entropy);
             result.entropy = entropy;
             result.log_Z = log_Z;
 
@@ -1022,8 +1011,8 @@ int main(int argc, char* argv[]) {
 
                 ChartItem* ptr = node;
                 do {
-                    for (size_t c = 0; c < ptr->children.size(); ++c) {
-                        countOrNodes(ptr->children[c]);
+                    for (size_t c = 0; c < ptr->Annotations().children.size(); ++c) {
+                        countOrNodes(ptr->Annotations().children[c]);
                     }
                     ptr = ptr->next_ptr;
                 } while (ptr && ptr != node);
@@ -1077,84 +1066,21 @@ int main(int argc, char* argv[]) {
             continue;  // Skip to next graph
         }
 
-        // ========== Fork-based timeout protection ==========
-        // Match em.cpp's run_safe() pattern: test parse AND forest processing
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Child: test full processing pipeline (parse + forest operations)
-            signal(SIGALRM, SIG_DFL);  // Ensure default handler (terminate process)
-            alarm(parse_timeout_seconds);  // Kernel timer - sends SIGALRM after timeout
-
-            auto child_code = context->Parse(static_cast<int>(i));
-            if (child_code == ParserError::kNone) {
-                ChartItem* child_root = context->parser->Result();
-                if (child_root) {
-                    // Test the operations that can hang (like em.cpp does)
-                    em_helper.addParentPointerOptimized(child_root, 0);
-                    em_helper.addRulePointer(child_root);
-                }
-            }
-            alarm(0);  // Cancel alarm if completed
-            _exit(child_code == ParserError::kNone ? 0 : 1);
-        }
-
-        bool should_skip = false;
-        if (pid < 0) {
-            // fork failed - parse directly (no protection)
-            std::cerr << "\nWarning: fork() failed for " << result.graph_id << ", parsing directly\n";
-        } else {
-            // Parent: blocking wait for child (child will self-terminate via SIGALRM if timeout)
-            int status;
-            waitpid(pid, &status, 0);
-
-            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-                std::string reason;
-                if (WIFSIGNALED(status)) {
-                    int sig = WTERMSIG(status);
-                    if (sig == SIGKILL) reason = "OOM killed";
-                    else if (sig == SIGALRM) reason = "timeout (" + std::to_string(parse_timeout_seconds) + "s)";
-                    else reason = "signal " + std::to_string(sig);
-                } else {
-                    reason = "parse failed";
-                }
-                std::cout << "\n  [SKIP] " << result.graph_id << " - " << reason << "\n";
-                skipped_count++;
-                should_skip = true;
-            }
-        }
-
-        if (should_skip) {
-            results.push_back(result);
-            continue;
-        }
-
-        // ========== First Parse: Baseline + EM (with alarm timeout) ==========
-        // Set up SIGALRM handler for timeout protection
-        struct sigaction sa_new, sa_old;
-        sa_new.sa_handler = sigalrm_handler;
-        sigemptyset(&sa_new.sa_mask);
-        sa_new.sa_flags = 0;
-        sigaction(SIGALRM, &sa_new, &sa_old);
-
-        g_timeout_flag = 0;
-        ParserError error = ParserError::kUnknown;
+        // ========== First Parse: Baseline + EM (with timeout) ==========
         ChartItem* root = nullptr;
-
-        if (sigsetjmp(g_timeout_jmp, 1) == 0) {
-            alarm(parse_timeout_seconds);
-            error = context->Parse(static_cast<int>(i));
-            alarm(0);  // Cancel alarm
-        } else {
-            // Timeout occurred via siglongjmp
-            std::cout << "\n  [SKIP] " << result.graph_id << " - parent parse timeout (" << parse_timeout_seconds << "s)\n";
-            sigaction(SIGALRM, &sa_old, nullptr);  // Restore handler
+        ParserError error = context->Parse(static_cast<int>(i),
+                                           Deadline::After(parse_timeout_seconds));
+        if (error == ParserError::kTimeout || error == ParserError::kOutOfMemory) {
+            std::cout << "\n  [SKIP] " << result.graph_id << " - "
+                      << (error == ParserError::kTimeout
+                              ? "timeout (" + std::to_string(parse_timeout_seconds) + "s)"
+                              : std::string("out of memory"))
+                      << "\n";
             skipped_count++;
             results.push_back(result);
             continue;
         }
 
-        sigaction(SIGALRM, &sa_old, nullptr);  // Restore handler
-
         if (error != ParserError::kNone) {
             results.push_back(result);
             continue;
@@ -1190,9 +1116,11 @@ int main(int argc, char* argv[]) {
             forest_cache_ptr->save(result.graph_id, graph_hash, persistent_root);
         }
 
-        // 1. Compute Entropy
+        // 1. Compute Entropy, by sweeps over the packed forest
         double log_Z = 0, entropy = 0;
-        lexcxg::ComputePartitionAndEntropyDP(root, log_Z, entropy);
+        PackedForest packed_forest;
+        packed_forest.BuildFromAnnotations(root);
+        lexcxg::ComputePartitionAndEntropyDP(packed_forest, log_Z, entropy);
         result.entropy = entropy;
         result.log_Z = log_Z;
 
@@ -1206,8 +1134,8 @@ int main(int argc, char* argv[]) {
 
             ChartItem* ptr = node;
             do {
-                for (size_t c = 0; c < ptr->children.size(); ++c) {
-                    countOrNodes(ptr->children[c]);
+                for (size_t c = 0; c < ptr->Annotations().children.size(); ++c) {
+                    countOrNodes(ptr->Annotations().children[c]);
                 }
                 ptr = ptr->next_ptr;
             } while (ptr && ptr != node);
@@ -1234,14 +1162,9 @@ int main(int argc, char* argv[]) {
         result.predicted_rules = deriv_info.rule_indices;
         result.predicted_edge_sets = deriv_info.edge_sets;
 
-        // ========== Second Parse: Oracle (with alarm timeout) ==========
-        sigaction(SIGALRM, &sa_new, &sa_old);
-        g_timeout_flag = 0;
-
-        if (sigsetjmp(g_timeout_jmp, 1) == 0) {
-            alarm(parse_timeout_seconds);
-            error = context->Parse(static_cast<int>(i));
-            alarm(0);  // Cancel alarm
+        // ========== Second Parse: Oracle (with timeout) ==========
+        {
+            error = context->Parse(static_cast<int>(i), Deadline::After(parse_timeout_seconds));
 
             if (error == ParserError::kNone) {
                 root = context->parser->Result();
@@ -1259,8 +1182,6 @@ int main(int argc, char* argv[]) {
         }
         // If timeout on oracle parse, just skip oracle (don't skip entire graph)
 
-        sigaction(SIGALRM, &sa_old, nullptr);  // Restore handler
-
         // Compute BLEU scores (compare against lemma_sequence, not original_sentence)
         result.bleu_em = computeSentenceBleu(result.em_sentence, result.lemma_sequence);
         result.bleu_baseline = computeSentenceBleu(result.baseline_sentence, result.lemma_sequence);
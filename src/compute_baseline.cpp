@@ -106,7 +106,7 @@ void SelectUniformDerivation(ChartItem* root_ptr, DerivationInfo& deriv_info,
     std::vector<ChartItem*> alternatives;
     ChartItem* ptr = root_ptr;
     do {
-        if (ptr->rule_ptr) {
+        if (ptr->Annotations().rule_ptr) {
             alternatives.push_back(ptr);
         }
         ptr = ptr->next_ptr;
@@ -129,12 +129,12 @@ void SelectUniformDerivation(ChartItem* root_ptr, DerivationInfo& deriv_info,
 
     // Uniformly sample one alternative (SHRG rule)
     ChartItem* chosen = uniformSample(alternatives);
-    if (!chosen || !chosen->rule_ptr) {
+    if (!chosen || !chosen->Annotations().rule_ptr) {
         return;
     }
 
     // Record this rule
-    deriv_info.rule_indices.push_back(chosen->shrg_index);
+    deriv_info.rule_indices.push_back(chosen->Annotations().shrg_index);
     deriv_info.edge_sets.push_back(chosen->edge_set);
 
     // Swap chosen to root position so Generator uses it
@@ -162,7 +162,7 @@ void SelectUniformDerivation(ChartItem* root_ptr, DerivationInfo& deriv_info,
     }
 
     // Recursively process children
-    for (auto child : root_ptr->children) {
+    for (auto child : root_ptr->Annotations().children) {
         SelectUniformDerivation(child, deriv_info, visited);
     }
 }
@@ -23,6 +23,7 @@
 // Parser includes
 #include "manager.hpp"
 #include "graph_parser/parser_base.hpp"
+#include "graph_parser/packed_forest.hpp"
 #include "em_framework/em.hpp"
 #include "em_framework/em_utils.hpp"
 
@@ -313,7 +314,9 @@ int main(int argc, char* argv[]) {
         auto start = std::chrono::high_resolution_clock::now();
 
         double log_Z, entropy;
-        ComputePartitionAndEntropyDP(root, log_Z, entropy);
+        shrg::PackedForest forest;
+        forest.BuildFromAnnotations(root);
+        ComputePartitionAndEntropyDP(forest, log_Z, entropy);
 
         auto end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double, std::milli> elapsed = end - start;
@@ -332,7 +335,7 @@ int main(int argc, char* argv[]) {
 
             shrg::ChartItem* ptr = node;
             do {
-                for (shrg::ChartItem* child : ptr->children) {
+                for (shrg::ChartItem* child : ptr->Annotations().children) {
                     countOrNodes(child);
                 }
                 ptr = ptr->next_ptr;
@@ -13,6 +13,7 @@
 #include "ambiguity_metrics/ambiguity_metrics.hpp"
 #include "manager.hpp"
 #include "graph_parser/parser_base.hpp"
+#include "graph_parser/packed_forest.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -104,8 +105,10 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        // Count derivations using the efficient method (children only, no parents_sib)
-        double log_count = lexcxg::CountDerivationsLog(root, generator);
+        // Count derivations by a sweep over the packed forest (children only, no parents_sib)
+        PackedForest forest;
+        forest.Build(root, generator);
+        double log_count = lexcxg::ComputeLogDerivationCount(forest);
         double count = std::exp(log_count);
 
         // Cap display count at 1e100 for readability
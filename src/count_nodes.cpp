@@ -258,7 +258,7 @@ using namespace shrg;
 //     return log_inside;
 // }
 int count_nodes(ChartItem *root){
-    if(root->count_visited_status == ChartItem::kVisited) {
+    if(root->Annotations().count_visited_status == ChartItem::kVisited) {
         return 0;
     }
     int count = 0;
@@ -266,7 +266,7 @@ int count_nodes(ChartItem *root){
     do{
         count++;
         ptr = ptr->next_ptr;
-        ptr->count_visited_status = ChartItem::kVisited;
+        ptr->Annotations().count_visited_status = ChartItem::kVisited;
         count += count_nodes(ptr);
     }while (ptr != root);
 }
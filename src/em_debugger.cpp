@@ -23,39 +23,39 @@ void addParentPointer(Context *context, ChartItem *root, int level){
     Generator *generator = context->parser->GetGenerator();
 
     do {
-        if (level > ptr->level) {
-            ptr->level = level;
+        if (level > ptr->Annotations().level) {
+            ptr->Annotations().level = level;
         }
 
         const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
-        if (ptr->child_visited_status != VISITED) {
+        if (ptr->Annotations().child_visited_status != VISITED) {
             for (auto edge_ptr : rule->nonterminal_edges) {
                 ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                ptr->children.push_back(child);
-                addParentPointer(context, child, ptr->level + 1);
+                ptr->Annotations().children.push_back(child);
+                addParentPointer(context, child, ptr->Annotations().level + 1);
             }
-            for (int i = 0; i < ptr->children.size(); i++) {
+            for (int i = 0; i < ptr->Annotations().children.size(); i++) {
                 std::vector<ChartItem *> sib;
                 std::tuple<ChartItem *, std::vector<ChartItem *>> res;
-                for (int j = 0; j < ptr->children.size(); j++) {
+                for (int j = 0; j < ptr->Annotations().children.size(); j++) {
                     if (j == i) {
                         continue;
                     }
-                    sib.push_back(ptr->children[j]);
+                    sib.push_back(ptr->Annotations().children[j]);
                 }
 
                 if (ptr) {
                     res = std::make_tuple(ptr, sib);
-                    ptr->children[i]->parents_sib.push_back(res);
+                    ptr->Annotations().children[i]->Annotations().parents_sib.push_back(res);
                 }
             }
-            ptr->child_visited_status = VISITED;
+            ptr->Annotations().child_visited_status = VISITED;
         } else {
-            for (auto child : ptr->children) {
-                addParentPointer(context, child, ptr->level + 1);
+            for (auto child : ptr->Annotations().children) {
+                addParentPointer(context, child, ptr->Annotations().level + 1);
             }
         }
-        assert(ptr->children.size() == rule->nonterminal_edges.size());
+        assert(ptr->Annotations().children.size() == rule->nonterminal_edges.size());
 
         ptr = ptr->next_ptr;
     } while (ptr != root);
@@ -76,48 +76,48 @@ void addParentPointerOptimized(Context *context, ChartItem *root, int level) {
 
         ChartItem *current = ptr;
         do {
-            if (level > current->level) {
-                current->level = level;
+            if (level > current->Annotations().level) {
+                current->Annotations().level = level;
             }
 
             const SHRG *rule = current->attrs_ptr->grammar_ptr;
 
-            if (current->child_visited_status != VISITED) {
-                current->children.reserve(rule->nonterminal_edges.size());
+            if (current->Annotations().child_visited_status != VISITED) {
+                current->Annotations().children.reserve(rule->nonterminal_edges.size());
 
                 // Find and process children
                 for (auto edge_ptr : rule->nonterminal_edges) {
                     ChartItem *child = generator->FindChartItemByEdge(current, edge_ptr);
-                    current->children.push_back(child);
-                    queue.push({child, current->level + 1});
+                    current->Annotations().children.push_back(child);
+                    queue.push({child, current->Annotations().level + 1});
                 }
 
                 // Precompute siblings once and reuse
-                size_t childCount = current->children.size();
+                size_t childCount = current->Annotations().children.size();
                 std::vector<std::vector<ChartItem*>> siblings(childCount);
 
                 for (size_t i = 0; i < childCount; ++i) {
                     for (size_t j = 0; j < childCount; ++j) {
                         if (i != j) {
-                            siblings[i].push_back(current->children[j]);
+                            siblings[i].push_back(current->Annotations().children[j]);
                         }
                     }
                 }
 
                 // Assign parent and sibling information
                 for (size_t i = 0; i < childCount; ++i) {
-                    current->children[i]->parents_sib.push_back({current, std::move(siblings[i])});
+                    current->Annotations().children[i]->Annotations().parents_sib.push_back({current, std::move(siblings[i])});
                 }
 
-                current->child_visited_status = VISITED;
+                current->Annotations().child_visited_status = VISITED;
             } else {
                 // Process children of already visited nodes to ensure full traversal
-                for (auto child : current->children) {
-                    queue.push({child, current->level + 1});
+                for (auto child : current->Annotations().children) {
+                    queue.push({child, current->Annotations().level + 1});
                 }
             }
 
-            assert(current->children.size() == rule->nonterminal_edges.size());
+            assert(current->Annotations().children.size() == rule->nonterminal_edges.size());
 
             current = current->next_ptr;
         } while (current != ptr);
@@ -12,15 +12,17 @@
 #include <algorithm>
 #include <limits>
 #include <queue>
-#include <signal.h>
 #include <setjmp.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include <ctime>
 #include <unordered_set>
 #include <unordered_map>
 #include <iomanip>
 #include <numeric>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 // Memory tracking for macOS
 #ifdef __APPLE__
@@ -94,12 +96,30 @@ void EM::enableCaching(const std::string& cache_dir) {
     cache_->set_grammar_hash(grammar_hash_);
     caching_enabled_ = true;
 
+    // Loaded forests keep the shrg_index of their items; it is the index of a CFG rule of the
+    // grammar, whichever way shrg_rules itself is indexed
+    cache_rules_.clear();
+    for (SHRG* rule : group_rules_) {
+        for (const auto& cfg_rule : rule->cfg_rules) {
+            if (cfg_rule.shrg_index >= static_cast<int>(cache_rules_.size())) {
+                cache_rules_.resize(cfg_rule.shrg_index + 1, nullptr);
+            }
+            cache_rules_[cfg_rule.shrg_index] = rule;
+        }
+    }
+    cache_attrs_pool_ = forest_cache::ForestCache::create_attrs_pool(cache_rules_);
+
     if (verbose_) {
         std::cout << "Forest caching enabled: " << cache_dir
                   << " (grammar hash: " << std::hex << grammar_hash_ << std::dec << ")\n";
     }
 }
 
+void EM::restoreCachedPointers(ChartItem* root) {
+    // attrs_ptr is not cached, so addRulePointer cannot be used
+    forest_cache::ForestCache::restore_all_pointers(root, cache_rules_, cache_attrs_pool_);
+}
+
 size_t EM::getCacheHits() const {
     return cache_ ? cache_->cache_hits() : 0;
 }
@@ -138,20 +158,20 @@ uint32_t EM::computeGraphHash(const EdsGraph& graph) const {
 }
 
 double EM::computeInside(ChartItem *root){
-    if(root->inside_visited_status == VISITED){
-        return root->log_inside_prob;
+    if(root->Annotations().inside_visited_status == pass_stamp_){
+        return root->Annotations().log_inside_prob;
     }
 
     ChartItem *ptr = root;
     double log_inside = ChartItem::log_zero;
 
     do{
-        double curr_log_inside = ptr->rule_ptr->log_rule_weight;
+        double curr_log_inside = ptr->Annotations().rule_ptr->log_rule_weight;
 //        assert(is_negative(curr_log_inside));
         curr_log_inside = sanitizeLogProb(curr_log_inside);
 
         double log_children = 0.0;
-        for(ChartItem *child:ptr->children){
+        for(ChartItem *child:ptr->Annotations().children){
             log_children += computeInside(child);
         }
         log_children = sanitizeLogProb(log_children);
@@ -174,58 +194,343 @@ double EM::computeInside(ChartItem *root){
 
     do{
         is_negative(log_inside);
-        ptr->log_inside_prob = log_inside;
-        ptr->inside_visited_status = VISITED;
+        ptr->Annotations().log_inside_prob = log_inside;
+        ptr->Annotations().inside_visited_status = pass_stamp_;
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
     return log_inside;
 }
 
+double EM::computeInside(const PackedForest &forest, std::vector<double> &log_inside) {
+    return sanitizeLogProb(forest.Inside(
+        [](const SHRG *rule) { return sanitizeLogProb(rule->log_rule_weight); }, log_inside));
+}
+
+void EM::computeOutside(const PackedForest &forest, const std::vector<double> &log_inside,
+                        std::vector<double> &log_outside) {
+    forest.Outside([](const SHRG *rule) { return rule->log_rule_weight; }, log_inside,
+                   log_outside);
+}
+
+void EM::computeExpectedCount(const PackedForest &forest, const std::vector<double> &log_inside,
+                              const std::vector<double> &log_outside, double pw) {
+    forest.ForEachEdgeCount([](const SHRG *rule) { return rule->log_rule_weight; }, log_inside,
+                            log_outside, pw, [&forest](uint32_t edge_index, double log_count) {
+                                SHRG *rule = forest.GetEdge(edge_index).rule_ptr;
+                                rule->log_count = addLogs(rule->log_count, log_count);
+                            });
+}
+
+void EM::computeExpectedCount(const PackedForest &forest, const std::vector<double> &log_inside,
+                              const std::vector<double> &log_outside, double pw,
+                              const std::vector<uint32_t> &rule_numbers,
+                              std::vector<ScaledProb> &counts) {
+    forest.ForEachEdgeCount([](const SHRG *rule) { return rule->log_rule_weight; }, log_inside,
+                            log_outside, pw, [&](uint32_t edge_index, double log_count) {
+                                counts[rule_numbers[edge_index]] += ScaledProb::FromLog(log_count);
+                            });
+}
+
+void EM::packForest(CachedForest& cf) {
+    cf.forest.BuildFromAnnotations(cf.root);
+    numberForestRules(cf);
+}
+
+void EM::numberForestRules(CachedForest& cf) {
+    cf.rule_numbers.resize(cf.forest.NumEdges());
+    for (uint32_t e = 0; e < cf.forest.NumEdges(); e++) {
+        cf.rule_numbers[e] = ruleNumber(cf.forest.GetEdge(e).rule_ptr);
+    }
+}
+
+void EM::buildForest(Context& context, utils::MemoryPool<ChartItem>& pool, int graph_index,
+                     const Deadline& deadline, ParsedGraph& result) {
+    EdsGraph& graph = graphs[graph_index];
+    GraphMetrics& metrics = result.metrics;
+    if (profiling_enabled_) {
+        metrics.sentence_id = graph.sentence_id;
+        metrics.node_count = graph.nodes.size();
+        metrics.edge_count = graph.edges.size();
+    }
+
+    // Try to load from cache first
+    ChartItem* persistent_root = nullptr;
+    uint32_t graph_hash = 0;
+
+    if (caching_enabled_ && cache_) {
+        graph_hash = computeGraphHash(graph);
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            persistent_root = cache_->load(graph.sentence_id, graph_hash, pool);
+        }
+        if (persistent_root) {
+            result.cache_hit = true;
+            // Re-link rule pointers on the loaded forest
+            restoreCachedPointers(persistent_root);
+        } else {
+            result.cache_miss = true;
+        }
+    }
+
+    if (!persistent_root) {
+        auto parse_start = std::chrono::high_resolution_clock::now();
+        auto code = context.Parse(graph, deadline);
+        auto parse_end = std::chrono::high_resolution_clock::now();
+
+        if (profiling_enabled_) {
+            metrics.parse_time_ms = std::chrono::duration<double, std::milli>(parse_end - parse_start).count();
+            metrics.peak_parse_bytes = context.PeakMemoryBytes();
+        }
+        if (code != ParserError::kNone) {
+            return;
+        }
+
+        ChartItem* root = context.parser->Result();
+        // the iterations run on packed forests, parents and siblings are only kept for
+        // the forest cache
+        Generator* context_generator = context.parser->GetGenerator();
+        if (caching_enabled_ && cache_) {
+            addParentPointerOptimized(root, 0, context_generator);
+        } else {
+            addChildren(root, context_generator);
+        }
+        addRulePointer(root);
+
+        // Deep copy to persistent storage before parser clears its pool
+        auto deep_copy_start = std::chrono::high_resolution_clock::now();
+        persistent_root = deepCopyDerivationForest(root, pool);
+        auto deep_copy_end = std::chrono::high_resolution_clock::now();
+
+        if (profiling_enabled_) {
+            metrics.deep_copy_time_ms = std::chrono::duration<double, std::milli>(deep_copy_end - deep_copy_start).count();
+        }
+
+        // Re-link rule pointers on the persistent copy
+        addRulePointer(persistent_root);
+
+        // Save to cache
+        if (caching_enabled_ && cache_ && persistent_root) {
+            std::lock_guard<std::mutex> lock(cache_mutex_);
+            cache_->save(graph.sentence_id, graph_hash, persistent_root);
+        }
+    }
+
+    result.root = persistent_root;
+    result.forest.BuildFromAnnotations(persistent_root);
+
+    // Compute forest metrics for profiling
+    if (profiling_enabled_) {
+        computeForestMetrics(persistent_root, metrics);
+        metrics.packed_forest_bytes = result.forest.Bytes();
+    }
+}
+
+void EM::buildForests(std::vector<ParsedGraph>& parsed) {
+    std::vector<Context*> contexts = parse_contexts_;
+    if (contexts.empty()) {
+        contexts.push_back(context);
+    }
+    size_t num_workers = contexts.size();
+    // every context copies into a pool of its own, they stay alive as long as the forests
+    while (extra_pools_.size() + 1 < num_workers) {
+        extra_pools_.push_back(std::make_unique<utils::MemoryPool<ChartItem>>());
+    }
+
+    std::vector<int> tasks;
+    for (int i = 0; i < (int)graphs.size(); i++) {
+        // Skip graphs in the skip list
+        if (!skip_graphs_.empty() && skip_graphs_.count(graphs[i].sentence_id)) {
+            parsed[i].skipped = true;
+            if (verbose_) {
+                std::cout << "\r[parsing] SKIPPING " << graphs[i].sentence_id
+                          << " (" << (i + 1) << "/" << graphs.size() << ")" << std::flush;
+            }
+            continue;
+        }
+        tasks.push_back(i);
+    }
+    if (num_workers > 1) {
+        // largest graphs first, so that no big graph is left for the end
+        std::stable_sort(tasks.begin(), tasks.end(), [&](int i, int j) {
+            return graphs[i].edges.size() > graphs[j].edges.size();
+        });
+    }
+
+    std::atomic<size_t> next_task{0};
+    std::atomic<bool> stop{false};
+    std::mutex progress_mutex;
+    size_t num_done = 0;
+    std::exception_ptr error;
+
+    auto work = [&](size_t worker_index) {
+        Context& worker_context = *contexts[worker_index];
+        utils::MemoryPool<ChartItem>& pool =
+            worker_index == 0 ? persistent_pool_ : *extra_pools_[worker_index - 1];
+        size_t task;
+        while (!stop && (task = next_task++) < tasks.size()) {
+            int graph_index = tasks[task];
+            try {
+                if (verbose_) {
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    std::cout << "\r[parsing] " << graphs[graph_index].sentence_id << " ("
+                              << (num_workers == 1 ? graph_index + 1 : ++num_done) << "/"
+                              << graphs.size() << ")" << std::flush;
+                }
+                // run() has no time limit, a failing worker only cancels the parses in flight
+                buildForest(worker_context, pool, graph_index, Deadline(&stop), parsed[graph_index]);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                stop = true;
+            }
+        }
+    };
+
+    if (num_workers == 1) {
+        work(0);
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(num_workers);
+        for (size_t i = 0; i < num_workers; i++) {
+            workers.emplace_back(work, i);
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+double EM::expectCachedForests(std::vector<CachedForest>& cached_forests, int iteration,
+                               std::vector<std::vector<double>>& history_graph_ll) {
+    // in scaled mode the weights are converted once per rule, not once per hyperedge
+    std::vector<ScaledProb> rule_weights;
+    if (scaled_probabilities_) {
+        rule_weights.reserve(numbered_rules_.size());
+        for (SHRG* rule : numbered_rules_) {
+            rule_weights.push_back(ScaledProb::FromLog(sanitizeLogProb(rule->log_rule_weight)));
+        }
+    }
+
+    // forests only touch their own metrics and history, the counts go to per-chunk buffers
+    return accumulateExpectedCounts(cached_forests.size(), [&](size_t i, std::vector<ScaledProb>& counts) {
+        auto& cf = cached_forests[i];
+
+        if (verbose_ && num_threads_ == 1) {
+            std::cout << "\r[iter " << iteration << "] " << cf.sentence_id
+                      << " (" << (i + 1) << "/" << cached_forests.size() << ")" << std::flush;
+        }
+
+        double pw;
+        if (profiling_enabled_ && cf.metrics_index < graph_metrics_.size()) {
+            auto& metrics = graph_metrics_[cf.metrics_index];
+            pw = expectForest(cf, rule_weights, counts, &metrics);
+            // Update total EM time (accumulated across iterations)
+            metrics.total_em_time_ms = metrics.inside_time_ms + metrics.outside_time_ms +
+                                       metrics.expected_count_time_ms;
+        } else {
+            pw = expectForest(cf, rule_weights, counts, nullptr);
+        }
+
+        history_graph_ll[cf.original_index].push_back(pw);
+        return pw;
+    });
+}
+
+double EM::expectForest(const CachedForest& cf, const std::vector<ScaledProb>& rule_weights,
+                        std::vector<ScaledProb>& counts, GraphMetrics* metrics) {
+    thread_local std::vector<double> log_inside, log_outside;
+    thread_local std::vector<ScaledProb> inside, outside;
+
+    // runs `step` and adds its time to the `time_ms` field of the metrics when profiling
+    auto timed = [metrics](double GraphMetrics::*time_ms, auto step) {
+        if (!metrics) {
+            step();
+            return;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        step();
+        auto end = std::chrono::high_resolution_clock::now();
+        metrics->*time_ms += std::chrono::duration<double, std::milli>(end - start).count();
+    };
+
+    double pw;
+    if (scaled_probabilities_) {
+        auto edge_weight = [&](uint32_t edge_index) {
+            return rule_weights[cf.rule_numbers[edge_index]];
+        };
+        ScaledProb partition;
+        timed(&GraphMetrics::inside_time_ms, [&] { partition = cf.forest.ScaledInside(edge_weight, inside); });
+        pw = sanitizeLogProb(partition.Log());
+        timed(&GraphMetrics::outside_time_ms, [&] { cf.forest.ScaledOutside(edge_weight, inside, outside); });
+        timed(&GraphMetrics::expected_count_time_ms, [&] {
+            if (partition.IsZero()) {
+                return;
+            }
+            cf.forest.ForEachScaledEdgeCount(edge_weight, inside, outside, partition,
+                                             [&](uint32_t edge_index, const ScaledProb& count) {
+                                                 counts[cf.rule_numbers[edge_index]] += count;
+                                             });
+        });
+    } else {
+        timed(&GraphMetrics::inside_time_ms, [&] { pw = computeInside(cf.forest, log_inside); });
+        timed(&GraphMetrics::outside_time_ms, [&] { computeOutside(cf.forest, log_inside, log_outside); });
+        timed(&GraphMetrics::expected_count_time_ms, [&] {
+            computeExpectedCount(cf.forest, log_inside, log_outside, pw, cf.rule_numbers, counts);
+        });
+    }
+    return pw;
+}
+
 void EM::computeOutsideNode(ChartItem *root, NodeLevelPQ &pq){
     ChartItem *ptr = root;
 
     do{
-        if(ptr->parents_sib.empty()){
+        if(ptr->Annotations().parents_sib.empty()){
             ptr = ptr->next_ptr;
             continue;
         }
 
         double log_outside = ChartItem::log_zero;
 
-        for(ParentTup &parent_sib : ptr->parents_sib){
+        for(ParentTup &parent_sib : ptr->Annotations().parents_sib){
             ChartItem *parent = getParent(parent_sib);
             std::vector<ChartItem*> siblings = getSiblings(parent_sib);
 
-            double curr_log_outside = parent->rule_ptr->log_rule_weight;
+            double curr_log_outside = parent->Annotations().rule_ptr->log_rule_weight;
             // assert(is_negative(curr_log_outside));
-            curr_log_outside += parent->log_outside_prob;
+            curr_log_outside += parent->Annotations().log_outside_prob;
             // assert(is_negative(curr_log_outside));
 
             for(auto sib:siblings){
-                curr_log_outside += sib->log_inside_prob;
+                curr_log_outside += sib->Annotations().log_inside_prob;
                 // assert(is_negative(curr_log_outside));
             }
 
             log_outside = addLogs(log_outside, curr_log_outside);
             // assert(is_negative(log_outside));
         }
-        ptr->log_outside_prob = log_outside;
-        ptr->outside_visited_status = VISITED;
+        ptr->Annotations().log_outside_prob = log_outside;
+        ptr->Annotations().outside_visited_status = pass_stamp_;
 
 
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
-    double root_log_outside = root->log_outside_prob;
+    double root_log_outside = root->Annotations().log_outside_prob;
 
     do{
-        if(ptr->outside_visited_status != VISITED){
-            ptr->log_outside_prob = root_log_outside;
-            ptr->outside_visited_status = VISITED;
+        if(ptr->Annotations().outside_visited_status != pass_stamp_){
+            ptr->Annotations().log_outside_prob = root_log_outside;
+            ptr->Annotations().outside_visited_status = pass_stamp_;
         }
 
-        for(ChartItem *child:ptr->children){
+        for(ChartItem *child:ptr->Annotations().children){
             pq.push(child);
         }
 
@@ -238,7 +543,7 @@ void EM::computeOutside(ChartItem *root){
     ChartItem *ptr = root;
 
     do{
-        ptr->log_outside_prob = 0.0;
+        ptr->Annotations().log_outside_prob = 0.0;
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
@@ -258,9 +563,9 @@ bool EM::parentsOutsideReady(ChartItem* node) const {
 
     ChartItem* ptr = node;
     do {
-        for (const auto& parent_sib : ptr->parents_sib) {
+        for (const auto& parent_sib : ptr->Annotations().parents_sib) {
             ChartItem* parent = std::get<0>(parent_sib);
-            if (parent && parent->outside_visited_status != VISITED) {
+            if (parent && parent->Annotations().outside_visited_status != pass_stamp_) {
                 return false;
             }
         }
@@ -279,40 +584,40 @@ void EM::computeOutsideChainOptimized(ChartItem* root) {
     int safety1 = 0;
 
     do {
-        if (!ptr->parents_sib.empty()) {
+        if (!ptr->Annotations().parents_sib.empty()) {
             double log_outside = ChartItem::log_zero;
 
-            for (const auto& parent_sib : ptr->parents_sib) {
+            for (const auto& parent_sib : ptr->Annotations().parents_sib) {
                 ChartItem* parent = std::get<0>(parent_sib);
-                if (!parent || !parent->rule_ptr) continue;  // Safety check
+                if (!parent || !parent->Annotations().rule_ptr) continue;  // Safety check
                 const std::vector<ChartItem*>& siblings = std::get<1>(parent_sib);
 
-                double curr_log_outside = parent->rule_ptr->log_rule_weight + parent->log_outside_prob;
+                double curr_log_outside = parent->Annotations().rule_ptr->log_rule_weight + parent->Annotations().log_outside_prob;
                 for (ChartItem* sibling : siblings) {
                     if (sibling) {  // Safety check
-                        curr_log_outside += sibling->log_inside_prob;
+                        curr_log_outside += sibling->Annotations().log_inside_prob;
                     }
                 }
 
                 log_outside = addLogs(log_outside, curr_log_outside);
             }
 
-            ptr->log_outside_prob = log_outside;
-            ptr->outside_visited_status = VISITED;
+            ptr->Annotations().log_outside_prob = log_outside;
+            ptr->Annotations().outside_visited_status = pass_stamp_;
         }
 
         ptr = ptr->next_ptr;
         if (++safety1 > 10000 || !ptr) break;  // Safety check
     } while (ptr != root);
 
-    double root_log_outside = root->log_outside_prob;
+    double root_log_outside = root->Annotations().log_outside_prob;
 
     ptr = root;
     int safety2 = 0;
     do {
-        if (ptr->outside_visited_status != VISITED) {
-            ptr->log_outside_prob = root_log_outside;
-            ptr->outside_visited_status = VISITED;
+        if (ptr->Annotations().outside_visited_status != pass_stamp_) {
+            ptr->Annotations().log_outside_prob = root_log_outside;
+            ptr->Annotations().outside_visited_status = pass_stamp_;
         }
 
         ptr = ptr->next_ptr;
@@ -329,8 +634,8 @@ void EM::computeOutside_optimized(ChartItem *root){
     collectAllReachableItems(root, all_items);
 
     if (all_items.empty()) {
-        root->log_outside_prob = 0.0;
-        root->outside_visited_status = VISITED;
+        root->Annotations().log_outside_prob = 0.0;
+        root->Annotations().outside_visited_status = pass_stamp_;
         return;
     }
 
@@ -340,10 +645,10 @@ void EM::computeOutside_optimized(ChartItem *root){
     std::queue<ChartItem*> ready;
 
     for (ChartItem* node : all_items) {
-        node->log_outside_prob = 0.0;
-        node->outside_visited_status = ChartItem::kEmpty;
+        node->Annotations().log_outside_prob = 0.0;
+        node->Annotations().outside_visited_status = ChartItem::kEmpty;
 
-        std::size_t parent_count = node->parents_sib.size();
+        std::size_t parent_count = node->Annotations().parents_sib.size();
         pending_parent_counts[node] = parent_count;
         if (parent_count == 0) {
             ready.push(node);
@@ -354,7 +659,7 @@ void EM::computeOutside_optimized(ChartItem *root){
         ChartItem* node = ready.front();
         ready.pop();
 
-        if (!node || node->outside_visited_status == VISITED) {
+        if (!node || node->Annotations().outside_visited_status == pass_stamp_) {
             continue;
         }
 
@@ -363,7 +668,7 @@ void EM::computeOutside_optimized(ChartItem *root){
         ChartItem* ptr = node;
         do {
             pending_parent_counts[ptr] = 0;
-            for (ChartItem* child : ptr->children) {
+            for (ChartItem* child : ptr->Annotations().children) {
                 if (!child) {
                     continue;
                 }
@@ -386,7 +691,7 @@ void EM::computeOutside_optimized(ChartItem *root){
     }
 
     for (ChartItem* node : all_items) {
-        if (node->outside_visited_status != VISITED) {
+        if (node->Annotations().outside_visited_status != pass_stamp_) {
             computeOutsideChainOptimized(node);
         }
     }
@@ -412,7 +717,7 @@ void EM::computeOutsideFixed(ChartItem* root) {
     // Initialize root chain to outside = 0.0 (same as original)
     ChartItem* ptr = root;
     do {
-        ptr->log_outside_prob = 0.0;
+        ptr->Annotations().log_outside_prob = 0.0;
         ptr = ptr->next_ptr;
     } while (ptr && ptr != root);
 
@@ -428,48 +733,48 @@ void EM::computeOutsideFixed(ChartItem* root) {
         ptr = node;
         do {
             // Skip if already visited
-            if (ptr->outside_visited_status == VISITED) {
+            if (ptr->Annotations().outside_visited_status == pass_stamp_) {
                 ptr = ptr->next_ptr;
                 continue;
             }
 
             // Skip items with no parents - this preserves root's initialized 0.0
             // (This is the key fix - without this, root gets overwritten to -inf)
-            if (ptr->parents_sib.empty()) {
+            if (ptr->Annotations().parents_sib.empty()) {
                 ptr = ptr->next_ptr;
                 continue;
             }
 
             // Compute outside from all parents
             double log_outside = ChartItem::log_zero;
-            for (const auto& parent_sib : ptr->parents_sib) {
+            for (const auto& parent_sib : ptr->Annotations().parents_sib) {
                 ChartItem* parent = std::get<0>(parent_sib);
-                if (!parent || !parent->rule_ptr) continue;
+                if (!parent || !parent->Annotations().rule_ptr) continue;
                 const auto& siblings = std::get<1>(parent_sib);
 
-                double curr = parent->rule_ptr->log_rule_weight + parent->log_outside_prob;
+                double curr = parent->Annotations().rule_ptr->log_rule_weight + parent->Annotations().log_outside_prob;
                 for (ChartItem* sib : siblings) {
-                    if (sib) curr += sib->log_inside_prob;
+                    if (sib) curr += sib->Annotations().log_inside_prob;
                 }
                 log_outside = addLogs(log_outside, curr);
             }
-            ptr->log_outside_prob = log_outside;
-            ptr->outside_visited_status = VISITED;
+            ptr->Annotations().log_outside_prob = log_outside;
+            ptr->Annotations().outside_visited_status = pass_stamp_;
 
             ptr = ptr->next_ptr;
         } while (ptr && ptr != node);
 
         // Propagate root's outside to unvisited alternatives and push children
-        double node_outside = node->log_outside_prob;
+        double node_outside = node->Annotations().log_outside_prob;
         ptr = node;
         do {
-            if (ptr->outside_visited_status != VISITED) {
-                ptr->log_outside_prob = node_outside;
-                ptr->outside_visited_status = VISITED;
+            if (ptr->Annotations().outside_visited_status != pass_stamp_) {
+                ptr->Annotations().log_outside_prob = node_outside;
+                ptr->Annotations().outside_visited_status = pass_stamp_;
             }
 
             // Push children - but only if not already in queue (THIS IS THE KEY FIX)
-            for (ChartItem* child : ptr->children) {
+            for (ChartItem* child : ptr->Annotations().children) {
                 if (child && !in_queue.count(child)) {
                     pq.push(child);
                     in_queue.insert(child);
@@ -498,13 +803,13 @@ bool EM::validateOutsideImplementations(ChartItem* root, double tolerance) {
 
     std::unordered_map<ChartItem*, double> original_values;
     for (ChartItem* item : all_items) {
-        original_values[item] = item->log_outside_prob;
+        original_values[item] = item->Annotations().log_outside_prob;
     }
 
     // Reset flags for all items
     for (ChartItem* item : all_items) {
-        item->outside_visited_status = ChartItem::kEmpty;
-        item->log_outside_prob = ChartItem::log_zero;
+        item->Annotations().outside_visited_status = ChartItem::kEmpty;
+        item->Annotations().log_outside_prob = ChartItem::log_zero;
     }
 
     // Run fixed implementation
@@ -520,7 +825,7 @@ bool EM::validateOutsideImplementations(ChartItem* root, double tolerance) {
 
     for (ChartItem* item : all_items) {
         double orig = original_values[item];
-        double fixed = item->log_outside_prob;
+        double fixed = item->Annotations().log_outside_prob;
 
         if (orig == ChartItem::log_zero) orig_inf_count++;
         if (fixed == ChartItem::log_zero) fixed_inf_count++;
@@ -602,6 +907,7 @@ bool EM::validateFullEMCycle(double tolerance) {
         for (auto rule : shrg_rules) {
             rule->log_count = ChartItem::log_zero;
         }
+        beginPass();
 
         double ll = 0.0;
         for (size_t idx : valid_graph_indices) {
@@ -632,6 +938,40 @@ bool EM::validateFullEMCycle(double tolerance) {
         std::cout << "  iteration " << iter << ": ll=" << ll << "\n";
     }
 
+    // Compares an iteration with the one of the original implementation
+    auto matchesOriginal = [&](int iter, double ll) {
+        double ll_diff = std::abs(original_ll_history[iter] - ll);
+
+        // Compare weights
+        double max_weight_diff = 0.0;
+        int weight_mismatches = 0;
+        for (size_t i = 0; i < shrg_rules.size(); i++) {
+            double orig = original_weight_history[iter][i];
+            double fixed = shrg_rules[i]->log_rule_weight;
+
+            bool orig_inf = (orig == ChartItem::log_zero);
+            bool fixed_inf = (fixed == ChartItem::log_zero);
+
+            if (orig_inf && fixed_inf) continue;
+            if (orig_inf != fixed_inf) {
+                weight_mismatches++;
+                continue;
+            }
+
+            double diff = std::abs(orig - fixed);
+            if (diff > max_weight_diff) max_weight_diff = diff;
+            if (diff > tolerance) weight_mismatches++;
+        }
+
+        bool iter_match = (ll_diff < tolerance) && (weight_mismatches == 0);
+
+        std::cout << "  iteration " << iter << ": ll=" << ll
+                  << " (diff=" << ll_diff << ")"
+                  << " weights_max_diff=" << max_weight_diff
+                  << (iter_match ? " MATCH" : " MISMATCH") << "\n";
+        return iter_match;
+    };
+
     // === Reset and run EM with OPTIMIZED computeOutsideFixed ===
     std::cout << "\nRunning EM with optimized computeOutsideFixed...\n";
 
@@ -646,6 +986,7 @@ bool EM::validateFullEMCycle(double tolerance) {
         for (auto rule : shrg_rules) {
             rule->log_count = ChartItem::log_zero;
         }
+        beginPass();
 
         double ll = 0.0;
         for (size_t idx : valid_graph_indices) {
@@ -666,38 +1007,46 @@ bool EM::validateFullEMCycle(double tolerance) {
         // Update weights
         updateEM();
 
-        // Compare log likelihood
-        double ll_diff = std::abs(original_ll_history[iter] - ll);
+        if (!matchesOriginal(iter, ll)) all_iterations_match = false;
+    }
 
-        // Compare weights
-        double max_weight_diff = 0.0;
-        int weight_mismatches = 0;
-        for (size_t i = 0; i < shrg_rules.size(); i++) {
-            double orig = original_weight_history[iter][i];
-            double fixed = shrg_rules[i]->log_rule_weight;
+    // === The E-step of run(): packed forests in log space and in scaled linear space ===
+    std::vector<CachedForest> cached_forests;
+    for (size_t idx : valid_graph_indices) {
+        EdsGraph& graph = graphs[idx];
+        auto code = context->Parse(graph);
+        if (code != ParserError::kNone) continue;
 
-            bool orig_inf = (orig == ChartItem::log_zero);
-            bool fixed_inf = (fixed == ChartItem::log_zero);
+        ChartItem* root = context->parser->Result();
+        addChildren(root);
+        addRulePointer(root);
+        ChartItem* persistent_root = deepCopyDerivationForest(root, persistent_pool_);
+        addRulePointer(persistent_root);
+        cached_forests.push_back({persistent_root, graph.sentence_id, (int)idx, graph_metrics_.size()});
+        packForest(cached_forests.back());
+    }
 
-            if (orig_inf && fixed_inf) continue;
-            if (orig_inf != fixed_inf) {
-                weight_mismatches++;
-                continue;
-            }
+    bool scaled_probabilities = scaled_probabilities_;
+    for (bool scaled : {false, true}) {
+        std::cout << "\nRunning EM on packed forests"
+                  << (scaled ? " with scaled probabilities" : " in log space") << "...\n";
+        scaled_probabilities_ = scaled;
 
-            double diff = std::abs(orig - fixed);
-            if (diff > max_weight_diff) max_weight_diff = diff;
-            if (diff > tolerance) weight_mismatches++;
+        // Restore initial weights
+        for (size_t i = 0; i < shrg_rules.size(); i++) {
+            shrg_rules[i]->log_rule_weight = init_weights[i];
         }
 
-        bool iter_match = (ll_diff < tolerance) && (weight_mismatches == 0);
-        if (!iter_match) all_iterations_match = false;
+        std::vector<std::vector<double>> history_graph_ll(graphs.size());
+        for (int iter = 0; iter < max_iterations; iter++) {
+            clearRuleCount();
+            double ll = expectCachedForests(cached_forests, iter, history_graph_ll);
+            updateEM();
 
-        std::cout << "  iteration " << iter << ": ll=" << ll
-                  << " (diff=" << ll_diff << ")"
-                  << " weights_max_diff=" << max_weight_diff
-                  << (iter_match ? " MATCH" : " MISMATCH") << "\n";
+            if (!matchesOriginal(iter, ll)) all_iterations_match = false;
+        }
     }
+    scaled_probabilities_ = scaled_probabilities;
 
     std::cout << "\n=== EM CYCLE VALIDATION RESULT ===\n";
     if (all_iterations_match) {
@@ -882,6 +1231,10 @@ inline std::string to_string(ParserError error) {
         return "UnInitialized";
     case ParserError::kUnknown:
         return "Unknown";
+    case ParserError::kTimeout:
+        return "Timeout";
+    case ParserError::kCancelled:
+        return "Cancelled";
     default:
         return "Invalid";
     }
@@ -902,12 +1255,11 @@ void EM::run() {
     std::cout << "Phase 1: Parsing and caching derivation forests...\n";
     t1 = clock();
 
-    struct CachedForest {
-        ChartItem* root;
-        std::string sentence_id;
-        int original_index;
-        size_t metrics_index;  // Index into graph_metrics_ for this forest
-    };
+    std::vector<ParsedGraph> parsed(training_size);
+    buildForests(parsed);
+
+    // commit in graph order, so forest indices, metrics and rule numbers do not depend on the
+    // parse contexts
     std::vector<CachedForest> cached_forests;
     cached_forests.reserve(training_size);
 
@@ -915,106 +1267,25 @@ void EM::run() {
     size_t cache_miss_count = 0;
 
     for (int i = 0; i < training_size; i++) {
-        EdsGraph& graph = graphs[i];
-
-        // Skip graphs in the skip list
-        if (!skip_graphs_.empty() && skip_graphs_.count(graph.sentence_id)) {
-            if (verbose_) {
-                std::cout << "\r[parsing] SKIPPING " << graph.sentence_id
-                          << " (" << (i + 1) << "/" << training_size << ")" << std::flush;
-            }
+        ParsedGraph& result = parsed[i];
+        if (result.skipped) {
             continue;
         }
+        cache_hit_count += result.cache_hit;
+        cache_miss_count += result.cache_miss;
 
-        if (verbose_) {
-            std::cout << "\r[parsing] " << graph.sentence_id
-                      << " (" << (i + 1) << "/" << training_size << ")" << std::flush;
-        }
-
-        // Start profiling for this graph
-        GraphMetrics metrics;
-        if (profiling_enabled_) {
-            metrics.sentence_id = graph.sentence_id;
-            metrics.node_count = graph.nodes.size();
-            metrics.edge_count = graph.edges.size();
-        }
-
-        // Try to load from cache first
-        ChartItem* persistent_root = nullptr;
-        uint32_t graph_hash = 0;
-
-        if (caching_enabled_ && cache_) {
-            graph_hash = computeGraphHash(graph);
-            persistent_root = cache_->load(graph.sentence_id, graph_hash, persistent_pool_);
-            if (persistent_root) {
-                cache_hit_count++;
-                // Re-link rule pointers on the loaded forest
-                addRulePointer(persistent_root);
-
-                if (profiling_enabled_) {
-                    computeForestMetrics(persistent_root, metrics);
-                }
-
-                size_t metrics_idx = graph_metrics_.size();
-                if (profiling_enabled_) {
-                    graph_metrics_.push_back(metrics);
-                }
-
-                cached_forests.push_back({persistent_root, graph.sentence_id, i, metrics_idx});
-                continue;  // Skip parsing, use cached forest
-            }
-            cache_miss_count++;
+        if (result.root) {
+            size_t metrics_idx = graph_metrics_.size();
+            cached_forests.push_back({result.root, graphs[i].sentence_id, i, metrics_idx,
+                                      std::move(result.forest)});
+            numberForestRules(cached_forests.back());
         }
-
-        auto parse_start = std::chrono::high_resolution_clock::now();
-        auto code = context->Parse(graph);
-        auto parse_end = std::chrono::high_resolution_clock::now();
-
+        // failed parses are profiled as well
         if (profiling_enabled_) {
-            metrics.parse_time_ms = std::chrono::duration<double, std::milli>(parse_end - parse_start).count();
-        }
-
-        if (code == ParserError::kNone) {
-            ChartItem* root = context->parser->Result();
-            addParentPointerOptimized(root, 0);
-            addRulePointer(root);
-
-            // Deep copy to persistent storage before parser clears its pool
-            auto deep_copy_start = std::chrono::high_resolution_clock::now();
-            persistent_root = deepCopyDerivationForest(root, persistent_pool_);
-            auto deep_copy_end = std::chrono::high_resolution_clock::now();
-
-            if (profiling_enabled_) {
-                metrics.deep_copy_time_ms = std::chrono::duration<double, std::milli>(deep_copy_end - deep_copy_start).count();
-            }
-
-            // Re-link rule pointers on the persistent copy
-            addRulePointer(persistent_root);
-
-            // Save to cache
-            if (caching_enabled_ && cache_ && persistent_root) {
-                if (graph_hash == 0) {
-                    graph_hash = computeGraphHash(graph);
-                }
-                cache_->save(graph.sentence_id, graph_hash, persistent_root);
-            }
-
-            // Compute forest metrics for profiling
-            if (profiling_enabled_) {
-                computeForestMetrics(persistent_root, metrics);
-            }
-
-            size_t metrics_idx = graph_metrics_.size();
-            if (profiling_enabled_) {
-                graph_metrics_.push_back(metrics);
-            }
-
-            cached_forests.push_back({persistent_root, graph.sentence_id, i, metrics_idx});
-        } else if (profiling_enabled_) {
-            // Still record metrics for failed parses
-            graph_metrics_.push_back(metrics);
+            graph_metrics_.push_back(std::move(result.metrics));
         }
     }
+    parsed.clear();
 
     t2 = clock();
     double parse_time = (double)(t2 - t1) / CLOCKS_PER_SEC;
@@ -1070,63 +1341,8 @@ void EM::run() {
         ll = 0;
         t1 = clock();
 
-        // Reset visited flags for all cached forests (with timing if profiling)
-        for (size_t i = 0; i < cached_forests.size(); i++) {
-            auto& cf = cached_forests[i];
-
-            if (profiling_enabled_ && cf.metrics_index < graph_metrics_.size()) {
-                auto reset_start = std::chrono::high_resolution_clock::now();
-                resetVisitedFlags(cf.root);
-                auto reset_end = std::chrono::high_resolution_clock::now();
-                // Accumulate across iterations
-                graph_metrics_[cf.metrics_index].reset_flags_time_ms +=
-                    std::chrono::duration<double, std::milli>(reset_end - reset_start).count();
-            } else {
-                resetVisitedFlags(cf.root);
-            }
-        }
-
         // Process all cached forests
-        for (size_t i = 0; i < cached_forests.size(); i++) {
-            auto& cf = cached_forests[i];
-
-            if (verbose_) {
-                std::cout << "\r[iter " << iteration << "] " << cf.sentence_id
-                          << " (" << (i + 1) << "/" << cached_forests.size() << ")" << std::flush;
-            }
-
-            if (profiling_enabled_ && cf.metrics_index < graph_metrics_.size()) {
-                auto& metrics = graph_metrics_[cf.metrics_index];
-
-                auto inside_start = std::chrono::high_resolution_clock::now();
-                double pw = computeInside(cf.root);
-                auto inside_end = std::chrono::high_resolution_clock::now();
-                metrics.inside_time_ms += std::chrono::duration<double, std::milli>(inside_end - inside_start).count();
-
-                auto outside_start = std::chrono::high_resolution_clock::now();
-                computeOutsideFixed(cf.root);  // Use optimized O(n log n) version
-                auto outside_end = std::chrono::high_resolution_clock::now();
-                metrics.outside_time_ms += std::chrono::duration<double, std::milli>(outside_end - outside_start).count();
-
-                auto expected_start = std::chrono::high_resolution_clock::now();
-                computeExpectedCount(cf.root, pw);
-                auto expected_end = std::chrono::high_resolution_clock::now();
-                metrics.expected_count_time_ms += std::chrono::duration<double, std::milli>(expected_end - expected_start).count();
-
-                // Update total EM time (accumulated across iterations)
-                metrics.total_em_time_ms = metrics.reset_flags_time_ms + metrics.inside_time_ms +
-                                           metrics.outside_time_ms + metrics.expected_count_time_ms;
-
-                ll += pw;
-                history_graph_ll[cf.original_index].push_back(pw);
-            } else {
-                double pw = computeInside(cf.root);
-                computeOutsideFixed(cf.root);  // Use optimized O(n log n) version
-                computeExpectedCount(cf.root, pw);
-                ll += pw;
-                history_graph_ll[cf.original_index].push_back(pw);
-            }
-        }
+        ll = expectCachedForests(cached_forests, iteration, history_graph_ll);
         if (verbose_) {
             std::cout << std::endl;
         }
@@ -1190,19 +1406,13 @@ void EM::run_safe() {
         graph_metrics_.reserve(training_size);
     }
 
-    // ========== Phase 1: Parse with fork-based protection ==========
+    // ========== Phase 1: Parse with a deadline per graph ==========
     if (verbose_) {
         std::cout << "Phase 1: Parsing and caching derivation forests...\n";
-        std::cout << "  (fork safety: timeout=" << time_out_in_seconds << "s per graph)\n";
+        std::cout << "  (timeout=" << time_out_in_seconds << "s per graph)\n";
     }
     t1 = clock();
 
-    struct CachedForest {
-        ChartItem* root;
-        std::string sentence_id;
-        int original_index;
-        size_t metrics_index;
-    };
     std::vector<CachedForest> cached_forests;
     cached_forests.reserve(training_size);
     int skipped_count = 0;
@@ -1216,14 +1426,14 @@ void EM::run_safe() {
             continue;
         }
 
-        // Try to load from cache first (skip fork test if cached)
+        // Try to load from cache first
         uint32_t graph_hash = 0;
         if (caching_enabled_ && cache_) {
             graph_hash = computeGraphHash(graph);
             ChartItem* cached_root = cache_->load(graph.sentence_id, graph_hash, persistent_pool_);
             if (cached_root) {
                 cache_hit_count++;
-                addRulePointer(cached_root);
+                restoreCachedPointers(cached_root);
 
                 GraphMetrics metrics;
                 if (profiling_enabled_) {
@@ -1234,12 +1444,14 @@ void EM::run_safe() {
                 }
 
                 size_t metrics_idx = graph_metrics_.size();
+                cached_forests.push_back({cached_root, graph.sentence_id, i, metrics_idx});
+                packForest(cached_forests.back());
+
                 if (profiling_enabled_) {
+                    metrics.packed_forest_bytes = cached_forests.back().forest.Bytes();
                     graph_metrics_.push_back(metrics);
                 }
-
-                cached_forests.push_back({cached_root, graph.sentence_id, i, metrics_idx});
-                continue;  // Skip fork test and parsing
+                continue;  // Skip parsing
             }
             cache_miss_count++;
         }
@@ -1252,52 +1464,6 @@ void EM::run_safe() {
                       << ", cached: " << cached_forests.size() << "]" << std::flush;
         }
 
-        // Fork a child to test if parsing is safe
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Child: attempt parse AND deep copy with time limit, then exit
-            // This tests actual memory usage, not just parse success
-            alarm(time_out_in_seconds);
-            auto child_code = context->Parse(graph);
-            if (child_code == ParserError::kNone) {
-                // Also test the memory-intensive deep copy operation
-                ChartItem* root = context->parser->Result();
-                addParentPointerOptimized(root, 0);
-                addRulePointer(root);
-                // Create temporary pool and test deep copy
-                utils::MemoryPool<ChartItem> test_pool;
-                deepCopyDerivationForest(root, test_pool);
-            }
-            _exit(child_code == ParserError::kNone ? 0 : 1);
-        }
-
-        if (pid < 0) {
-            // fork failed - fall through and parse directly
-            std::cerr << "\nWarning: fork() failed for " << graph.sentence_id << ", parsing directly\n";
-        } else {
-            // Parent: wait for child result
-            int status;
-            waitpid(pid, &status, 0);
-
-            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-                std::string reason;
-                if (WIFSIGNALED(status)) {
-                    int sig = WTERMSIG(status);
-                    if (sig == SIGKILL) reason = "OOM killed";
-                    else if (sig == SIGALRM) reason = "timeout (" + std::to_string(time_out_in_seconds) + "s)";
-                    else reason = "signal " + std::to_string(sig);
-                } else {
-                    reason = "parse failed";
-                }
-                if (verbose_) {
-                    std::cout << "\n  [SKIP] " << graph.sentence_id << " - " << reason << "\n";
-                }
-                skipped_count++;
-                continue;
-            }
-        }
-
-        // Child succeeded (or fork failed) - parse for real in parent
         GraphMetrics metrics;
         if (profiling_enabled_) {
             metrics.sentence_id = graph.sentence_id;
@@ -1306,16 +1472,35 @@ void EM::run_safe() {
         }
 
         auto parse_start = std::chrono::high_resolution_clock::now();
-        auto code = context->Parse(graph);
+        // the parser gives up cooperatively, so every graph is parsed once
+        auto code = context->Parse(graph, Deadline::After(time_out_in_seconds));
         auto parse_end = std::chrono::high_resolution_clock::now();
 
         if (profiling_enabled_) {
             metrics.parse_time_ms = std::chrono::duration<double, std::milli>(parse_end - parse_start).count();
+            metrics.peak_parse_bytes = context->PeakMemoryBytes();
+        }
+
+        if (code == ParserError::kTimeout || code == ParserError::kOutOfMemory) {
+            if (verbose_) {
+                std::cout << "\n  [SKIP] " << graph.sentence_id << " - "
+                          << (code == ParserError::kTimeout
+                                  ? "timeout (" + std::to_string(time_out_in_seconds) + "s)"
+                                  : std::string("out of memory"))
+                          << "\n";
+            }
+            skipped_count++;
         }
 
         if (code == ParserError::kNone) {
             ChartItem* root = context->parser->Result();
-            addParentPointerOptimized(root, 0);
+            // the iterations run on packed forests, parents and siblings are only kept for
+            // the forest cache
+            if (caching_enabled_ && cache_) {
+                addParentPointerOptimized(root, 0);
+            } else {
+                addChildren(root);
+            }
             addRulePointer(root);
 
             auto deep_copy_start = std::chrono::high_resolution_clock::now();
@@ -1336,17 +1521,16 @@ void EM::run_safe() {
                 cache_->save(graph.sentence_id, graph_hash, persistent_root);
             }
 
-            if (profiling_enabled_) {
-                computeForestMetrics(persistent_root, metrics);
-            }
-
             size_t metrics_idx = graph_metrics_.size();
+            cached_forests.push_back({persistent_root, graph.sentence_id, i, metrics_idx});
+            packForest(cached_forests.back());
+
             if (profiling_enabled_) {
+                computeForestMetrics(persistent_root, metrics);
+                metrics.packed_forest_bytes = cached_forests.back().forest.Bytes();
                 graph_metrics_.push_back(metrics);
             }
 
-            cached_forests.push_back({persistent_root, graph.sentence_id, i, metrics_idx});
-
             // Debug: print memory every 500 forests
             if (verbose_ && cached_forests.size() % 500 == 0) {
                 double mem_now = getMemoryUsageMB();
@@ -1364,7 +1548,7 @@ void EM::run_safe() {
     double final_mem = getMemoryUsageMB();
     if (verbose_) {
         std::cout << "\nParsing complete: " << cached_forests.size() << " forests cached, "
-                  << skipped_count << " skipped (unsafe), in "
+                  << skipped_count << " skipped (timeout or out of memory), in "
                   << parse_time << " seconds";
         if (caching_enabled_) {
             std::cout << " (cache hits: " << cache_hit_count
@@ -1412,25 +1596,7 @@ void EM::run_safe() {
         ll = 0;
         t1 = clock();
 
-        for (size_t i = 0; i < cached_forests.size(); i++) {
-            auto& cf = cached_forests[i];
-            resetVisitedFlags(cf.root);
-        }
-
-        for (size_t i = 0; i < cached_forests.size(); i++) {
-            auto& cf = cached_forests[i];
-
-            if (verbose_) {
-                std::cout << "\r[iter " << iteration << "] " << cf.sentence_id
-                          << " (" << (i + 1) << "/" << cached_forests.size() << ")" << std::flush;
-            }
-
-            double pw = computeInside(cf.root);
-            computeOutsideFixed(cf.root);
-            computeExpectedCount(cf.root, pw);
-            ll += pw;
-            history_graph_ll[cf.original_index].push_back(pw);
-        }
+        ll = expectCachedForests(cached_forests, iteration, history_graph_ll);
         if (verbose_) {
             std::cout << std::endl;
         }
@@ -1500,6 +1666,7 @@ void EM::run_1iter() {
         prev_ll = ll;
         ll = 0;
         t1 = clock();
+        beginPass();
 
         double time_diff;
 
@@ -1588,6 +1755,9 @@ void EM::run_from_saved() {
 
     std::vector<double> lls;
     std::vector<double> times;
+    // forests[i] packed, and the inside and outside scores of the forest being processed
+    std::vector<PackedForest> packed_forests;
+    std::vector<double> log_inside, log_outside;
 
     for(int i = 0; i < training_size; i++) {
         EdsGraph graph = graphs[i];
@@ -1595,9 +1765,11 @@ void EM::run_from_saved() {
         std::cout << to_string(code);
         if (code == ParserError::kNone) {
             ChartItem *root = context->parser->Result();
-            addParentPointerOptimized(root, 0);
+            addChildren(root);
             addRulePointer(root);
             forests.push_back(root);
+            packed_forests.emplace_back();
+            packed_forests.back().BuildFromAnnotations(root);
             lemmas.push_back(graph.lemma_sequence);
         }
     }
@@ -1611,10 +1783,10 @@ void EM::run_from_saved() {
 //                std::cout << i << "\n";
 //            }
             std::cout << i << "\n";
-            ChartItem *root = forests[i];
-            double pw = computeInside(root);
-            computeOutsideFixed(root);  // Use optimized O(n log n) version
-            computeExpectedCount(root, pw);
+            const PackedForest &forest = packed_forests[i];
+            double pw = computeInside(forest, log_inside);
+            computeOutside(forest, log_inside, log_outside);
+            computeExpectedCount(forest, log_inside, log_outside, pw);
 
             std::cout << "bababa";
             std::cout << pw;
@@ -1674,27 +1846,27 @@ bool EM::converged() const {
 }
 
 void EM::computeExpectedCount(ChartItem *root, double pw) {
-    if(root->count_visited_status == VISITED){
+    if(root->Annotations().count_visited_status == pass_stamp_){
         return ;
     }
     ChartItem *ptr = root;
 
     do{
-        double curr_log_count = ptr->rule_ptr->log_rule_weight;
+        double curr_log_count = ptr->Annotations().rule_ptr->log_rule_weight;
 //        assert(is_negative(curr_log_count));
 
-        curr_log_count += ptr->log_outside_prob;
+        curr_log_count += ptr->Annotations().log_outside_prob;
         curr_log_count -= pw;
 
-        for(ChartItem *child:ptr->children){
-            curr_log_count += child->log_inside_prob;
+        for(ChartItem *child:ptr->Annotations().children){
+            curr_log_count += child->Annotations().log_inside_prob;
         }
 
-        ptr->log_sent_rule_count = curr_log_count;
-        ptr->rule_ptr->log_count = addLogs(ptr->rule_ptr->log_count, curr_log_count);
+        ptr->Annotations().log_sent_rule_count = curr_log_count;
+        ptr->Annotations().rule_ptr->log_count = addLogs(ptr->Annotations().rule_ptr->log_count, curr_log_count);
 
-        ptr->count_visited_status = VISITED;
-        for(ChartItem *child:ptr->children){
+        ptr->Annotations().count_visited_status = pass_stamp_;
+        for(ChartItem *child:ptr->Annotations().children){
             computeExpectedCount(child, pw);
         }
         ptr = ptr->next_ptr;
@@ -1704,61 +1876,30 @@ void EM::computeExpectedCount(ChartItem *root, double pw) {
 
 
 void EM::updateEM() {
-    LabelCount total_count;
-    LabelToRule::iterator it;
-
-    for(it = rule_dict.begin(); it != rule_dict.end(); it++) {
-        RuleVector v = it->second;
-        double log_total_count = ChartItem::log_zero;
-        for (auto rule : v) {
-            log_total_count = addLogs(log_total_count, rule->log_count);
-            if(!is_normal_count(log_total_count)){
-                std::cout << "count";
-            }
-//            assert(is_normal_count(log_total_count));
-        }
-        total_count[it->first] = log_total_count;
-    }
+    gatherGroupValues(&SHRG::log_count, group_counts_);
+    gatherGroupValues(&SHRG::log_rule_weight, group_weights_);
     max_change = 0.0;
-    for(int i = 0; i < shrg_rules.size(); i++) {
-        auto rule = shrg_rules[i];
-        LabelHash l = rule->label_hash;
-        double new_phi;
-
-        // special case 1: the rule doesn't appear
-        if (rule->log_count == ChartItem::log_zero) {
-            // if the rule is the only one with the label
-            if (rule_dict[l].size() == 1) {
-                new_phi = 0.0;
-            } else {
-                new_phi = ChartItem::log_zero;
+    for (std::size_t g = 0; g < numGroups(); g++) {
+        double log_total_count = groupLogSum(group_counts_, g);
+        if (!is_normal_count(log_total_count)) {
+            std::cout << "count";
+        }
+        uint32_t begin = group_begin_[g], end = group_begin_[g + 1];
+        // special case: a rule that doesn't appear gets probability 0, or 1 if it is the only one
+        // with the label
+        double unseen_phi = end - begin == 1 ? 0.0 : ChartItem::log_zero;
+        for (uint32_t i = begin; i < end; i++) {
+            double log_count = group_counts_[i];
+            double new_phi = log_count == ChartItem::log_zero ? unseen_phi : log_count - log_total_count;
+            double change = std::abs(group_weights_[i] - new_phi);
+            if (change > max_change) {
+                max_change = change;
+                max_change_ind = group_first_index_[i];
             }
-        } else {
-            new_phi = rule->log_count - total_count[l];
-//            assert(is_negative(new_phi));
-        }
-        double change = abs(rule->log_rule_weight - new_phi);
-        if(change > max_change){
-            max_change = change;
-            max_change_ind = i;
+            group_weights_[i] = new_phi;
         }
-        rule->log_rule_weight = new_phi;
     }
-}
-
-LabelToRule EM::getRuleDict(){
-    LabelToRule dict;
-    for(auto rule:shrg_rules){
-        dict[rule->label_hash].push_back(rule);
-    }
-
-    //remove duplicates
-    LabelToRule::iterator it;
-    for(it = dict.begin(); it != dict.end(); it++){
-        std::set<SHRG*>s(it->second.begin(), it->second.end());
-        dict[it->first] = RuleVector(s.begin(), s.end());
-    }
-    return dict;
+    scatterGroupWeights(group_weights_);
 }
 
 // Deep copy functions for persistent derivation forests
@@ -1779,38 +1920,39 @@ ChartItem* EM::deepCopyChartItem(ChartItem* original,
     // Copy all essential data
     copy->attrs_ptr = original->attrs_ptr;
     copy->edge_set = original->edge_set;
+    copy->edge_set_hash = original->edge_set_hash;
     copy->boundary_node_mapping = original->boundary_node_mapping;
-    copy->level = original->level;
+    copy->Annotations().level = original->Annotations().level;
     copy->score = original->score;
     copy->status = original->status;
 
     // Copy EM-related probabilities and counts
-    copy->log_inside_prob = original->log_inside_prob;
-    copy->log_outside_prob = original->log_outside_prob;
-    copy->log_sent_rule_count = original->log_sent_rule_count;
-    copy->log_inside_count = original->log_inside_count;
+    copy->Annotations().log_inside_prob = original->Annotations().log_inside_prob;
+    copy->Annotations().log_outside_prob = original->Annotations().log_outside_prob;
+    copy->Annotations().log_sent_rule_count = original->Annotations().log_sent_rule_count;
+    copy->Annotations().log_inside_count = original->Annotations().log_inside_count;
 
     // Don't copy rule pointers - they will be set by addRulePointer() after deep copy
-    copy->shrg_index = -1;  // Will be set by addRulePointer()
-    copy->rule_ptr = nullptr;  // Will be set by addRulePointer()
+    copy->Annotations().shrg_index = -1;  // Will be set by addRulePointer()
+    copy->Annotations().rule_ptr = nullptr;  // Will be set by addRulePointer()
 
     // Copy status flags (reset to unvisited state for fresh EM iteration)
-    copy->inside_visited_status = ChartItem::kEmpty;
-    copy->outside_visited_status = ChartItem::kEmpty;
-    copy->count_visited_status = ChartItem::kEmpty;
-    copy->child_visited_status = ChartItem::kEmpty;
-    copy->update_status = ChartItem::kEmpty;
-    copy->rule_visited = ChartItem::kEmpty;
+    copy->Annotations().inside_visited_status = ChartItem::kEmpty;
+    copy->Annotations().outside_visited_status = ChartItem::kEmpty;
+    copy->Annotations().count_visited_status = ChartItem::kEmpty;
+    copy->Annotations().child_visited_status = ChartItem::kEmpty;
+    copy->Annotations().update_status = ChartItem::kEmpty;
+    copy->Annotations().rule_visited = ChartItem::kEmpty;
 
     // Copy derivation scoring fields
-    copy->em_greedy_score = original->em_greedy_score;
-    copy->em_greedy_deriv = original->em_greedy_deriv;
-    copy->em_inside_score = original->em_inside_score;
-    copy->em_inside_deriv = original->em_inside_deriv;
-    copy->count_greedy_score = original->count_greedy_score;
-    copy->count_greedy_deriv = original->count_greedy_deriv;
-    copy->count_inside_score = original->count_inside_score;
-    copy->count_inside_deriv = original->count_inside_deriv;
+    copy->Annotations().em_greedy_score = original->Annotations().em_greedy_score;
+    copy->Annotations().em_greedy_deriv = original->Annotations().em_greedy_deriv;
+    copy->Annotations().em_inside_score = original->Annotations().em_inside_score;
+    copy->Annotations().em_inside_deriv = original->Annotations().em_inside_deriv;
+    copy->Annotations().count_greedy_score = original->Annotations().count_greedy_score;
+    copy->Annotations().count_greedy_deriv = original->Annotations().count_greedy_deriv;
+    copy->Annotations().count_inside_score = original->Annotations().count_inside_score;
+    copy->Annotations().count_inside_deriv = original->Annotations().count_inside_deriv;
 
     // Register the copy early to handle circular references
     copied_map[original] = copy;
@@ -1828,17 +1970,17 @@ void EM::deepCopyDerivationRelations(ChartItem* original,
                                      std::unordered_map<ChartItem*, ChartItem*>& copied_map,
                                      utils::MemoryPool<ChartItem>& persistent_pool) {
     // Copy children relationships
-    copy->children.clear();
-    copy->children.reserve(original->children.size());
-    for (ChartItem* child : original->children) {
+    copy->Annotations().children.clear();
+    copy->Annotations().children.reserve(original->Annotations().children.size());
+    for (ChartItem* child : original->Annotations().children) {
         ChartItem* child_copy = deepCopyChartItem(child, copied_map, persistent_pool);
-        copy->children.push_back(child_copy);
+        copy->Annotations().children.push_back(child_copy);
     }
 
     // Copy parent-sibling relationships
-    copy->parents_sib.clear();
-    copy->parents_sib.reserve(original->parents_sib.size());
-    for (const auto& parent_sib_tuple : original->parents_sib) {
+    copy->Annotations().parents_sib.clear();
+    copy->Annotations().parents_sib.reserve(original->Annotations().parents_sib.size());
+    for (const auto& parent_sib_tuple : original->Annotations().parents_sib) {
         ChartItem* parent = std::get<0>(parent_sib_tuple);
         const std::vector<ChartItem*>& siblings = std::get<1>(parent_sib_tuple);
 
@@ -1851,7 +1993,7 @@ void EM::deepCopyDerivationRelations(ChartItem* original,
             siblings_copy.push_back(sibling_copy);
         }
 
-        copy->parents_sib.emplace_back(parent_copy, std::move(siblings_copy));
+        copy->Annotations().parents_sib.emplace_back(parent_copy, std::move(siblings_copy));
     }
 
     // Copy next_ptr chain (alternative derivations for same subgraph)
@@ -1872,38 +2014,38 @@ void EM::deepCopyDerivationRelations(ChartItem* original,
 }
 
 void EM::collectAllReachableItems(ChartItem* root, std::unordered_set<ChartItem*>& all_items) {
-    if (!root || all_items.count(root)) {
-        return;
-    }
-
-    all_items.insert(root);
-
-    // Follow children
-    for (ChartItem* child : root->children) {
-        collectAllReachableItems(child, all_items);
-    }
+    // explicit stack instead of recursion, deep forests overflow the call stack
+    std::vector<ChartItem*> stack{root};
+    auto visit = [&](ChartItem* item) {
+        if (item && !all_items.count(item)) {
+            stack.push_back(item);
+        }
+    };
 
-    // Follow parent-sibling relationships
-    for (const auto& parent_sib_tuple : root->parents_sib) {
-        ChartItem* parent = std::get<0>(parent_sib_tuple);
-        collectAllReachableItems(parent, all_items);
+    while (!stack.empty()) {
+        ChartItem* item = stack.back();
+        stack.pop_back();
+        if (!item || !all_items.insert(item).second) {
+            continue;
+        }
 
-        for (ChartItem* sibling : std::get<1>(parent_sib_tuple)) {
-            collectAllReachableItems(sibling, all_items);
+        // Follow children
+        for (ChartItem* child : item->Annotations().children) {
+            visit(child);
         }
-    }
 
-    // Follow next_ptr chain (but avoid infinite loops)
-    if (root->next_ptr && root->next_ptr != root) {
-        collectAllReachableItems(root->next_ptr, all_items);
-    }
+        // Follow parent-sibling relationships
+        for (const auto& parent_sib_tuple : item->Annotations().parents_sib) {
+            visit(std::get<0>(parent_sib_tuple));
+            for (ChartItem* sibling : std::get<1>(parent_sib_tuple)) {
+                visit(sibling);
+            }
+        }
 
-    // Follow left_ptr and right_ptr
-    if (root->left_ptr) {
-        collectAllReachableItems(root->left_ptr, all_items);
-    }
-    if (root->right_ptr) {
-        collectAllReachableItems(root->right_ptr, all_items);
+        // Follow next_ptr chain, left_ptr and right_ptr
+        visit(item->next_ptr);
+        visit(item->left_ptr);
+        visit(item->right_ptr);
     }
 }
 
@@ -1932,50 +2074,6 @@ ChartItem* EM::deepCopyDerivationForest(ChartItem* root, utils::MemoryPool<Chart
     return copied_map[root];
 }
 
-void EM::resetVisitedFlags(ChartItem* root) {
-    if (!root) return;
-
-    std::unordered_set<ChartItem*> visited;
-    resetVisitedFlagsRecursive(root, visited);
-}
-
-void EM::resetVisitedFlagsRecursive(ChartItem* item, std::unordered_set<ChartItem*>& visited) {
-    if (!item || visited.count(item)) return;
-
-    visited.insert(item);
-
-    // Reset all the critical visited flags
-    ChartItem* ptr = item;
-    do {
-        ptr->inside_visited_status = ChartItem::kEmpty;
-        ptr->outside_visited_status = ChartItem::kEmpty;
-        ptr->count_visited_status = ChartItem::kEmpty;
-        ptr->child_visited_status = ChartItem::kEmpty;
-        // Keep rule_visited as VISITED since rule pointers are valid
-
-        ptr = ptr->next_ptr;
-    } while (ptr && ptr != item);
-
-    // Recursively reset flags for all reachable items
-    for (ChartItem* child : item->children) {
-        resetVisitedFlagsRecursive(child, visited);
-    }
-
-    for (const auto& parent_sib_tuple : item->parents_sib) {
-        resetVisitedFlagsRecursive(std::get<0>(parent_sib_tuple), visited);
-        for (ChartItem* sibling : std::get<1>(parent_sib_tuple)) {
-            resetVisitedFlagsRecursive(sibling, visited);
-        }
-    }
-
-    if (item->left_ptr) {
-        resetVisitedFlagsRecursive(item->left_ptr, visited);
-    }
-    if (item->right_ptr) {
-        resetVisitedFlagsRecursive(item->right_ptr, visited);
-    }
-}
-
 
 // ===================== PROFILING FUNCTIONS =====================
 
@@ -1996,8 +2094,20 @@ void EM::computeForestMetrics(ChartItem* root, GraphMetrics& metrics) {
     size_t max_chain = 0;
     size_t max_children = 0;
     size_t max_parents = 0;
+    size_t forest_bytes = 0;
 
     for (ChartItem* item : all_items) {
+        // Count memory held by the item
+        forest_bytes += sizeof(ChartItem);
+        if (item->HasAnnotations()) {
+            const ChartItemAnnotations& annotations = item->Annotations();
+            forest_bytes += sizeof(ChartItemAnnotations) +
+                            annotations.children.capacity() * sizeof(ChartItem*) +
+                            annotations.parents_sib.capacity() * sizeof(ParentTup);
+            for (const auto& parent_sib : annotations.parents_sib)
+                forest_bytes += std::get<1>(parent_sib).capacity() * sizeof(ChartItem*);
+        }
+
         // Count chain length
         size_t chain_len = 1;
         ChartItem* ptr = item->next_ptr;
@@ -2008,19 +2118,20 @@ void EM::computeForestMetrics(ChartItem* root, GraphMetrics& metrics) {
         if (chain_len > max_chain) max_chain = chain_len;
 
         // Count children
-        if (item->children.size() > max_children) {
-            max_children = item->children.size();
+        if (item->Annotations().children.size() > max_children) {
+            max_children = item->Annotations().children.size();
         }
 
         // Count parents
-        if (item->parents_sib.size() > max_parents) {
-            max_parents = item->parents_sib.size();
+        if (item->Annotations().parents_sib.size() > max_parents) {
+            max_parents = item->Annotations().parents_sib.size();
         }
     }
 
     metrics.max_chain_length = max_chain;
     metrics.max_children = max_children;
     metrics.max_parents = max_parents;
+    metrics.forest_bytes = forest_bytes;
 }
 
 void EM::writeMetricsToCSV(const std::string& filepath) {
@@ -2032,7 +2143,8 @@ void EM::writeMetricsToCSV(const std::string& filepath) {
 
     // Write header
     out << "sentence_id,nodes,edges,forest_size,max_chain,max_children,max_parents,"
-        << "parse_ms,deep_copy_ms,reset_ms,inside_ms,outside_ms,expected_ms,total_em_ms\n";
+        << "parse_ms,deep_copy_ms,inside_ms,outside_ms,expected_ms,total_em_ms,"
+        << "peak_parse_bytes,forest_bytes,packed_forest_bytes\n";
 
     // Write data
     for (const auto& m : graph_metrics_) {
@@ -2046,11 +2158,13 @@ void EM::writeMetricsToCSV(const std::string& filepath) {
             << std::fixed << std::setprecision(2)
             << m.parse_time_ms << ","
             << m.deep_copy_time_ms << ","
-            << m.reset_flags_time_ms << ","
             << m.inside_time_ms << ","
             << m.outside_time_ms << ","
             << m.expected_count_time_ms << ","
-            << m.total_em_time_ms << "\n";
+            << m.total_em_time_ms << ","
+            << m.peak_parse_bytes << ","
+            << m.forest_bytes << ","
+            << m.packed_forest_bytes << "\n";
     }
 
     out.close();
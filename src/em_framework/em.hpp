@@ -8,8 +8,10 @@
 #include <unordered_map>
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include "../manager.hpp"
 #include "../forest_cache.hpp"
+#include "../graph_parser/packed_forest.hpp"
 #include "em_base.hpp"
 #include "em_types.hpp"
 #include "em_utils.hpp"
@@ -26,9 +28,11 @@ struct GraphMetrics {
     size_t max_chain_length = 0;
     size_t max_children = 0;
     size_t max_parents = 0;
+    size_t peak_parse_bytes = 0;  // high-water mark of the parser's chart
+    size_t forest_bytes = 0;      // items, annotations and edge lists of the forest
+    size_t packed_forest_bytes = 0;  // the PackedForest that the EM iterations run on
     double parse_time_ms = 0.0;
     double deep_copy_time_ms = 0.0;
-    double reset_flags_time_ms = 0.0;
     double inside_time_ms = 0.0;
     double outside_time_ms = 0.0;
     double expected_count_time_ms = 0.0;
@@ -52,10 +56,29 @@ class EM : public EMBase {
     double computeInside(ChartItem *root);
     void computeOutsideNode(ChartItem *root, NodeLevelPQ &pq);
     void computeOutside(ChartItem *root);
+
+    // the E-step over a packed forest, as sweeps over its nodes
+    double computeInside(const PackedForest &forest, std::vector<double> &log_inside);
+    void computeOutside(const PackedForest &forest, const std::vector<double> &log_inside,
+                        std::vector<double> &log_outside);
+    void computeExpectedCount(const PackedForest &forest, const std::vector<double> &log_inside,
+                              const std::vector<double> &log_outside, double pw);
+    // adds the counts to counts[rule_numbers[e]] for every hyperedge e instead
+    void computeExpectedCount(const PackedForest &forest, const std::vector<double> &log_inside,
+                              const std::vector<double> &log_outside, double pw,
+                              const std::vector<uint32_t> &rule_numbers,
+                              std::vector<ScaledProb> &counts);
+
     void initializeWeights();  // Set uniform weights for all rules
 
+    // Runs the E-step of run() in linear space on scaled probabilities (ScaledProb) instead of
+    // log space, so the sweeps take no exp or log. Off by default; validateFullEMCycle compares
+    // both modes with the ChartItem passes.
+    void setScaledProbabilities(bool enable) { scaled_probabilities_ = enable; }
+    bool getScaledProbabilities() const { return scaled_probabilities_; }
+
     void run() override;
-    void run_safe();  // Like run(), but forks child to test each parse before committing
+    void run_safe();  // Like run(), but skips the graphs that time out or run out of memory
     void run_from_saved();
 
   protected:
@@ -77,10 +100,51 @@ class EM : public EMBase {
 
     // Persistent memory pool for storing deep-copied derivation forests
     utils::MemoryPool<ChartItem> persistent_pool_;
+    // The persistent pools of all but the first parse context of run()
+    std::vector<std::unique_ptr<utils::MemoryPool<ChartItem>>> extra_pools_;
+    std::mutex cache_mutex_;  // guards cache_ while forests are built concurrently
+    bool scaled_probabilities_ = false;
     void run_1iter();
 
   private:
-    LabelToRule getRuleDict();
+
+    // A derivation forest kept for all EM iterations
+    struct CachedForest {
+        ChartItem* root = nullptr;
+        std::string sentence_id;
+        int original_index = -1;
+        size_t metrics_index = 0;              // Index into graph_metrics_ for this forest
+        PackedForest forest{};                 // what the EM iterations run on
+        std::vector<uint32_t> rule_numbers{};  // rule number of every hyperedge of `forest`
+    };
+
+    // Packs the forest of `cf.root`
+    void packForest(CachedForest& cf);
+    // Numbers the rules of the hyperedges of `cf.forest`
+    void numberForestRules(CachedForest& cf);
+
+    // What phase 1 of run() made of one graph, committed to the cached forests in graph order
+    struct ParsedGraph {
+        bool skipped = false;
+        bool cache_hit = false;
+        bool cache_miss = false;
+        ChartItem* root = nullptr;  // nullptr if the parse failed
+        GraphMetrics metrics;
+        PackedForest forest;
+    };
+
+    // Parses (or loads) graphs[graph_index] on `context` and copies its forest into `pool`
+    void buildForest(Context& context, utils::MemoryPool<ChartItem>& pool, int graph_index,
+                     const Deadline& deadline, ParsedGraph& result);
+    // Builds the forests of all graphs on the parse contexts
+    void buildForests(std::vector<ParsedGraph>& parsed);
+    // E-step over all cached forests on num_threads_ threads, returns the log likelihood
+    double expectCachedForests(std::vector<CachedForest>& cached_forests, int iteration,
+                               std::vector<std::vector<double>>& history_graph_ll);
+    // E-step over one forest, adds its counts to `counts` and returns its log likelihood;
+    // `rule_weights` are the weights by rule number in scaled mode
+    double expectForest(const CachedForest& cf, const std::vector<ScaledProb>& rule_weights,
+                        std::vector<ScaledProb>& counts, GraphMetrics* metrics);
 
     // Deep copy functions for persistent derivation forests
     ChartItem* deepCopyChartItem(ChartItem* original,
@@ -94,7 +158,6 @@ class EM : public EMBase {
 
     void collectAllReachableItems(ChartItem* root, std::unordered_set<ChartItem*>& all_items);
 
-    void resetVisitedFlagsRecursive(ChartItem* item, std::unordered_set<ChartItem*>& visited);
     bool parentsOutsideReady(ChartItem* node) const;
     void computeOutsideChainOptimized(ChartItem* root);
     void computeOutside_optimized(ChartItem *root);
@@ -103,9 +166,6 @@ class EM : public EMBase {
     // Main function to deep copy an entire derivation forest
     ChartItem* deepCopyDerivationForest(ChartItem* root, utils::MemoryPool<ChartItem>& persistent_pool);
 
-    // Reset visited flags for all items in a derivation forest before each EM iteration
-    void resetVisitedFlags(ChartItem* root);
-
     // Profiling support
     bool profiling_enabled_ = false;
     std::vector<GraphMetrics> graph_metrics_;
@@ -149,6 +209,12 @@ private:
     std::unique_ptr<forest_cache::ForestCache> cache_;
     bool caching_enabled_ = false;
     uint32_t grammar_hash_ = 0;
+    // the rule of every shrg_index, and one GrammarAttributes per entry for loaded forests
+    std::vector<SHRG*> cache_rules_;
+    std::vector<GrammarAttributes> cache_attrs_pool_;
+
+    // Restores rule_ptr and attrs_ptr on a forest loaded from the cache
+    void restoreCachedPointers(ChartItem* root);
 
     // Helper to compute grammar hash for cache validation
     uint32_t computeGrammarHash() const;
@@ -1,6 +1,13 @@
 //
 // Created by Yuan Gao on 03/06/2024.
 //
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
 #include "em_utils.hpp"
 #include "em_base.hpp"
 
@@ -13,147 +20,165 @@ void EMBase::addParentPointer(ChartItem *root, int level){
         ChartItem *ptr = root;
 
         do {
-            if (level > ptr->level) {
-                ptr->level = level;
+            if (level > ptr->Annotations().level) {
+                ptr->Annotations().level = level;
             }
 
             const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
-            if (ptr->child_visited_status != EMBase::VISITED) {
-                for (auto edge_ptr : rule->nonterminal_edges) {
-                    ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                    ptr->children.push_back(child);
-                    addParentPointer(child, ptr->level + 1);
+            if (ptr->Annotations().child_visited_status != EMBase::VISITED) {
+                generator->FindChildren(ptr, ptr->Annotations().children);
+                for (auto child : ptr->Annotations().children) {
+                    addParentPointer(child, ptr->Annotations().level + 1);
                 }
-                for (int i = 0; i < ptr->children.size(); i++) {
+                for (int i = 0; i < ptr->Annotations().children.size(); i++) {
                     std::vector<ChartItem *> sib;
                     std::tuple<ChartItem *, std::vector<ChartItem *>> res;
-                    for (int j = 0; j < ptr->children.size(); j++) {
+                    for (int j = 0; j < ptr->Annotations().children.size(); j++) {
                         if (j == i) {
                             continue;
                         }
-                        sib.push_back(ptr->children[j]);
+                        sib.push_back(ptr->Annotations().children[j]);
                     }
 
                     if (ptr) {
                         res = std::make_tuple(ptr, sib);
-                        ptr->children[i]->parents_sib.push_back(res);
+                        ptr->Annotations().children[i]->Annotations().parents_sib.push_back(res);
                     }
                 }
-                ptr->child_visited_status = VISITED;
+                ptr->Annotations().child_visited_status = VISITED;
             } else {
-                for (auto child : ptr->children) {
-                    addParentPointer(child, ptr->level + 1);
+                for (auto child : ptr->Annotations().children) {
+                    addParentPointer(child, ptr->Annotations().level + 1);
                 }
             }
-            assert(ptr->children.size() == rule->nonterminal_edges.size());
+            assert(ptr->Annotations().children.size() == rule->nonterminal_edges.size());
 
             ptr = ptr->next_ptr;
         } while (ptr != root);
 }
 
-void EMBase::addChildren(ChartItem* root) {
-        if(root->child_visited_status == EMBase::VISITED){
-            return;
-        }
-        ChartItem* start = root;
+void EMBase::addChildren(ChartItem* root, Generator* generator) {
+    // explicit stack instead of recursion, deep forests overflow the call stack
+    std::vector<ChartItem*> stack{root};
+    while (!stack.empty()) {
+        ChartItem* start = stack.back();
+        stack.pop_back();
         ChartItem* ptr = start;
 
         do {
-            const SHRG* rule = ptr->attrs_ptr->grammar_ptr;
-
-            // Only compute children if not already done
-            if (ptr->child_visited_status != EMBase::VISITED) {
+            if (ptr->Annotations().child_visited_status != EMBase::VISITED) {
                 // Add children based on nonterminal edges in the rule
-                for (auto edge_ptr : rule->nonterminal_edges) {
-                    ChartItem* child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                    ptr->children.push_back(child);
-                    addChildren(child);  // Recursively process children
-                }
+                generator->FindChildren(ptr, ptr->Annotations().children);
+                ptr->Annotations().child_visited_status = VISITED;
+                assert(ptr->Annotations().children.size() == ptr->attrs_ptr->grammar_ptr->nonterminal_edges.size());
 
-                ptr->child_visited_status = VISITED;
-                assert(ptr->children.size() == rule->nonterminal_edges.size());
-            } else {
-                // If already visited, still need to ensure children are processed
-                for (auto child : ptr->children) {
-                    addChildren(child);
+                for (auto child : ptr->Annotations().children) {
+                    if (child->Annotations().child_visited_status != EMBase::VISITED) {
+                        stack.push_back(child);
+                    }
                 }
             }
-
             ptr = ptr->next_ptr;
         } while (ptr != start);
+    }
 }
 
-void EMBase::addParentPointerOptimized(ChartItem *root, int level) {
-//        std::cout << "addParentPointerOptimized" << std::endl;
+void EMBase::addParentPointerOptimized(ChartItem *root, int level, Generator *generator) {
     if (!root) return;
 
-    std::queue<std::pair<ChartItem*, int>> queue;
-    queue.push({root, level});
-
-    while (!queue.empty()) {
-        auto [ptr1, level] = queue.front();
-        queue.pop();
-        auto ptr = ptr1;
-        do{
-                if (level > ptr->level) {
-                    ptr->level = level;
-                }
-
-                const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
-
-                if (ptr->child_visited_status != EMBase::VISITED) {
-                    ptr->children.reserve(rule->nonterminal_edges.size());
-
-                    for (auto edge_ptr : rule->nonterminal_edges) {
-                        ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                        ptr->children.push_back(child);
-                        queue.push({child, ptr->level + 1});
-                    }
+    // Depth-first walk that expands every alternative cycle once: it links children, parents
+    // and siblings, and lists the cycles children first. A cycle is entered through any of its
+    // items, so `expanded` holds all items of the expanded cycles.
+    std::unordered_set<ChartItem*> expanded;
+    std::vector<ChartItem*> order;
+    std::vector<std::pair<ChartItem*, bool>> stack{{root, false}};
+
+    while (!stack.empty()) {
+        auto [start, done] = stack.back();
+        if (done) {
+            stack.pop_back();
+            order.push_back(start);
+            continue;
+        }
+        if (expanded.count(start)) {
+            stack.pop_back();
+            continue;
+        }
+        stack.back().second = true;
 
-                    size_t childCount = ptr->children.size();
-                    std::vector<std::vector<ChartItem*>> siblings(childCount);
+        ChartItem* ptr = start;
+        do {
+            expanded.insert(ptr);
+            ptr = ptr->next_ptr;
+        } while (ptr != start);
 
-                    for (size_t i = 0; i < childCount; ++i) {
-                        for (size_t j = 0; j < childCount; ++j) {
-                            if (i != j) {
-                                siblings[i].push_back(ptr->children[j]);
-                            }
+        do {
+            if (ptr->Annotations().child_visited_status != EMBase::VISITED) {
+                generator->FindChildren(ptr, ptr->Annotations().children);
+                auto &children = ptr->Annotations().children;
+
+                for (size_t i = 0; i < children.size(); ++i) {
+                    std::vector<ChartItem*> siblings;
+                    siblings.reserve(children.size() - 1);
+                    for (size_t j = 0; j < children.size(); ++j) {
+                        if (i != j) {
+                            siblings.push_back(children[j]);
                         }
                     }
+                    children[i]->Annotations().parents_sib.push_back({ptr, std::move(siblings)});
+                }
 
-                    // Assign parent and sibling information
-                    for (size_t i = 0; i < childCount; ++i) {
-                        ptr->children[i]->parents_sib.push_back({ptr, std::move(siblings[i])});
-                    }
+                ptr->Annotations().child_visited_status = VISITED;
+            }
+            assert(ptr->Annotations().children.size() == ptr->attrs_ptr->grammar_ptr->nonterminal_edges.size());
 
-                    ptr->child_visited_status = VISITED;
-                } else {
-                    for (auto child : ptr->children) {
-                        queue.push({child, ptr->level + 1});
-                    }
+            for (auto child : ptr->Annotations().children) {
+                if (!expanded.count(child)) {
+                    stack.push_back({child, false});
                 }
+            }
+            ptr = ptr->next_ptr;
+        } while (ptr != start);
+    }
+
+    // The level of a cycle is the longest path to it from the root, so every parent has a lower
+    // level than its children. One sweep from the root down sets it, parents before children.
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        ChartItem* start = *it;
+        ChartItem* ptr = start;
+        int cycle_level = start == root ? level : 0;
+        do {
+            cycle_level = std::max(cycle_level, ptr->Annotations().level);
+            ptr = ptr->next_ptr;
+        } while (ptr != start);
 
-                assert(ptr->children.size() == rule->nonterminal_edges.size());
-                ptr = ptr->next_ptr;
-        }while(ptr1 != ptr);
+        do {
+            ptr->Annotations().level = cycle_level;
+            for (auto child : ptr->Annotations().children) {
+                if (child->Annotations().level < cycle_level + 1) {
+                    child->Annotations().level = cycle_level + 1;
+                }
+            }
+            ptr = ptr->next_ptr;
+        } while (ptr != start);
     }
 }
 
 double EMBase::computeInside(ChartItem *root){
-    if(root->inside_visited_status == VISITED){
-        return root->log_inside_prob;
+    if(root->Annotations().inside_visited_status == pass_stamp_){
+        return root->Annotations().log_inside_prob;
     }
 
     ChartItem *ptr = root;
     double log_inside = ChartItem::log_zero;
 
     do{
-        double curr_log_inside = ptr->rule_ptr->log_rule_weight;
+        double curr_log_inside = ptr->Annotations().rule_ptr->log_rule_weight;
 //        assert(is_negative(curr_log_inside));
         curr_log_inside = sanitizeLogProb(curr_log_inside);
 
         double log_children = 0.0;
-        for(ChartItem *child:ptr->children){
+        for(ChartItem *child:ptr->Annotations().children){
             log_children += computeInside(child);
         }
         log_children = sanitizeLogProb(log_children);
@@ -176,8 +201,8 @@ double EMBase::computeInside(ChartItem *root){
 
     do{
         is_negative(log_inside);
-        ptr->log_inside_prob = log_inside;
-        ptr->inside_visited_status = VISITED;
+        ptr->Annotations().log_inside_prob = log_inside;
+        ptr->Annotations().inside_visited_status = pass_stamp_;
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
@@ -188,46 +213,46 @@ void EMBase::computeOutsideNode(ChartItem *root, NodeLevelPQ &pq){
     ChartItem *ptr = root;
 
     do{
-        if(ptr->parents_sib.empty()){
+        if(ptr->Annotations().parents_sib.empty()){
             ptr = ptr->next_ptr;
             continue;
         }
 
         double log_outside = ChartItem::log_zero;
 
-        for(ParentTup &parent_sib : ptr->parents_sib){
+        for(ParentTup &parent_sib : ptr->Annotations().parents_sib){
             ChartItem *parent = getParent(parent_sib);
             std::vector<ChartItem*> siblings = getSiblings(parent_sib);
 
-            double curr_log_outside = parent->rule_ptr->log_rule_weight;
+            double curr_log_outside = parent->Annotations().rule_ptr->log_rule_weight;
             assert(is_negative(curr_log_outside));
-            curr_log_outside += parent->log_outside_prob;
+            curr_log_outside += parent->Annotations().log_outside_prob;
             assert(is_negative(curr_log_outside));
 
             for(auto sib:siblings){
-                curr_log_outside += sib->log_inside_prob;
+                curr_log_outside += sib->Annotations().log_inside_prob;
                 assert(is_negative(curr_log_outside));
             }
 
             log_outside = addLogs(log_outside, curr_log_outside);
             assert(is_negative(log_outside));
         }
-        ptr->log_outside_prob = log_outside;
-        ptr->outside_visited_status = VISITED;
+        ptr->Annotations().log_outside_prob = log_outside;
+        ptr->Annotations().outside_visited_status = pass_stamp_;
 
 
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
-    double root_log_outside = root->log_outside_prob;
+    double root_log_outside = root->Annotations().log_outside_prob;
 
     do{
-        if(ptr->outside_visited_status != VISITED){
-            ptr->log_outside_prob = root_log_outside;
-            ptr->outside_visited_status = VISITED;
+        if(ptr->Annotations().outside_visited_status != pass_stamp_){
+            ptr->Annotations().log_outside_prob = root_log_outside;
+            ptr->Annotations().outside_visited_status = pass_stamp_;
         }
 
-        for(ChartItem *child:ptr->children){
+        for(ChartItem *child:ptr->Annotations().children){
             pq.push(child);
         }
 
@@ -240,7 +265,7 @@ void EMBase::computeOutside(ChartItem *root){
     ChartItem *ptr = root;
 
     do{
-        ptr->log_outside_prob = 0.0;
+        ptr->Annotations().log_outside_prob = 0.0;
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
@@ -255,24 +280,247 @@ void EMBase::computeOutside(ChartItem *root){
 
 
 void EMBase::addRulePointer(ChartItem *root) {
-    if (root->rule_visited == VISITED) {
-        return;
+    std::vector<ChartItem *> stack{root};
+    while (!stack.empty()) {
+        ChartItem *start = stack.back();
+        stack.pop_back();
+        if (start->Annotations().rule_visited == VISITED) {
+            continue;
+        }
+
+        ChartItem *ptr = start;
+        do {
+            // Use the grammar pointer directly instead of indexing by shrg_index.
+            // This ensures consistent indexing with grammar objects (0 to hrg_size-1)
+            // rather than shrg_indices (0 to shrg_size-1) which may be larger.
+            ptr->Annotations().rule_ptr = const_cast<SHRG*>(ptr->attrs_ptr->grammar_ptr);
+            ptr->Annotations().shrg_index = ptr->attrs_ptr->grammar_ptr->best_cfg_ptr->shrg_index;
+
+            ptr->Annotations().rule_visited = VISITED;
+            for (ChartItem *child : ptr->Annotations().children) {
+                if (child->Annotations().rule_visited != VISITED) {
+                    stack.push_back(child);
+                }
+            }
+            ptr = ptr->next_ptr;
+        } while (ptr != start);
     }
+}
 
-    ChartItem *ptr = root;
-    do {
-        // Use the grammar pointer directly instead of indexing by shrg_index.
-        // This ensures consistent indexing with grammar objects (0 to hrg_size-1)
-        // rather than shrg_indices (0 to shrg_size-1) which may be larger.
-        ptr->rule_ptr = const_cast<SHRG*>(ptr->attrs_ptr->grammar_ptr);
-        ptr->shrg_index = ptr->attrs_ptr->grammar_ptr->best_cfg_ptr->shrg_index;
-
-        ptr->rule_visited = VISITED;
-        for (ChartItem *child : ptr->children) {
-            addRulePointer(child);
+uint32_t EMBase::ruleNumber(SHRG *rule) {
+    auto it = rule_numbers_.find(rule);
+    if (it != rule_numbers_.end()) {
+        return it->second;
+    }
+    uint32_t number = numbered_rules_.size();
+    numbered_rules_.push_back(rule);
+    rule_numbers_.emplace(rule, number);
+    return number;
+}
+
+void EMBase::buildNormalizationGroups() {
+    std::vector<uint32_t> order(shrg_rules.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    // a stable sort keeps the first occurrence of a duplicate rule in front
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        SHRG *rule_a = shrg_rules[a], *rule_b = shrg_rules[b];
+        if (rule_a->label_hash != rule_b->label_hash) {
+            return rule_a->label_hash < rule_b->label_hash;
         }
-        ptr = ptr->next_ptr;
-    } while (ptr != root);
+        return std::less<SHRG *>()(rule_a, rule_b);
+    });
+
+    group_rules_.clear();
+    group_begin_.clear();
+    group_first_index_.clear();
+    for (uint32_t i : order) {
+        SHRG *rule = shrg_rules[i];
+        if (!group_rules_.empty() && group_rules_.back() == rule) {
+            continue;
+        }
+        if (group_rules_.empty() || group_rules_.back()->label_hash != rule->label_hash) {
+            group_begin_.push_back(group_rules_.size());
+        }
+        group_rules_.push_back(rule);
+        group_first_index_.push_back(i);
+    }
+    group_begin_.push_back(group_rules_.size());
+    group_counts_.resize(group_rules_.size());
+    group_weights_.resize(group_rules_.size());
+}
+
+LabelToRule EMBase::getRuleDict() const {
+    LabelToRule dict;
+    for (std::size_t g = 0; g < numGroups(); g++) {
+        dict.emplace_hint(dict.end(), group_rules_[group_begin_[g]]->label_hash,
+                          RuleVector(group_rules_.begin() + group_begin_[g],
+                                     group_rules_.begin() + group_begin_[g + 1]));
+    }
+    return dict;
+}
+
+void EMBase::gatherGroupValues(double SHRG::*field, std::vector<double> &values) const {
+    values.resize(group_rules_.size());
+    for (std::size_t i = 0; i < group_rules_.size(); i++) {
+        values[i] = group_rules_[i]->*field;
+    }
+}
+
+void EMBase::scatterGroupWeights(const std::vector<double> &log_weights) const {
+    for (std::size_t i = 0; i < group_rules_.size(); i++) {
+        group_rules_[i]->log_rule_weight = log_weights[i];
+    }
+}
+
+double EMBase::groupLogSum(const std::vector<double> &log_values, std::size_t g) const {
+    return LogSumExp(log_values.data() + group_begin_[g], group_begin_[g + 1] - group_begin_[g]);
+}
+
+void EMBase::normalizeGroups(std::vector<double> &log_values) const {
+    for (std::size_t g = 0; g < numGroups(); g++) {
+        double log_sum = groupLogSum(log_values, g);
+        double shift = log_sum == ChartItem::log_zero ? 0.0 : log_sum;
+        for (uint32_t i = group_begin_[g]; i < group_begin_[g + 1]; i++) {
+            log_values[i] -= shift;
+        }
+    }
+}
+
+void EMBase::setParseContexts(const std::vector<Context *> &contexts) {
+    parse_contexts_ = contexts;
+    for (Context *parse_context : parse_contexts_) {
+        parse_context->parser->SetRecordChildren(true);
+    }
+}
+
+double EMBase::accumulateExpectedCounts(
+    std::size_t num_forests,
+    const std::function<double(std::size_t, std::vector<ScaledProb> &)> &expect) {
+    return accumulateCounts(num_forests, num_threads_,
+                            [&](std::size_t, std::size_t i, std::vector<ScaledProb> &counts) {
+                                return expect(i, counts);
+                            });
+}
+
+double EMBase::expectParsedGraphs(
+    const std::vector<std::size_t> &graph_indices,
+    const std::function<double(Context &, std::size_t, std::vector<ScaledProb> &)> &expect) {
+    std::vector<Context *> contexts = parse_contexts_;
+    if (contexts.empty()) {
+        contexts.push_back(context);
+    }
+    return accumulateCounts(
+        graph_indices.size(), contexts.size(),
+        [&](std::size_t worker, std::size_t k, std::vector<ScaledProb> &counts) {
+            Context &worker_context = *contexts[worker];
+            if (worker_context.Parse(graphs[graph_indices[k]]) != ParserError::kNone) {
+                return 0.0;
+            }
+            return expect(worker_context, k, counts);
+        });
+}
+
+void EMBase::addRuleCounts(const std::vector<ScaledProb> &counts) {
+    for (std::size_t r = 0; r < counts.size(); ++r) {
+        numbered_rules_[r]->log_count = addLogs(numbered_rules_[r]->log_count, counts[r].Log());
+    }
+}
+
+double EMBase::accumulateCounts(
+    std::size_t num_forests, std::size_t max_workers,
+    const std::function<double(std::size_t, std::size_t, std::vector<ScaledProb> &)> &expect) {
+    // chunk boundaries only depend on num_forests, never on the threads
+    const std::size_t kMaxChunks = 64;
+    std::size_t num_chunks = std::min(kMaxChunks, num_forests);
+    if (num_chunks == 0) {
+        return 0.0;
+    }
+    std::size_t num_rules = numbered_rules_.size();
+
+    if (chunk_counts_.size() < num_chunks) {
+        chunk_counts_.resize(num_chunks);
+    }
+    chunk_lls_.assign(num_chunks, 0.0);
+    std::atomic<std::size_t> next_task{0};
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+
+    // runs task(worker, i) for every i < num_tasks, the workers take the next i until none is
+    // left
+    auto run_tasks = [&](std::size_t num_tasks,
+                         const std::function<void(std::size_t, std::size_t)> &task) {
+        auto work = [&](std::size_t worker) {
+            try {
+                for (std::size_t i = next_task++; i < num_tasks; i = next_task++) {
+                    task(worker, i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_task = num_tasks;
+            }
+        };
+        next_task = 0;
+        std::size_t num_workers =
+            std::min({static_cast<std::size_t>(num_threads_), max_workers, num_tasks});
+        if (num_workers <= 1) {
+            work(0);
+        } else {
+            std::vector<std::thread> workers;
+            workers.reserve(num_workers);
+            for (std::size_t i = 0; i < num_workers; ++i) {
+                workers.emplace_back(work, i);
+            }
+            for (std::thread &worker : workers) {
+                worker.join();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    };
+
+    run_tasks(num_chunks, [&](std::size_t worker, std::size_t chunk) {
+        std::vector<ScaledProb> &counts = chunk_counts_[chunk];
+        counts.assign(num_rules, ScaledProb());
+        std::size_t begin = chunk * num_forests / num_chunks;
+        std::size_t end = (chunk + 1) * num_forests / num_chunks;
+        for (std::size_t i = begin; i < end; ++i) {
+            chunk_lls_[chunk] += expect(worker, i, counts);
+        }
+    });
+
+    // pairwise sums over the chunks in the same order for every rule; the rules are split
+    // into slices which are summed in parallel
+    const std::size_t kRulesPerSlice = 4096;
+    std::size_t num_slices = (num_rules + kRulesPerSlice - 1) / kRulesPerSlice;
+    run_tasks(num_slices, [&](std::size_t, std::size_t slice) {
+        std::size_t begin = slice * kRulesPerSlice;
+        std::size_t end = std::min(num_rules, begin + kRulesPerSlice);
+        for (std::size_t stride = 1; stride < num_chunks; stride *= 2) {
+            for (std::size_t chunk = 0; chunk + stride < num_chunks; chunk += 2 * stride) {
+                std::vector<ScaledProb> &sum = chunk_counts_[chunk];
+                const std::vector<ScaledProb> &other = chunk_counts_[chunk + stride];
+                for (std::size_t r = begin; r < end; ++r) {
+                    sum[r] += other[r];
+                }
+            }
+        }
+        for (std::size_t r = begin; r < end; ++r) {
+            numbered_rules_[r]->log_count = addLogs(numbered_rules_[r]->log_count, chunk_counts_[0][r].Log());
+        }
+    });
+
+    for (std::size_t stride = 1; stride < num_chunks; stride *= 2) {
+        for (std::size_t chunk = 0; chunk + stride < num_chunks; chunk += 2 * stride) {
+            chunk_lls_[chunk] += chunk_lls_[chunk + stride];
+        }
+    }
+    return chunk_lls_[0];
 }
 
 void EMBase::clearRuleCount(){
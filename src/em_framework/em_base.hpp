@@ -5,9 +5,13 @@
 #ifndef SHRG_GRAPH_PARSER_EM_H
 #define SHRG_GRAPH_PARSER_EM_H
 
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
 #include <utility>
 
 #include "../graph_parser/generator.hpp"
+#include "../graph_parser/log_math.hpp"
 #include "../graph_parser/parser_chart_item.hpp"
 #include "../manager.hpp"
 #include "em_types.hpp"
@@ -25,6 +29,13 @@ class EMBase {
         ll = 0;
         output_dir = "N";
         generator = context->parser->GetGenerator();
+        // forests come out of the parser with their children already linked
+        context->parser->SetRecordChildren(true);
+        buildNormalizationGroups();
+        // every rule is numbered up front, the E-step threads only look the numbers up
+        for (SHRG *rule : group_rules_) {
+            ruleNumber(rule);
+        }
     }
 
     Generator* getGenerator() { return generator; }
@@ -38,14 +49,33 @@ class EMBase {
     void setGraphs(std::vector<EdsGraph> &new_graphs){graphs = new_graphs;}
 
     void addParentPointer(ChartItem *root, int level);
-    void addChildren(ChartItem* root);
-    void addParentPointerOptimized(ChartItem *root, int level);
+    void addChildren(ChartItem* root) { addChildren(root, generator); }
+    void addParentPointerOptimized(ChartItem *root, int level) {
+        addParentPointerOptimized(root, level, generator);
+    }
+    // the same for a forest of another context, found with the generator of its parser
+    void addChildren(ChartItem* root, Generator* generator);
+    void addParentPointerOptimized(ChartItem *root, int level, Generator* generator);
     void addRulePointer(ChartItem *root);
     double computeInside(ChartItem *root);
     void computeOutsideNode(ChartItem *root, NodeLevelPQ &pq);
     void computeOutside(ChartItem *root);
     virtual void run() = 0;
 
+    // Starts a new inside/outside/count pass over every forest at once. An item counts as visited
+    // in the current pass when its *_visited_status equals the pass stamp, so no flag is reset.
+    void beginPass() { ++pass_stamp_; }
+
+    // Threads of the E-step (1 by default). Results do not depend on it.
+    void setNumThreads(int num_threads) { num_threads_ = std::max(1, num_threads); }
+    int getNumThreads() const { return num_threads_; }
+
+    // Contexts the graphs are parsed on, one thread each; `context` alone by default. EM::run()
+    // parses on them once, the algorithms that parse in every iteration (BatchEM, ViterbiEM,
+    // VariationalInference) run their E-step on min(num_threads, contexts) of them. The results
+    // do not depend on the number of contexts. EM::run_safe() always parses on `context`.
+    void setParseContexts(const std::vector<Context*>& contexts);
+
     float FindBestScoreWeight(ChartItem *root_ptr);
     Derivation& FindBestDerivation_EMGreedy(ChartItem *root_ptr);
   protected:
@@ -59,12 +89,80 @@ class EMBase {
     std::vector<ChartItem*> forests;
     std::vector<std::string> lemmas;
     int time_out_in_seconds = 5;
+    // stamps are positive, so they never match kEmpty or the VISITED sentinel
+    int pass_stamp_ = 1;
+    int num_threads_ = 1;
+
+    // the distinct rules numbered densely, so that expected counts fit in plain arrays
+    std::vector<SHRG *> numbered_rules_;
+    std::unordered_map<const SHRG *, uint32_t> rule_numbers_;
+    uint32_t ruleNumber(SHRG *rule);
+    // the number of a rule numbered before, safe to call from the E-step threads
+    uint32_t ruleNumberOf(const SHRG *rule) const { return rule_numbers_.at(rule); }
+
+    std::vector<Context*> parse_contexts_;
+
+    // Adds the expected counts of forests [0, num_forests) to SHRG::log_count and returns the sum
+    // of their log likelihoods. `expect(i, counts)` adds the expected counts of forest i to
+    // `counts` (indexed by rule number) and returns its log likelihood; it is called from
+    // num_threads_ threads. The forests are cut into a fixed number of chunks with one count
+    // buffer each, summed by a fixed binary tree, so the result is the same for any number of
+    // threads. Counts are summed in linear space and logged once per rule.
+    double accumulateExpectedCounts(
+        std::size_t num_forests,
+        const std::function<double(std::size_t, std::vector<ScaledProb> &)> &expect);
+
+    // The same for forests that are parsed in the E-step: graphs[graph_indices[k]] is parsed on
+    // one of the parse contexts, then `expect(context, k, counts)` adds the expected counts of
+    // the forest of `context` and returns its log likelihood. Graphs that fail to parse add
+    // nothing.
+    double expectParsedGraphs(
+        const std::vector<std::size_t> &graph_indices,
+        const std::function<double(Context &, std::size_t, std::vector<ScaledProb> &)> &expect);
+
+    // adds `counts` (indexed by rule number) to SHRG::log_count
+    void addRuleCounts(const std::vector<ScaledProb> &counts);
 
     virtual bool converged() const = 0;
     virtual void computeExpectedCount(ChartItem *root, double pw) = 0;
     virtual void updateEM() = 0;
 
     void clearRuleCount();
+
+    // The distinct rules grouped by label, in CSR form: group g is
+    // group_rules_[group_begin_[g], group_begin_[g + 1]). Groups are ordered by label hash and the
+    // rules of a group by address, the order of getRuleDict(). group_first_index_[i] is the first
+    // index of group_rules_[i] in shrg_rules. The M-steps work on arrays parallel to group_rules_.
+    std::vector<SHRG *> group_rules_;
+    std::vector<uint32_t> group_begin_;
+    std::vector<uint32_t> group_first_index_;
+    // scratch arrays parallel to group_rules_, kept between iterations
+    std::vector<double> group_counts_;
+    std::vector<double> group_weights_;
+
+    void buildNormalizationGroups();
+    std::size_t numGroups() const { return group_begin_.size() - 1; }
+    LabelToRule getRuleDict() const;
+    // copies `field` of every rule of group_rules_ to `values`
+    void gatherGroupValues(double SHRG::*field, std::vector<double> &values) const;
+    // sets the weight of every rule of group_rules_ from `log_weights`
+    void scatterGroupWeights(const std::vector<double> &log_weights) const;
+    // log of the sum of group g of `log_values`
+    double groupLogSum(const std::vector<double> &log_values, std::size_t g) const;
+    // Subtracts from each group of `log_values` its log sum, so that the group sums to 1. A group
+    // of log_zero values stays log_zero.
+    void normalizeGroups(std::vector<double> &log_values) const;
+
+  private:
+    // the count buffers and log likelihoods of the chunks, kept between iterations
+    std::vector<std::vector<ScaledProb>> chunk_counts_;
+    std::vector<double> chunk_lls_;
+
+    // accumulateExpectedCounts on at most `max_workers` threads; `expect(worker, i, counts)` also
+    // gets the index of the calling thread, in [0, max_workers)
+    double accumulateCounts(
+        std::size_t num_forests, std::size_t max_workers,
+        const std::function<double(std::size_t, std::size_t, std::vector<ScaledProb> &)> &expect);
 };
 
 }
@@ -23,9 +23,7 @@ BatchEM::BatchEM(RuleVector &shrg_rules, std::vector<EdsGraph> &graphs,
     total_examples = graphs.size();
 
     // Initialize previous weights for all rules
-    for (auto rule : shrg_rules) {
-        prev_weights[rule] = rule->log_rule_weight;
-    }
+    gatherGroupValues(&SHRG::log_rule_weight, prev_weights);
 }
 
 BatchEM::BatchEM(RuleVector &shrg_rules, std::vector<EdsGraph> &graphs,
@@ -37,37 +35,41 @@ BatchEM::BatchEM(RuleVector &shrg_rules, std::vector<EdsGraph> &graphs,
     total_examples = graphs.size();
 
     // Initialize previous weights for all rules
-    for (auto rule : shrg_rules) {
-        prev_weights[rule] = rule->log_rule_weight;
-    }
+    gatherGroupValues(&SHRG::log_rule_weight, prev_weights);
     output_dir = std::move(dir);
     time_out_in_seconds = timeout_seconds;
 }
 
 
 void BatchEM::computeExpectedCount(ChartItem *root, double pw) {
-    if(root->count_visited_status == VISITED){
+    std::vector<ScaledProb> counts(numbered_rules_.size());
+    computeExpectedCount(root, pw, counts);
+    addRuleCounts(counts);
+}
+
+void BatchEM::computeExpectedCount(ChartItem *root, double pw, std::vector<ScaledProb> &counts) {
+    if(root->Annotations().count_visited_status == pass_stamp_){
         return ;
     }
     ChartItem *ptr = root;
 
     do{
-        double curr_log_count = ptr->rule_ptr->log_rule_weight;
+        double curr_log_count = ptr->Annotations().rule_ptr->log_rule_weight;
         //        assert(is_negative(curr_log_count));
 
-        curr_log_count += ptr->log_outside_prob;
+        curr_log_count += ptr->Annotations().log_outside_prob;
         curr_log_count -= pw;
 
-        for(ChartItem *child:ptr->children){
-            curr_log_count += child->log_inside_prob;
+        for(ChartItem *child:ptr->Annotations().children){
+            curr_log_count += child->Annotations().log_inside_prob;
         }
 
-        ptr->log_sent_rule_count = curr_log_count;
-        ptr->rule_ptr->log_count = addLogs(ptr->rule_ptr->log_count, curr_log_count);
+        ptr->Annotations().log_sent_rule_count = curr_log_count;
+        counts[ruleNumberOf(ptr->Annotations().rule_ptr)] += ScaledProb::FromLog(curr_log_count);
 
-        ptr->count_visited_status = VISITED;
-        for(ChartItem *child:ptr->children){
-            computeExpectedCount(child, pw);
+        ptr->Annotations().count_visited_status = pass_stamp_;
+        for(ChartItem *child:ptr->Annotations().children){
+            computeExpectedCount(child, pw, counts);
         }
         ptr = ptr->next_ptr;
     }while(ptr != root);
@@ -98,6 +100,7 @@ void BatchEM::run() {
             prev_ll = ll;
             ll = 0;
             t1 = clock();
+            beginPass();
 
             // Shuffle indices for random batch selection
             std::shuffle(indices.begin(), indices.end(), g);
@@ -115,28 +118,27 @@ void BatchEM::run() {
                 batch_num++;
                 clearRuleCount();
 
-                // Original loop - commented out
-                for (size_t i = batch_start; i < batch_end; i++) {
-                    size_t idx = indices[i];
-                    EdsGraph& graph = graphs[idx];
-
+                // the graphs of the batch are parsed and counted on the parse contexts
+                std::vector<size_t> batch(indices.begin() + batch_start,
+                                          indices.begin() + batch_end);
+                ll += expectParsedGraphs(batch, [&](Context& worker_context, size_t k,
+                                                    std::vector<ScaledProb>& counts) {
                     // Progress tracking for every graph
-                    std::cout << "\r[iter " << iteration << "] " << graph.sentence_id
-                              << " (" << (i + 1) << "/" << indices.size() << ")" << std::flush;
-
-                    auto code = context->Parse(graph);
-                    if (code == ParserError::kNone) {
-                        ChartItem* root = context->parser->Result();
-                        addParentPointerOptimized(root, 0);
-                        addRulePointer(root);
+                    if (num_threads_ == 1) {
+                        std::cout << "\r[iter " << iteration << "] " << graphs[batch[k]].sentence_id
+                                  << " (" << (batch_start + k + 1) << "/" << indices.size() << ")"
+                                  << std::flush;
+                    }
 
-                        double pw = computeInside(root);
-                        computeOutside(root);
-                        computeExpectedCount(root, pw);
+                    ChartItem* root = worker_context.parser->Result();
+                    addParentPointerOptimized(root, 0, worker_context.parser->GetGenerator());
+                    addRulePointer(root);
 
-                        ll += pw;
-                    }
-                }
+                    double pw = computeInside(root);
+                    computeOutside(root);
+                    computeExpectedCount(root, pw, counts);
+                    return pw;
+                });
 
                 // Fork-based timeout implementation
                 // for (size_t i = batch_start; i < batch_end; i++) {
@@ -223,13 +225,13 @@ void BatchEM::run() {
 void BatchEM::verifyNormalization() {
     const double epsilon = 1e-6;  // Tolerance for floating point comparison
 
-    for (const auto& pair : rule_dict) {
+    for (std::size_t g = 0; g < numGroups(); g++) {
         double sum = 0.0;
-        for (const auto& rule : pair.second) {
-            sum += std::exp(rule->log_rule_weight);
+        for (uint32_t i = group_begin_[g]; i < group_begin_[g + 1]; i++) {
+            sum += std::exp(group_rules_[i]->log_rule_weight);
         }
         if (std::abs(sum - 1.0) > epsilon) {
-            std::cerr << "Warning: Rules for labelHash " << pair.first
+            std::cerr << "Warning: Rules for labelHash " << group_rules_[group_begin_[g]]->label_hash
                       << " sum to " << sum << std::endl;
         }
     }
@@ -239,60 +241,36 @@ void BatchEM::updateEM() {
     double batch_weight = static_cast<double>(current_batch_size) /
                             total_examples;
         double prev_weight = 1.0 - batch_weight;
+        const double log_smoothing = std::log(smoothing_factor);
 
-        std::unordered_map<LabelHash, std::vector<std::pair<SHRG*, double>>>
-            label_to_unnormalized;
-
-        for (auto& pair : rule_dict) {
-            LabelHash label = pair.first;
-
-            double log_total_count = ChartItem::log_zero;
-            for (auto rule : pair.second) {
-                if (rule->log_count != ChartItem::log_zero) {
-                    log_total_count = addLogs(log_total_count, rule->log_count);
-                }
-            }
-
-            for (auto rule : pair.second) {
-                double new_phi;
-                if (rule->log_count != ChartItem::log_zero) {
-                    new_phi = rule->log_count - log_total_count;
-                } else {
-                    new_phi = prev_weights[rule];
-                }
+        // count - total count of the label, log_zero for the rules that don't appear
+        gatherGroupValues(&SHRG::log_count, group_counts_);
+        group_weights_ = group_counts_;
+        normalizeGroups(group_weights_);
 
-                double smoothed_new = addLogs(new_phi, std::log(smoothing_factor));
-                double smoothed_prev = addLogs(prev_weights[rule],
-                                             std::log(smoothing_factor));
+        for (std::size_t i = 0; i < group_rules_.size(); i++) {
+            double new_phi = group_counts_[i] != ChartItem::log_zero ? group_weights_[i]
+                                                                     : prev_weights[i];
 
-                double unnormalized = std::log(
-                    prev_weight * std::exp(smoothed_prev) +
-                    batch_weight * std::exp(smoothed_new)
-                );
+            double smoothed_new = addLogs(new_phi, log_smoothing);
+            double smoothed_prev = addLogs(prev_weights[i], log_smoothing);
 
-                label_to_unnormalized[label].push_back({rule, unnormalized});
-            }
+            group_weights_[i] = std::log(
+                prev_weight * std::exp(smoothed_prev) +
+                batch_weight * std::exp(smoothed_new)
+            );
         }
 
-        for (auto& pair : label_to_unnormalized) {
-            double log_sum = ChartItem::log_zero;
-            for (const auto& rule_weight : pair.second) {
-                log_sum = addLogs(log_sum, rule_weight.second);
-            }
-
-            for (const auto& rule_weight : pair.second) {
-                SHRG* rule = rule_weight.first;
-                double normalized = rule_weight.second - log_sum;
-
-                assert(normalized <= 0.0);  // log probability should be <= 0
-                assert(std::isfinite(normalized));
-
-                // Update weights
-                prev_weights[rule] = normalized;
-                rule->log_rule_weight = normalized;
-            }
+        normalizeGroups(group_weights_);
+        for (double normalized : group_weights_) {
+            assert(normalized <= 0.0);  // log probability should be <= 0
+            assert(std::isfinite(normalized));
         }
 
+        // Update weights
+        prev_weights = group_weights_;
+        scatterGroupWeights(group_weights_);
+
         verifyNormalization();
 }
 
@@ -300,17 +278,4 @@ bool BatchEM::converged() const {
     return std::abs(ll - prev_ll) <= threshold;
 }
 
-LabelToRule BatchEM::getRuleDict() {
-    LabelToRule dict;
-    for (auto rule : shrg_rules) {
-        dict[rule->label_hash].push_back(rule);
-    }
-
-    // Remove duplicates
-    for (auto& pair : dict) {
-        std::set<SHRG*> s(pair.second.begin(), pair.second.end());
-        pair.second = RuleVector(s.begin(), s.end());
-    }
-    return dict;
-}
 }
\ No newline at end of file
@@ -25,10 +25,12 @@ protected:
     int total_examples;
     int curr_batch_size;
     const double smoothing_factor = 1e-10;
-    std::unordered_map<SHRG*, double> prev_weights;
+    // previous weights, parallel to group_rules_
+    std::vector<double> prev_weights;
     void computeExpectedCount(ChartItem *root, double pw) override;
+    // adds the expected counts to `counts` (indexed by rule number) instead of SHRG::log_count
+    void computeExpectedCount(ChartItem *root, double pw, std::vector<ScaledProb> &counts);
     void updateEM() override;
     void verifyNormalization();
-    LabelToRule getRuleDict();
 };
 }
@@ -5,6 +5,7 @@ namespace shrg::em{
 const int EM_DATA_PROCESSOR::VISITED = -2000;
 EM_DATA_PROCESSOR:: EM_DATA_PROCESSOR(std::vector<EdsGraph> &graphs, shrg::Context *context)
     : context(context), graphs(graphs) {
+    context->parser->SetRecordChildren(true);
 }
 
 void EM_DATA_PROCESSOR::parseAllGraphs(){
@@ -44,39 +45,38 @@ void EM_DATA_PROCESSOR::addParentPointer(ChartItem *root, int level){
     Generator *generator = context->parser->GetGenerator();
 
     do {
-        if (level > ptr->level) {
-            ptr->level = level;
+        if (level > ptr->Annotations().level) {
+            ptr->Annotations().level = level;
         }
 
         const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
-        if (ptr->child_visited_status != EM_DATA_PROCESSOR::VISITED) {
-            for (auto edge_ptr : rule->nonterminal_edges) {
-                ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                ptr->children.push_back(child);
-                addParentPointer(child, ptr->level + 1);
+        if (ptr->Annotations().child_visited_status != EM_DATA_PROCESSOR::VISITED) {
+            generator->FindChildren(ptr, ptr->Annotations().children);
+            for (auto child : ptr->Annotations().children) {
+                addParentPointer(child, ptr->Annotations().level + 1);
             }
-            for (int i = 0; i < ptr->children.size(); i++) {
+            for (int i = 0; i < ptr->Annotations().children.size(); i++) {
                 std::vector<ChartItem *> sib;
                 std::tuple<ChartItem *, std::vector<ChartItem *>> res;
-                for (int j = 0; j < ptr->children.size(); j++) {
+                for (int j = 0; j < ptr->Annotations().children.size(); j++) {
                     if (j == i) {
                         continue;
                     }
-                    sib.push_back(ptr->children[j]);
+                    sib.push_back(ptr->Annotations().children[j]);
                 }
 
                 if (ptr) {
                     res = std::make_tuple(ptr, sib);
-                    ptr->children[i]->parents_sib.push_back(res);
+                    ptr->Annotations().children[i]->Annotations().parents_sib.push_back(res);
                 }
             }
-            ptr->child_visited_status = EM_DATA_PROCESSOR::VISITED;
+            ptr->Annotations().child_visited_status = EM_DATA_PROCESSOR::VISITED;
         } else {
-            for (auto child : ptr->children) {
-                addParentPointer(child, ptr->level + 1);
+            for (auto child : ptr->Annotations().children) {
+                addParentPointer(child, ptr->Annotations().level + 1);
             }
         }
-        assert(ptr->children.size() == rule->nonterminal_edges.size());
+        assert(ptr->Annotations().children.size() == rule->nonterminal_edges.size());
 
         ptr = ptr->next_ptr;
     } while (ptr != root);
@@ -95,48 +95,45 @@ void EM_DATA_PROCESSOR::addParentPointerOptimized(ChartItem *root, int level) {
         auto [ptr, level] = queue.front();
         queue.pop();
 
-        if (level > ptr->level) {
-            ptr->level = level;
+        if (level > ptr->Annotations().level) {
+            ptr->Annotations().level = level;
         }
 
         const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
 
-        if (ptr->child_visited_status != EM_DATA_PROCESSOR::VISITED) {
-            ptr->children.reserve(rule->nonterminal_edges.size());
-
+        if (ptr->Annotations().child_visited_status != EM_DATA_PROCESSOR::VISITED) {
             // Find and process children
-            for (auto edge_ptr : rule->nonterminal_edges) {
-                ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                ptr->children.push_back(child);
-                queue.push({child, ptr->level + 1});
+            generator->FindChildren(ptr, ptr->Annotations().children);
+            for (auto child : ptr->Annotations().children) {
+                queue.push({child, ptr->Annotations().level + 1});
             }
 
             // Precompute siblings once and reuse
-            size_t childCount = ptr->children.size();
+            size_t childCount = ptr->Annotations().children.size();
             std::vector<std::vector<ChartItem*>> siblings(childCount);
 
             for (size_t i = 0; i < childCount; ++i) {
                 for (size_t j = 0; j < childCount; ++j) {
                     if (i != j) {
-                        siblings[i].push_back(ptr->children[j]);
+                        siblings[i].push_back(ptr->Annotations().children[j]);
                     }
                 }
             }
 
             // Assign parent and sibling information
             for (size_t i = 0; i < childCount; ++i) {
-                ptr->children[i]->parents_sib.push_back({ptr, std::move(siblings[i])});
+                ptr->Annotations().children[i]->Annotations().parents_sib.push_back({ptr, std::move(siblings[i])});
             }
 
-            ptr->child_visited_status = EM_DATA_PROCESSOR::VISITED;
+            ptr->Annotations().child_visited_status = EM_DATA_PROCESSOR::VISITED;
         } else {
             // Process children of already visited nodes to ensure full traversal
-            for (auto child : ptr->children) {
-                queue.push({child, ptr->level + 1});
+            for (auto child : ptr->Annotations().children) {
+                queue.push({child, ptr->Annotations().level + 1});
             }
         }
 
-        assert(ptr->children.size() == rule->nonterminal_edges.size());
+        assert(ptr->Annotations().children.size() == rule->nonterminal_edges.size());
     }
 }
 
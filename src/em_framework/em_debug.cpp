@@ -67,12 +67,12 @@ ChartItem* deepCopyChartItem(ChartItem* root) {
         ChartItem* current = queue.front();
         queue.pop();
 
-        for (auto child : current->children) {
+        for (auto child : current->Annotations().children) {
             if (oldToNew.find(child) == oldToNew.end()) {
                 oldToNew[child] = new ChartItem(*child);
                 queue.push(child);
             }
-            oldToNew[current]->children.push_back(oldToNew[child]);
+            oldToNew[current]->Annotations().children.push_back(oldToNew[child]);
         }
 
         if (current->next_ptr && oldToNew.find(current->next_ptr) == oldToNew.end()) {
@@ -100,39 +100,39 @@ bool compareChartItems(ChartItem* root1, ChartItem* root2) {
         queue2.pop();
 
         // Skip if already visited
-        if (node1->inside_visited_status == 1 && node2->inside_visited_status == 1) continue;
+        if (node1->Annotations().inside_visited_status == 1 && node2->Annotations().inside_visited_status == 1) continue;
 
         // Mark as visited
-        node1->inside_visited_status = 1;
-        node2->inside_visited_status = 1;
+        node1->Annotations().inside_visited_status = 1;
+        node2->Annotations().inside_visited_status = 1;
 
-        if (node1->level != node2->level) {
+        if (node1->Annotations().level != node2->Annotations().level) {
             return false;
         }
-        if (node1->child_visited_status != node2->child_visited_status){
+        if (node1->Annotations().child_visited_status != node2->Annotations().child_visited_status){
             return false;
         }
-        if (node1->children.size() != node2->children.size()){
+        if (node1->Annotations().children.size() != node2->Annotations().children.size()){
             return false;
         }
-        if (node1->parents_sib.size() != node2->parents_sib.size()){
+        if (node1->Annotations().parents_sib.size() != node2->Annotations().parents_sib.size()){
             return false;
         }
 
-        for (size_t i = 0; i < node1->children.size(); ++i) {
-            queue1.push(node1->children[i]);
-            queue2.push(node2->children[i]);
+        for (size_t i = 0; i < node1->Annotations().children.size(); ++i) {
+            queue1.push(node1->Annotations().children[i]);
+            queue2.push(node2->Annotations().children[i]);
         }
 
-        for (size_t i = 0; i < node1->parents_sib.size(); ++i) {
-            if (std::get<0>(node1->parents_sib[i]) != std::get<0>(node2->parents_sib[i])) {
+        for (size_t i = 0; i < node1->Annotations().parents_sib.size(); ++i) {
+            if (std::get<0>(node1->Annotations().parents_sib[i]) != std::get<0>(node2->Annotations().parents_sib[i])) {
                 return false;
             }
-            if (std::get<1>(node1->parents_sib[i]).size() != std::get<1>(node2->parents_sib[i]).size()) {
+            if (std::get<1>(node1->Annotations().parents_sib[i]).size() != std::get<1>(node2->Annotations().parents_sib[i]).size()) {
                 return false;
             }
-            for (size_t j = 0; j < std::get<1>(node1->parents_sib[i]).size(); ++j) {
-                if (std::get<1>(node1->parents_sib[i])[j] != std::get<1>(node2->parents_sib[i])[j]) {
+            for (size_t j = 0; j < std::get<1>(node1->Annotations().parents_sib[i]).size(); ++j) {
+                if (std::get<1>(node1->Annotations().parents_sib[i])[j] != std::get<1>(node2->Annotations().parents_sib[i])[j]) {
                     return false;
                 }
             }
@@ -164,7 +164,7 @@ void deleteChartItem(ChartItem* root) {
         if (visited[current]) continue;
         visited[current] = true;
 
-        for (auto child : current->children) {
+        for (auto child : current->Annotations().children) {
             if (!visited[child]) {
                 queue.push(child);
             }
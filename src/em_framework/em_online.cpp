@@ -23,9 +23,7 @@ namespace shrg::em {
         examples_seen = 0;
 
         // Initialize previous weights
-        for (auto rule : shrg_rules) {
-            prev_weights[rule] = rule->log_rule_weight;
-        }
+        gatherGroupValues(&SHRG::log_rule_weight, prev_weights);
     }
 
     OnlineEM::OnlineEM(RuleVector &shrg_rules, std::vector<EdsGraph> &graphs,
@@ -37,35 +35,33 @@ namespace shrg::em {
         examples_seen = 0;
 
         // Initialize previous weights
-        for (auto rule : shrg_rules) {
-            prev_weights[rule] = rule->log_rule_weight;
-        }
+        gatherGroupValues(&SHRG::log_rule_weight, prev_weights);
         output_dir = std::move(dir);
         time_out_in_seconds = timeout_seconds;
     }
 
     void OnlineEM::computeExpectedCount(ChartItem *root, double pw) {
-        if(root->count_visited_status == VISITED){
+        if(root->Annotations().count_visited_status == pass_stamp_){
             return ;
         }
         ChartItem *ptr = root;
 
         do{
-            double curr_log_count = ptr->rule_ptr->log_rule_weight;
+            double curr_log_count = ptr->Annotations().rule_ptr->log_rule_weight;
             //        assert(is_negative(curr_log_count));
 
-            curr_log_count += ptr->log_outside_prob;
+            curr_log_count += ptr->Annotations().log_outside_prob;
             curr_log_count -= pw;
 
-            for(ChartItem *child:ptr->children){
-                curr_log_count += child->log_inside_prob;
+            for(ChartItem *child:ptr->Annotations().children){
+                curr_log_count += child->Annotations().log_inside_prob;
             }
 
-            ptr->log_sent_rule_count = curr_log_count;
-            ptr->rule_ptr->log_count = addLogs(ptr->rule_ptr->log_count, curr_log_count);
+            ptr->Annotations().log_sent_rule_count = curr_log_count;
+            ptr->Annotations().rule_ptr->log_count = addLogs(ptr->Annotations().rule_ptr->log_count, curr_log_count);
 
-            ptr->count_visited_status = VISITED;
-            for(ChartItem *child:ptr->children){
+            ptr->Annotations().count_visited_status = pass_stamp_;
+            for(ChartItem *child:ptr->Annotations().children){
                 computeExpectedCount(child, pw);
             }
             ptr = ptr->next_ptr;
@@ -98,6 +94,7 @@ namespace shrg::em {
             prev_ll = ll;
             ll = 0;
             t1 = clock();
+            beginPass();
 
             // Shuffle indices for random example processing
             std::shuffle(indices.begin(), indices.end(), g);
@@ -228,88 +225,46 @@ namespace shrg::em {
         // Learning rate decreases with number of examples seen
         double learning_rate = 1.0 / std::sqrt(examples_seen);
         double retain_rate = 1.0 - learning_rate;
+        const double log_smoothing = std::log(smoothing_factor);
 
-        // Group rules by labelHash
-        std::unordered_map<LabelHash, std::vector<std::pair<SHRG*, double>>>
-            label_to_unnormalized;
+        // Normalized counts of each label in current example, log_zero for the rules that don't
+        // appear
+        gatherGroupValues(&SHRG::log_count, group_counts_);
+        group_weights_ = group_counts_;
+        normalizeGroups(group_weights_);
 
         // First pass: compute unnormalized weights
-        for (auto& pair : rule_dict) {
-            LabelHash label = pair.first;
-
-            // Get total counts for this label in current example
-            double log_total_count = ChartItem::log_zero;
-            for (auto rule : pair.second) {
-                if (rule->log_count != ChartItem::log_zero) {
-                    log_total_count = addLogs(log_total_count, rule->log_count);
-                }
-            }
-
-            // Compute unnormalized weights for each rule
-            for (auto rule : pair.second) {
-                double new_phi;
-                if (rule->log_count != ChartItem::log_zero) {
-                    // Rule appears in example
-                    new_phi = rule->log_count - log_total_count;
-                } else {
-                    // Rule not in example
-                    new_phi = prev_weights[rule];
-                }
-
-                // Add smoothing
-                double smoothed_new = addLogs(new_phi, std::log(smoothing_factor));
-                double smoothed_prev = addLogs(prev_weights[rule],
-                                             std::log(smoothing_factor));
-
-                // Combine weights with learning rate
-                double unnormalized = std::log(
-                    retain_rate * std::exp(smoothed_prev) +
-                    learning_rate * std::exp(smoothed_new)
-                );
-
-                label_to_unnormalized[label].push_back({rule, unnormalized});
-            }
+        for (std::size_t i = 0; i < group_rules_.size(); i++) {
+            // Rules not in example keep their previous weight
+            double new_phi = group_counts_[i] != ChartItem::log_zero ? group_weights_[i]
+                                                                     : prev_weights[i];
+
+            // Add smoothing
+            double smoothed_new = addLogs(new_phi, log_smoothing);
+            double smoothed_prev = addLogs(prev_weights[i], log_smoothing);
+
+            // Combine weights with learning rate
+            group_weights_[i] = std::log(
+                retain_rate * std::exp(smoothed_prev) +
+                learning_rate * std::exp(smoothed_new)
+            );
         }
 
         // Second pass: normalize within each labelHash group
-        for (auto& pair : label_to_unnormalized) {
-            // Compute sum for normalization
-            double log_sum = ChartItem::log_zero;
-            for (const auto& rule_weight : pair.second) {
-                log_sum = addLogs(log_sum, rule_weight.second);
-            }
-
-            // Normalize and update weights
-            for (const auto& rule_weight : pair.second) {
-                SHRG* rule = rule_weight.first;
-                double normalized = rule_weight.second - log_sum;
-
-                // Verify normalization
-                assert(normalized <= 0.0);
-                assert(std::isfinite(normalized));
-
-                // Update weights
-                prev_weights[rule] = normalized;
-                rule->log_rule_weight = normalized;
-            }
+        normalizeGroups(group_weights_);
+        for (double normalized : group_weights_) {
+            // Verify normalization
+            assert(normalized <= 0.0);
+            assert(std::isfinite(normalized));
         }
+
+        // Update weights
+        prev_weights = group_weights_;
+        scatterGroupWeights(group_weights_);
     }
 
     bool OnlineEM::converged() const  {
         return std::abs(ll - prev_ll) <= threshold;
     }
 
-    LabelToRule OnlineEM::getRuleDict() {
-        LabelToRule dict;
-        for (auto rule : shrg_rules) {
-            dict[rule->label_hash].push_back(rule);
-        }
-
-        // Remove duplicates
-        for (auto& pair : dict) {
-            std::set<SHRG*> s(pair.second.begin(), pair.second.end());
-            pair.second = RuleVector(s.begin(), s.end());
-        }
-        return dict;
-    }
 };// namespace shrg::em
\ No newline at end of file
@@ -23,12 +23,12 @@ protected:
     LabelToRule rule_dict;
     size_t total_examples;
     size_t examples_seen;
-    std::unordered_map<SHRG*, double> prev_weights;
+    // previous weights, parallel to group_rules_
+    std::vector<double> prev_weights;
     const double smoothing_factor = 1e-10;
     void computeExpectedCount(ChartItem *root, double pw) override;
     void updateEM() override;
     void verifyNormalization();
-    LabelToRule getRuleDict();
 
 };
 }
@@ -18,7 +18,7 @@ using LabelCount = std::map<LabelHash, double>;
 const int VISITED = -2000;
 
 struct LessThanByLevel {
-    bool operator()(ChartItem *lhs, const ChartItem *rhs) const { return lhs->level > rhs->level; }
+    bool operator()(ChartItem *lhs, const ChartItem *rhs) const { return lhs->Annotations().level > rhs->Annotations().level; }
 };
 
 typedef std::priority_queue<ChartItem *, std::vector<ChartItem *>, LessThanByLevel> NodeLevelPQ;
@@ -222,8 +222,8 @@ void loadValidationFile(string filename,
 }
 
 double ComputeInsideCount(ChartItem *root) {
-    if (root->inside_visited_status == VISITED) {
-       return root->log_inside_count;
+    if (root->Annotations().inside_visited_status == VISITED) {
+       return root->Annotations().log_inside_count;
     }
 
     ChartItem *ptr = root;
@@ -234,7 +234,7 @@ double ComputeInsideCount(ChartItem *root) {
         curr_log_inside = sanitizeLogProb(curr_log_inside);
 
         double log_children = 0.0;
-        for (ChartItem *child:ptr->children) {
+        for (ChartItem *child:ptr->Annotations().children) {
             log_children += ComputeInsideCount(child);
         }
         log_children = sanitizeLogProb(log_children);
@@ -249,8 +249,8 @@ double ComputeInsideCount(ChartItem *root) {
     }while (ptr != root);
 
     do {
-        ptr->log_inside_count = log_inside;
-        ptr->inside_visited_status = VISITED;
+        ptr->Annotations().log_inside_count = log_inside;
+        ptr->Annotations().inside_visited_status = VISITED;
         ptr = ptr->next_ptr;
     }while (ptr != root);
 
@@ -267,22 +267,22 @@ void clear_flags_helper(ChartItem* root, std::unordered_set<ChartItem*> visited)
 
     ChartItem *ptr = root;
     do {
-        ptr->inside_visited_status = ChartItem::kEmpty;
-        ptr->outside_visited_status = ChartItem::kEmpty;
-        ptr->count_visited_status = ChartItem::kEmpty;
-        ptr->child_visited_status = ChartItem::kEmpty;
-        ptr->update_status = ChartItem::kEmpty;
-
-        ptr->em_greedy_deriv = ChartItem::kEmpty;
-        ptr->em_greedy_score = ChartItem::kEmpty;
-        ptr->em_inside_deriv = ChartItem::kEmpty;
-        ptr->em_inside_score = ChartItem::kEmpty;
-        ptr->count_greedy_deriv = ChartItem::kEmpty;
-        ptr->count_greedy_score = ChartItem:: kEmpty;
-        ptr->count_inside_deriv = ChartItem::kEmpty;
-        ptr->count_inside_score = ChartItem::kEmpty;
-
-        for (auto child:ptr->children) {
+        ptr->Annotations().inside_visited_status = ChartItem::kEmpty;
+        ptr->Annotations().outside_visited_status = ChartItem::kEmpty;
+        ptr->Annotations().count_visited_status = ChartItem::kEmpty;
+        ptr->Annotations().child_visited_status = ChartItem::kEmpty;
+        ptr->Annotations().update_status = ChartItem::kEmpty;
+
+        ptr->Annotations().em_greedy_deriv = ChartItem::kEmpty;
+        ptr->Annotations().em_greedy_score = ChartItem::kEmpty;
+        ptr->Annotations().em_inside_deriv = ChartItem::kEmpty;
+        ptr->Annotations().em_inside_score = ChartItem::kEmpty;
+        ptr->Annotations().count_greedy_deriv = ChartItem::kEmpty;
+        ptr->Annotations().count_greedy_score = ChartItem:: kEmpty;
+        ptr->Annotations().count_inside_deriv = ChartItem::kEmpty;
+        ptr->Annotations().count_inside_score = ChartItem::kEmpty;
+
+        for (auto child:ptr->Annotations().children) {
             clear_flags_helper(child, visited);
         }
         ptr = ptr->next_ptr;
@@ -301,16 +301,16 @@ void clear_derivflags_helper(ChartItem* root, std::unordered_set<ChartItem*> vis
 
     ChartItem *ptr = root;
     do {
-        ptr->em_greedy_deriv = ChartItem::kEmpty;
-        ptr->em_greedy_score = ChartItem::kEmpty;
-        ptr->em_inside_deriv = ChartItem::kEmpty;
-        ptr->em_inside_score = ChartItem::kEmpty;
-        ptr->count_greedy_deriv = ChartItem::kEmpty;
-        ptr->count_greedy_score = ChartItem:: kEmpty;
-        ptr->count_inside_deriv = ChartItem::kEmpty;
-        ptr->count_inside_score = ChartItem::kEmpty;
-
-        for (auto child:ptr->children) {
+        ptr->Annotations().em_greedy_deriv = ChartItem::kEmpty;
+        ptr->Annotations().em_greedy_score = ChartItem::kEmpty;
+        ptr->Annotations().em_inside_deriv = ChartItem::kEmpty;
+        ptr->Annotations().em_inside_score = ChartItem::kEmpty;
+        ptr->Annotations().count_greedy_deriv = ChartItem::kEmpty;
+        ptr->Annotations().count_greedy_score = ChartItem:: kEmpty;
+        ptr->Annotations().count_inside_deriv = ChartItem::kEmpty;
+        ptr->Annotations().count_inside_score = ChartItem::kEmpty;
+
+        for (auto child:ptr->Annotations().children) {
             clear_flags_helper(child, visited);
         }
         ptr = ptr->next_ptr;
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <vector>
 #include <future>
+#include <numeric>
 #include <signal.h>
 #include <setjmp.h>
 #include <unistd.h>
@@ -42,7 +43,8 @@ bool ViterbiEM::validateProbabilities() {
     }
     return true;
 }
-ChartItem* ViterbiEM::findBestChild(ChartItem* parent, const SHRG* grammar, int edge_index) {
+ChartItem* ViterbiEM::findBestChild(ChartItem* parent, const SHRG* grammar, int edge_index,
+                                    Generator* generator) {
     ChartItem* child = generator->FindChartItemByEdge(parent, grammar->nonterminal_edges[edge_index]);
     if (!child) return nullptr;
 
@@ -62,7 +64,7 @@ ChartItem* ViterbiEM::findBestChild(ChartItem* parent, const SHRG* grammar, int
     return best;
 }
 
-void ViterbiEM::buildBestParseRelationships(ChartItem* root, int level) {
+void ViterbiEM::buildBestParseRelationships(ChartItem* root, int level, Generator* generator) {
     if (!root) return;
 
     std::queue<std::pair<ChartItem*, int>> queue;
@@ -72,39 +74,39 @@ void ViterbiEM::buildBestParseRelationships(ChartItem* root, int level) {
         auto [current, current_level] = queue.front();
         queue.pop();
 
-        if (current_level > current->level) {
-            current->level = current_level;
+        if (current_level > current->Annotations().level) {
+            current->Annotations().level = current_level;
         }
 
-        if (current->child_visited_status != EMBase::VISITED) {
+        if (current->Annotations().child_visited_status != EMBase::VISITED) {
             const SHRG* grammar = current->attrs_ptr->grammar_ptr;
             size_t child_count = grammar->nonterminal_edges.size();
-            current->children.reserve(child_count);
+            current->Annotations().children.reserve(child_count);
 
             // Find best child for each edge
             for (size_t i = 0; i < child_count; ++i) {
-                ChartItem* best_child = findBestChild(current, grammar, i);
+                ChartItem* best_child = findBestChild(current, grammar, i, generator);
                 if (best_child) {
-                    current->children.push_back(best_child);
+                    current->Annotations().children.push_back(best_child);
                     queue.push({best_child, current_level + 1});
                 }
             }
 
             // Create sibling vectors for best parse only
-            for (size_t i = 0; i < current->children.size(); ++i) {
+            for (size_t i = 0; i < current->Annotations().children.size(); ++i) {
                 std::vector<ChartItem*> siblings;
-                for (size_t j = 0; j < current->children.size(); ++j) {
+                for (size_t j = 0; j < current->Annotations().children.size(); ++j) {
                     if (i != j) {
-                        siblings.push_back(current->children[j]);
+                        siblings.push_back(current->Annotations().children[j]);
                     }
                 }
-                current->children[i]->parents_sib.clear();  // Clear any existing relationships
-                current->children[i]->parents_sib.push_back({current, std::move(siblings)});
+                current->Annotations().children[i]->Annotations().parents_sib.clear();  // Clear any existing relationships
+                current->Annotations().children[i]->Annotations().parents_sib.push_back({current, std::move(siblings)});
             }
 
-            current->child_visited_status = EMBase::VISITED;
+            current->Annotations().child_visited_status = EMBase::VISITED;
         } else {
-            for (ChartItem* child : current->children) {
+            for (ChartItem* child : current->Annotations().children) {
                 queue.push({child, current_level + 1});
             }
         }
@@ -128,43 +130,35 @@ void ViterbiEM::run() {
 
     std::vector<double> lls;
 
+    std::vector<size_t> all_graphs(training_size);
+    std::iota(all_graphs.begin(), all_graphs.end(), 0);
+
     do {
         prev_ll = ll;
         ll = 0;
         t1 = clock();
+        beginPass();
 
-        // Original loop - commented out
-        for(int i = 0; i < training_size; i++) {
-            // std::cout << i << std::endl;
-            if(i % 200 == 0) {
+        // every graph is parsed and counted on one of the parse contexts
+        ll = expectParsedGraphs(all_graphs, [&](Context& worker_context, size_t i,
+                                                std::vector<ScaledProb>& counts) {
+            if(num_threads_ == 1 && i % 200 == 0) {
                 std::cout << "Processing graph " << i << "\n";
             }
 
-            EdsGraph graph = graphs[i];
-            auto code = context->Parse(graph);
-
-            if(code == ParserError::kNone) {
-                ChartItem* root = context->parser->Result();
-
-                // std::cout << "buildBestParse"<< std::endl;
-                buildBestParseRelationships(root, 0);  // Build relationships only for best parse
-                // std::cout << "adding rule pointer"<< std::endl;
-                addRulePointer(root);
-                // if (iteration == 1 && i == 3) {
-                    // std::cout << "stop here" << std::endl;
-                // }
-
-                // std::cout << "inside"<< std::endl;
-                double pw = computeViterbiInside(root);
-                // std::cout << "outside"<< std::endl;
-                computeViterbiOutside(root);
-                // std::cout << "count" << std::endl;
-                computeExpectedCount(root, pw);
-
-                ll += pw;
-                history_graph_ll[i].push_back(pw);
-            }
-        }
+            ChartItem* root = worker_context.parser->Result();
+
+            // Build relationships only for best parse
+            buildBestParseRelationships(root, 0, worker_context.parser->GetGenerator());
+            addRulePointer(root);
+
+            double pw = computeViterbiInside(root);
+            computeViterbiOutside(root);
+            computeExpectedCount(root, pw, counts);
+
+            history_graph_ll[i].push_back(pw);
+            return pw;
+        });
 
         // Fork-based timeout implementation
         // for(int i = 0; i < training_size; i++) {
@@ -274,7 +268,7 @@ void ViterbiEM::reorganizeBestParse(ChartItem* root) {
     }
 
     // Recursively process children
-    for (ChartItem* child : root->children) {
+    for (ChartItem* child : root->Annotations().children) {
         reorganizeBestParse(child);
     }
 }
@@ -298,12 +292,12 @@ void ViterbiEM::reorganizeBestParse(ChartItem* root) {
 //     return log_inside;
 // }
 double ViterbiEM::computeViterbiInside(ChartItem* root) {
-    if(root->inside_visited_status == ChartItem::kVisited) {
-        return root->log_inside_prob;
+    if(root->Annotations().inside_visited_status == pass_stamp_) {
+        return root->Annotations().log_inside_prob;
     }
 
     // Initialize with rule weight
-    double log_inside = root->rule_ptr->log_rule_weight;
+    double log_inside = root->Annotations().rule_ptr->log_rule_weight;
 
     // Safety check for valid log probability
     if (!std::isfinite(log_inside)) {
@@ -312,7 +306,7 @@ double ViterbiEM::computeViterbiInside(ChartItem* root) {
     }
 
     // Compute children recursively
-    for(ChartItem* child : root->children) {
+    for(ChartItem* child : root->Annotations().children) {
         double child_prob = computeViterbiInside(child);
         if (std::isfinite(child_prob)) {
             log_inside += child_prob;
@@ -326,137 +320,108 @@ double ViterbiEM::computeViterbiInside(ChartItem* root) {
         log_inside = ChartItem::log_zero;
     }
 
-    root->log_inside_prob = log_inside;
-    root->inside_visited_status = ChartItem::kVisited;
+    root->Annotations().log_inside_prob = log_inside;
+    root->Annotations().inside_visited_status = pass_stamp_;
 
     return log_inside;
 }
 
 void ViterbiEM::computeViterbiOutside(ChartItem* root) {
     NodeLevelPQ pq;
-    root->log_outside_prob = 0.0;
+    root->Annotations().log_outside_prob = 0.0;
     pq.push(root);
 
     while(!pq.empty()) {
         ChartItem* node = pq.top();
         pq.pop();
 
-        if(!node->parents_sib.empty()) {
+        if(!node->Annotations().parents_sib.empty()) {
             double log_outside = ChartItem::log_zero;
 
-            for(auto& parent_sib : node->parents_sib) {
+            for(auto& parent_sib : node->Annotations().parents_sib) {
                 ChartItem* parent = getParent(parent_sib);
 
                     std::vector<ChartItem*> siblings = getSiblings(parent_sib);
 
-                    log_outside = parent->rule_ptr->log_rule_weight;
-                    log_outside += parent->log_outside_prob;
+                    log_outside = parent->Annotations().rule_ptr->log_rule_weight;
+                    log_outside += parent->Annotations().log_outside_prob;
 
                     for(auto sib : siblings) {
                         ChartItem* sib_head = sib;
-                        log_outside += sib_head->log_inside_prob;
+                        log_outside += sib_head->Annotations().log_inside_prob;
                     }
             }
 
-            node->log_outside_prob = log_outside;
-            node->outside_visited_status = ChartItem::kVisited;
+            node->Annotations().log_outside_prob = log_outside;
+            node->Annotations().outside_visited_status = pass_stamp_;
         }
 
-        for(ChartItem* child : node->children) {
+        for(ChartItem* child : node->Annotations().children) {
             pq.push(child);
         }
     }
 }
 
 void ViterbiEM::computeExpectedCount(ChartItem* root, double pw) {
-    if(root->count_visited_status == ChartItem::kVisited) {
+    std::vector<ScaledProb> counts(numbered_rules_.size());
+    computeExpectedCount(root, pw, counts);
+    addRuleCounts(counts);
+}
+
+void ViterbiEM::computeExpectedCount(ChartItem* root, double pw, std::vector<ScaledProb>& counts) {
+    if(root->Annotations().count_visited_status == pass_stamp_) {
         return;
     }
 
-    double curr_log_count = root->rule_ptr->log_rule_weight;
-    curr_log_count += root->log_outside_prob;
+    double curr_log_count = root->Annotations().rule_ptr->log_rule_weight;
+    curr_log_count += root->Annotations().log_outside_prob;
     curr_log_count -= pw;
     if(!is_normal_count(curr_log_count)){
         std::cout << "count";
     }
 
-    for(ChartItem* child : root->children) {
-        curr_log_count += child->log_inside_prob;
+    for(ChartItem* child : root->Annotations().children) {
+        curr_log_count += child->Annotations().log_inside_prob;
         if(!is_normal_count(curr_log_count)){
             std::cout << "count";
         }
     }
 
-    root->log_sent_rule_count = curr_log_count;
-    root->rule_ptr->log_count = addLogs(root->rule_ptr->log_count, curr_log_count);
-    if(!is_normal_count(root->rule_ptr->log_count)){
-        std::cout << "count";
-    }
+    root->Annotations().log_sent_rule_count = curr_log_count;
+    counts[ruleNumberOf(root->Annotations().rule_ptr)] += ScaledProb::FromLog(curr_log_count);
 
-    root->count_visited_status = ChartItem::kVisited;
+    root->Annotations().count_visited_status = pass_stamp_;
 
     // Process children recursively
-    for(ChartItem* child : root->children) {
-        computeExpectedCount(child, pw);
+    for(ChartItem* child : root->Annotations().children) {
+        computeExpectedCount(child, pw, counts);
     }
 }
 
 void ViterbiEM::updateEM() {
     const double smoothing_factor = 1e-10;  // Small constant for smoothing
-    LabelCount total_count;
-    LabelToRule::iterator it;
-
-    // First pass: compute totals with smoothing
-    for(it = rule_dict.begin(); it != rule_dict.end(); it++) {
-        RuleVector v = it->second;
-        double log_total_count = ChartItem::log_zero;
-
-        // Add smoothing to all rules
-        for (auto rule : v) {
-            double smoothed_count = addLogs(rule->log_count, std::log(smoothing_factor));
-            log_total_count = addLogs(log_total_count, smoothed_count);
-        }
-        total_count[it->first] = log_total_count;
-    }
-
-    // Second pass: update rule weights with smoothing
-    for(int i = 0; i < shrg_rules.size(); i++) {
-        auto rule = shrg_rules[i];
-        LabelHash l = rule->label_hash;
+    const double log_smoothing = std::log(smoothing_factor);
 
-        // Add smoothing to count
-        double smoothed_count = addLogs(rule->log_count, std::log(smoothing_factor));
-        double new_phi = smoothed_count - total_count[l];
+    // Add smoothing to all counts and normalize them within their label
+    gatherGroupValues(&SHRG::log_count, group_weights_);
+    for (double &log_count : group_weights_) {
+        log_count = addLogs(log_count, log_smoothing);
+    }
+    normalizeGroups(group_weights_);
 
-        // Ensure we don't have invalid log probabilities
-        if (std::isfinite(new_phi)) {
-            rule->log_rule_weight = new_phi;
-        } else {
-            // If we get an invalid value, use a very small probability
-            rule->log_rule_weight = std::log(smoothing_factor);
+    for (double &new_phi : group_weights_) {
+        // If we get an invalid value, use a very small probability
+        if (!std::isfinite(new_phi)) {
+            new_phi = log_smoothing;
         }
-
         // Verify the new weight is valid
-        assert(std::isfinite(rule->log_rule_weight));
-        assert(rule->log_rule_weight <= 0.0);  // Log probabilities should be <= 0
+        assert(std::isfinite(new_phi));
+        assert(new_phi <= 0.0);  // Log probabilities should be <= 0
     }
+    scatterGroupWeights(group_weights_);
 }
 bool ViterbiEM::converged() const {
     return std::abs(ll - prev_ll) <= threshold;
 }
-LabelToRule ViterbiEM::getRuleDict(){
-    LabelToRule dict;
-    for(auto rule:shrg_rules){
-        dict[rule->label_hash].push_back(rule);
-    }
-
-    //remove duplicates
-    LabelToRule::iterator it;
-    for(it = dict.begin(); it != dict.end(); it++){
-        std::set<SHRG*>s(it->second.begin(), it->second.end());
-        dict[it->first] = RuleVector(s.begin(), s.end());
-    }
-    return dict;
-}
 
 } // namespace shrg::em
\ No newline at end of file
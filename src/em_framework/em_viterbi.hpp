@@ -20,12 +20,16 @@ protected:
     LabelToRule rule_dict;
     bool converged() const override;
     void computeExpectedCount(ChartItem *root, double pw) override;
+    // adds the expected counts to `counts` (indexed by rule number) instead of SHRG::log_count
+    void computeExpectedCount(ChartItem *root, double pw, std::vector<ScaledProb> &counts);
     // Reorganizes parse forest to put best parse first at each node
     void reorganizeBestParse(ChartItem* root);
 
-    // Build parent-child relationships for best parse path
-    void buildBestParseRelationships(ChartItem* root, int level);
-    ChartItem* findBestChild(ChartItem* parent, const SHRG* grammar, int edge_index);
+    // Build parent-child relationships for best parse path, `generator` is the one of the
+    // parser the forest comes from
+    void buildBestParseRelationships(ChartItem* root, int level, Generator* generator);
+    ChartItem* findBestChild(ChartItem* parent, const SHRG* grammar, int edge_index,
+                             Generator* generator);
 
     // Compute probabilities along best path only
     double computeViterbiInside(ChartItem* root);
@@ -35,7 +39,6 @@ protected:
     bool validateProbabilities();
 private:
 
-    LabelToRule getRuleDict();
 };
 
 } // namespace shrg::em
\ No newline at end of file
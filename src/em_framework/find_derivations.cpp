@@ -12,7 +12,7 @@ using namespace std;
 // Thread-local random generator for thread safety
 thread_local std::mt19937 g_rng(std::random_device{}());
 float FindBestScoreWeight(ChartItem *root_ptr) {
-    if (root_ptr->em_greedy_score == VISITED)
+    if (root_ptr->Annotations().em_greedy_score == VISITED)
         return root_ptr->score;
 
     ChartItem *ptr = root_ptr;
@@ -21,8 +21,8 @@ float FindBestScoreWeight(ChartItem *root_ptr) {
     ChartItem *max_subgraph_ptr = root_ptr;
 
     do {
-        double current_weight = ptr->rule_ptr->log_rule_weight;
-        for (auto child:ptr->children) {
+        double current_weight = ptr->Annotations().rule_ptr->log_rule_weight;
+        for (auto child:ptr->Annotations().children) {
             current_weight += FindBestScoreWeight(child);
         }
 
@@ -40,7 +40,7 @@ float FindBestScoreWeight(ChartItem *root_ptr) {
     }
 
 
-    root_ptr->em_greedy_score = VISITED;
+    root_ptr->Annotations().em_greedy_score = VISITED;
     root_ptr->score = max_weight;
     return root_ptr->score;
 }
@@ -49,8 +49,8 @@ float FindBestScoreWeight(ChartItem *root_ptr) {
 
 int addDerivationNode(Derivation &derivation, ChartItem *item, const SHRG::CFGRule *best_cfg) {
     DerivationNode node;
-    node.grammar_ptr = item->rule_ptr;
-    node.cfg_ptr = best_cfg ? best_cfg : (item->rule_ptr ? &item->rule_ptr->cfg_rules[0] : nullptr);
+    node.grammar_ptr = item->Annotations().rule_ptr;
+    node.cfg_ptr = best_cfg ? best_cfg : (item->Annotations().rule_ptr ? &item->Annotations().rule_ptr->cfg_rules[0] : nullptr);
     node.item_ptr = item;
 
     int node_index = derivation.size();
@@ -60,18 +60,18 @@ int addDerivationNode(Derivation &derivation, ChartItem *item, const SHRG::CFGRu
 
 Derivation FindBestDerivation_EMGreedy(ChartItem *root_ptr) {
     Derivation derivation;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED) return derivation;
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED) return derivation;
 
     // Find best root alternative using rule weights
     ChartItem *best_root = root_ptr;
-    double best_root_weight = root_ptr->rule_ptr ? root_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
+    double best_root_weight = root_ptr->Annotations().rule_ptr ? root_ptr->Annotations().rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
 
     // Mark all alternatives as visited
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr && curr_root->rule_ptr->log_rule_weight > best_root_weight) {
-            best_root_weight = curr_root->rule_ptr->log_rule_weight;
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr && curr_root->Annotations().rule_ptr->log_rule_weight > best_root_weight) {
+            best_root_weight = curr_root->Annotations().rule_ptr->log_rule_weight;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
@@ -79,14 +79,14 @@ Derivation FindBestDerivation_EMGreedy(ChartItem *root_ptr) {
 
     int root_index = addDerivationNode(derivation, best_root, nullptr);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
-        double best_weight = child_ptr->rule_ptr ? child_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
+        double best_weight = child_ptr->Annotations().rule_ptr ? child_ptr->Annotations().rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
 
         ChartItem *curr_ptr = child_ptr->next_ptr;
         while(curr_ptr != child_ptr) {
-            if(curr_ptr->rule_ptr && curr_ptr->rule_ptr->log_rule_weight > best_weight) {
-                best_weight = curr_ptr->rule_ptr->log_rule_weight;
+            if(curr_ptr->Annotations().rule_ptr && curr_ptr->Annotations().rule_ptr->log_rule_weight > best_weight) {
+                best_weight = curr_ptr->Annotations().rule_ptr->log_rule_weight;
                 best_child = curr_ptr;
             }
             curr_ptr = curr_ptr->next_ptr;
@@ -124,16 +124,16 @@ T sampleWeighted(const std::vector<std::pair<T, double>>& alternatives) {
 
 Derivation FindBestDerivation_sample(ChartItem *root_ptr) {
     Derivation derivation;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED)
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED)
         return derivation;
 
     // Collect all root alternatives and their weights
     std::vector<std::pair<ChartItem*, double>> root_alternatives;
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr) {
-            root_alternatives.push_back(std::make_pair(curr_root, curr_root->rule_ptr->log_rule_weight));
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr) {
+            root_alternatives.push_back(std::make_pair(curr_root, curr_root->Annotations().rule_ptr->log_rule_weight));
         }
         curr_root = curr_root->next_ptr;
     } while (curr_root != root_ptr);
@@ -142,13 +142,13 @@ Derivation FindBestDerivation_sample(ChartItem *root_ptr) {
     ChartItem *sampled_root = sampleWeighted(root_alternatives);
 
     int root_index = addDerivationNode(derivation, sampled_root, nullptr);
-    for (auto child_ptr : sampled_root->children) {
+    for (auto child_ptr : sampled_root->Annotations().children) {
         // Collect all child alternatives and their weights
         std::vector<std::pair<ChartItem*, double>> child_alternatives;
         ChartItem *curr_ptr = child_ptr;
         do {
-            if (curr_ptr->rule_ptr) {
-                child_alternatives.push_back(std::make_pair(curr_ptr, curr_ptr->rule_ptr->log_rule_weight));
+            if (curr_ptr->Annotations().rule_ptr) {
+                child_alternatives.push_back(std::make_pair(curr_ptr, curr_ptr->Annotations().rule_ptr->log_rule_weight));
             }
             curr_ptr = curr_ptr->next_ptr;
         } while (curr_ptr != child_ptr);
@@ -170,18 +170,18 @@ Derivation FindBestDerivation_sample(ChartItem *root_ptr) {
 
 Derivation FindBestDerivation_EMInside(ChartItem *root_ptr) {
     Derivation derivation;
-    if (!root_ptr || root_ptr->em_inside_deriv == VISITED) return derivation;
+    if (!root_ptr || root_ptr->Annotations().em_inside_deriv == VISITED) return derivation;
 
     // Find best root alternative using inside scores
     ChartItem *best_root = root_ptr;
-    double best_root_score = root_ptr->log_inside_prob;
+    double best_root_score = root_ptr->Annotations().log_inside_prob;
 
     // Mark all alternatives as visited
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_inside_deriv = VISITED;
-        if(curr_root->log_inside_prob > best_root_score) {
-            best_root_score = curr_root->log_inside_prob;
+        curr_root->Annotations().em_inside_deriv = VISITED;
+        if(curr_root->Annotations().log_inside_prob > best_root_score) {
+            best_root_score = curr_root->Annotations().log_inside_prob;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
@@ -189,14 +189,14 @@ Derivation FindBestDerivation_EMInside(ChartItem *root_ptr) {
 
     int root_index = addDerivationNode(derivation, best_root, nullptr);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
-        double best_score = child_ptr->log_inside_prob;
+        double best_score = child_ptr->Annotations().log_inside_prob;
 
         ChartItem *curr_ptr = child_ptr->next_ptr;
         while(curr_ptr != child_ptr) {
-            if(curr_ptr->log_inside_prob > best_score) {
-                best_score = curr_ptr->log_inside_prob;
+            if(curr_ptr->Annotations().log_inside_prob > best_score) {
+                best_score = curr_ptr->Annotations().log_inside_prob;
                 best_child = curr_ptr;
             }
             curr_ptr = curr_ptr->next_ptr;
@@ -222,15 +222,15 @@ T* uniformRandomSample(const std::vector<T*>& items) {
 
 DerivationInfo ExtractDerivation_uniform(ChartItem *root_ptr) {
     DerivationInfo result;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED)
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED)
         return result;
 
     // Collect all root alternatives
     std::vector<ChartItem*> root_alternatives;
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr) {
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr) {
             root_alternatives.push_back(curr_root);
         }
         curr_root = curr_root->next_ptr;
@@ -240,10 +240,10 @@ DerivationInfo ExtractDerivation_uniform(ChartItem *root_ptr) {
     ChartItem *sampled_root = uniformRandomSample(root_alternatives);
     if (!sampled_root) return result;
 
-    result.rule_indices.push_back(sampled_root->shrg_index);
+    result.rule_indices.push_back(sampled_root->Annotations().shrg_index);
     result.edge_sets.push_back(sampled_root->edge_set);
 
-    for (auto child_ptr : sampled_root->children) {
+    for (auto child_ptr : sampled_root->Annotations().children) {
         // // Collect all child alternatives
         // std::vector<ChartItem*> child_alternatives;
         // ChartItem *curr_ptr = child_ptr;
@@ -278,7 +278,7 @@ DerivationInfo ExtractDerivation_uniform(ChartItem *root_ptr) {
 
 Derivation FindBestDerivation_CountGreedy(ChartItem *root_ptr) {
     Derivation derivation;
-    if (!root_ptr || root_ptr->count_greedy_deriv == VISITED) return derivation;
+    if (!root_ptr || root_ptr->Annotations().count_greedy_deriv == VISITED) return derivation;
 
     // Find best root alternative using counts
     ChartItem *best_root = root_ptr;
@@ -287,7 +287,7 @@ Derivation FindBestDerivation_CountGreedy(ChartItem *root_ptr) {
     // Mark all alternatives as visited
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->count_greedy_deriv = VISITED;
+        curr_root->Annotations().count_greedy_deriv = VISITED;
         if(curr_root->score > best_root_score) {
             best_root_score = curr_root->score;
             best_root = curr_root;
@@ -297,7 +297,7 @@ Derivation FindBestDerivation_CountGreedy(ChartItem *root_ptr) {
 
     int root_index = addDerivationNode(derivation, best_root, nullptr);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
         double best_score = child_ptr->score;
 
@@ -321,18 +321,18 @@ Derivation FindBestDerivation_CountGreedy(ChartItem *root_ptr) {
 
 Derivation FindBestDerivation_CountInside(ChartItem *root_ptr) {
     Derivation derivation;
-    if (!root_ptr || root_ptr->count_inside_deriv == VISITED) return derivation;
+    if (!root_ptr || root_ptr->Annotations().count_inside_deriv == VISITED) return derivation;
 
     // Find best root alternative using inside counts
     ChartItem *best_root = root_ptr;
-    double best_root_score = root_ptr->log_inside_count;
+    double best_root_score = root_ptr->Annotations().log_inside_count;
 
     // Mark all alternatives as visited
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->count_inside_deriv = VISITED;
-        if(curr_root->log_inside_count > best_root_score) {
-            best_root_score = curr_root->log_inside_count;
+        curr_root->Annotations().count_inside_deriv = VISITED;
+        if(curr_root->Annotations().log_inside_count > best_root_score) {
+            best_root_score = curr_root->Annotations().log_inside_count;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
@@ -340,14 +340,14 @@ Derivation FindBestDerivation_CountInside(ChartItem *root_ptr) {
 
     int root_index = addDerivationNode(derivation, best_root, nullptr);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
-        double best_score = child_ptr->log_inside_count;
+        double best_score = child_ptr->Annotations().log_inside_count;
 
         ChartItem *curr_ptr = child_ptr->next_ptr;
         while(curr_ptr != child_ptr) {
-            if(curr_ptr->log_inside_count > best_score) {
-                best_score = curr_ptr->log_inside_count;
+            if(curr_ptr->Annotations().log_inside_count > best_score) {
+                best_score = curr_ptr->Annotations().log_inside_count;
                 best_child = curr_ptr;
             }
             curr_ptr = curr_ptr->next_ptr;
@@ -364,31 +364,31 @@ Derivation FindBestDerivation_CountInside(ChartItem *root_ptr) {
 
 std::vector<int> ExtractRuleIndices_EMGreedy(ChartItem *root_ptr) {
     std::vector<int> indices;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED) return indices;
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED) return indices;
 
     ChartItem *best_root = root_ptr;
-    double best_root_weight = root_ptr->rule_ptr ? root_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
+    double best_root_weight = root_ptr->Annotations().rule_ptr ? root_ptr->Annotations().rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr && curr_root->rule_ptr->log_rule_weight > best_root_weight) {
-            best_root_weight = curr_root->rule_ptr->log_rule_weight;
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr && curr_root->Annotations().rule_ptr->log_rule_weight > best_root_weight) {
+            best_root_weight = curr_root->Annotations().rule_ptr->log_rule_weight;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
-    indices.push_back(best_root->shrg_index);
+    indices.push_back(best_root->Annotations().shrg_index);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
-        double best_weight = child_ptr->rule_ptr ? child_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
+        double best_weight = child_ptr->Annotations().rule_ptr ? child_ptr->Annotations().rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
 
         ChartItem *curr_ptr = child_ptr->next_ptr;
         while(curr_ptr != child_ptr) {
-            if(curr_ptr->rule_ptr && curr_ptr->rule_ptr->log_rule_weight > best_weight) {
-                best_weight = curr_ptr->rule_ptr->log_rule_weight;
+            if(curr_ptr->Annotations().rule_ptr && curr_ptr->Annotations().rule_ptr->log_rule_weight > best_weight) {
+                best_weight = curr_ptr->Annotations().rule_ptr->log_rule_weight;
                 best_child = curr_ptr;
             }
             curr_ptr = curr_ptr->next_ptr;
@@ -402,8 +402,8 @@ std::vector<int> ExtractRuleIndices_EMGreedy(ChartItem *root_ptr) {
 
 
 double computeInside_score(ChartItem *root){
-    if(root->inside_visited_status == VISITED){
-        return root->log_inside_prob;
+    if(root->Annotations().inside_visited_status == VISITED){
+        return root->Annotations().log_inside_prob;
     }
 
     ChartItem *ptr = root;
@@ -415,7 +415,7 @@ double computeInside_score(ChartItem *root){
         curr_log_inside = sanitizeLogProb(curr_log_inside);
 
         double log_children = 0.0;
-        for(ChartItem *child:ptr->children){
+        for(ChartItem *child:ptr->Annotations().children){
             log_children += computeInside_score(child);
         }
         log_children = sanitizeLogProb(log_children);
@@ -438,8 +438,8 @@ double computeInside_score(ChartItem *root){
 
     do{
         is_negative(log_inside);
-        ptr->log_inside_prob = log_inside;
-        ptr->inside_visited_status = VISITED;
+        ptr->Annotations().log_inside_prob = log_inside;
+        ptr->Annotations().inside_visited_status = VISITED;
         ptr = ptr->next_ptr;
     }while(ptr != root);
 
@@ -448,15 +448,15 @@ double computeInside_score(ChartItem *root){
 
 std::vector<int> ExtractRuleIndices_sampled(ChartItem *root_ptr) {
     std::vector<int> indices;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED)
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED)
         return indices;
 
     // Collect all root alternatives and their weights
     std::vector<std::pair<ChartItem*, double>> root_alternatives;
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr) {
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr) {
             root_alternatives.push_back(std::make_pair(curr_root, 0));
         }
         curr_root = curr_root->next_ptr;
@@ -464,15 +464,15 @@ std::vector<int> ExtractRuleIndices_sampled(ChartItem *root_ptr) {
 
     // Sample a root alternative based on weights
     ChartItem *sampled_root = sampleWeighted(root_alternatives);
-    indices.push_back(sampled_root->shrg_index);
+    indices.push_back(sampled_root->Annotations().shrg_index);
 
-    for (auto child_ptr : sampled_root->children) {
+    for (auto child_ptr : sampled_root->Annotations().children) {
         // Collect all child alternatives and their weights
         std::vector<std::pair<ChartItem*, double>> child_alternatives;
         ChartItem *curr_ptr = child_ptr;
         do {
-            if (curr_ptr->rule_ptr) {
-                child_alternatives.push_back(std::make_pair(curr_ptr, curr_ptr->rule_ptr->log_rule_weight));
+            if (curr_ptr->Annotations().rule_ptr) {
+                child_alternatives.push_back(std::make_pair(curr_ptr, curr_ptr->Annotations().rule_ptr->log_rule_weight));
             }
             curr_ptr = curr_ptr->next_ptr;
         } while (curr_ptr != child_ptr);
@@ -489,32 +489,32 @@ std::vector<int> ExtractRuleIndices_sampled(ChartItem *root_ptr) {
 
 DerivationInfo ExtractDerivation_sampled(ChartItem *root_ptr) {
     DerivationInfo result;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED)
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED)
         return result;
 
     // Collect all root alternatives and their weights
     std::vector<std::pair<ChartItem*, double>> root_alternatives;
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr) {
-            root_alternatives.push_back(std::make_pair(curr_root, curr_root->rule_ptr->log_rule_weight));
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr) {
+            root_alternatives.push_back(std::make_pair(curr_root, curr_root->Annotations().rule_ptr->log_rule_weight));
         }
         curr_root = curr_root->next_ptr;
     } while (curr_root != root_ptr);
 
     // Sample a root alternative based on weights
     ChartItem *sampled_root = sampleWeighted(root_alternatives);
-    result.rule_indices.push_back(sampled_root->shrg_index);
+    result.rule_indices.push_back(sampled_root->Annotations().shrg_index);
     result.edge_sets.push_back(sampled_root->edge_set);
 
-    for (auto child_ptr : sampled_root->children) {
+    for (auto child_ptr : sampled_root->Annotations().children) {
         // Collect all child alternatives and their weights
         std::vector<std::pair<ChartItem*, double>> child_alternatives;
         ChartItem *curr_ptr = child_ptr;
         do {
-            if (curr_ptr->rule_ptr) {
-                child_alternatives.push_back(std::make_pair(curr_ptr, curr_ptr->rule_ptr->log_rule_weight));
+            if (curr_ptr->Annotations().rule_ptr) {
+                child_alternatives.push_back(std::make_pair(curr_ptr, curr_ptr->Annotations().rule_ptr->log_rule_weight));
             }
             curr_ptr = curr_ptr->next_ptr;
         } while (curr_ptr != child_ptr);
@@ -543,31 +543,31 @@ DerivationInfo ExtractDerivation_sampled(ChartItem *root_ptr) {
 
 std::vector<int> ExtractRuleIndices_EMInside(ChartItem *root_ptr) {
     std::vector<int> indices;
-    if (!root_ptr || root_ptr->em_inside_deriv == VISITED) return indices;
+    if (!root_ptr || root_ptr->Annotations().em_inside_deriv == VISITED) return indices;
 
     ChartItem *best_root = root_ptr;
-    double best_root_score = root_ptr->log_inside_prob;
+    double best_root_score = root_ptr->Annotations().log_inside_prob;
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_inside_deriv = VISITED;
-        if(curr_root->log_inside_prob > best_root_score) {
-            best_root_score = curr_root->log_inside_prob;
+        curr_root->Annotations().em_inside_deriv = VISITED;
+        if(curr_root->Annotations().log_inside_prob > best_root_score) {
+            best_root_score = curr_root->Annotations().log_inside_prob;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
-    indices.push_back(best_root->shrg_index);
+    indices.push_back(best_root->Annotations().shrg_index);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
-        double best_score = child_ptr->log_inside_prob;
+        double best_score = child_ptr->Annotations().log_inside_prob;
 
         ChartItem *curr_ptr = child_ptr->next_ptr;
         while(curr_ptr != child_ptr) {
-            if(curr_ptr->log_inside_prob > best_score) {
-                best_score = curr_ptr->log_inside_prob;
+            if(curr_ptr->Annotations().log_inside_prob > best_score) {
+                best_score = curr_ptr->Annotations().log_inside_prob;
                 best_child = curr_ptr;
             }
             curr_ptr = curr_ptr->next_ptr;
@@ -581,14 +581,14 @@ std::vector<int> ExtractRuleIndices_EMInside(ChartItem *root_ptr) {
 
 std::vector<int> ExtractRuleIndices_CountGreedy(ChartItem *root_ptr) {
     std::vector<int> indices;
-    if (!root_ptr || root_ptr->count_greedy_deriv == VISITED) return indices;
+    if (!root_ptr || root_ptr->Annotations().count_greedy_deriv == VISITED) return indices;
 
     ChartItem *best_root = root_ptr;
     double best_root_score = root_ptr->score;
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->count_greedy_deriv = VISITED;
+        curr_root->Annotations().count_greedy_deriv = VISITED;
         if(curr_root->score > best_root_score) {
             best_root_score = curr_root->score;
             best_root = curr_root;
@@ -596,9 +596,9 @@ std::vector<int> ExtractRuleIndices_CountGreedy(ChartItem *root_ptr) {
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
-    indices.push_back(best_root->shrg_index);
+    indices.push_back(best_root->Annotations().shrg_index);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
         double best_score = child_ptr->score;
 
@@ -619,31 +619,31 @@ std::vector<int> ExtractRuleIndices_CountGreedy(ChartItem *root_ptr) {
 
 std::vector<int> ExtractRuleIndices_CountInside(ChartItem *root_ptr) {
     std::vector<int> indices;
-    if (!root_ptr || root_ptr->count_inside_deriv == VISITED) return indices;
+    if (!root_ptr || root_ptr->Annotations().count_inside_deriv == VISITED) return indices;
 
     ChartItem *best_root = root_ptr;
-    double best_root_score = root_ptr->log_inside_count;
+    double best_root_score = root_ptr->Annotations().log_inside_count;
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->count_inside_deriv = VISITED;
-        if(curr_root->log_inside_count > best_root_score) {
-            best_root_score = curr_root->log_inside_count;
+        curr_root->Annotations().count_inside_deriv = VISITED;
+        if(curr_root->Annotations().log_inside_count > best_root_score) {
+            best_root_score = curr_root->Annotations().log_inside_count;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
-    indices.push_back(best_root->shrg_index);
+    indices.push_back(best_root->Annotations().shrg_index);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         ChartItem *best_child = child_ptr;
-        double best_score = child_ptr->log_inside_count;
+        double best_score = child_ptr->Annotations().log_inside_count;
 
         ChartItem *curr_ptr = child_ptr->next_ptr;
         while(curr_ptr != child_ptr) {
-            if(curr_ptr->log_inside_count > best_score) {
-                best_score = curr_ptr->log_inside_count;
+            if(curr_ptr->Annotations().log_inside_count > best_score) {
+                best_score = curr_ptr->Annotations().log_inside_count;
                 best_child = curr_ptr;
             }
             curr_ptr = curr_ptr->next_ptr;
@@ -658,26 +658,26 @@ std::vector<int> ExtractRuleIndices_CountInside(ChartItem *root_ptr) {
 
 DerivationInfo ExtractRuleIndicesAndEdges_EMGreedy(ChartItem *root_ptr) {
     DerivationInfo result;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED) return result;
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED) return result;
 
     ChartItem *best_root = root_ptr;
-    double best_root_weight = root_ptr->rule_ptr ? root_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
+    double best_root_weight = root_ptr->Annotations().rule_ptr ? root_ptr->Annotations().rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
-        if (curr_root->rule_ptr && curr_root->rule_ptr->log_rule_weight > best_root_weight) {
-            best_root_weight = curr_root->rule_ptr->log_rule_weight;
+        curr_root->Annotations().em_greedy_deriv = VISITED;
+        if (curr_root->Annotations().rule_ptr && curr_root->Annotations().rule_ptr->log_rule_weight > best_root_weight) {
+            best_root_weight = curr_root->Annotations().rule_ptr->log_rule_weight;
             best_root = curr_root;
         }
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
     // Add both the rule index and edge set from the best root
-    result.rule_indices.push_back(best_root->shrg_index);
+    result.rule_indices.push_back(best_root->Annotations().shrg_index);
     result.edge_sets.push_back(best_root->edge_set);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         // ChartItem *best_child = child_ptr;
         // double best_weight = child_ptr->rule_ptr ? child_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
         //
@@ -708,27 +708,27 @@ DerivationInfo ExtractRuleIndicesAndEdges_EMGreedy(ChartItem *root_ptr) {
     return result;
 }
 double get_rule_inside_em(ChartItem *root) {
-    if (!root || !root->rule_ptr) {
+    if (!root || !root->Annotations().rule_ptr) {
         return -std::numeric_limits<double>::infinity();
     }
-    double s = root->rule_ptr->log_rule_weight;
-    for (auto child:root->children) {
-        s += child->log_inside_prob;
+    double s = root->Annotations().rule_ptr->log_rule_weight;
+    for (auto child:root->Annotations().children) {
+        s += child->Annotations().log_inside_prob;
     }
     return s;
 }
 DerivationInfo ExtractRuleIndicesAndEdges_EMInside(ChartItem *root_ptr) {
     DerivationInfo result;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED) return result;
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED) return result;
 
     ChartItem *best_root = root_ptr;
     double best_root_weight = get_rule_inside_em(root_ptr);
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->em_greedy_deriv = VISITED;
+        curr_root->Annotations().em_greedy_deriv = VISITED;
         double curr_weight = get_rule_inside_em(curr_root);
-        if (curr_root->rule_ptr && curr_weight > best_root_weight) {
+        if (curr_root->Annotations().rule_ptr && curr_weight > best_root_weight) {
             best_root_weight = curr_weight;
             best_root = curr_root;
         }
@@ -736,10 +736,10 @@ DerivationInfo ExtractRuleIndicesAndEdges_EMInside(ChartItem *root_ptr) {
     } while(curr_root != root_ptr);
 
     // Add both the rule index and edge set from the best root
-    result.rule_indices.push_back(best_root->shrg_index);
+    result.rule_indices.push_back(best_root->Annotations().shrg_index);
     result.edge_sets.push_back(best_root->edge_set);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
         // ChartItem *best_child = child_ptr;
         // double best_weight = child_ptr->rule_ptr ? child_ptr->rule_ptr->log_rule_weight : -std::numeric_limits<double>::infinity();
         //
@@ -775,10 +775,10 @@ ChartItem* FindNodeWithIndex(ChartItem* start_ptr, int target_index) {
 
     ChartItem* curr_ptr = start_ptr;
     do {
-        if (curr_ptr->shrg_index == target_index) {
+        if (curr_ptr->Annotations().shrg_index == target_index) {
             return curr_ptr;
         }
-        for(auto rule :curr_ptr->rule_ptr->cfg_rules){
+        for(auto rule :curr_ptr->Annotations().rule_ptr->cfg_rules){
             if(rule.shrg_index == target_index){
                 return curr_ptr;
             }
@@ -974,7 +974,7 @@ std::optional<DerivationInfo> TryExtractGoldDerivation(
         auto new_remaining = RemoveIndex(remaining_indices, current_index);
 
         // If this is a leaf node, return just this node's info
-        if (current_node->children.empty()) {
+        if (current_node->Annotations().children.empty()) {
             DerivationInfo result;
             result.rule_indices.push_back(current_index);
             result.edge_sets.push_back(current_node->edge_set);
@@ -990,7 +990,7 @@ std::optional<DerivationInfo> TryExtractGoldDerivation(
         bool all_children_valid = true;
 
         // Process each child iteratively
-        for (auto child_ptr : current_node->children) {
+        for (auto child_ptr : current_node->Annotations().children) {
             auto child_result = TryExtractGoldDerivation(child_ptr, remaining_for_children);
             if (!child_result) {
                 all_children_valid = false;
@@ -1032,7 +1032,7 @@ std::optional<DerivationInfo> ExtractGoldDerivation(
     // Try each alternative at this position (next_ptr chain)
     ChartItem* ptr = node;
     do {
-        int rule_idx = ptr->shrg_index;
+        int rule_idx = ptr->Annotations().shrg_index;
 
         // Is this rule in our gold set?
         auto it = gold_indices.find(rule_idx);
@@ -1049,7 +1049,7 @@ std::optional<DerivationInfo> ExtractGoldDerivation(
 
             // Match all children
             bool valid = true;
-            for (auto* child : ptr->children) {
+            for (auto* child : ptr->Annotations().children) {
                 auto child_result = ExtractGoldDerivation(child, gold_indices);
                 if (!child_result) {
                     valid = false;
@@ -1167,22 +1167,22 @@ std::optional<DerivationInfo> ExtractGoldDerivationTree(
 
 double get_rule_inside(ChartItem *root) {
     double s = root->score;
-    for (auto child:root->children) {
-        s += child->log_inside_prob;
+    for (auto child:root->Annotations().children) {
+        s += child->Annotations().log_inside_prob;
     }
     return s;
 }
 
 DerivationInfo ExtractRuleIndicesAndEdges_CountGreedy(ChartItem *root_ptr) {
     DerivationInfo result;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED) return result;
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED) return result;
 
     ChartItem *best_root = root_ptr;
     double best_root_score = get_rule_inside(root_ptr);
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->count_greedy_deriv = VISITED;
+        curr_root->Annotations().count_greedy_deriv = VISITED;
         double curr_inside = get_rule_inside(curr_root);
         if(curr_inside > best_root_score) {
             best_root_score = curr_inside;
@@ -1191,10 +1191,10 @@ DerivationInfo ExtractRuleIndicesAndEdges_CountGreedy(ChartItem *root_ptr) {
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
-    result.rule_indices.push_back(best_root->shrg_index);
+    result.rule_indices.push_back(best_root->Annotations().shrg_index);
     result.edge_sets.push_back(best_root->edge_set);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
 
         auto child_info = ExtractRuleIndicesAndEdges_EMGreedy(child_ptr);
 
@@ -1214,14 +1214,14 @@ DerivationInfo ExtractRuleIndicesAndEdges_CountGreedy(ChartItem *root_ptr) {
 
 DerivationInfo ExtractRuleIndicesAndEdges_ScoreGreedy(ChartItem *root_ptr) {
     DerivationInfo result;
-    if (!root_ptr || root_ptr->em_greedy_deriv == VISITED) return result;
+    if (!root_ptr || root_ptr->Annotations().em_greedy_deriv == VISITED) return result;
 
     ChartItem *best_root = root_ptr;
     double best_root_score = root_ptr->score;
 
     ChartItem *curr_root = root_ptr;
     do {
-        curr_root->count_greedy_deriv = VISITED;
+        curr_root->Annotations().count_greedy_deriv = VISITED;
         double curr_inside = curr_root->score;
         if(curr_inside > best_root_score) {
             best_root_score = curr_inside;
@@ -1230,10 +1230,10 @@ DerivationInfo ExtractRuleIndicesAndEdges_ScoreGreedy(ChartItem *root_ptr) {
         curr_root = curr_root->next_ptr;
     } while(curr_root != root_ptr);
 
-    result.rule_indices.push_back(best_root->shrg_index);
+    result.rule_indices.push_back(best_root->Annotations().shrg_index);
     result.edge_sets.push_back(best_root->edge_set);
 
-    for(auto child_ptr : best_root->children) {
+    for(auto child_ptr : best_root->Annotations().children) {
 
         auto child_info = ExtractRuleIndicesAndEdges_ScoreGreedy(child_ptr);
 
@@ -1257,10 +1257,10 @@ bool IndexExistsInSubtree(ChartItem* root_ptr, int target_index) {
     // Check in current linked list
     ChartItem* curr_ptr = root_ptr;
     do {
-        if (curr_ptr->shrg_index == target_index) {
+        if (curr_ptr->Annotations().shrg_index == target_index) {
             return true;
         }
-        for(auto rule :curr_ptr->rule_ptr->cfg_rules){
+        for(auto rule :curr_ptr->Annotations().rule_ptr->cfg_rules){
             if(rule.shrg_index == target_index){
                 return true;
             }
@@ -1269,7 +1269,7 @@ bool IndexExistsInSubtree(ChartItem* root_ptr, int target_index) {
     } while (curr_ptr != root_ptr);
 
     // Check in all children recursively
-    for (auto child_ptr : root_ptr->children) {
+    for (auto child_ptr : root_ptr->Annotations().children) {
         if (IndexExistsInSubtree(child_ptr, target_index)) {
             return true;
         }
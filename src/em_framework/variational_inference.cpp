@@ -1,6 +1,7 @@
 #include "variational_inference.hpp"
 #include <cmath>
 #include <iostream>
+#include <numeric>
 #include <queue>
 
 namespace shrg::vi {
@@ -65,22 +66,22 @@ VariationalInference::VariationalInference(RuleVector &shrg_rules,
 }
 
 void VariationalInference::traverseForELBO(ChartItem* root, double& expected_ll) {
-    if (!root || root->count_visited_status != VISITED) {
+    if (!root || root->Annotations().count_visited_status != pass_stamp_) {
         return;
     }
 
     ChartItem* ptr = root;
     do {
         // Add contribution of this rule using log-space arithmetic
-        if (ptr->log_sent_rule_count != ChartItem::log_zero) {
+        if (ptr->Annotations().log_sent_rule_count != ChartItem::log_zero) {
             // Note: Both log_sent_rule_count and expected_log_prob are already negative
-            double log_contribution = ptr->log_sent_rule_count +
-                                    computeExpectedLogProb(ptr->rule_ptr);
+            double log_contribution = ptr->Annotations().log_sent_rule_count +
+                                    expected_log_probs_[ruleNumberOf(ptr->Annotations().rule_ptr)];
             expected_ll = addLogs(expected_ll, log_contribution);
         }
 
         // Recursively process children
-        for (ChartItem* child : ptr->children) {
+        for (ChartItem* child : ptr->Annotations().children) {
             traverseForELBO(child, expected_ll);
         }
 
@@ -101,38 +102,42 @@ void VariationalInference::run() {
     std::cout << "Running Variational Inference...\n";
     int iteration = 0;
     elbo_ = -std::numeric_limits<double>::infinity();  // Initialize to negative infinity
-
+    std::vector<size_t> all_graphs(graphs.size());
+    std::iota(all_graphs.begin(), all_graphs.end(), 0);
 
     do {
         prev_elbo_ = elbo_;
-        elbo_ = 0.0;
         clearRuleCount();
+        beginPass();
+
+        // the expected log probabilities of the rules are fixed during the E-step
+        expected_log_probs_.resize(numbered_rules_.size());
+        for (size_t r = 0; r < numbered_rules_.size(); r++) {
+            expected_log_probs_[r] = computeExpectedLogProb(numbered_rules_[r]);
+        }
 
-        // E-step: Update variational distribution over latent variables (parses)
-        for (size_t i = 0; i < graphs.size(); i++) {
-            if (i % 200 == 0) {
+        // E-step: Update variational distribution over latent variables (parses), every graph
+        // is parsed on one of the parse contexts
+        elbo_ = expectParsedGraphs(all_graphs, [&](Context& worker_context, size_t i,
+                                                   std::vector<ScaledProb>& counts) {
+            if (num_threads_ == 1 && i % 200 == 0) {
                 std::cout << "Processing graph " << i << "\n";
             }
 
-            EdsGraph& graph = graphs[i];
-            auto code = context->Parse(graph);
+            ChartItem* root = worker_context.parser->Result();
+            addParentPointerOptimized(root, 0, worker_context.parser->GetGenerator());
+            addRulePointer(root);
 
-            if (code == ParserError::kNone) {
-                ChartItem* root = context->parser->Result();
-                addParentPointerOptimized(root, 0);
-                addRulePointer(root);
+            // Compute expected counts and likelihood under current variational distribution
+            double pw = computeVariationalInside(root);
+            computeVariationalOutside(root);
+            computeExpectedCount(root, pw, counts);
 
-                // Compute expected counts and likelihood under current variational distribution
-                double pw = computeVariationalInside(root);
-                computeVariationalOutside(root);
-                computeExpectedCount(root, pw);
-
-                // Add expected log likelihood to ELBO
-                double expected_ll = 0.0;
-                traverseForELBO(root, expected_ll);
-                elbo_ += expected_ll;
-            }
-        }
+            // Add expected log likelihood to ELBO
+            double expected_ll = 0.0;
+            traverseForELBO(root, expected_ll);
+            return expected_ll;
+        });
 
         // M-step: Update variational parameters
         updateEM();
@@ -152,8 +157,8 @@ void VariationalInference::run() {
 }
 
 double VariationalInference::computeVariationalInside(ChartItem* root) {
-    if (root->inside_visited_status == VISITED) {
-        return root->log_inside_prob;
+    if (root->Annotations().inside_visited_status == pass_stamp_) {
+        return root->Annotations().log_inside_prob;
     }
 
     ChartItem* ptr = root;
@@ -161,10 +166,10 @@ double VariationalInference::computeVariationalInside(ChartItem* root) {
 
     do {
         // Use expected log probability under variational distribution
-        double curr_log_inside = computeExpectedLogProb(ptr->rule_ptr);
+        double curr_log_inside = expected_log_probs_[ruleNumberOf(ptr->Annotations().rule_ptr)];
 
         double log_children = 0.0;
-        for (ChartItem* child : ptr->children) {
+        for (ChartItem* child : ptr->Annotations().children) {
             log_children += computeVariationalInside(child);
         }
 
@@ -176,8 +181,8 @@ double VariationalInference::computeVariationalInside(ChartItem* root) {
 
     // Store results
     do {
-        ptr->log_inside_prob = log_inside;
-        ptr->inside_visited_status = VISITED;
+        ptr->Annotations().log_inside_prob = log_inside;
+        ptr->Annotations().inside_visited_status = pass_stamp_;
         ptr = ptr->next_ptr;
     } while (ptr != root);
 
@@ -186,61 +191,68 @@ double VariationalInference::computeVariationalInside(ChartItem* root) {
 
 void VariationalInference::computeVariationalOutside(ChartItem* root) {
     NodeLevelPQ pq;
-    root->log_outside_prob = 0.0;
+    root->Annotations().log_outside_prob = 0.0;
     pq.push(root);
 
     while (!pq.empty()) {
         ChartItem* node = pq.top();
         pq.pop();
 
-        if (!node->parents_sib.empty()) {
+        if (!node->Annotations().parents_sib.empty()) {
             double log_outside = ChartItem::log_zero;
 
-            for (auto& parent_sib : node->parents_sib) {
+            for (auto& parent_sib : node->Annotations().parents_sib) {
                 ChartItem* parent = getParent(parent_sib);
                 std::vector<ChartItem*> siblings = getSiblings(parent_sib);
 
-                double curr_log_outside = computeExpectedLogProb(parent->rule_ptr);
-                curr_log_outside += parent->log_outside_prob;
+                double curr_log_outside = expected_log_probs_[ruleNumberOf(parent->Annotations().rule_ptr)];
+                curr_log_outside += parent->Annotations().log_outside_prob;
 
                 for (auto sib : siblings) {
-                    curr_log_outside += sib->log_inside_prob;
+                    curr_log_outside += sib->Annotations().log_inside_prob;
                 }
 
                 log_outside = addLogs(log_outside, curr_log_outside);
             }
 
-            node->log_outside_prob = log_outside;
-            node->outside_visited_status = VISITED;
+            node->Annotations().log_outside_prob = log_outside;
+            node->Annotations().outside_visited_status = pass_stamp_;
         }
 
-        for (ChartItem* child : node->children) {
+        for (ChartItem* child : node->Annotations().children) {
             pq.push(child);
         }
     }
 }
 
 void VariationalInference::computeExpectedCount(ChartItem* root, double pw) {
-    if (root->count_visited_status == VISITED) {
+    std::vector<ScaledProb> counts(numbered_rules_.size());
+    computeExpectedCount(root, pw, counts);
+    addRuleCounts(counts);
+}
+
+void VariationalInference::computeExpectedCount(ChartItem* root, double pw,
+                                                std::vector<ScaledProb>& counts) {
+    if (root->Annotations().count_visited_status == pass_stamp_) {
         return;
     }
 
     ChartItem* ptr = root;
     do {
-        double curr_log_count = computeExpectedLogProb(ptr->rule_ptr);
-        curr_log_count += ptr->log_outside_prob;
+        double curr_log_count = expected_log_probs_[ruleNumberOf(ptr->Annotations().rule_ptr)];
+        curr_log_count += ptr->Annotations().log_outside_prob;
         curr_log_count -= pw;
 
-        for (ChartItem* child : ptr->children) {
-            curr_log_count += child->log_inside_prob;
+        for (ChartItem* child : ptr->Annotations().children) {
+            curr_log_count += child->Annotations().log_inside_prob;
         }
 
-        ptr->log_sent_rule_count = curr_log_count;
-        ptr->rule_ptr->log_count = addLogs(ptr->rule_ptr->log_count, curr_log_count);
+        ptr->Annotations().log_sent_rule_count = curr_log_count;
+        counts[ruleNumberOf(ptr->Annotations().rule_ptr)] += ScaledProb::FromLog(curr_log_count);
 
-        ptr->count_visited_status = VISITED;
-        for (ChartItem* child : ptr->children) {
-            computeExpectedCount(child, pw);
+        ptr->Annotations().count_visited_status = pass_stamp_;
+        for (ChartItem* child : ptr->Annotations().children) {
+            computeExpectedCount(child, pw, counts);
         }
         ptr = ptr->next_ptr;
     } while (ptr != root);
@@ -333,18 +345,4 @@ bool VariationalInference::converged() const {
     return std::abs(elbo_ - prev_elbo_) <= threshold;
 }
 
-LabelToRule VariationalInference::getRuleDict() {
-    LabelToRule dict;
-    for (auto rule : shrg_rules) {
-        dict[rule->label_hash].push_back(rule);
-    }
-
-    // Remove duplicates
-    for (auto& pair : dict) {
-        std::set<SHRG*> s(pair.second.begin(), pair.second.end());
-        pair.second = RuleVector(s.begin(), s.end());
-    }
-    return dict;
-}
-
 } // namespace shrg::vi
\ No newline at end of file
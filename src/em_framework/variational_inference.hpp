@@ -28,6 +28,8 @@ protected:
     double computeVariationalInside(ChartItem* root);
     void computeVariationalOutside(ChartItem* root);
     void computeExpectedCount(ChartItem* root, double pw) override;
+    // adds the expected counts to `counts` (indexed by rule number) instead of SHRG::log_count
+    void computeExpectedCount(ChartItem* root, double pw, std::vector<ScaledProb>& counts);
     void updateEM();
     void traverseForELBO(ChartItem* root, double& expected_ll);
     void verifyELBOIncrease(double new_elbo, double old_elbo);
@@ -44,8 +46,9 @@ private:
 
     // Variational parameters
     std::unordered_map<SHRG*, double> gamma_;  // Dirichlet parameters
+    // computeExpectedLogProb of every rule by rule number, computed before each E-step
+    std::vector<double> expected_log_probs_;
 
-    LabelToRule getRuleDict();
 };
 
 } // namespace shrg::vi
\ No newline at end of file
@@ -338,7 +338,7 @@ void writeStringsToFile(const std::vector<std::string>& strings, const std::stri
 }
 ChartItem* SampleDerivationTree(ChartItem* root_ptr, std::mt19937& gen) {
     if (!root_ptr) return nullptr;
-    if (root_ptr->em_greedy_score == VISITED)
+    if (root_ptr->Annotations().em_greedy_score == VISITED)
         return root_ptr;
 
     ChartItem* ptr = root_ptr;
@@ -363,13 +363,13 @@ ChartItem* SampleDerivationTree(ChartItem* root_ptr, std::mt19937& gen) {
     }
 
     // Recursively sample children
-    for (auto child : root_ptr->children) {
+    for (auto child : root_ptr->Annotations().children) {
         if (child) {
             SampleDerivationTree(child, gen);
         }
     }
 
-    root_ptr->em_greedy_score = VISITED;
+    root_ptr->Annotations().em_greedy_score = VISITED;
     return root_ptr;
 }
 
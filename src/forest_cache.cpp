@@ -5,13 +5,18 @@
 
 #include "forest_cache.hpp"
 
-#include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <queue>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <cerrno>
-#include <cctype>
 
 namespace shrg {
 namespace forest_cache {
@@ -23,10 +28,67 @@ bool create_directory(const std::string& path) {
     return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
 }
 
-// Check if file exists
-bool file_exists(const std::string& path) {
+// Size of an open file, 0 if it cannot be found
+uint64_t file_size(int fd) {
     struct stat buffer;
-    return (stat(path.c_str(), &buffer) == 0);
+    return fstat(fd, &buffer) == 0 ? static_cast<uint64_t>(buffer.st_size) : 0;
+}
+
+// Whether an open file is still the one at `path`, and not one renamed over it
+bool same_file(int fd, const std::string& path) {
+    struct stat opened, named;
+    return fstat(fd, &opened) == 0 && stat(path.c_str(), &named) == 0 &&
+           opened.st_dev == named.st_dev && opened.st_ino == named.st_ino;
+}
+
+// Write all of `size` bytes at `offset`, retrying short writes
+bool write_fully(int fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+    return true;
+}
+
+// Read all of `size` bytes at `offset`, false at the end of the file
+bool read_fully(int fd, char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t got = pread(fd, data, size, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= static_cast<size_t>(got);
+        offset += static_cast<uint64_t>(got);
+    }
+    return true;
+}
+
+// Append the bytes of `count` values to a record
+template <typename T>
+void append_bytes(std::vector<char>& record, const T* values, size_t count) {
+    const char* data = reinterpret_cast<const char*>(values);
+    record.insert(record.end(), data, data + count * sizeof(T));
+}
+
+// Bytes of a serialized forest, padded so that the next one stays 8-byte aligned
+uint64_t record_size(const ForestHeader& header) {
+    uint64_t size = sizeof(ForestHeader) +
+                    uint64_t(header.node_count) * sizeof(SerializedNode) +
+                    uint64_t(header.total_parents) * sizeof(SerializedParentSib) +
+                    (uint64_t(header.total_children) + header.total_siblings) * sizeof(int32_t);
+    return (size + 7) & ~uint64_t(7);
 }
 
 // Convert EdgeSet (std::bitset<256>) to 4 uint64_t values
@@ -65,6 +127,25 @@ void data_to_nodemapping(const uint8_t data[16], NodeMapping& nm) {
     std::memcpy(nm.m1.data(), data, 16);
 }
 
+// Check that the ranges of every node and parent-sib entry lie within the arrays of the forest
+bool ranges_valid(const ForestView& view) {
+    const ForestHeader& header = *view.header;
+    for (uint32_t i = 0; i < header.node_count; i++) {
+        const SerializedNode& node = view.nodes[i];
+        if (node.children_begin > node.children_end || node.children_end > header.total_children ||
+            node.parents_begin > node.parents_end || node.parents_end > header.total_parents) {
+            return false;
+        }
+    }
+    for (uint32_t p = 0; p < header.total_parents; p++) {
+        const SerializedParentSib& ps = view.parents[p];
+        if (ps.siblings_begin > ps.siblings_end || ps.siblings_end > header.total_siblings) {
+            return false;
+        }
+    }
+    return true;
+}
+
 }  // namespace
 
 // ============================================================================
@@ -73,13 +154,213 @@ void data_to_nodemapping(const uint8_t data[16], NodeMapping& nm) {
 
 ForestCache::ForestCache(const std::string& cache_dir)
     : cache_dir_(cache_dir),
-      forests_dir_(cache_dir + "/forests"),
       grammar_hash_(0),
       cache_hits_(0),
       cache_misses_(0) {
-    // Create cache directories
+    // Create cache directory
     create_directory(cache_dir_);
-    create_directory(forests_dir_);
+    warn_legacy_cache();
+    open_pack();
+}
+
+ForestCache::~ForestCache() {
+    unmap_all();
+    if (pack_fd_ >= 0) {
+        close(pack_fd_);
+    }
+    if (index_fd_ >= 0) {
+        close(index_fd_);
+    }
+}
+
+void ForestCache::open_pack() {
+    pack_fd_ = open((cache_dir_ + "/forests.pack").c_str(), O_RDWR | O_CREAT, 0644);
+    if (!lock_pack()) {
+        std::cerr << "Warning: Cannot open forest pack in: " << cache_dir_ << "\n";
+        return;
+    }
+
+    // A new pack, or one written with another format, starts over
+    PackHeader pack_header{}, index_header{};
+    bool valid = read_fully(pack_fd_, reinterpret_cast<char*>(&pack_header), sizeof(PackHeader), 0) &&
+                 read_fully(index_fd_, reinterpret_cast<char*>(&index_header), sizeof(PackHeader), 0) &&
+                 pack_header.magic == PACK_MAGIC && pack_header.version == CACHE_VERSION &&
+                 index_header.magic == INDEX_MAGIC && index_header.version == CACHE_VERSION;
+    if (!valid) {
+        PackHeader header{PACK_MAGIC, CACHE_VERSION, 0};
+        bool written = ftruncate(pack_fd_, 0) == 0 && ftruncate(index_fd_, 0) == 0 &&
+                       write_fully(pack_fd_, reinterpret_cast<const char*>(&header),
+                                   sizeof(header), 0);
+        header.magic = INDEX_MAGIC;
+        written = written && write_fully(index_fd_, reinterpret_cast<const char*>(&header),
+                                         sizeof(header), 0);
+        if (!written) {
+            std::cerr << "Warning: Cannot initialize forest pack in: " << cache_dir_ << "\n";
+        }
+    }
+    flock(pack_fd_, LOCK_UN);
+
+    index_read_offset_ = sizeof(PackHeader);
+    read_index();
+
+    // Forests saved again leave their old records behind, drop them once they dominate the pack
+    uint64_t live_size = 0;
+    for (const auto& kv : index_) {
+        live_size += kv.second.size;
+    }
+    if (file_size(pack_fd_) > sizeof(PackHeader) + 2 * live_size) {
+        compact();
+    }
+}
+
+bool ForestCache::lock_pack() const {
+    std::string pack_path = cache_dir_ + "/forests.pack";
+    std::string index_path = cache_dir_ + "/forests.idx";
+    bool replaced = false;
+    while (pack_fd_ >= 0) {
+        flock(pack_fd_, LOCK_EX);
+        if (same_file(pack_fd_, pack_path)) {
+            // The index is opened under the lock, so it belongs to the same pack
+            if (index_fd_ < 0) {
+                index_fd_ = open(index_path.c_str(), O_RDWR | O_CREAT, 0644);
+            }
+            if (index_fd_ >= 0) {
+                // A compacted pack always has valid headers, a new one is checked by open_pack()
+                if (replaced) {
+                    read_index();
+                }
+                return true;
+            }
+            flock(pack_fd_, LOCK_UN);
+            break;
+        }
+
+        // Another process compacted the pack while this one held the old file
+        flock(pack_fd_, LOCK_UN);
+        close(pack_fd_);
+        if (index_fd_ >= 0) {
+            close(index_fd_);
+        }
+        index_fd_ = -1;
+        retired_mappings_.insert(retired_mappings_.end(), mappings_.begin(), mappings_.end());
+        mappings_.clear();
+        index_.clear();
+        index_read_offset_ = sizeof(PackHeader);
+        pack_fd_ = open(pack_path.c_str(), O_RDWR | O_CREAT, 0644);
+        replaced = true;
+    }
+
+    if (pack_fd_ >= 0) {
+        close(pack_fd_);
+    }
+    pack_fd_ = -1;
+    return false;
+}
+
+void ForestCache::warn_legacy_cache() const {
+    std::string forests_dir = cache_dir_ + "/forests";
+    DIR* dir = opendir(forests_dir.c_str());
+    if (!dir) {
+        return;
+    }
+    size_t legacy_count = 0;
+    while (struct dirent* file = readdir(dir)) {
+        std::string name = file->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+            legacy_count++;
+        }
+    }
+    closedir(dir);
+    if (legacy_count > 0) {
+        std::cerr << "Warning: Ignoring " << legacy_count
+                  << " forests cached in the old per-file format in: " << forests_dir
+                  << " (they are re-parsed into the pack, the directory can be removed)\n";
+    }
+}
+
+void ForestCache::read_index() const {
+    if (index_fd_ < 0) {
+        return;
+    }
+    uint64_t index_size = file_size(index_fd_);
+    uint64_t pack_size = file_size(pack_fd_);
+    std::string graph_id;
+    while (index_read_offset_ + sizeof(PackIndexEntry) <= index_size) {
+        PackIndexEntry entry;
+        if (!read_fully(index_fd_, reinterpret_cast<char*>(&entry), sizeof(entry),
+                        index_read_offset_)) {
+            break;
+        }
+        graph_id.resize(entry.id_length);
+        if (!read_fully(index_fd_, &graph_id[0], entry.id_length,
+                        index_read_offset_ + sizeof(entry))) {
+            break;  // The rest of the entry is still being written
+        }
+        index_read_offset_ += sizeof(entry) + entry.id_length;
+
+        // Forests are written before their entries, an entry past the pack is damaged
+        if (entry.offset + entry.size <= pack_size) {
+            index_[graph_id] = entry;
+        }
+    }
+}
+
+const char* ForestCache::map_range(uint64_t offset, uint64_t size) const {
+    if (mappings_.empty() || offset + size > mappings_.back().size) {
+        uint64_t pack_size = file_size(pack_fd_);
+        if (offset + size > pack_size) {
+            return nullptr;
+        }
+        void* data = mmap(nullptr, pack_size, PROT_READ, MAP_SHARED, pack_fd_, 0);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        mappings_.push_back({data, pack_size});
+    }
+    return static_cast<const char*>(mappings_.back().data) + offset;
+}
+
+void ForestCache::unmap_all() {
+    for (const Mapping& mapping : mappings_) {
+        munmap(mapping.data, mapping.size);
+    }
+    for (const Mapping& mapping : retired_mappings_) {
+        munmap(mapping.data, mapping.size);
+    }
+    mappings_.clear();
+    retired_mappings_.clear();
+}
+
+void ForestCache::append(const std::string& graph_id, uint32_t graph_hash,
+                         const std::vector<char>& record) {
+    if (pack_fd_ < 0) {
+        return;
+    }
+    PackIndexEntry entry;
+    entry.size = record.size();
+    entry.graph_hash = graph_hash;
+    entry.id_length = static_cast<uint32_t>(graph_id.size());
+
+    std::vector<char> index_record;
+    append_bytes(index_record, &entry, 1);
+    append_bytes(index_record, graph_id.data(), graph_id.size());
+
+    // The lock orders the appends of all processes sharing the cache directory
+    if (!lock_pack()) {
+        return;
+    }
+    entry.offset = file_size(pack_fd_);
+    std::memcpy(index_record.data(), &entry, sizeof(entry));
+    bool written = write_fully(pack_fd_, record.data(), record.size(), entry.offset) &&
+                   write_fully(index_fd_, index_record.data(), index_record.size(),
+                               file_size(index_fd_));
+    flock(pack_fd_, LOCK_UN);
+
+    if (!written) {
+        std::cerr << "Warning: Cannot append to forest pack in: " << cache_dir_ << "\n";
+        return;
+    }
+    index_[graph_id] = entry;
 }
 
 void ForestCache::set_grammar_hash(uint32_t hash) {
@@ -96,52 +377,59 @@ uint32_t ForestCache::compute_hash(const std::string& content) {
     return hash;
 }
 
-std::string ForestCache::sanitize_filename(const std::string& graph_id) {
-    std::string result;
-    result.reserve(graph_id.size());
-    for (char c : graph_id) {
-        if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-' || c == '.') {
-            result += c;
-        } else {
-            // Replace invalid chars with underscore
-            result += '_';
-        }
-    }
-    return result;
-}
-
-std::string ForestCache::get_forest_path(const std::string& graph_id) const {
-    return forests_dir_ + "/" + sanitize_filename(graph_id) + ".bin";
-}
-
-bool ForestCache::has_valid_cache(const std::string& graph_id, uint32_t graph_hash) const {
-    std::string path = get_forest_path(graph_id);
-    if (!file_exists(path)) {
+bool ForestCache::make_view(const char* data, uint64_t size, ForestView& view) {
+    if (!data || size < sizeof(ForestHeader)) {
         return false;
     }
-
-    // Read and validate header
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
+    view.header = reinterpret_cast<const ForestHeader*>(data);
+    if (record_size(*view.header) > size) {
         return false;
     }
+    const char* ptr = data + sizeof(ForestHeader);
+    view.nodes = reinterpret_cast<const SerializedNode*>(ptr);
+    ptr += view.header->node_count * sizeof(SerializedNode);
+    view.parents = reinterpret_cast<const SerializedParentSib*>(ptr);
+    ptr += view.header->total_parents * sizeof(SerializedParentSib);
+    view.children = reinterpret_cast<const int32_t*>(ptr);
+    ptr += view.header->total_children * sizeof(int32_t);
+    view.siblings = reinterpret_cast<const int32_t*>(ptr);
+    return true;
+}
 
-    ForestHeader header;
-    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+bool ForestCache::find(const std::string& graph_id, uint32_t graph_hash, ForestView& view) const {
+    auto it = index_.find(graph_id);
+    if (it == index_.end() || it->second.graph_hash != graph_hash) {
+        // Another process may have added the forest since the index was read, or compacted the
+        // pack, after which the old index is no longer written
+        if (pack_fd_ >= 0 && !same_file(pack_fd_, cache_dir_ + "/forests.pack")) {
+            if (lock_pack()) {
+                flock(pack_fd_, LOCK_UN);
+            }
+        }
+        read_index();
+        it = index_.find(graph_id);
+        if (it == index_.end()) {
+            return false;
+        }
+    }
 
-    if (!file || file.gcount() != sizeof(header)) {
+    const PackIndexEntry& entry = it->second;
+    if (!make_view(map_range(entry.offset, entry.size), entry.size, view)) {
         return false;
     }
 
     // Validate magic, version, and hashes
-    if (header.magic != CACHE_MAGIC ||
-        header.version != CACHE_VERSION ||
-        header.grammar_hash != grammar_hash_ ||
-        header.graph_hash != graph_hash) {
-        return false;
-    }
+    const ForestHeader& header = *view.header;
+    return header.magic == CACHE_MAGIC &&
+           header.version == CACHE_VERSION &&
+           header.grammar_hash == grammar_hash_ &&
+           header.graph_hash == graph_hash &&
+           header.node_count > 0;
+}
 
-    return true;
+bool ForestCache::has_valid_cache(const std::string& graph_id, uint32_t graph_hash) const {
+    ForestView view;
+    return find(graph_id, graph_hash, view);
 }
 
 void ForestCache::collect_all_items(ChartItem* root,
@@ -181,12 +469,12 @@ void ForestCache::collect_all_items(ChartItem* root,
         }
 
         // Add children
-        for (ChartItem* child : item->children) {
+        for (ChartItem* child : item->Annotations().children) {
             enqueue_if_new(child);
         }
 
         // Add items from parents_sib
-        for (const auto& parent_sib : item->parents_sib) {
+        for (const auto& parent_sib : item->Annotations().parents_sib) {
             ChartItem* parent = std::get<0>(parent_sib);
             enqueue_if_new(parent);
             for (ChartItem* sib : std::get<1>(parent_sib)) {
@@ -204,17 +492,20 @@ void ForestCache::serialize_node(ChartItem* item,
                                   const std::unordered_map<ChartItem*, int32_t>& item_to_index,
                                   SerializedNode& node,
                                   std::vector<int32_t>& children_out,
-                                  std::vector<SerializedParentSib>& parents_out) {
+                                  std::vector<SerializedParentSib>& parents_out,
+                                  std::vector<int32_t>& siblings_out) {
     // Serialize EdgeSet
     edgeset_to_data(item->edge_set, node.edge_set_data);
 
     // Serialize NodeMapping
     nodemapping_to_data(item->boundary_node_mapping, node.boundary_mapping);
 
+    const ChartItemAnnotations& annotations = item->Annotations();
+
     // Copy scalar fields
     node.score = item->score;
-    node.level = item->level;
-    node.shrg_index = item->shrg_index;
+    node.level = annotations.level;
+    node.shrg_index = annotations.shrg_index;
 
     // Convert pointers to indices
     auto get_index = [&](ChartItem* ptr) -> int32_t {
@@ -228,91 +519,92 @@ void ForestCache::serialize_node(ChartItem* item,
     node.right_index = get_index(item->right_ptr);
 
     // Serialize children
-    children_out.clear();
-    for (ChartItem* child : item->children) {
+    node.children_begin = static_cast<uint32_t>(children_out.size());
+    for (ChartItem* child : annotations.children) {
         children_out.push_back(get_index(child));
     }
-    node.children_count = static_cast<uint32_t>(children_out.size());
+    node.children_end = static_cast<uint32_t>(children_out.size());
 
     // Serialize parents_sib
-    parents_out.clear();
-    for (const auto& parent_sib : item->parents_sib) {
+    node.parents_begin = static_cast<uint32_t>(parents_out.size());
+    for (const auto& parent_sib : annotations.parents_sib) {
         SerializedParentSib ps;
         ps.parent_index = get_index(std::get<0>(parent_sib));
+        ps.siblings_begin = static_cast<uint32_t>(siblings_out.size());
         for (ChartItem* sib : std::get<1>(parent_sib)) {
-            ps.sibling_indices.push_back(get_index(sib));
+            siblings_out.push_back(get_index(sib));
         }
+        ps.siblings_end = static_cast<uint32_t>(siblings_out.size());
         parents_out.push_back(ps);
     }
-    node.parents_count = static_cast<uint32_t>(parents_out.size());
+    node.parents_end = static_cast<uint32_t>(parents_out.size());
 
     // Copy EM-related fields
-    node.log_inside_prob = item->log_inside_prob;
-    node.log_outside_prob = item->log_outside_prob;
-    node.log_sent_rule_count = item->log_sent_rule_count;
-    node.log_inside_count = item->log_inside_count;
+    node.log_inside_prob = annotations.log_inside_prob;
+    node.log_outside_prob = annotations.log_outside_prob;
+    node.log_sent_rule_count = annotations.log_sent_rule_count;
+    node.log_inside_count = annotations.log_inside_count;
 
     // Copy derivation scoring fields
-    node.em_greedy_score = item->em_greedy_score;
-    node.em_greedy_deriv = item->em_greedy_deriv;
-    node.em_inside_score = item->em_inside_score;
-    node.em_inside_deriv = item->em_inside_deriv;
-    node.count_greedy_score = item->count_greedy_score;
-    node.count_greedy_deriv = item->count_greedy_deriv;
-    node.count_inside_score = item->count_inside_score;
-    node.count_inside_deriv = item->count_inside_deriv;
+    node.em_greedy_score = annotations.em_greedy_score;
+    node.em_greedy_deriv = annotations.em_greedy_deriv;
+    node.em_inside_score = annotations.em_inside_score;
+    node.em_inside_deriv = annotations.em_inside_deriv;
+    node.count_greedy_score = annotations.count_greedy_score;
+    node.count_greedy_deriv = annotations.count_greedy_deriv;
+    node.count_inside_score = annotations.count_inside_score;
+    node.count_inside_deriv = annotations.count_inside_deriv;
 }
 
 void ForestCache::deserialize_node(const SerializedNode& node, ChartItem* item) {
     // Deserialize EdgeSet
     data_to_edgeset(node.edge_set_data, item->edge_set);
+    item->edge_set_hash = HashEdgeSet(item->edge_set);
 
     // Deserialize NodeMapping
     data_to_nodemapping(node.boundary_mapping, item->boundary_node_mapping);
 
+    ChartItemAnnotations& annotations = item->Annotations();
+
     // Copy scalar fields
     item->score = node.score;
-    item->level = node.level;
-    item->shrg_index = node.shrg_index;
+    annotations.level = node.level;
+    annotations.shrg_index = node.shrg_index;
 
     // Pointer fields will be restored later by restore_relationships
 
     // Reset status flags for fresh EM iteration
     item->status = ChartItem::kEmpty;
-    item->inside_visited_status = ChartItem::kEmpty;
-    item->outside_visited_status = ChartItem::kEmpty;
-    item->count_visited_status = ChartItem::kEmpty;
-    item->child_visited_status = ChartItem::kEmpty;
-    item->update_status = ChartItem::kEmpty;
-    item->rule_visited = ChartItem::kEmpty;
+    annotations.inside_visited_status = ChartItem::kEmpty;
+    annotations.outside_visited_status = ChartItem::kEmpty;
+    annotations.count_visited_status = ChartItem::kEmpty;
+    annotations.child_visited_status = ChartItem::kEmpty;
+    annotations.update_status = ChartItem::kEmpty;
+    annotations.rule_visited = ChartItem::kEmpty;
 
     // Copy EM-related fields
-    item->log_inside_prob = node.log_inside_prob;
-    item->log_outside_prob = node.log_outside_prob;
-    item->log_sent_rule_count = node.log_sent_rule_count;
-    item->log_inside_count = node.log_inside_count;
+    annotations.log_inside_prob = node.log_inside_prob;
+    annotations.log_outside_prob = node.log_outside_prob;
+    annotations.log_sent_rule_count = node.log_sent_rule_count;
+    annotations.log_inside_count = node.log_inside_count;
 
     // Copy derivation scoring fields
-    item->em_greedy_score = node.em_greedy_score;
-    item->em_greedy_deriv = node.em_greedy_deriv;
-    item->em_inside_score = node.em_inside_score;
-    item->em_inside_deriv = node.em_inside_deriv;
-    item->count_greedy_score = node.count_greedy_score;
-    item->count_greedy_deriv = node.count_greedy_deriv;
-    item->count_inside_score = node.count_inside_score;
-    item->count_inside_deriv = node.count_inside_deriv;
+    annotations.em_greedy_score = node.em_greedy_score;
+    annotations.em_greedy_deriv = node.em_greedy_deriv;
+    annotations.em_inside_score = node.em_inside_score;
+    annotations.em_inside_deriv = node.em_inside_deriv;
+    annotations.count_greedy_score = node.count_greedy_score;
+    annotations.count_greedy_deriv = node.count_greedy_deriv;
+    annotations.count_inside_score = node.count_inside_score;
+    annotations.count_inside_deriv = node.count_inside_deriv;
 
     // Rule pointer will be set by addRulePointer after loading
-    item->rule_ptr = nullptr;
+    item->Annotations().rule_ptr = nullptr;
     item->attrs_ptr = nullptr;
 }
 
-void ForestCache::restore_relationships(
-    const std::vector<SerializedNode>& nodes,
-    const std::vector<std::vector<int32_t>>& all_children,
-    const std::vector<std::vector<SerializedParentSib>>& all_parents,
-    std::vector<ChartItem*>& items) {
-
+void ForestCache::restore_relationships(const ForestView& view,
+                                        std::vector<ChartItem*>& items) {
     auto get_ptr = [&](int32_t idx) -> ChartItem* {
         if (idx < 0 || idx >= static_cast<int32_t>(items.size())) {
             return nullptr;
@@ -320,9 +612,9 @@ void ForestCache::restore_relationships(
         return items[idx];
     };
 
-    for (size_t i = 0; i < nodes.size(); i++) {
+    for (size_t i = 0; i < items.size(); i++) {
         ChartItem* item = items[i];
-        const SerializedNode& node = nodes[i];
+        const SerializedNode& node = view.nodes[i];
 
         // Restore pointer fields
         item->next_ptr = get_ptr(node.next_index);
@@ -335,23 +627,24 @@ void ForestCache::restore_relationships(
         }
 
         // Restore children
-        item->children.clear();
-        item->children.reserve(all_children[i].size());
-        for (int32_t child_idx : all_children[i]) {
-            item->children.push_back(get_ptr(child_idx));
+        item->Annotations().children.clear();
+        item->Annotations().children.reserve(node.children_end - node.children_begin);
+        for (uint32_t c = node.children_begin; c < node.children_end; c++) {
+            item->Annotations().children.push_back(get_ptr(view.children[c]));
         }
 
         // Restore parents_sib
-        item->parents_sib.clear();
-        item->parents_sib.reserve(all_parents[i].size());
-        for (const auto& ps : all_parents[i]) {
+        item->Annotations().parents_sib.clear();
+        item->Annotations().parents_sib.reserve(node.parents_end - node.parents_begin);
+        for (uint32_t p = node.parents_begin; p < node.parents_end; p++) {
+            const SerializedParentSib& ps = view.parents[p];
             ChartItem* parent = get_ptr(ps.parent_index);
             std::vector<ChartItem*> siblings;
-            siblings.reserve(ps.sibling_indices.size());
-            for (int32_t sib_idx : ps.sibling_indices) {
-                siblings.push_back(get_ptr(sib_idx));
+            siblings.reserve(ps.siblings_end - ps.siblings_begin);
+            for (uint32_t s = ps.siblings_begin; s < ps.siblings_end; s++) {
+                siblings.push_back(get_ptr(view.siblings[s]));
             }
-            item->parents_sib.emplace_back(parent, std::move(siblings));
+            item->Annotations().parents_sib.emplace_back(parent, std::move(siblings));
         }
     }
 }
@@ -376,19 +669,14 @@ void ForestCache::save(const std::string& graph_id, uint32_t graph_hash,
         ordered_items[kv.second] = kv.first;
     }
 
-    // Serialize all nodes
+    // Serialize all nodes into flat arrays
     std::vector<SerializedNode> nodes(ordered_items.size());
-    std::vector<std::vector<int32_t>> all_children(ordered_items.size());
-    std::vector<std::vector<SerializedParentSib>> all_parents(ordered_items.size());
-
-    uint32_t total_children = 0;
-    uint32_t total_parents = 0;
+    std::vector<int32_t> children;
+    std::vector<SerializedParentSib> parents;
+    std::vector<int32_t> siblings;
 
     for (size_t i = 0; i < ordered_items.size(); i++) {
-        serialize_node(ordered_items[i], item_to_index, nodes[i],
-                       all_children[i], all_parents[i]);
-        total_children += static_cast<uint32_t>(all_children[i].size());
-        total_parents += static_cast<uint32_t>(all_parents[i].size());
+        serialize_node(ordered_items[i], item_to_index, nodes[i], children, parents, siblings);
     }
 
     // Prepare header
@@ -399,135 +687,41 @@ void ForestCache::save(const std::string& graph_id, uint32_t graph_hash,
     header.graph_hash = graph_hash;
     header.root_index = item_to_index[root];
     header.node_count = static_cast<uint32_t>(nodes.size());
-    header.total_children = total_children;
-    header.total_parents = total_parents;
-
-    // Write to file
-    std::string path = get_forest_path(graph_id);
-    std::ofstream file(path, std::ios::binary | std::ios::trunc);
-    if (!file) {
-        std::cerr << "Warning: Cannot create cache file: " << path << "\n";
-        return;
-    }
-
-    // Write header
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-
-    // Write nodes
-    file.write(reinterpret_cast<const char*>(nodes.data()),
-               static_cast<std::streamsize>(nodes.size() * sizeof(SerializedNode)));
-
-    // Write children (flat array with counts embedded in nodes)
-    for (size_t i = 0; i < all_children.size(); i++) {
-        if (!all_children[i].empty()) {
-            file.write(reinterpret_cast<const char*>(all_children[i].data()),
-                       static_cast<std::streamsize>(all_children[i].size() * sizeof(int32_t)));
-        }
-    }
-
-    // Write parents_sib
-    for (size_t i = 0; i < all_parents.size(); i++) {
-        // Write count of parent_sib entries (already in node)
-        for (const auto& ps : all_parents[i]) {
-            file.write(reinterpret_cast<const char*>(&ps.parent_index), sizeof(int32_t));
-            uint32_t sib_count = static_cast<uint32_t>(ps.sibling_indices.size());
-            file.write(reinterpret_cast<const char*>(&sib_count), sizeof(uint32_t));
-            if (sib_count > 0) {
-                file.write(reinterpret_cast<const char*>(ps.sibling_indices.data()),
-                           static_cast<std::streamsize>(sib_count * sizeof(int32_t)));
-            }
-        }
-    }
-
-    file.close();
+    header.total_children = static_cast<uint32_t>(children.size());
+    header.total_parents = static_cast<uint32_t>(parents.size());
+    header.total_siblings = static_cast<uint32_t>(siblings.size());
+
+    // Lay the forest out as it is read in place: header, nodes, parents, children, siblings
+    std::vector<char> record;
+    record.reserve(record_size(header));
+    append_bytes(record, &header, 1);
+    append_bytes(record, nodes.data(), nodes.size());
+    append_bytes(record, parents.data(), parents.size());
+    append_bytes(record, children.data(), children.size());
+    append_bytes(record, siblings.data(), siblings.size());
+    record.resize(record_size(header), 0);
+
+    append(graph_id, graph_hash, record);
 }
 
 ChartItem* ForestCache::load(const std::string& graph_id, uint32_t graph_hash,
                               utils::MemoryPool<ChartItem>& pool) {
-    std::string path = get_forest_path(graph_id);
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
-        cache_misses_++;
-        return nullptr;
-    }
-
-    // Read header
-    ForestHeader header;
-    file.read(reinterpret_cast<char*>(&header), sizeof(header));
-
-    if (!file || file.gcount() != sizeof(header)) {
-        cache_misses_++;
-        return nullptr;
-    }
-
-    // Validate header
-    if (header.magic != CACHE_MAGIC ||
-        header.version != CACHE_VERSION ||
-        header.grammar_hash != grammar_hash_ ||
-        header.graph_hash != graph_hash) {
-        cache_misses_++;
-        return nullptr;
-    }
-
-    if (header.node_count == 0) {
-        cache_misses_++;
-        return nullptr;
-    }
-
-    // Read nodes
-    std::vector<SerializedNode> nodes(header.node_count);
-    file.read(reinterpret_cast<char*>(nodes.data()),
-              static_cast<std::streamsize>(header.node_count * sizeof(SerializedNode)));
-
-    if (!file) {
+    ForestView view;
+    if (!find(graph_id, graph_hash, view) || !ranges_valid(view)) {
         cache_misses_++;
         return nullptr;
     }
 
-    // Read children
-    std::vector<std::vector<int32_t>> all_children(header.node_count);
-    for (size_t i = 0; i < header.node_count; i++) {
-        uint32_t count = nodes[i].children_count;
-        if (count > 0) {
-            all_children[i].resize(count);
-            file.read(reinterpret_cast<char*>(all_children[i].data()),
-                      static_cast<std::streamsize>(count * sizeof(int32_t)));
-        }
-    }
-
-    // Read parents_sib
-    std::vector<std::vector<SerializedParentSib>> all_parents(header.node_count);
-    for (size_t i = 0; i < header.node_count; i++) {
-        uint32_t count = nodes[i].parents_count;
-        all_parents[i].reserve(count);
-        for (uint32_t j = 0; j < count; j++) {
-            SerializedParentSib ps;
-            file.read(reinterpret_cast<char*>(&ps.parent_index), sizeof(int32_t));
-            uint32_t sib_count;
-            file.read(reinterpret_cast<char*>(&sib_count), sizeof(uint32_t));
-            if (sib_count > 0) {
-                ps.sibling_indices.resize(sib_count);
-                file.read(reinterpret_cast<char*>(ps.sibling_indices.data()),
-                          static_cast<std::streamsize>(sib_count * sizeof(int32_t)));
-            }
-            all_parents[i].push_back(std::move(ps));
-        }
-    }
-
-    if (!file) {
-        cache_misses_++;
-        return nullptr;
-    }
-
-    // Allocate all nodes in the memory pool
+    // Allocate all nodes in the memory pool, straight from the mapped pack
+    const ForestHeader& header = *view.header;
     std::vector<ChartItem*> items(header.node_count);
     for (size_t i = 0; i < header.node_count; i++) {
         items[i] = pool.Push();
-        deserialize_node(nodes[i], items[i]);
+        deserialize_node(view.nodes[i], items[i]);
     }
 
     // Restore all pointer relationships
-    restore_relationships(nodes, all_children, all_parents, items);
+    restore_relationships(view, items);
 
     cache_hits_++;
 
@@ -540,32 +734,127 @@ ChartItem* ForestCache::load(const std::string& graph_id, uint32_t graph_hash,
 }
 
 void ForestCache::clear() {
-    // Remove all files in forests directory
-    // Note: This is a simple implementation; a more robust version
-    // would iterate through the directory
+    // Truncate the pack and its index back to their headers
+    unmap_all();
+    index_.clear();
+    index_read_offset_ = sizeof(PackHeader);
+    if (pack_fd_ >= 0 && lock_pack()) {
+        if (ftruncate(pack_fd_, sizeof(PackHeader)) != 0 ||
+            ftruncate(index_fd_, sizeof(PackHeader)) != 0) {
+            std::cerr << "Warning: Cannot clear forest pack in: " << cache_dir_ << "\n";
+        }
+        flock(pack_fd_, LOCK_UN);
+    }
     cache_hits_ = 0;
     cache_misses_ = 0;
 }
 
+void ForestCache::compact() {
+    if (pack_fd_ < 0 || !lock_pack()) {
+        return;
+    }
+    read_index();
+
+    std::string pack_path = cache_dir_ + "/forests.pack";
+    std::string index_path = cache_dir_ + "/forests.idx";
+    std::string new_pack_path = pack_path + ".tmp";
+    std::string new_index_path = index_path + ".tmp";
+    int new_pack_fd = open(new_pack_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int new_index_fd = open(new_index_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    // The new pack is locked before it is visible, so processes opening it wait for the index
+    PackHeader header{PACK_MAGIC, CACHE_VERSION, 0};
+    bool written = new_pack_fd >= 0 && new_index_fd >= 0 && flock(new_pack_fd, LOCK_EX) == 0 &&
+                   write_fully(new_pack_fd, reinterpret_cast<const char*>(&header),
+                               sizeof(header), 0);
+    header.magic = INDEX_MAGIC;
+    written = written && write_fully(new_index_fd, reinterpret_cast<const char*>(&header),
+                                     sizeof(header), 0);
+
+    // Copy the latest forest of every graph, in the order of the old pack
+    std::vector<std::pair<uint64_t, const std::string*>> live;
+    for (const auto& kv : index_) {
+        live.emplace_back(kv.second.offset, &kv.first);
+    }
+    std::sort(live.begin(), live.end());
+    std::unordered_map<std::string, PackIndexEntry> new_index;
+    uint64_t pack_offset = sizeof(PackHeader);
+    uint64_t index_offset = sizeof(PackHeader);
+    std::vector<char> record, index_record;
+    for (size_t i = 0; i < live.size() && written; i++) {
+        const std::string& graph_id = *live[i].second;
+        PackIndexEntry entry = index_.at(graph_id);
+        record.resize(entry.size);
+        written = read_fully(pack_fd_, record.data(), record.size(), entry.offset);
+        entry.offset = pack_offset;
+        index_record.clear();
+        append_bytes(index_record, &entry, 1);
+        append_bytes(index_record, graph_id.data(), graph_id.size());
+        written = written &&
+                  write_fully(new_pack_fd, record.data(), record.size(), pack_offset) &&
+                  write_fully(new_index_fd, index_record.data(), index_record.size(),
+                              index_offset);
+        pack_offset += record.size();
+        index_offset += index_record.size();
+        new_index[graph_id] = entry;
+    }
+
+    // The index is renamed first: until the pack follows, openers still find the old pack and
+    // wait on its lock, after which they see that it was replaced
+    written = written && rename(new_index_path.c_str(), index_path.c_str()) == 0;
+    if (written && rename(new_pack_path.c_str(), pack_path.c_str()) != 0) {
+        // The old pack stays with the new index, which must not point into it
+        written = false;
+        if (ftruncate(new_index_fd, sizeof(PackHeader)) != 0) {
+            std::cerr << "Warning: Cannot clear forest pack in: " << cache_dir_ << "\n";
+        }
+    }
+    if (!written) {
+        std::cerr << "Warning: Cannot compact forest pack in: " << cache_dir_ << "\n";
+        unlink(new_pack_path.c_str());
+        unlink(new_index_path.c_str());
+        if (new_pack_fd >= 0) {
+            close(new_pack_fd);
+        }
+        if (new_index_fd >= 0) {
+            close(new_index_fd);
+        }
+        flock(pack_fd_, LOCK_UN);
+        return;
+    }
+
+    // Move to the new pack; views into the old one keep their mappings
+    flock(pack_fd_, LOCK_UN);
+    close(pack_fd_);
+    close(index_fd_);
+    pack_fd_ = new_pack_fd;
+    index_fd_ = new_index_fd;
+    retired_mappings_.insert(retired_mappings_.end(), mappings_.begin(), mappings_.end());
+    mappings_.clear();
+    index_ = std::move(new_index);
+    index_read_offset_ = index_offset;
+    flock(pack_fd_, LOCK_UN);
+}
+
 void ForestCache::restore_rule_pointers(ChartItem* root, const std::vector<SHRG*>& shrg_rules) {
-    if (!root || root->rule_visited == ChartItem::kVisited) {
+    if (!root || root->Annotations().rule_visited == ChartItem::kVisited) {
         return;
     }
 
     ChartItem* ptr = root;
     do {
         // Use pre-stored shrg_index instead of accessing attrs_ptr
-        int grammar_index = ptr->shrg_index;
+        int grammar_index = ptr->Annotations().shrg_index;
         if (grammar_index >= 0 && grammar_index < static_cast<int>(shrg_rules.size())) {
-            ptr->rule_ptr = shrg_rules[grammar_index];
+            ptr->Annotations().rule_ptr = shrg_rules[grammar_index];
         } else {
-            ptr->rule_ptr = nullptr;
+            ptr->Annotations().rule_ptr = nullptr;
         }
 
-        ptr->rule_visited = ChartItem::kVisited;
+        ptr->Annotations().rule_visited = ChartItem::kVisited;
 
         // Recursively restore for children
-        for (ChartItem* child : ptr->children) {
+        for (ChartItem* child : ptr->Annotations().children) {
             restore_rule_pointers(child, shrg_rules);
         }
 
@@ -596,41 +885,41 @@ void ForestCache::restore_all_pointers(ChartItem* root, const std::vector<SHRG*>
         ChartItem* item = queue.front();
         queue.pop();
 
-        if (!item || item->rule_visited == ChartItem::kVisited) {
+        if (!item || item->Annotations().rule_visited == ChartItem::kVisited) {
             continue;
         }
 
         // Process this item and all items in its next_ptr cycle
         ChartItem* ptr = item;
         do {
-            if (ptr->rule_visited == ChartItem::kVisited) {
+            if (ptr->Annotations().rule_visited == ChartItem::kVisited) {
                 ptr = ptr->next_ptr;
                 continue;
             }
 
-            int grammar_index = ptr->shrg_index;
+            int grammar_index = ptr->Annotations().shrg_index;
             if (grammar_index >= 0 &&
                 grammar_index < static_cast<int>(shrg_rules.size()) &&
                 grammar_index < static_cast<int>(attrs_pool.size())) {
-                ptr->rule_ptr = shrg_rules[grammar_index];
+                ptr->Annotations().rule_ptr = shrg_rules[grammar_index];
                 ptr->attrs_ptr = &attrs_pool[grammar_index];
             } else {
-                ptr->rule_ptr = nullptr;
+                ptr->Annotations().rule_ptr = nullptr;
                 ptr->attrs_ptr = nullptr;
             }
 
-            ptr->rule_visited = ChartItem::kVisited;
+            ptr->Annotations().rule_visited = ChartItem::kVisited;
 
             // Queue all reachable nodes: children, left_ptr, right_ptr
-            for (ChartItem* child : ptr->children) {
-                if (child && child->rule_visited != ChartItem::kVisited) {
+            for (ChartItem* child : ptr->Annotations().children) {
+                if (child && child->Annotations().rule_visited != ChartItem::kVisited) {
                     queue.push(child);
                 }
             }
-            if (ptr->left_ptr && ptr->left_ptr->rule_visited != ChartItem::kVisited) {
+            if (ptr->left_ptr && ptr->left_ptr->Annotations().rule_visited != ChartItem::kVisited) {
                 queue.push(ptr->left_ptr);
             }
-            if (ptr->right_ptr && ptr->right_ptr->rule_visited != ChartItem::kVisited) {
+            if (ptr->right_ptr && ptr->right_ptr->Annotations().rule_visited != ChartItem::kVisited) {
                 queue.push(ptr->right_ptr);
             }
 
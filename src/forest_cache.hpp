@@ -1,6 +1,7 @@
 //
 // Forest Caching for SHRG Parser
-// Serializes derivation forests to disk to skip re-parsing across runs.
+// Serializes derivation forests to disk to skip re-parsing across runs. All forests live in one
+// append-only pack file that is memory-mapped for loading.
 //
 
 #pragma once
@@ -24,9 +25,14 @@ constexpr uint32_t CACHE_VERSION = 1;
 // Magic number to identify cache files
 constexpr uint32_t CACHE_MAGIC = 0x46525354;  // "FRST"
 
+// Magic numbers of the pack file and of its index
+constexpr uint32_t PACK_MAGIC = 0x4B435046;   // "FPCK"
+constexpr uint32_t INDEX_MAGIC = 0x58444946;  // "FIDX"
+
 /**
  * Serialized representation of a ChartItem.
- * Pointers are converted to indices for disk storage.
+ * Pointers are converted to indices for disk storage, and children and parents to ranges of the
+ * flat arrays of the forest, so a forest can be read in place wherever it is mapped.
  */
 struct SerializedNode {
     // EdgeSet is a std::bitset<256> which is 32 bytes
@@ -44,11 +50,13 @@ struct SerializedNode {
     int32_t left_index;
     int32_t right_index;
 
-    // Children count (children stored separately)
-    uint32_t children_count;
+    // Children are children[children_begin, children_end) of the forest
+    uint32_t children_begin;
+    uint32_t children_end;
 
-    // Parents count (parents stored separately)
-    uint32_t parents_count;
+    // Parents are parents[parents_begin, parents_end) of the forest
+    uint32_t parents_begin;
+    uint32_t parents_end;
 
     // EM-related probabilities
     double log_inside_prob;
@@ -69,7 +77,7 @@ struct SerializedNode {
     SerializedNode()
         : edge_set_data{0}, boundary_mapping{0}, score(1.0f), level(-1),
           shrg_index(-1), next_index(-1), left_index(-1), right_index(-1),
-          children_count(0), parents_count(0),
+          children_begin(0), children_end(0), parents_begin(0), parents_end(0),
           log_inside_prob(0.0), log_outside_prob(-std::numeric_limits<double>::infinity()),
           log_sent_rule_count(-std::numeric_limits<double>::infinity()), log_inside_count(0.0),
           em_greedy_score(-1), em_greedy_deriv(-1), em_inside_score(-1), em_inside_deriv(-1),
@@ -78,15 +86,17 @@ struct SerializedNode {
 
 /**
  * Serialized parent-sibling relationship.
- * Each parent has a reference and a list of sibling indices.
+ * Each parent has a reference and a range of the sibling array of the forest.
  */
 struct SerializedParentSib {
     int32_t parent_index;
-    std::vector<int32_t> sibling_indices;
+    uint32_t siblings_begin;
+    uint32_t siblings_end;
 };
 
 /**
- * Header for a serialized forest file.
+ * Header for a serialized forest. It is followed by node_count SerializedNodes, total_parents
+ * SerializedParentSibs, total_children child indices and total_siblings sibling indices.
  */
 struct ForestHeader {
     uint32_t magic;
@@ -97,10 +107,43 @@ struct ForestHeader {
     uint32_t node_count;
     uint32_t total_children;  // Total number of children across all nodes
     uint32_t total_parents;   // Total number of parent-sib entries across all nodes
+    uint32_t total_siblings;  // Total number of siblings across all parent-sib entries
+    uint32_t reserved;        // Keeps the nodes that follow 8-byte aligned
 
     ForestHeader()
         : magic(CACHE_MAGIC), version(CACHE_VERSION), grammar_hash(0), graph_hash(0),
-          root_index(-1), node_count(0), total_children(0), total_parents(0) {}
+          root_index(-1), node_count(0), total_children(0), total_parents(0), total_siblings(0),
+          reserved(0) {}
+};
+
+/**
+ * Header of the pack file and of its index.
+ */
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t reserved;  // Keeps the records that follow 8-byte aligned
+};
+
+/**
+ * Entry of the pack index, followed on disk by the id_length bytes of the graph id.
+ */
+struct PackIndexEntry {
+    uint64_t offset;  // Of the forest in the pack file
+    uint64_t size;    // Bytes of the forest, padded to a multiple of 8
+    uint32_t graph_hash;
+    uint32_t id_length;
+};
+
+/**
+ * A serialized forest read in place from the pack mapping. Every pointer points into the mapping.
+ */
+struct ForestView {
+    const ForestHeader* header = nullptr;
+    const SerializedNode* nodes = nullptr;
+    const SerializedParentSib* parents = nullptr;
+    const int32_t* children = nullptr;
+    const int32_t* siblings = nullptr;
 };
 
 /**
@@ -108,9 +151,14 @@ struct ForestHeader {
  *
  * Cache directory structure:
  *   {cache_dir}/
- *     metadata.bin       - Grammar hash and validation info
- *     forests/
- *       {graph_id}.bin   - Per-graph serialized forests
+ *     forests.pack       - Serialized forests, appended one after another
+ *     forests.idx        - Graph id, graph hash, offset and size of every forest of the pack
+ *
+ * The pack is memory-mapped, so loading a forest reads it in place, and processes sharing a cache
+ * directory share its pages. A forest saved again is appended, and its latest index entry wins.
+ * Appends take an exclusive lock on the pack, so several processes can fill the same cache.
+ * Compaction writes the live forests to a new pack and renames it over the old one under the same
+ * lock; the other processes move to the new pack the next time they take the lock.
  */
 class ForestCache {
 public:
@@ -119,6 +167,10 @@ public:
      * @param cache_dir Directory to store cached forests
      */
     explicit ForestCache(const std::string& cache_dir);
+    ~ForestCache();
+
+    ForestCache(const ForestCache&) = delete;
+    ForestCache& operator=(const ForestCache&) = delete;
 
     /**
      * Set the grammar hash for validation.
@@ -159,10 +211,26 @@ public:
                     utils::MemoryPool<ChartItem>& pool);
 
     /**
-     * Clear all cached forests.
+     * Find a derivation forest in the pack without copying it.
+     * @param graph_id Unique identifier for the graph
+     * @param graph_hash Hash of the graph content (for validation)
+     * @param view Filled with the arrays of the forest, valid until clear() or destruction
+     * @return true if a valid forest was found
+     */
+    bool find(const std::string& graph_id, uint32_t graph_hash, ForestView& view) const;
+
+    /**
+     * Clear all cached forests. Views found before are no longer valid.
      */
     void clear();
 
+    /**
+     * Rewrite the pack with only the latest forest of every graph, dropping the records that were
+     * saved over. The pack is also compacted when it is opened with more stale than live bytes.
+     * Views found before stay valid.
+     */
+    void compact();
+
     /**
      * Restore rule pointers on a loaded forest using shrg_index.
      * This is needed because attrs_ptr is not serialized.
@@ -205,21 +273,64 @@ public:
     size_t cache_misses() const { return cache_misses_; }
 
 private:
+    struct Mapping {
+        void* data;
+        size_t size;
+    };
+
     std::string cache_dir_;
-    std::string forests_dir_;
     uint32_t grammar_hash_;
     mutable size_t cache_hits_;
     mutable size_t cache_misses_;
 
+    // Reopened by lookups too, when another process has compacted the pack
+    mutable int pack_fd_ = -1;
+    mutable int index_fd_ = -1;
+    // Latest entry of every graph id, read up to index_read_offset_ bytes of the index file
+    mutable std::unordered_map<std::string, PackIndexEntry> index_;
+    mutable uint64_t index_read_offset_ = 0;
+    // The pack is mapped again when it outgrows the last mapping; earlier mappings are kept, so
+    // views into them stay valid
+    mutable std::vector<Mapping> mappings_;
+    // Mappings of packs replaced by a compaction, kept for the same reason
+    mutable std::vector<Mapping> retired_mappings_;
+
+    /**
+     * Open the pack and its index, writing their headers if they are new or of another version.
+     */
+    void open_pack();
+
+    /**
+     * Take the exclusive lock of the pack. If another process has compacted the pack into a new
+     * file, the new pack and index are opened and locked instead, and the index is read again.
+     * @return false if the pack cannot be opened
+     */
+    bool lock_pack() const;
+
+    /**
+     * Warn about forests left in the per-file format of earlier versions, which are not read.
+     */
+    void warn_legacy_cache() const;
+
+    /**
+     * Read the index entries appended since the last read, by this or another process.
+     */
+    void read_index() const;
+
     /**
-     * Get the path for a graph's cached forest.
+     * Get the mapped bytes [offset, offset + size) of the pack, or nullptr if out of the file.
      */
-    std::string get_forest_path(const std::string& graph_id) const;
+    const char* map_range(uint64_t offset, uint64_t size) const;
 
     /**
-     * Sanitize graph_id for use as filename.
+     * Append a serialized forest to the pack and its entry to the index.
      */
-    static std::string sanitize_filename(const std::string& graph_id);
+    void append(const std::string& graph_id, uint32_t graph_hash, const std::vector<char>& record);
+
+    /**
+     * Release the mappings of the pack.
+     */
+    void unmap_all();
 
     /**
      * Collect all reachable ChartItems from a root.
@@ -228,13 +339,20 @@ private:
                                   std::unordered_map<ChartItem*, int32_t>& item_to_index);
 
     /**
-     * Serialize a ChartItem to a SerializedNode.
+     * Serialize a ChartItem to a SerializedNode, appending its children, parents and siblings to
+     * the flat arrays of the forest.
      */
     static void serialize_node(ChartItem* item,
                                const std::unordered_map<ChartItem*, int32_t>& item_to_index,
                                SerializedNode& node,
                                std::vector<int32_t>& children_out,
-                               std::vector<SerializedParentSib>& parents_out);
+                               std::vector<SerializedParentSib>& parents_out,
+                               std::vector<int32_t>& siblings_out);
+
+    /**
+     * Check the sizes of a serialized forest of `size` bytes at `data` and set up a view of it.
+     */
+    static bool make_view(const char* data, uint64_t size, ForestView& view);
 
     /**
      * Deserialize a SerializedNode to a ChartItem.
@@ -244,11 +362,7 @@ private:
     /**
      * Restore pointer relationships after deserializing all nodes.
      */
-    static void restore_relationships(
-        const std::vector<SerializedNode>& nodes,
-        const std::vector<std::vector<int32_t>>& all_children,
-        const std::vector<std::vector<SerializedParentSib>>& all_parents,
-        std::vector<ChartItem*>& items);
+    static void restore_relationships(const ForestView& view, std::vector<ChartItem*>& items);
 };
 
 }  // namespace forest_cache
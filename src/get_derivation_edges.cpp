@@ -404,10 +404,10 @@ int main(int argc, char *argv[]) {
                         if (!node) return;
                         shrg::ChartItem* p = node;
                         do {
-                            if (seen_indices.find(p->shrg_index) == seen_indices.end()) {
-                                seen_indices.insert(p->shrg_index);
+                            if (seen_indices.find(p->Annotations().shrg_index) == seen_indices.end()) {
+                                seen_indices.insert(p->Annotations().shrg_index);
                             }
-                            for (auto* child : p->children) {
+                            for (auto* child : p->Annotations().children) {
                                 collect_indices(child);
                             }
                             p = p->next_ptr;
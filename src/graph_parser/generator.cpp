@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <limits>
 
@@ -55,12 +56,35 @@ inline void GenerateToken(std::string &sentence, const std::string &token,
 }
 
 bool Generator::MatchTerminalEdges(NodeMapping &merged_mapping, const SHRG *grammar_ptr,
-                                   EdgeSet &edge_set, uint index) {
-    size_t edge_count = grammar_ptr->terminal_edges.size();
-    if (index == edge_count)
-        return edge_set.none();
+                                   const EdgeSet &edge_set) {
+    // every edge of the item should be matched by exactly one terminal edge
+    if (edge_set.count() != grammar_ptr->terminal_edges.size())
+        return false;
 
-    const SHRG::Edge *shrg_edge_ptr = grammar_ptr->terminal_edges[index];
+    const EdsGraph *graph_ptr = Graph();
+    item_edges_.clear();
+    for (std::size_t i = edge_set._Find_first(); i < edge_set.size(); i = edge_set._Find_next(i))
+        item_edges_.push_back(&graph_ptr->edges[i]);
+
+    PlanTerminalMatch(
+        *grammar_ptr,
+        [this](const SHRG::Edge *shrg_edge_ptr) {
+            return std::count_if(item_edges_.begin(), item_edges_.end(), [&](auto edge_ptr) {
+                return edge_ptr->label == shrg_edge_ptr->label &&
+                       edge_ptr->linked_nodes.size() == shrg_edge_ptr->linked_nodes.size();
+            });
+        },
+        match_plan_);
+
+    EdgeSet used_edges;
+    return MatchPlannedEdges(merged_mapping, used_edges, 0);
+}
+
+bool Generator::MatchPlannedEdges(NodeMapping &merged_mapping, EdgeSet &used_edges, uint index) {
+    if (index == match_plan_.size())
+        return true;
+
+    const SHRG::Edge *shrg_edge_ptr = match_plan_[index];
     assert(shrg_edge_ptr->is_terminal);
     size_t node_count = shrg_edge_ptr->linked_nodes.size();
 
@@ -71,10 +95,10 @@ bool Generator::MatchTerminalEdges(NodeMapping &merged_mapping, const SHRG *gram
     uint from = merged_mapping[shrg_edge_ptr->linked_nodes[0]->index];
     uint to = (node_count > 1) ? merged_mapping[shrg_edge_ptr->linked_nodes[1]->index] : 0;
 
-    const EdsGraph *graph_ptr = Graph();
-    for (uint i = 0; i < edge_set.size(); i++) {
-        const EdsGraph::Edge &eds_edge = graph_ptr->edges[i];
-        if (eds_edge.linked_nodes.size() != node_count || eds_edge.label != shrg_edge_ptr->label)
+    for (const EdsGraph::Edge *edge_ptr : item_edges_) {
+        const EdsGraph::Edge &eds_edge = *edge_ptr;
+        if (used_edges[eds_edge.index] || eds_edge.linked_nodes.size() != node_count ||
+            eds_edge.label != shrg_edge_ptr->label)
             continue;
         uint current_from = eds_edge.linked_nodes[0]->index + 1;
         uint current_to = (node_count > 1) ? eds_edge.linked_nodes[1]->index + 1 : 0;
@@ -85,10 +109,10 @@ bool Generator::MatchTerminalEdges(NodeMapping &merged_mapping, const SHRG *gram
         if (shrg_to_index >= 0)
             merged_mapping[shrg_to_index] = current_to;
 
-        edge_set[i] = false; // try match this edge
-        if (MatchTerminalEdges(merged_mapping, grammar_ptr, edge_set, index + 1))
+        used_edges[eds_edge.index] = true; // try match this edge
+        if (MatchPlannedEdges(merged_mapping, used_edges, index + 1))
             return true;
-        edge_set[i] = true;
+        used_edges[eds_edge.index] = false;
 
         merged_mapping[shrg_from_index] = from;
         if (shrg_to_index >= 0)
@@ -97,6 +121,35 @@ bool Generator::MatchTerminalEdges(NodeMapping &merged_mapping, const SHRG *gram
     return false;
 }
 
+void Generator::ResolveChildren(ChartItem *chart_item_ptr, ChartItem **children) {
+    for (auto edge_ptr : chart_item_ptr->attrs_ptr->grammar_ptr->nonterminal_edges)
+        *children++ = ResolveChartItemByEdge(chart_item_ptr, edge_ptr);
+}
+
+ChartItem *Generator::FindChartItemByEdge(ChartItem *chart_item_ptr,
+                                          const SHRG::Edge *shrg_edge_ptr) {
+    if (ChartItem *const *children = parser_->RecordedChildren(chart_item_ptr)) {
+        auto &nonterminal_edges = chart_item_ptr->attrs_ptr->grammar_ptr->nonterminal_edges;
+        auto it = std::find(nonterminal_edges.begin(), nonterminal_edges.end(), shrg_edge_ptr);
+        assert(it != nonterminal_edges.end());
+        return children[it - nonterminal_edges.begin()];
+    }
+    return ResolveChartItemByEdge(chart_item_ptr, shrg_edge_ptr);
+}
+
+void Generator::FindChildren(ChartItem *chart_item_ptr, std::vector<ChartItem *> &children) {
+    std::size_t num_children = chart_item_ptr->attrs_ptr->grammar_ptr->nonterminal_edges.size();
+    if (num_children == 0)
+        return;
+    std::size_t offset = children.size();
+    if (ChartItem *const *recorded_children = parser_->RecordedChildren(chart_item_ptr))
+        children.insert(children.end(), recorded_children, recorded_children + num_children);
+    else {
+        children.resize(offset + num_children);
+        ResolveChildren(chart_item_ptr, children.data() + offset);
+    }
+}
+
 std::size_t Generator::CountChartItems(ChartItem *chart_item_ptr) {
     std::size_t count = 0;
     ChartItem *current_ptr = chart_item_ptr;
@@ -106,8 +159,10 @@ std::size_t Generator::CountChartItems(ChartItem *chart_item_ptr) {
             current_ptr->status = ChartItem::kVisited;
 
             const SHRG *grammar_ptr = current_ptr->attrs_ptr->grammar_ptr;
+            ChartItem *const *children = parser_->RecordedChildren(current_ptr);
             for (auto edge_ptr : grammar_ptr->nonterminal_edges)
-                count += CountChartItems(FindChartItemByEdge(current_ptr, edge_ptr));
+                count += CountChartItems(children ? *children++
+                                                  : ResolveChartItemByEdge(current_ptr, edge_ptr));
         }
         current_ptr = current_ptr->next_ptr;
     } while (current_ptr != chart_item_ptr);
@@ -203,10 +258,8 @@ int Generator::Generate(ChartItem *chart_item_ptr, Derivation &derivation, std::
                     is_mapping_computed = true;
                     CopyMapping(chart_item_ptr->boundary_node_mapping, full_mapping,
                                 grammar_ptr->external_nodes);
-                    EdgeSet edge_set = chart_item_ptr->edge_set;
-
                     [[maybe_unused]] bool success =
-                        MatchTerminalEdges(full_mapping, grammar_ptr, edge_set, 0);
+                        MatchTerminalEdges(full_mapping, grammar_ptr, chart_item_ptr->edge_set);
 //                    assert(success);
                 }
                 auto &nodes = item.aligned_edge_ptr->linked_nodes;
@@ -8,10 +8,18 @@ class Generator {
   protected:
     const SHRGParserBase *parser_ = nullptr;
 
+    // edges of the item being matched and the order of the terminal edges matched against them
+    std::vector<const EdsGraph::Edge *> item_edges_;
+    std::vector<const SHRG::Edge *> match_plan_;
+
     virtual float GetScoreOfChilren(ChartItem *current_ptr);
 
-    bool MatchTerminalEdges(NodeMapping &merged_mapping, const SHRG *grammar_ptr, EdgeSet &edge_set,
-                            uint index);
+    // recovers the full node mapping of a chart item which consists of the terminal edges of
+    // `grammar_ptr` only; `merged_mapping` is left unchanged if there is no such mapping
+    bool MatchTerminalEdges(NodeMapping &merged_mapping, const SHRG *grammar_ptr,
+                            const EdgeSet &edge_set);
+
+    bool MatchPlannedEdges(NodeMapping &merged_mapping, EdgeSet &used_edges, uint index);
 
   public:
     // Find best chart_item in a cycle list recursively
@@ -21,8 +29,19 @@ class Generator {
 
     virtual ~Generator() {}
 
-    virtual ChartItem *FindChartItemByEdge(ChartItem *chart_item_ptr,
-                                           const SHRG::Edge *shrg_edge_ptr) = 0;
+    // derives the child item of `chart_item_ptr` at `shrg_edge_ptr` from its left and right items
+    virtual ChartItem *ResolveChartItemByEdge(ChartItem *chart_item_ptr,
+                                              const SHRG::Edge *shrg_edge_ptr) = 0;
+
+    // stores the children of `chart_item_ptr` into `children`, in the order of
+    // SHRG::nonterminal_edges
+    virtual void ResolveChildren(ChartItem *chart_item_ptr, ChartItem **children);
+
+    // the child item at `shrg_edge_ptr`, taken from the children recorded by the parser if any
+    ChartItem *FindChartItemByEdge(ChartItem *chart_item_ptr, const SHRG::Edge *shrg_edge_ptr);
+
+    // appends all children of `chart_item_ptr` to `children`
+    void FindChildren(ChartItem *chart_item_ptr, std::vector<ChartItem *> &children);
 
     int Generate(ChartItem *chart_item_ptr, Derivation &derivation, std::string &sentence);
 
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace shrg {
+
+namespace log_math {
+
+constexpr double kLog2E = 1.44269504088896338700e+00;
+// ln 2 split so that k * kLn2Hi is exact for |k| < 2^20
+constexpr double kLn2Hi = 6.93147180369123816490e-01;
+constexpr double kLn2Lo = 1.90821492927058770002e-10;
+// adding and subtracting 1.5 * 2^52 rounds a double of magnitude below 2^51 to an integer,
+// without a call or a branch
+constexpr double kRoundShifter = 6755399441055744.0;
+
+inline double RoundToInteger(double x) { return (x + kRoundShifter) - kRoundShifter; }
+
+// 2^k for -1022 <= k <= 1023, built from its exponent bits (and 0 for k = -1023)
+inline double Pow2(int64_t k) {
+    uint64_t bits = static_cast<uint64_t>(k + 1023) << 52;
+    double result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+} // namespace log_math
+
+// exp(x) for x <= 0 with a relative error of a few ulp; 0 below -708 (and for -inf), where exp(x)
+// is no longer a normal double. There are no branches, so loops over arrays get vectorized.
+inline double ExpNonPositive(double x) {
+    using namespace log_math;
+    bool underflow = !(x >= -708.0);
+    x = underflow ? 0.0 : x;
+    // x = k ln2 + r with |r| <= ln2 / 2
+    double k = RoundToInteger(x * kLog2E);
+    double r = (x - k * kLn2Hi) - k * kLn2Lo;
+    // Taylor polynomial of degree 13, its truncation error is below 1e-17 for |r| <= ln2 / 2
+    double p = 1.0 / 6227020800.0;
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    return underflow ? 0.0 : p * Pow2(static_cast<int64_t>(k));
+}
+
+// log(exp(values[0]) + ... + exp(values[n - 1])) with a single log: the values are shifted by
+// their maximum, so every exp is of a non-positive number. -inf if n is 0 or all values are -inf.
+inline double LogSumExp(const double *values, std::size_t n) {
+    constexpr double log_zero = -std::numeric_limits<double>::infinity();
+    if (n == 1)
+        return values[0];
+    std::size_t max_index = 0;
+    for (std::size_t i = 1; i < n; ++i)
+        max_index = values[i] > values[max_index] ? i : max_index;
+    double max_value = n == 0 ? log_zero : values[max_index];
+    if (max_value == log_zero)
+        return log_zero;
+
+    // sum of the others relative to the maximum; four independent sums, in a fixed order, so
+    // that the exps run side by side
+    double sums[4] = {0.0, 0.0, 0.0, 0.0};
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        for (std::size_t j = 0; j < 4; ++j)
+            sums[j] += i + j == max_index ? 0.0 : ExpNonPositive(values[i + j] - max_value);
+    for (; i < n; ++i)
+        sums[0] += i == max_index ? 0.0 : ExpNonPositive(values[i] - max_value);
+    return max_value + std::log1p((sums[0] + sums[1]) + (sums[2] + sums[3]));
+}
+
+// A nonnegative number mantissa * 2^exponent with the mantissa in [0.5, 1), or 0. Sums and
+// products of probabilities keep full precision over any range without leaving linear space, only
+// the conversions from and to log space take an exp or a log. The arithmetic has no data dependent
+// branches, addends come in any order of magnitude.
+class ScaledProb {
+  private:
+    // the exponent of 0, below that of any other number, so 0 needs no special case in sums
+    static constexpr int64_t kZeroExponent = -(int64_t(1) << 60);
+
+    double mantissa_ = 0.0;
+    int64_t exponent_ = kZeroExponent;
+
+    ScaledProb(double mantissa, int64_t exponent) : mantissa_(mantissa), exponent_(exponent) {
+        Normalize();
+    }
+
+    // moves a positive normal (or zero) mantissa to [0.5, 1) by rewriting its exponent bits
+    void Normalize() {
+        uint64_t bits;
+        std::memcpy(&bits, &mantissa_, sizeof(bits));
+        constexpr uint64_t kExponentMask = uint64_t(0x7ff) << 52;
+        int64_t shift = static_cast<int64_t>((bits & kExponentMask) >> 52) - 1022;
+        uint64_t normalized = (bits & ~kExponentMask) | (uint64_t(1022) << 52);
+        bool zero = bits == 0;
+        normalized = zero ? 0 : normalized;
+        std::memcpy(&mantissa_, &normalized, sizeof(normalized));
+        exponent_ = zero ? kZeroExponent : exponent_ + shift;
+    }
+
+  public:
+    static constexpr double log_zero = -std::numeric_limits<double>::infinity();
+
+    ScaledProb() = default;
+
+    static ScaledProb One() { return ScaledProb(1.0, 0); }
+
+    static ScaledProb FromLog(double log_value) {
+        using namespace log_math;
+        if (!(log_value > log_zero))
+            return ScaledProb();
+        // log_value = (k + 1) ln2 + (r - ln2) with |r| <= ln2 / 2
+        double k = RoundToInteger(log_value * kLog2E);
+        double r = (log_value - k * kLn2Hi) - k * kLn2Lo;
+        return ScaledProb(ExpNonPositive((r - kLn2Hi) - kLn2Lo), static_cast<int64_t>(k) + 1);
+    }
+
+    bool IsZero() const { return mantissa_ == 0.0; }
+
+    double Log() const {
+        using namespace log_math;
+        if (IsZero())
+            return log_zero;
+        double exponent = static_cast<double>(exponent_);
+        return exponent * kLn2Hi + (exponent * kLn2Lo + std::log(mantissa_));
+    }
+
+    // 1 / this, which must not be 0
+    ScaledProb Inverse() const { return ScaledProb(1.0 / mantissa_, -exponent_); }
+
+    ScaledProb &operator*=(const ScaledProb &other) {
+        // the product of two mantissas is in [0.25, 1)
+        mantissa_ *= other.mantissa_;
+        exponent_ += other.exponent_;
+        Normalize();
+        return *this;
+    }
+
+    ScaledProb &operator+=(const ScaledProb &other) {
+        // both addends are aligned to the larger exponent; 2^-1023 is built as 0, so an addend
+        // below 2^-1022 of the other one is dropped
+        int64_t exponent = std::max(exponent_, other.exponent_);
+        double scale = log_math::Pow2(std::max<int64_t>(exponent_ - exponent, -1023));
+        double other_scale = log_math::Pow2(std::max<int64_t>(other.exponent_ - exponent, -1023));
+        // the sum is in [0.5, 2)
+        mantissa_ = mantissa_ * scale + other.mantissa_ * other_scale;
+        exponent_ = exponent;
+        Normalize();
+        return *this;
+    }
+
+    friend ScaledProb operator*(ScaledProb a, const ScaledProb &b) { return a *= b; }
+    friend ScaledProb operator+(ScaledProb a, const ScaledProb &b) { return a += b; }
+};
+
+} // namespace shrg
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,114 @@
+#include <stdexcept>
+#include <unordered_map>
+
+#include "generator.hpp"
+#include "packed_forest.hpp"
+
+namespace shrg {
+
+template <typename ChildrenOf, typename RuleOf>
+void PackedForest::BuildFrom(ChartItem *root_ptr, ChildrenOf children_of, RuleOf rule_of) {
+    Clear();
+    if (!root_ptr)
+        return;
+
+    // node of every item; kPending marks the nodes on the current path of the depth-first search
+    const uint32_t kPending = std::numeric_limits<uint32_t>::max();
+    std::unordered_map<ChartItem *, uint32_t> node_of;
+
+    struct Frame {
+        ChartItem *head_ptr;
+        bool expanded;
+    };
+    std::vector<Frame> stack{{root_ptr, false}};
+    std::vector<ChartItem *> item_children;
+
+    while (!stack.empty()) {
+        Frame &frame = stack.back();
+        ChartItem *head_ptr = frame.head_ptr;
+        if (!frame.expanded) {
+            if (node_of.count(head_ptr)) { // reached through another parent
+                stack.pop_back();
+                continue;
+            }
+            frame.expanded = true;
+            ChartItem *current_ptr = head_ptr;
+            do {
+                node_of.emplace(current_ptr, kPending);
+                current_ptr = current_ptr->next_ptr;
+            } while (current_ptr && current_ptr != head_ptr);
+
+            current_ptr = head_ptr;
+            do {
+                item_children.clear();
+                children_of(current_ptr, item_children);
+                for (ChartItem *child_ptr : item_children)
+                    if (!node_of.count(child_ptr))
+                        stack.push_back({child_ptr, false});
+                current_ptr = current_ptr->next_ptr;
+            } while (current_ptr && current_ptr != head_ptr);
+            continue;
+        }
+
+        // all children are done, so the node gets the next index
+        stack.pop_back();
+        uint32_t node_index = nodes_.size();
+        Node node{static_cast<uint32_t>(edges_.size()), 0};
+        ChartItem *current_ptr = head_ptr;
+        do {
+            node_of[current_ptr] = node_index;
+            item_children.clear();
+            children_of(current_ptr, item_children);
+
+            Hyperedge edge{rule_of(current_ptr), node_index,
+                           static_cast<uint32_t>(children_.size()), 0};
+            for (ChartItem *child_ptr : item_children) {
+                auto it = node_of.find(child_ptr);
+                assert(it != node_of.end());
+                if (it->second == kPending)
+                    throw std::runtime_error("derivation forest is cyclic");
+                children_.push_back(it->second);
+            }
+            edge.child_end = children_.size();
+            edges_.push_back(edge);
+            items_.push_back(current_ptr);
+            current_ptr = current_ptr->next_ptr;
+        } while (current_ptr && current_ptr != head_ptr);
+        node.edge_end = edges_.size();
+        nodes_.push_back(node);
+    }
+}
+
+void PackedForest::Build(ChartItem *root_ptr, Generator *generator) {
+    BuildFrom(
+        root_ptr,
+        [generator](ChartItem *chart_item_ptr, std::vector<ChartItem *> &children) {
+            generator->FindChildren(chart_item_ptr, children);
+        },
+        [](ChartItem *chart_item_ptr) {
+            return const_cast<SHRG *>(chart_item_ptr->attrs_ptr->grammar_ptr);
+        });
+}
+
+void PackedForest::BuildFromAnnotations(ChartItem *root_ptr) {
+    BuildFrom(
+        root_ptr,
+        [](ChartItem *chart_item_ptr, std::vector<ChartItem *> &children) {
+            auto &item_children = chart_item_ptr->Annotations().children;
+            children.insert(children.end(), item_children.begin(), item_children.end());
+        },
+        [](ChartItem *chart_item_ptr) {
+            SHRG *rule_ptr = chart_item_ptr->Annotations().rule_ptr;
+            return rule_ptr ? rule_ptr
+                            : const_cast<SHRG *>(chart_item_ptr->attrs_ptr->grammar_ptr);
+        });
+}
+
+void PackedForest::Clear() {
+    nodes_.clear();
+    edges_.clear();
+    children_.clear();
+    items_.clear();
+}
+
+} // namespace shrg
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "log_math.hpp"
+#include "parser_chart_item.hpp"
+
+namespace shrg {
+
+class Generator;
+
+// Derivation forest in CSR layout. A node stands for a cycle of alternative chart items (linked by
+// next_ptr), a hyperedge for one item of the cycle: the rule it applies and its child nodes, one
+// per nonterminal edge. Nodes are numbered in topological order, children before parents, so the
+// root is the last node and every pass over the forest is a flat forward or backward sweep.
+//
+// The passes take the log weight of a rule from `rule_weight(rule_ptr)`, so EM and variational
+// inference only differ in the weights they plug in. The Scaled* passes are the
+// same sums and products in linear space, on ScaledProbs, and call neither exp nor log.
+class PackedForest {
+  public:
+    static constexpr double log_zero = -std::numeric_limits<double>::infinity();
+
+    struct Node {
+        uint32_t edge_begin; // hyperedges of the node are [edge_begin, edge_end)
+        uint32_t edge_end;
+    };
+
+    struct Hyperedge {
+        SHRG *rule_ptr;
+        uint32_t head;        // the node derived by this hyperedge
+        uint32_t child_begin; // child nodes are Children()[child_begin, child_end)
+        uint32_t child_end;
+    };
+
+  private:
+    std::vector<Node> nodes_;
+    std::vector<Hyperedge> edges_;
+    std::vector<uint32_t> children_;
+    // chart item of every hyperedge, valid as long as the forest it was built from
+    std::vector<ChartItem *> items_;
+
+    template <typename ChildrenOf, typename RuleOf>
+    void BuildFrom(ChartItem *root_ptr, ChildrenOf children_of, RuleOf rule_of);
+
+  public:
+    static double LogAdd(double a, double b) {
+        if (a == log_zero)
+            return b;
+        if (b == log_zero)
+            return a;
+        return a > b ? a + std::log1p(std::exp(b - a)) : b + std::log1p(std::exp(a - b));
+    }
+
+    // builds the forest of a parse result, children are found by `generator` (or taken from the
+    // ones recorded by the parser)
+    void Build(ChartItem *root_ptr, Generator *generator);
+
+    // builds a forest whose children are already linked in ChartItemAnnotations::children (the
+    // forests copied by EM or loaded from the forest cache)
+    void BuildFromAnnotations(ChartItem *root_ptr);
+
+    void Clear();
+
+    bool Empty() const { return nodes_.empty(); }
+    uint32_t NumNodes() const { return nodes_.size(); }
+    uint32_t NumEdges() const { return edges_.size(); }
+    uint32_t Root() const { return nodes_.size() - 1; }
+
+    const Node &GetNode(uint32_t node_index) const { return nodes_[node_index]; }
+    const Hyperedge &GetEdge(uint32_t edge_index) const { return edges_[edge_index]; }
+    const std::vector<uint32_t> &Children() const { return children_; }
+    ChartItem *Item(uint32_t edge_index) const { return items_[edge_index]; }
+
+    // bytes held by the arrays of the forest
+    std::size_t Bytes() const {
+        return nodes_.capacity() * sizeof(Node) + edges_.capacity() * sizeof(Hyperedge) +
+               children_.capacity() * sizeof(uint32_t) + items_.capacity() * sizeof(ChartItem *);
+    }
+
+    // log inside score of every node, returns the one of the root
+    template <typename RuleWeight>
+    double Inside(RuleWeight rule_weight, std::vector<double> &log_inside) const {
+        log_inside.assign(nodes_.size(), log_zero);
+        std::vector<double> edge_scores; // of the hyperedges of one node, summed at once
+        for (uint32_t i = 0; i < nodes_.size(); ++i) {
+            edge_scores.clear();
+            for (uint32_t e = nodes_[i].edge_begin; e < nodes_[i].edge_end; ++e) {
+                const Hyperedge &edge = edges_[e];
+                double log_children = 0.0;
+                for (uint32_t c = edge.child_begin; c < edge.child_end; ++c)
+                    log_children += log_inside[children_[c]];
+                edge_scores.push_back(rule_weight(edge.rule_ptr) + log_children);
+            }
+            log_inside[i] = LogSumExp(edge_scores.data(), edge_scores.size());
+        }
+        return Empty() ? log_zero : log_inside.back();
+    }
+
+    // log outside score of every node, the one of the root is 0
+    template <typename RuleWeight>
+    void Outside(RuleWeight rule_weight, const std::vector<double> &log_inside,
+                 std::vector<double> &log_outside) const {
+        log_outside.assign(nodes_.size(), log_zero);
+        if (Empty())
+            return;
+        log_outside.back() = 0.0;
+        for (uint32_t i = nodes_.size(); i-- > 0;) {
+            if (log_outside[i] == log_zero)
+                continue;
+            for (uint32_t e = nodes_[i].edge_begin; e < nodes_[i].edge_end; ++e) {
+                const Hyperedge &edge = edges_[e];
+                double log_base = rule_weight(edge.rule_ptr) + log_outside[i];
+                for (uint32_t c = edge.child_begin; c < edge.child_end; ++c) {
+                    double log_outside_of_child = log_base;
+                    for (uint32_t s = edge.child_begin; s < edge.child_end; ++s)
+                        if (s != c)
+                            log_outside_of_child += log_inside[children_[s]];
+                    double &child_outside = log_outside[children_[c]];
+                    child_outside = LogAdd(child_outside, log_outside_of_child);
+                }
+            }
+        }
+    }
+
+    // calls `function(edge_index, log_count)` with the log expected count of every hyperedge, where
+    // `log_partition` is the log inside score of the root
+    template <typename RuleWeight, typename Function>
+    void ForEachEdgeCount(RuleWeight rule_weight, const std::vector<double> &log_inside,
+                          const std::vector<double> &log_outside, double log_partition,
+                          Function function) const {
+        for (uint32_t e = 0; e < edges_.size(); ++e) {
+            const Hyperedge &edge = edges_[e];
+            double log_count = rule_weight(edge.rule_ptr);
+            log_count += log_outside[edge.head];
+            log_count -= log_partition;
+            for (uint32_t c = edge.child_begin; c < edge.child_end; ++c)
+                log_count += log_inside[children_[c]];
+            function(e, log_count);
+        }
+    }
+
+    // inside score of every node in linear space, returns the one of the root; the weight of a
+    // hyperedge is `edge_weight(edge_index)`
+    template <typename EdgeWeight>
+    ScaledProb ScaledInside(EdgeWeight edge_weight, std::vector<ScaledProb> &inside) const {
+        inside.assign(nodes_.size(), ScaledProb());
+        for (uint32_t i = 0; i < nodes_.size(); ++i) {
+            ScaledProb node_inside;
+            for (uint32_t e = nodes_[i].edge_begin; e < nodes_[i].edge_end; ++e) {
+                const Hyperedge &edge = edges_[e];
+                ScaledProb edge_inside = edge_weight(e);
+                for (uint32_t c = edge.child_begin; c < edge.child_end; ++c)
+                    edge_inside *= inside[children_[c]];
+                node_inside += edge_inside;
+            }
+            inside[i] = node_inside;
+        }
+        return Empty() ? ScaledProb() : inside.back();
+    }
+
+    // outside score of every node in linear space, the one of the root is 1
+    template <typename EdgeWeight>
+    void ScaledOutside(EdgeWeight edge_weight, const std::vector<ScaledProb> &inside,
+                       std::vector<ScaledProb> &outside) const {
+        outside.assign(nodes_.size(), ScaledProb());
+        if (Empty())
+            return;
+        outside.back() = ScaledProb::One();
+        for (uint32_t i = nodes_.size(); i-- > 0;) {
+            if (outside[i].IsZero())
+                continue;
+            for (uint32_t e = nodes_[i].edge_begin; e < nodes_[i].edge_end; ++e) {
+                const Hyperedge &edge = edges_[e];
+                ScaledProb base = edge_weight(e) * outside[i];
+                for (uint32_t c = edge.child_begin; c < edge.child_end; ++c) {
+                    ScaledProb outside_of_child = base;
+                    for (uint32_t s = edge.child_begin; s < edge.child_end; ++s)
+                        if (s != c)
+                            outside_of_child *= inside[children_[s]];
+                    outside[children_[c]] += outside_of_child;
+                }
+            }
+        }
+    }
+
+    // calls `function(edge_index, count)` with the expected count of every hyperedge in linear
+    // space, where `partition` is the inside score of the root and must not be 0
+    template <typename EdgeWeight, typename Function>
+    void ForEachScaledEdgeCount(EdgeWeight edge_weight, const std::vector<ScaledProb> &inside,
+                                const std::vector<ScaledProb> &outside,
+                                const ScaledProb &partition, Function function) const {
+        ScaledProb inverse_partition = partition.Inverse();
+        for (uint32_t e = 0; e < edges_.size(); ++e) {
+            const Hyperedge &edge = edges_[e];
+            ScaledProb count = edge_weight(e) * outside[edge.head] * inverse_partition;
+            for (uint32_t c = edge.child_begin; c < edge.child_end; ++c)
+                count *= inside[children_[c]];
+            function(e, count);
+        }
+    }
+};
+
+} // namespace shrg
+
+// Local Variables:
+// mode: c++
+// End:
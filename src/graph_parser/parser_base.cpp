@@ -1,17 +1,16 @@
 #include <iostream>
+#include <unordered_set>
 
+#include "generator.hpp"
 #include "parser_base.hpp"
 
 namespace shrg {
 
 using std::size_t;
 
-static ChartItem invalid_chart_item(nullptr, {}, {.m8 = {UINT64_MAX, UINT64_MAX}});
-const Ref<ChartItem> ChartItemSet::empty_key_(invalid_chart_item);
-
 ParserError SHRGParserBase::BeforeParse(const EdsGraph &graph) {
     size_t edge_count = graph.edges.size();
-    if (edge_count > MAX_GRAPH_EDGE_COUNT)
+    if (edge_count > MAX_GRAPH_EDGE_COUNT || graph.nodes.size() >= MAX_GRAPH_NODE_COUNT)
         return ParserError::kTooLarge;
 
     // set edge mask
@@ -19,6 +18,8 @@ ParserError SHRGParserBase::BeforeParse(const EdsGraph &graph) {
     all_edges_in_graph_ = 0;
     all_edges_in_graph_.flip();
     all_edges_in_graph_ >>= all_edges_in_graph_.size() - edge_count;
+
+    ComputeIncidenceMasks(graph, incident_edges_);
     return ParserError::kNone;
 }
 
@@ -30,9 +31,52 @@ void SHRGParserBase::ClearChart() {
     SHRG_DEBUG_RESET(num_succ_merge_operations_);
     SHRG_DEBUG_RESET(num_total_merge_operations_);
     SHRG_DEBUG_RESET(num_indexing_keys_);
+    SHRG_DEBUG_RESET(num_agenda_updates_);
+    SHRG_DEBUG_RESET(num_agenda_revisits_);
 
     matched_item_ptr_ = nullptr;
     items_pool_.Clear();
+    item_children_.clear();
+
+    // the peak of a parse starts from what the cleared chart still holds
+    memory_.Assign(utils::MemoryKind::kPool, items_pool_.Bytes());
+    memory_.ResetPeak();
+}
+
+void SHRGParserBase::RecordChildrenOf(ChartItem *chart_item_ptr) {
+    std::size_t num_children = chart_item_ptr->attrs_ptr->grammar_ptr->nonterminal_edges.size();
+    if (num_children == 0 || chart_item_ptr->children_offset != ChartItem::kNoChildren)
+        return;
+
+    std::size_t offset = item_children_.size();
+    item_children_.resize(offset + num_children);
+    GetGenerator()->ResolveChildren(chart_item_ptr, item_children_.data() + offset);
+    chart_item_ptr->children_offset = offset;
+}
+
+void SHRGParserBase::RecordForestChildren(ChartItem *root_ptr) {
+    if (!root_ptr)
+        return;
+
+    std::unordered_set<ChartItem *> visited{root_ptr};
+    std::vector<ChartItem *> stack{root_ptr};
+    while (!stack.empty()) {
+        ChartItem *head_ptr = stack.back();
+        stack.pop_back();
+
+        ChartItem *current_ptr = head_ptr;
+        do {
+            RecordChildrenOf(current_ptr);
+            if (ChartItem *const *children = RecordedChildren(current_ptr)) {
+                std::size_t num_children =
+                    current_ptr->attrs_ptr->grammar_ptr->nonterminal_edges.size();
+                for (std::size_t i = 0; i < num_children; ++i)
+                    if (visited.insert(children[i]).second)
+                        stack.push_back(children[i]);
+            }
+            current_ptr = current_ptr->next_ptr;
+        } while (current_ptr && current_ptr != head_ptr);
+    }
 }
 
 void PrecomputeBoundaryNodesForHRG(NodeMapping &boundary_nodes_of_hrg, const SHRG &grammar,
@@ -1,35 +1,33 @@
 #pragma  once
 
-#include "../include/memory_utils.hpp"
+#include <atomic>
+#include <chrono>
 
-#include "sparsehash/dense_hash_map"
+#include "../include/flat_hash_table.hpp"
+#include "../include/memory_utils.hpp"
 
 #include "parser_debug.hpp"
 #include "parser_utils.hpp"
 
 namespace shrg {
 
-using ChartItemList = std::vector<ChartItem *>;
+// containers of the parsers whose size depends on the graph charge the MemoryAccount of the parser
+using ChartItemList = utils::CountedVector<ChartItem *>;
 class ChartItemSet {
   private:
-    std::vector<ChartItem *> items_;
-    google::dense_hash_map<Ref<ChartItem>, int> item_to_index_;
-
-    static const Ref<ChartItem> empty_key_;
+    ChartItemList items_;
+    utils::FlatIndexTable<Ref<ChartItem>> item_to_index_; // indices into items_
 
   public:
     using iterator = decltype(items_.begin());
     using const_iterator = decltype(items_.cbegin());
 
-    ChartItemSet() { // google dense_hash_map need an empty_key
-        item_to_index_.set_empty_key(empty_key_);
-    }
-
     const ChartItemList &AsList() const { return items_; }
 
+    // O(1) for the index; its slots are kept for the next graph unless they are mostly unused
     void Clear() {
         items_.clear();
-        item_to_index_.clear(); // TODO: optimize memory use
+        item_to_index_.Clear();
     }
 
     iterator begin() { return items_.begin(); }
@@ -49,7 +47,7 @@ class ChartItemSet {
     // Try to insert a new subgraph
     bool TryInsert(ChartItem *chart_item_ptr) {
         Ref<ChartItem> subgraph_ref(*chart_item_ptr);
-        auto result = item_to_index_.insert({subgraph_ref, items_.size()});
+        auto result = item_to_index_.Insert(subgraph_ref);
         if (!result.second) { // insertion failed
             // Because a subgraph may have multiple derivations, the `subgraph' here is actually a
             // tuple of subgraph and derivation. (graph part and derivation part) But if two such
@@ -59,7 +57,11 @@ class ChartItemSet {
             // this subgraph should not be already inserted into cycle list
             assert(!chart_item_ptr->next_ptr);
 
-            items_[result.first->second]->Push(chart_item_ptr);
+            ChartItem *head_ptr = items_[result.first];
+            head_ptr->Push(chart_item_ptr);
+            // the entry stands for all derivations of the subgraph
+            head_ptr->viterbi_score =
+                std::max(head_ptr->viterbi_score, chart_item_ptr->viterbi_score);
 
             assert(chart_item_ptr->next_ptr); // this subgraph should be inserted into cycle list
             return false;
@@ -88,7 +90,9 @@ enum class ParserError {
     kOutOfMemory = 2,
     kTooLarge = 3,
     kUnInitialized = 4,
-    kUnknown = 5
+    kUnknown = 5,
+    kTimeout = 6,
+    kCancelled = 7
 };
 
 constexpr const char *ToString(ParserError v) {
@@ -103,11 +107,67 @@ constexpr const char *ToString(ParserError v) {
         return "TooLarge";
     case ParserError::kOutOfMemory:
         return "OutOfMemory";
+    case ParserError::kTimeout:
+        return "Timeout";
+    case ParserError::kCancelled:
+        return "Cancelled";
     default:
         return "???";
     }
 }
 
+// When a parse has to give up: a point in time and/or a flag raised by another thread. Parsers
+// check it before every agenda update and stop with kTimeout or kCancelled respectively, so the
+// check is cooperative and a single update is never interrupted.
+struct Deadline {
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point time_point = Clock::time_point::max(); // max() for no time limit
+    const std::atomic<bool> *cancelled = nullptr;            // nullptr if it can't be cancelled
+
+    Deadline() = default;
+
+    explicit Deadline(const std::atomic<bool> *cancelled_) : cancelled(cancelled_) {}
+
+    // expires `seconds` from now; a non-positive value means no time limit
+    static Deadline After(double seconds, const std::atomic<bool> *cancelled = nullptr) {
+        Deadline deadline(cancelled);
+        if (seconds > 0)
+            deadline.time_point =
+                Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                   std::chrono::duration<double>(seconds));
+        return deadline;
+    }
+
+    bool IsSet() const { return cancelled || time_point != Clock::time_point::max(); }
+
+    bool Cancelled() const { return cancelled && cancelled->load(std::memory_order_relaxed); }
+
+    bool TimedOut() const {
+        return time_point != Clock::time_point::max() && Clock::now() >= time_point;
+    }
+};
+
+// Read-only data derived from the grammars (tree decompositions, masks, ...). It is built once
+// and shared by all parsers of the same kind, so it must not be modified after construction.
+class CompiledGrammar {
+  protected:
+    const std::vector<SHRG> &grammars_;
+    GrammarLabelIndex label_index_;
+
+  public:
+    explicit CompiledGrammar(const std::vector<SHRG> &grammars)
+        : grammars_(grammars), label_index_(grammars) {}
+
+    CompiledGrammar(const CompiledGrammar &other) = delete;
+    CompiledGrammar &operator=(const CompiledGrammar &other) = delete;
+
+    const std::vector<SHRG> &Grammars() const { return grammars_; }
+    const GrammarLabelIndex &LabelIndex() const { return label_index_; }
+
+    virtual ~CompiledGrammar() {}
+};
+
 #define DEFINE_GETTER(modifier, type, name, getter)                                                \
   public:                                                                                          \
     type Get##getter() const { return name; }                                                      \
@@ -122,6 +182,9 @@ class SHRGParserBase {
     const char *parser_type_;
     bool verbose_ = true;
     uint max_pool_size_ = 1024; // unlimited
+    Deadline deadline_;         // of every following parse
+    // bytes held by the chart: the item pool and the containers charged while parsing
+    utils::MemoryAccount memory_;
 
     DEFINE_GETTER(protected, uint64_t, num_grammars_available_, NumGrammarsAvailable);
     DEFINE_GETTER(protected, uint64_t, num_terminal_subgraphs_, NumTerminalSubgraphs);
@@ -130,10 +193,14 @@ class SHRGParserBase {
     DEFINE_GETTER(protected, uint64_t, num_succ_merge_operations_, NumSuccMergeOps);
     DEFINE_GETTER(protected, uint64_t, num_total_merge_operations_, NumTotalMergeOps);
     DEFINE_GETTER(protected, uint64_t, num_indexing_keys_, NumIndexingKeys);
+    DEFINE_GETTER(protected, uint64_t, num_agenda_updates_, NumAgendaUpdates);
+    DEFINE_GETTER(protected, uint64_t, num_agenda_revisits_, NumAgendaRevisits);
 
     // point to current edsgraph
     const EdsGraph *graph_ptr_;
     EdgeSet all_edges_in_graph_;
+    // edges linked to each node of current edsgraph, used for boundary tests
+    IncidenceMasks incident_edges_;
 
     // point to SHRG grammars
     const std::vector<SHRG> &grammars_;
@@ -143,25 +210,58 @@ class SHRGParserBase {
     Label start_symbol_;
     ChartItem *matched_item_ptr_; // head pointer of parsing results
     utils::MemoryPool<ChartItem> items_pool_;
+    // selects the grammars usable for current graph
+    GrammarSelector grammar_selector_;
+    // children of the completed items, one per nonterminal edge in the order of
+    // SHRG::nonterminal_edges, see ChartItem::children_offset
+    bool record_children_ = false;
+    utils::CountedVector<ChartItem *> item_children_;
 
     ParserError BeforeParse(const EdsGraph &graph);
 
+    // kOutOfMemory, kCancelled or kTimeout if the parse has to stop, checked before every agenda
+    // update. The caller drops its queued agendas, so the chart is ready for the next parse.
+    ParserError CheckLimits() {
+        if (items_pool_.PoolSize() > max_pool_size_)
+            return ParserError::kOutOfMemory;
+        memory_.Assign(utils::MemoryKind::kPool, items_pool_.Bytes());
+        if (memory_.OverBudget())
+            return ParserError::kOutOfMemory;
+        if (deadline_.Cancelled())
+            return ParserError::kCancelled;
+        if (deadline_.TimedOut())
+            return ParserError::kTimeout;
+        return ParserError::kNone;
+    }
+
     void ClearChart();
 
-    template <typename ResultMap> void SetCompleteItem(const ResultMap &results, int label_offset) {
-        auto it = results.find(static_cast<uint64_t>(start_symbol_) << label_offset);
-        if (it != results.end()) {
-            for (auto chart_item_ptr : it->second.passive_items)
-                if (chart_item_ptr->edge_set == all_edges_in_graph_) {
-                    // there should be only one possible solution
-                    assert(matched_item_ptr_ == nullptr);
-                    matched_item_ptr_ = chart_item_ptr;
+    // records the children of a completed item if SetRecordChildren(true) was called
+    void RecordChildren(ChartItem *chart_item_ptr) {
+        if (record_children_)
+            RecordChildrenOf(chart_item_ptr);
+    }
+
+    void RecordChildrenOf(ChartItem *chart_item_ptr);
+
+    // records the children of every item of the derivation forest of `root_ptr`, for parsers
+    // whose items only get their final children once the forest is expanded
+    void RecordForestChildren(ChartItem *root_ptr);
+
+    // `agenda_ptr` is the agenda of the start symbol, nullptr if there is none
+    template <typename AgendaType> void SetCompleteItem(const AgendaType *agenda_ptr) {
+        if (!agenda_ptr)
+            return;
+        for (auto chart_item_ptr : agenda_ptr->passive_items)
+            if (chart_item_ptr->edge_set == all_edges_in_graph_) {
+                // there should be only one possible solution
+                assert(matched_item_ptr_ == nullptr);
+                matched_item_ptr_ = chart_item_ptr;
 #ifdef NDEBUG
-                    // check in DEBUG mode
-                    break;
+                // check in DEBUG mode
+                break;
 #endif
-                }
-        }
+            }
     }
 
   public:
@@ -177,6 +277,30 @@ class SHRGParserBase {
     void SetVerbose(bool verbose) { verbose_ = verbose; }
     void SetStartSymbol(Label start_symbol) { start_symbol_ = start_symbol; }
     void SetPoolSize(uint max_pool_size) { max_pool_size_ = max_pool_size; }
+    // A parse stops with kOutOfMemory once the chart holds more than `max_memory_bytes` (0 is
+    // unlimited). Buffers kept from earlier parses count as well, since they are still held.
+    void SetMemoryBudget(std::size_t max_memory_bytes) { memory_.SetBudget(max_memory_bytes); }
+    const utils::MemoryAccount &Memory() const { return memory_; }
+
+    // high-water mark of the bytes held by the chart during the last parse
+    std::size_t PeakMemoryBytes() {
+        memory_.Assign(utils::MemoryKind::kPool, items_pool_.Bytes());
+        return memory_.PeakBytes();
+    }
+    // Lets the parser store the children of every completed item, so that the derivation forest
+    // comes out with its hyperedges already linked (see Generator::FindChildren).
+    void SetRecordChildren(bool record_children) { record_children_ = record_children; }
+    bool IsRecordingChildren() const { return record_children_; }
+
+    // children of `chart_item_ptr` recorded during the last parse, nullptr if there are none
+    ChartItem *const *RecordedChildren(const ChartItem *chart_item_ptr) const {
+        if (chart_item_ptr->children_offset == ChartItem::kNoChildren)
+            return nullptr;
+        return item_children_.data() + chart_item_ptr->children_offset;
+    }
+
+    void SetDeadline(const Deadline &deadline) { deadline_ = deadline; }
+    const Deadline &GetDeadline() const { return deadline_; }
 
     const EdsGraph *Graph() const { return graph_ptr_; }
     void SetGraph(const EdsGraph* graph) { graph_ptr_ = graph; }
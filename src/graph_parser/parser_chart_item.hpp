@@ -4,6 +4,9 @@
 #include <bitset>
 #include <boost/functional/hash.hpp>
 // #include <boost/functional/hash/hash_fix.hpp>
+#include <cassert>
+#include <limits>
+#include <memory>
 #include <unordered_set>
 #include <vector>
 #include <tuple>
@@ -14,6 +17,7 @@
 namespace shrg {
 
 const int MAX_GRAPH_EDGE_COUNT = 256;
+// NodeMapping stores (index of EdsGraph::Node + 1) in a uint8_t
 const int MAX_GRAPH_NODE_COUNT = 256;
 const int MAX_GRAMMAR_BOUNDARY_NODE_COUNT = 16;
 
@@ -54,33 +58,36 @@ template <typename T> Ref<T> GetRef(const T &t) { return Ref<T>(t); }
 
 struct GrammarAttributes;
 
-class ChartItem {
-  public:
-    static const int kEmpty = -1;
-    static const int kExpanded = -100;
-    static const int kVisited = -1000;
-    static constexpr double ZERO_LOG = 3000.0;
-    static constexpr double log_zero = -std::numeric_limits<double>::infinity();
+// Zobrist key of an edge. The hash of an edge set is the XOR of the keys of its edges, so the hash
+// of the union of two disjoint edge sets (which is what every merge produces) is the XOR of their
+// hashes.
+inline uint64_t EdgeKey(std::size_t edge_index) {
+    uint64_t z = (edge_index + 1) * 0x9e3779b97f4a7c15ULL; // splitmix64
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
 
-  public:
-    GrammarAttributes *attrs_ptr; // the attributes of the grammar that the item belongs to
+inline uint64_t HashEdgeSet(const EdgeSet &edge_set) {
+    uint64_t hash_value = 0;
+    for (std::size_t i = edge_set._Find_first(); i < edge_set.size(); i = edge_set._Find_next(i))
+        hash_value ^= EdgeKey(i);
+    return hash_value;
+}
 
-    ChartItem *next_ptr = nullptr;
-    ChartItem *left_ptr = nullptr;
-    ChartItem *right_ptr = nullptr;
+class ChartItem;
 
-    EdgeSet edge_set; // edge set of EdsGraph::Edge
-    // mapping from boundary nodes of SHRG (SHRG::Node) to boundary nodes of EDS (EdsGraph::Node,
-    // the index starts from 1)
-    NodeMapping boundary_node_mapping;
+// EM and derivation state of a chart item. The parser never reads any of it, so it is kept out
+// of the pooled ChartItem and only allocated when EM or decoding first touches an item.
+struct ChartItemAnnotations {
+    static const int kEmpty = -1;
+    static constexpr double log_zero = -std::numeric_limits<double>::infinity();
 
-    std::vector<ChartItem*> children;
-    std::vector<std::tuple<ChartItem*, std::vector<ChartItem*>>> parents_sib;
+    std::vector<ChartItem *> children;
+    std::vector<std::tuple<ChartItem *, std::vector<ChartItem *>>> parents_sib;
 
     int level = -1;
 
-    float score = 1.0; // initially above zero
-    int status = kEmpty;
     int inside_visited_status = kEmpty;
     int outside_visited_status = kEmpty;
     int count_visited_status = kEmpty;
@@ -101,18 +108,101 @@ class ChartItem {
     double log_sent_rule_count = log_zero;
     double log_inside_count = 0.0;
 
-
     int shrg_index = -1;
     shrg::SHRG *rule_ptr = nullptr;
 
     int rule_visited = kEmpty;
+};
+
+class ChartItem {
+  public:
+    static const int kEmpty = -1;
+    static const int kExpanded = -100;
+    static const int kVisited = -1000;
+    static const uint32_t kNoChildren = std::numeric_limits<uint32_t>::max();
+    static constexpr double ZERO_LOG = 3000.0;
+    static constexpr double log_zero = -std::numeric_limits<double>::infinity();
+
+  public:
+    GrammarAttributes *attrs_ptr; // the attributes of the grammar that the item belongs to
+
+    ChartItem *next_ptr = nullptr;
+    ChartItem *left_ptr = nullptr;
+    ChartItem *right_ptr = nullptr;
+
+    EdgeSet edge_set; // edge set of EdsGraph::Edge
+    // mapping from boundary nodes of SHRG (SHRG::Node) to boundary nodes of EDS (EdsGraph::Node,
+    // the index starts from 1)
+    NodeMapping boundary_node_mapping;
+    // HashEdgeSet(edge_set), kept up to date incrementally
+    uint64_t edge_set_hash = 0;
+
+    float score = 1.0; // initially above zero
+    int status = kEmpty;
+    // log score of the best derivation of the subgraph found so far (sum of RuleScore() of the
+    // rules in it), which orders the merges of the pruned parse mode
+    float viterbi_score = 0.0f;
+    // position of the children of the item in the side array of the parser that completed it
+    // (see SHRGParserBase::SetRecordChildren), kNoChildren if they are not recorded
+    uint32_t children_offset = kNoChildren;
 
     ChartItem() : attrs_ptr(nullptr), boundary_node_mapping{} {}
 
     explicit ChartItem(GrammarAttributes *attrs_ptr, //
                        const EdgeSet &edge_set_ = 0, //
                        const NodeMapping &node_mapping_ = {})
-        : attrs_ptr(attrs_ptr), edge_set(edge_set_), boundary_node_mapping(node_mapping_) {}
+        : attrs_ptr(attrs_ptr), edge_set(edge_set_), boundary_node_mapping(node_mapping_),
+          edge_set_hash(HashEdgeSet(edge_set_)) {}
+
+    ChartItem(GrammarAttributes *attrs_ptr,                       //
+              const EdgeSet &edge_set_, uint64_t edge_set_hash_, //
+              const NodeMapping &node_mapping_)
+        : attrs_ptr(attrs_ptr), edge_set(edge_set_), boundary_node_mapping(node_mapping_),
+          edge_set_hash(edge_set_hash_) {}
+
+    ChartItem(const ChartItem &other)
+        : attrs_ptr(other.attrs_ptr), next_ptr(other.next_ptr), left_ptr(other.left_ptr),
+          right_ptr(other.right_ptr), edge_set(other.edge_set),
+          boundary_node_mapping(other.boundary_node_mapping),
+          edge_set_hash(other.edge_set_hash), score(other.score), status(other.status),
+          viterbi_score(other.viterbi_score), children_offset(other.children_offset),
+          annotations_(other.annotations_
+                           ? std::make_unique<ChartItemAnnotations>(*other.annotations_)
+                           : nullptr) {}
+
+    ChartItem &operator=(const ChartItem &other) {
+        if (this != &other) {
+            ChartItem tmp(other);
+            std::swap(*this, tmp);
+        }
+        return *this;
+    }
+
+    ChartItem(ChartItem &&) = default;
+    ChartItem &operator=(ChartItem &&) = default;
+
+    void AddEdge(std::size_t edge_index) {
+        assert(!edge_set[edge_index]); // the key of an edge can only be added once
+        edge_set[edge_index] = true;
+        edge_set_hash ^= EdgeKey(edge_index);
+    }
+
+    bool HasAnnotations() const { return annotations_ != nullptr; }
+
+    // EM and derivation state, allocated on first use
+    ChartItemAnnotations &Annotations() {
+        if (!annotations_)
+            annotations_ = std::make_unique<ChartItemAnnotations>();
+        return *annotations_;
+    }
+
+    // an item that has never been annotated reads as freshly initialized
+    const ChartItemAnnotations &Annotations() const {
+        static const ChartItemAnnotations empty_annotations;
+        return annotations_ ? *annotations_ : empty_annotations;
+    }
+
+    void ClearAnnotations() { annotations_.reset(); }
 
     void Swap(ChartItem &other) {
         std::swap(attrs_ptr, other.attrs_ptr);
@@ -120,19 +210,24 @@ class ChartItem {
         std::swap(right_ptr, other.right_ptr);
         std::swap(score, other.score);
         std::swap(status, other.status);
-
-        std::swap(log_inside_prob, other.log_inside_prob);
-        std::swap(log_outside_prob, other.log_outside_prob);
-        std::swap(log_sent_rule_count, other.log_sent_rule_count);
-        std::swap(inside_visited_status, other.inside_visited_status);
-        std::swap(outside_visited_status, other.outside_visited_status);
-        std::swap(count_visited_status, other.count_visited_status);
-        std::swap(rule_visited, other.rule_visited);
-        std::swap(child_visited_status, other.child_visited_status);
-        std::swap(children, other.children);
-        std::swap(parents_sib, other.parents_sib);
-        std::swap(rule_ptr, other.rule_ptr);
-        std::swap(shrg_index, other.shrg_index);
+        std::swap(children_offset, other.children_offset);
+
+        if (!annotations_ && !other.annotations_)
+            return;
+        ChartItemAnnotations &annotations = Annotations();
+        ChartItemAnnotations &other_annotations = other.Annotations();
+        std::swap(annotations.log_inside_prob, other_annotations.log_inside_prob);
+        std::swap(annotations.log_outside_prob, other_annotations.log_outside_prob);
+        std::swap(annotations.log_sent_rule_count, other_annotations.log_sent_rule_count);
+        std::swap(annotations.inside_visited_status, other_annotations.inside_visited_status);
+        std::swap(annotations.outside_visited_status, other_annotations.outside_visited_status);
+        std::swap(annotations.count_visited_status, other_annotations.count_visited_status);
+        std::swap(annotations.rule_visited, other_annotations.rule_visited);
+        std::swap(annotations.child_visited_status, other_annotations.child_visited_status);
+        std::swap(annotations.children, other_annotations.children);
+        std::swap(annotations.parents_sib, other_annotations.parents_sib);
+        std::swap(annotations.rule_ptr, other_annotations.rule_ptr);
+        std::swap(annotations.shrg_index, other_annotations.shrg_index);
     }
 
     ChartItem *Pop() {
@@ -146,7 +241,8 @@ class ChartItem {
         next_ptr = chart_item_ptr;
     }
 
-
+  private:
+    std::unique_ptr<ChartItemAnnotations> annotations_;
 };
 
 template <typename T> inline bool operator==(const Ref<T> &ref1, const Ref<T> &ref2) {
@@ -154,7 +250,8 @@ template <typename T> inline bool operator==(const Ref<T> &ref1, const Ref<T> &r
 }
 
 inline bool operator==(const ChartItem &v1, const ChartItem &v2) {
-    return v1.edge_set == v2.edge_set && v1.boundary_node_mapping == v2.boundary_node_mapping;
+    return v1.edge_set_hash == v2.edge_set_hash &&
+           v1.boundary_node_mapping == v2.boundary_node_mapping && v1.edge_set == v2.edge_set;
 }
 
 } // namespace shrg
@@ -168,7 +265,7 @@ template <> struct hash<Ref<ChartItem>> {
     // !!! the hash function must be mark as const
     std::size_t operator()(const Ref<ChartItem> &ref) const {
         auto &v = ref.get();
-        auto hash_value = std::hash<decltype(v.edge_set)>()(v.edge_set);
+        std::size_t hash_value = v.edge_set_hash;
         boost::hash_combine(hash_value, v.boundary_node_mapping);
         return hash_value;
     }
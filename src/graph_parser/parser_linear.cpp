@@ -14,9 +14,8 @@ namespace linear {
 
 using std::size_t;
 
-LinearSHRGParser::LinearSHRGParser(const std::vector<SHRG> &grammars, const TokenSet &label_set)
-    : LinearSHRGParserBase("linear", grammars, label_set), //
-      attributes_(grammars.size()) {
+LinearGrammar::LinearGrammar(const std::vector<SHRG> &grammars)
+    : CompiledGrammar(grammars), attributes_(grammars.size()) {
 
     std::unordered_map<EdgeHash, std::unordered_set<NodeMapping>> activated_masks;
     for (size_t i = 0; i < grammars.size(); ++i) {
@@ -67,12 +66,19 @@ LinearSHRGParser::LinearSHRGParser(const std::vector<SHRG> &grammars, const Toke
     }
 }
 
+LinearSHRGParser::LinearSHRGParser(std::shared_ptr<const Grammar> compiled_grammar,
+                                   const TokenSet &label_set)
+    : LinearSHRGParserBase("linear", compiled_grammar->Grammars(), label_set), //
+      compiled_grammar_(std::move(compiled_grammar)),                        //
+      terminal_items_(grammars_.size()) {}
+
 void LinearSHRGParser::EmitSubGraph(ChartItem *chart_item_ptr, uint boundary_node_count,
                                     Attributes *attrs_ptr) {
     LabelHash label_hash = attrs_ptr->grammar_ptr->label_hash;
     const NodeMapping &node_mapping = chart_item_ptr->boundary_node_mapping;
 
     assert(attrs_ptr->required_masks);
+    RecordChildren(chart_item_ptr);
 
     Agenda *agenda_ptr = &agendas_.At(label_hash, node_mapping, boundary_node_count);
     // NOTE: it is important to insert full mask of chart_item into agendas_ first the next_ptr of
@@ -93,22 +99,23 @@ void LinearSHRGParser::EmitSubGraph(ChartItem *chart_item_ptr, uint boundary_nod
     }
 }
 
-bool LinearSHRGParser::MatchTerminalEdges(Attributes *attrs_ptr) {
+bool LinearSHRGParser::MatchTerminalEdges(Attributes *attrs_ptr, ChartItemList &terminal_items) {
     const SHRG *grammar_ptr = attrs_ptr->grammar_ptr;
     if (grammar_ptr->IsEmpty()) // grammar without semantic part
         return false;
 
     if (grammar_ptr->terminal_edges.empty()) { // grammar without terminal edges
-        attrs_ptr->terminal_items.push_back(items_pool_.Push(attrs_ptr));
+        terminal_items.push_back(items_pool_.Push(attrs_ptr));
         SHRG_DEBUG_INC(num_terminal_subgraphs_);
     } else {
         NodeMapping node_mapping{}; // initalization is important and necessary
         NodeSet node_set;
         EdgeSet edge_set;
-        LinearSHRGParserBase::MatchTerminalEdges(attrs_ptr, node_mapping, edge_set, node_set, 0);//yg: BUG
+        PlanTerminalEdges(grammar_ptr);
+        LinearSHRGParserBase::MatchTerminalEdges(attrs_ptr, terminal_items, //
+                                                 node_mapping, edge_set, node_set, 0); //yg: BUG
     }
 
-    auto &terminal_items = attrs_ptr->terminal_items;
     if (grammar_ptr->nonterminal_edges.empty()) {
         for (auto chart_item_ptr : terminal_items) {
             NodeMapping &node_mapping = chart_item_ptr->boundary_node_mapping;
@@ -140,14 +147,14 @@ void LinearSHRGParser::ClearChart() {
         SHRG_DEBUG_REPORT_TIMER("Clear");
 }
 
-void LinearSHRGParser::EnableGrammar(Attributes *attrs_ptr) {
+void LinearSHRGParser::EnableGrammar(Attributes *attrs_ptr, const ChartItemList &terminal_items) {
     const SHRG *grammar_ptr = attrs_ptr->grammar_ptr;
 
     assert(!grammar_ptr->nonterminal_edges.empty());
 
     const SHRG::Edge *first_edge_ptr = grammar_ptr->nonterminal_edges[0];
     const NodeMapping &first_boundary_nodes = attrs_ptr->edge_masks[0];
-    for (auto terminal_item_ptr : attrs_ptr->terminal_items) {
+    for (auto terminal_item_ptr : terminal_items) {
         const NodeMapping &node_mapping = terminal_item_ptr->boundary_node_mapping;
         Agenda *agenda_ptr = //
             &agendas_.At(first_edge_ptr,
@@ -164,19 +171,16 @@ void LinearSHRGParser::InitializeChart() {
     SHRG_DEBUG_START_TIMER();
 
     LinearSHRGParserBase::InitializeChart();
-    for (size_t i = 0; i < grammars_.size(); ++i) {
-        const SHRG &grammar = grammars_[i];
-
-        if (!IsGrammarCompatiable(grammar, terminal_map_))
-            continue;
-
-        Attributes &attrs = attributes_[i];
-        attrs.Clear();
+    // grammars whose terminal edges all occur in current graph
+    for (uint i : grammar_selector_.Select(compiled_grammar_->LabelIndex(), *graph_ptr_)) {
+        Attributes *attrs_ptr = compiled_grammar_->AttributesOf(i);
+        ChartItemList &terminal_items = terminal_items_[i];
+        terminal_items.clear();
         // TODO: check correctness of the result
-        if (MatchTerminalEdges(&attrs)) { //yg: BUG
-            assert(!grammar.nonterminal_edges.empty()); // Strange condition ???
+        if (MatchTerminalEdges(attrs_ptr, terminal_items)) { //yg: BUG
+            assert(!grammars_[i].nonterminal_edges.empty()); // Strange condition ???
             // add attrs to corresponding available_items
-            EnableGrammar(&attrs);
+            EnableGrammar(attrs_ptr, terminal_items);
             SHRG_DEBUG_INC(num_grammars_available_);
         }
     }
@@ -195,16 +199,18 @@ void LinearSHRGParser::MergeItems(Agenda::ActiveItem &item, ChartItem *external_
     Attributes *attrs_ptr = static_cast<Attributes *>(internal_item_ptr->attrs_ptr);
 
     EdgeSet merged_edge_set;
+    uint64_t merged_edge_set_hash;
     NodeMapping merged_mapping{}; // initialization is very important
 
     uint index = item.index;
     const SHRG *grammar_ptr = attrs_ptr->grammar_ptr;
     const SHRG::Edge *edge_ptr = grammar_ptr->nonterminal_edges[index];
 
-    int boundary_node_count = MergeTwoChartItems(graph_ptr_,                                     //
+    int boundary_node_count = MergeTwoChartItems(incident_edges_,                                //
                                                  external_item_ptr, internal_item_ptr, edge_ptr, //
                                                  grammar_ptr->fragment.nodes.size(),             //
-                                                 merged_edge_set, merged_mapping,
+                                                 merged_edge_set, merged_edge_set_hash,
+                                                 merged_mapping,
                                                  attrs_ptr->boundary_nodes_of_steps[index]);
 
     if (boundary_node_count == -1)
@@ -215,7 +221,8 @@ void LinearSHRGParser::MergeItems(Agenda::ActiveItem &item, ChartItem *external_
         !CheckAndChangeMappingFinally(grammar_ptr, boundary_node_count, merged_mapping))
         return;
 
-    ChartItem *chart_item_ptr = items_pool_.Push(attrs_ptr, merged_edge_set, merged_mapping);
+    ChartItem *chart_item_ptr =
+        items_pool_.Push(attrs_ptr, merged_edge_set, merged_edge_set_hash, merged_mapping);
     chart_item_ptr->left_ptr = internal_item_ptr;
     chart_item_ptr->right_ptr = external_item_ptr;
     SHRG_DEBUG_INC(num_succ_merge_operations_);
@@ -261,6 +268,7 @@ void LinearSHRGParser::UpdateAgenda(Agenda *agenda_ptr) {
 }
 
 ParserError LinearSHRGParser::Parse(const EdsGraph &graph) {
+    utils::MemoryAccount::Scope memory_scope(memory_);
     auto code = SHRGParserBase::BeforeParse(graph);
     if (code != ParserError::kNone)
         return code;
@@ -270,22 +278,24 @@ ParserError LinearSHRGParser::Parse(const EdsGraph &graph) {
 
     SHRG_DEBUG_START_TIMER();
     while (!updated_agendas_.empty()) {
-        if (items_pool_.PoolSize() > max_pool_size_) {
-            std::queue<Agenda *> empty;
+        code = CheckLimits();
+        if (code != ParserError::kNone) {
+            decltype(updated_agendas_) empty;
             updated_agendas_.swap(empty);
-            return ParserError::kOutOfMemory;
+            return code;
         }
         Agenda *agenda_ptr = updated_agendas_.front();
         updated_agendas_.pop();
         agenda_ptr->in_queue = false;
+        SHRG_DEBUG_INC(num_agenda_updates_);
+        if (agenda_ptr->num_updates++ > 0)
+            SHRG_DEBUG_INC(num_agenda_revisits_);
         UpdateAgenda(agenda_ptr);
     }
 
-    SetCompleteItem(agendas_.Small(), 40 /* label_offset */);
+    SetCompleteItem(agendas_.Find(MakeLabelHash(start_symbol_, 0, false), NodeMapping{}, 0));
 
-    num_indexing_keys_ = agendas_.Small().size() +  //
-                         agendas_.Medium().size() + //
-                         agendas_.Large().size();
+    num_indexing_keys_ = agendas_.Size();
     if (verbose_) {
         SHRG_DEBUG_REPORT_TIMER("Parsing");
         PRINT_EXPR(num_active_items_);
@@ -293,6 +303,8 @@ ParserError LinearSHRGParser::Parse(const EdsGraph &graph) {
         PRINT_EXPR(num_indexing_keys_);
         PRINT_EXPR(num_succ_merge_operations_);
         PRINT_EXPR(num_total_merge_operations_);
+        PRINT_EXPR(num_agenda_updates_);
+        PRINT_EXPR(num_agenda_revisits_);
     }
 
     return matched_item_ptr_ ? ParserError::kNone : ParserError::kNoResult;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <queue>
 #include <unordered_map>
 
@@ -13,12 +14,29 @@ struct Attributes : public AttributesBase {
     const std::vector<NodeMapping> *required_masks = nullptr;
 
     std::vector<NodeMapping> edge_masks;
+};
+
+// per-grammar attributes and masks shared by all linear parsers
+class LinearGrammar : public CompiledGrammar {
+  protected:
+    std::unordered_map<EdgeHash, std::vector<NodeMapping>> all_required_masks_;
+
+    // each SHRG grammar has a corresponding Attributes
+    std::vector<Attributes> attributes_;
+
+  public:
+    explicit LinearGrammar(const std::vector<SHRG> &grammars);
 
-    void Clear() { terminal_items.clear(); }
+    // chart items point to their attributes through non-const pointers, but the attributes are
+    // never modified after construction
+    Attributes *AttributesOf(std::size_t grammar_index) const {
+        return const_cast<Attributes *>(&attributes_[grammar_index]);
+    }
 };
 
 struct Agenda {
     bool in_queue = false;
+    uint num_updates = 0; // how many times the agenda is updated in current parsing
 
     struct ActiveItem {
         ChartItem *chart_item_ptr;
@@ -29,10 +47,11 @@ struct Agenda {
     uint num_visited_active_items = 0;
 
     ChartItemSet passive_items;
-    std::vector<ActiveItem> active_items;
+    utils::CountedVector<ActiveItem> active_items;
 
     void Clear() {
         in_queue = false;
+        num_updates = 0;
 
         num_visited_passive_items = 0;
         num_visited_active_items = 0;
@@ -43,13 +62,17 @@ struct Agenda {
 };
 
 class LinearSHRGParser : public LinearSHRGParserBase {
+  public:
+    using Grammar = LinearGrammar;
+
   private:
-    std::unordered_map<EdgeHash, std::vector<NodeMapping>> all_required_masks_;
+    std::shared_ptr<const Grammar> compiled_grammar_;
 
-    // each SHRG grammar has a corresponding Attributes
-    std::vector<Attributes> attributes_;
+    // items only have terminal edges, indexed by grammar
+    std::vector<ChartItemList> terminal_items_;
     ChartItemMap<Agenda> agendas_;
-    std::queue<Agenda *> updated_agendas_; // chart agenda
+    // chart agenda
+    std::queue<Agenda *, std::deque<Agenda *, utils::CountedAllocator<Agenda *>>> updated_agendas_;
 
     void ClearChart();
 
@@ -57,16 +80,21 @@ class LinearSHRGParser : public LinearSHRGParserBase {
 
     void EmitSubGraph(ChartItem *chart_item_ptr, uint boundary_node_count, Attributes *attrs_ptr);
 
-    bool MatchTerminalEdges(Attributes *attrs_ptr);
+    bool MatchTerminalEdges(Attributes *attrs_ptr, ChartItemList &terminal_items);
 
-    void EnableGrammar(Attributes *attrs_ptr);
+    void EnableGrammar(Attributes *attrs_ptr, const ChartItemList &terminal_items);
 
     void MergeItems(Agenda::ActiveItem &item, ChartItem *chart_item_ptr);
 
     void UpdateAgenda(Agenda *agenda_ptr);
 
   public:
-    LinearSHRGParser(const std::vector<SHRG> &grammars, const TokenSet &label_set);
+    LinearSHRGParser(std::shared_ptr<const Grammar> compiled_grammar, const TokenSet &label_set);
+
+    LinearSHRGParser(const std::vector<SHRG> &grammars, const TokenSet &label_set)
+        : LinearSHRGParser(std::make_shared<const Grammar>(grammars), label_set) {}
+
+    const std::shared_ptr<const Grammar> &GetCompiledGrammar() const { return compiled_grammar_; }
 
     ParserError Parse(const EdsGraph &graph) override;
 };
@@ -28,7 +28,8 @@ void AttributesBase::Initialize(const SHRG &grammar) {
     }
 }
 
-void LinearSHRGParserBase::CheckTerminalItems(AttributesBase *attrs_ptr, //
+void LinearSHRGParserBase::CheckTerminalItems(AttributesBase *attrs_ptr,
+                                              ChartItemList &terminal_items, //
                                               const NodeMapping &original_node_mapping,
                                               const EdgeSet &edge_set) {
     const SHRG *grammar_ptr = attrs_ptr->grammar_ptr;
@@ -44,7 +45,7 @@ void LinearSHRGParserBase::CheckTerminalItems(AttributesBase *attrs_ptr, //
         // index == 0 means that, the node has only non-terminal edges
         if (index > 0) {
             const SHRG::Node &node = shrg_nodes[i];
-            if (IsBoundaryNode(graph_ptr_->nodes[index - 1], edge_set)) {
+            if (IsBoundaryNode(incident_edges_[index - 1], edge_set)) {
                 boundary_node_count++;
                 if (!node.is_external && node.type == NodeType::kFixed)
                     return; // internal nodes shouldn't be mapped
@@ -60,20 +61,31 @@ void LinearSHRGParserBase::CheckTerminalItems(AttributesBase *attrs_ptr, //
     if (grammar_ptr->nonterminal_edges.empty())
         chart_item_ptr->status = boundary_node_count;
 
-    attrs_ptr->terminal_items.push_back(chart_item_ptr);
+    terminal_items.push_back(chart_item_ptr);
     SHRG_DEBUG_INC(num_terminal_subgraphs_);
 }
 
-void LinearSHRGParserBase::MatchTerminalEdges(AttributesBase *attrs_ptr, //
+void LinearSHRGParserBase::PlanTerminalEdges(const SHRG *grammar_ptr) {
+    PlanTerminalMatch(
+        *grammar_ptr,
+        [this](const SHRG::Edge *edge_ptr) -> size_t {
+            auto it = terminal_map_.find(edge_ptr->Hash());
+            return it == terminal_map_.end() ? 0 : it->second.size();
+        },
+        match_plan_);
+}
+
+void LinearSHRGParserBase::MatchTerminalEdges(AttributesBase *attrs_ptr,
+                                              ChartItemList &terminal_items, //
                                               NodeMapping &node_mapping, EdgeSet &edge_set,
                                               NodeSet &node_set, uint index) {
-    size_t edge_count = attrs_ptr->grammar_ptr->terminal_edges.size();
+    size_t edge_count = match_plan_.size();
     if (index == edge_count) {
-        CheckTerminalItems(attrs_ptr, node_mapping, edge_set); //yg:BUG
+        CheckTerminalItems(attrs_ptr, terminal_items, node_mapping, edge_set); //yg:BUG
         return;
     }
 
-    const SHRG::Edge *shrg_edge_ptr = attrs_ptr->grammar_ptr->terminal_edges[index];
+    const SHRG::Edge *shrg_edge_ptr = match_plan_[index];
     EdgeHash edge_hash = shrg_edge_ptr->Hash();
 
     assert(shrg_edge_ptr->is_terminal);
@@ -91,7 +103,8 @@ void LinearSHRGParserBase::MatchTerminalEdges(AttributesBase *attrs_ptr, //
             int edge_index = it->second->index;
             if (!edge_set[edge_index]) {
                 edge_set[edge_index] = true;
-                MatchTerminalEdges(attrs_ptr, node_mapping, edge_set, node_set, index + 1);
+                MatchTerminalEdges(attrs_ptr, terminal_items, node_mapping, edge_set, node_set,
+                                   index + 1);
                 edge_set[edge_index] = false;
             }
         }
@@ -127,7 +140,8 @@ void LinearSHRGParserBase::MatchTerminalEdges(AttributesBase *attrs_ptr, //
             node_set[eds_index] = true;
 
             edge_set[edge_index] = true;
-            MatchTerminalEdges(attrs_ptr, node_mapping, edge_set, node_set, index + 1);
+            MatchTerminalEdges(attrs_ptr, terminal_items, node_mapping, edge_set, node_set,
+                               index + 1);
             edge_set[edge_index] = false;
 
             // restore. here we have from == 0, because the edge is not complete
@@ -146,7 +160,8 @@ void LinearSHRGParserBase::MatchTerminalEdges(AttributesBase *attrs_ptr, //
             node_set[eds_to_index] = true;
 
             edge_set[edge_index] = true;
-            MatchTerminalEdges(attrs_ptr, node_mapping, edge_set, node_set, index + 1); //yg:BUG 2nd iter
+            MatchTerminalEdges(attrs_ptr, terminal_items, node_mapping, edge_set, node_set,
+                               index + 1); //yg:BUG 2nd iter
             edge_set[edge_index] = false;
 
             node_mapping[shrg_from_index] = from;
@@ -193,8 +208,8 @@ void LinearSHRGParserBase::ClearChart() {
     terminal_partial_map_.clear();
 }
 
-ChartItem *LinearGenerator::FindChartItemByEdge(ChartItem *chart_item_ptr,
-                                                const SHRG::Edge *shrg_edge_ptr) {
+ChartItem *LinearGenerator::ResolveChartItemByEdge(ChartItem *chart_item_ptr,
+                                                   const SHRG::Edge *shrg_edge_ptr) {
     const SHRG *grammar_ptr = chart_item_ptr->attrs_ptr->grammar_ptr;
     uint num_nonterminals = grammar_ptr->nonterminal_edges.size();
 
@@ -214,5 +229,16 @@ ChartItem *LinearGenerator::FindChartItemByEdge(ChartItem *chart_item_ptr,
     return result_ptr;
 }
 
+void LinearGenerator::ResolveChildren(ChartItem *chart_item_ptr, ChartItem **children) {
+    const SHRG *grammar_ptr = chart_item_ptr->attrs_ptr->grammar_ptr;
+    // every merge attaches the next nonterminal as the right item, the last one on top
+    for (int i = grammar_ptr->nonterminal_edges.size() - 1; i >= 0; --i) {
+        assert(chart_item_ptr->right_ptr->attrs_ptr->grammar_ptr->label ==
+               grammar_ptr->nonterminal_edges[i]->label);
+        children[i] = chart_item_ptr->right_ptr;
+        chart_item_ptr = chart_item_ptr->left_ptr;
+    }
+}
+
 } // namespace linear
 } // namespace shrg
@@ -7,8 +7,6 @@ namespace shrg {
 namespace linear {
 
 struct AttributesBase : public GrammarAttributes {
-    ChartItemList terminal_items; // items only have terminal edges
-
     std::vector<NodeMapping> boundary_nodes_of_steps;
 
     void Initialize(const SHRG &grammar);
@@ -18,8 +16,11 @@ class LinearGenerator : public Generator {
   public:
     using Generator::Generator;
 
-    ChartItem *FindChartItemByEdge(ChartItem *subgraph_ptr,
-                                   const SHRG::Edge *shrg_edge_ptr) override;
+    ChartItem *ResolveChartItemByEdge(ChartItem *subgraph_ptr,
+                                      const SHRG::Edge *shrg_edge_ptr) override;
+
+    // all children come out of one walk along the left items
+    void ResolveChildren(ChartItem *chart_item_ptr, ChartItem **children) override;
 };
 
 class LinearSHRGParserBase : public SHRGParserBase {
@@ -31,10 +32,18 @@ class LinearSHRGParserBase : public SHRGParserBase {
     std::unordered_map<TerminalHash, TerminalEdges> terminal_partial_map_;
     std::unordered_map<TerminalHash, const EdsGraph::Edge *> terminal_complete_map_;
 
-    void CheckTerminalItems(AttributesBase *agenda_ptr, //
+    // terminal edges of the grammar being matched, in the order of PlanTerminalMatch()
+    std::vector<const SHRG::Edge *> match_plan_;
+
+    // items only have terminal edges are collected into `terminal_items`
+    void CheckTerminalItems(AttributesBase *agenda_ptr, ChartItemList &terminal_items, //
                             const NodeMapping &node_mapping, const EdgeSet &edge_set);
 
-    void MatchTerminalEdges(AttributesBase *agenda_ptr, //
+    // plans the terminal edges of `grammar_ptr` against current graph into match_plan_
+    void PlanTerminalEdges(const SHRG *grammar_ptr);
+
+    // matches match_plan_[index:], PlanTerminalEdges() should be called first
+    void MatchTerminalEdges(AttributesBase *agenda_ptr, ChartItemList &terminal_items, //
                             NodeMapping &node_mapping, EdgeSet &edge_set, NodeSet &node_set,
                             uint index);
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "parser_tree_base.hpp"
 
 namespace shrg {
@@ -26,8 +28,146 @@ ChartItem *FindEdgeInTree(ChartItem *chart_item_ptr, const SHRG::Edge *edge_ptr)
     return result_ptr;
 }
 
-ChartItem *TreeGenerator::FindChartItemByEdge(ChartItem *chart_item_ptr,
-                                              const SHRG::Edge *shrg_edge_ptr) {
+NodeMapping ComputeCoveredMasks(TreeNodeBase *node_ptr) {
+    if (!node_ptr->Left()) // leaf node
+        return {};
+
+    NodeMapping matched_nodes = ComputeCoveredMasks(node_ptr->Left());
+    NodeMapping &mask = node_ptr->covered_mask;
+    if (!node_ptr->Right()) { // unary node
+        int index = 0;
+        for (auto shrg_node_ptr : node_ptr->covered_edge_ptr->linked_nodes) {
+            mask[index++] = matched_nodes[shrg_node_ptr->index];
+            // after current edge is matched, the node is also matched
+            matched_nodes[shrg_node_ptr->index] = UINT8_MAX;
+        }
+    } else { // binary node
+        NodeMapping right_matched_nodes = ComputeCoveredMasks(node_ptr->Right());
+        for (uint i = 0; i < matched_nodes.size(); ++i)
+            if (matched_nodes[i] != 0 && right_matched_nodes[i] != 0 &&
+                node_ptr->Left()->boundary_nodes[i] == 1 &&
+                node_ptr->Right()->boundary_nodes[i] == 1)
+                mask[i] = UINT8_MAX;
+
+        matched_nodes.m8[0] |= right_matched_nodes.m8[0];
+        matched_nodes.m8[1] |= right_matched_nodes.m8[1];
+    }
+    return matched_nodes;
+}
+
+uint BucketedUnaryAgenda::IndexOf(const NodeMapping &mask) {
+    for (uint k = 0; k < num_mask_indices; ++k)
+        if (mask_indices[k].mask == mask)
+            return k;
+
+    if (num_mask_indices == mask_indices.size())
+        mask_indices.emplace_back();
+    MaskIndex &index = mask_indices[num_mask_indices];
+    index.mask = mask;
+    index.num_passive_items = 0;
+    index.buckets.Clear();
+    return num_mask_indices++;
+}
+
+SignatureBucket *BucketedUnaryAgenda::FindBucket(const ActiveItem &item) {
+    const TreeNodeBase *node_ptr = item.node_ptr;
+    return mask_indices[IndexOf(node_ptr->covered_mask)].buckets.Find(
+        MaskedNodeMapping(node_ptr->covered_edge_ptr, item.chart_item_ptr->boundary_node_mapping,
+                          node_ptr->covered_mask));
+}
+
+SignatureBucket &BucketedUnaryAgenda::TouchBucket(uint mask_index, const NodeMapping &signature) {
+    SignatureBucket &bucket = mask_indices[mask_index].buckets[signature];
+    if (!bucket.HasNewItems(num_visited_active_items, num_visited_passive_items))
+        touched_buckets.push_back({mask_index, signature});
+    return bucket;
+}
+
+void BucketedUnaryAgenda::BucketNewItems() {
+    std::size_t active_size = active_items.size();
+    std::size_t passive_size = passive_items.Size();
+
+    touched_buckets.clear();
+    for (std::size_t i = num_visited_active_items; i < active_size; ++i) {
+        const ActiveItem &item = active_items[i];
+        const TreeNodeBase *node_ptr = item.node_ptr;
+        uint k = IndexOf(node_ptr->covered_mask);
+        TouchBucket(k, MaskedNodeMapping(node_ptr->covered_edge_ptr,
+                                         item.chart_item_ptr->boundary_node_mapping,
+                                         node_ptr->covered_mask))
+            .left_items.Push(i, item.chart_item_ptr);
+    }
+    for (uint k = 0; k < num_mask_indices; ++k) {
+        MaskIndex &index = mask_indices[k];
+        for (std::size_t j = index.num_passive_items; j < passive_size; ++j)
+            TouchBucket(k, MaskedNodeMapping(passive_items[j]->boundary_node_mapping, index.mask))
+                .right_items.Push(j, passive_items[j]);
+        index.num_passive_items = passive_size;
+    }
+}
+
+int AgendaScheduler::Priority(const ChartItem *chart_item_ptr,
+                              const TreeNodeBase *node_ptr) const {
+    if (policy_ == SchedulingPolicy::kSmallestFirst)
+        return chart_item_ptr->edge_set.count();
+    assert(policy_ == SchedulingPolicy::kTreeDepth);
+    return node_ptr ? -static_cast<int>(node_ptr->depth) : 1;
+}
+
+void AgendaScheduler::Push(Agenda *agenda_ptr, const ChartItem *chart_item_ptr,
+                           const TreeNodeBase *node_ptr) {
+    if (policy_ == SchedulingPolicy::kFifo) {
+        if (!agenda_ptr->in_queue) {
+            agenda_ptr->in_queue = true;
+            fifo_.push_back(agenda_ptr);
+            ++size_;
+        }
+        return;
+    }
+
+    int priority = Priority(chart_item_ptr, node_ptr);
+    if (agenda_ptr->in_queue) {
+        if (agenda_ptr->priority <= priority)
+            return;
+    } else {
+        agenda_ptr->in_queue = true;
+        ++size_;
+    }
+    agenda_ptr->priority = priority;
+    heap_.push_back({priority, sequence_++, agenda_ptr});
+    std::push_heap(heap_.begin(), heap_.end());
+}
+
+Agenda *AgendaScheduler::Pop() {
+    assert(!Empty());
+    Agenda *agenda_ptr;
+    if (policy_ == SchedulingPolicy::kFifo) {
+        agenda_ptr = fifo_.front();
+        fifo_.pop_front();
+    } else {
+        while (true) {
+            std::pop_heap(heap_.begin(), heap_.end());
+            Entry entry = heap_.back();
+            heap_.pop_back();
+            agenda_ptr = entry.agenda_ptr;
+            if (agenda_ptr->in_queue && agenda_ptr->priority == entry.priority)
+                break;
+        }
+    }
+    agenda_ptr->in_queue = false;
+    if (--size_ == 0) // only outdated entries are left, their agendas may be gone before next Pop()
+        heap_.clear();
+    return agenda_ptr;
+}
+
+void AgendaScheduler::Clear() {
+    fifo_.clear();
+    heap_.clear();
+    size_ = 0;
+}
+
+ChartItem *TreeGenerator::ResolveChartItemByEdge(ChartItem *chart_item_ptr,
+                                                 const SHRG::Edge *shrg_edge_ptr) {
     ChartItem *result_ptr = FindEdgeInTree(chart_item_ptr, shrg_edge_ptr);
     assert(result_ptr && result_ptr->attrs_ptr->grammar_ptr->label == shrg_edge_ptr->label);
     return result_ptr;
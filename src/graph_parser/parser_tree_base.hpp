@@ -1,6 +1,8 @@
 #pragma once
 
-#include <queue>
+#include <algorithm>
+#include <deque>
+#include <memory>
 #include <unordered_map>
 
 #include "generator.hpp"
@@ -15,6 +17,9 @@ struct Agenda {
     bool in_queue;
     bool is_binary;
 
+    int priority = 0;     // maintained by AgendaScheduler
+    uint num_updates = 0; // how many times the agenda is updated in current parsing
+
     Agenda(bool _in_queue, bool _is_binary) : in_queue(_in_queue), is_binary(_is_binary) {}
 
     virtual void Clear() = 0;
@@ -29,12 +34,13 @@ struct UnaryAgenda : public Agenda {
     uint num_visited_active_items = 0;
 
     ChartItemSet passive_items;
-    std::vector<ActiveItem> active_items;
+    utils::CountedVector<ActiveItem> active_items;
 
     UnaryAgenda() : Agenda(false, false) {}
 
     void Clear() override {
         in_queue = false;
+        num_updates = 0;
 
         num_visited_passive_items = 0;
         num_visited_active_items = 0;
@@ -54,30 +60,563 @@ struct BinaryAgenda : public Agenda {
 
     void Clear() override {
         in_queue = false;
+        num_updates = 0;
 
         num_left_visited_items = 0;
         num_right_visited_items = 0;
     }
 };
 
+// Cube pruning over the new pairs of an agenda. The pairs are given as grids (the cross product of
+// a list of rows and a list of columns, both are positions of items); the score of a pair is the
+// sum of the viterbi scores of its items. Rows and columns are sorted by descending score, so the
+// successors of a pair in a grid never score higher, and a heap over the frontiers of all grids
+// yields the pairs best first while only touching the ones that are actually tried.
+class MergeCube {
+    struct Candidate {
+        float score;
+        uint position;
+    };
+
+    struct Grid {
+        uint rows_begin, num_rows;
+        uint columns_begin, num_columns;
+    };
+
+    struct Cell {
+        float score;
+        uint grid, row, column;
+
+        bool operator<(const Cell &other) const { // max-heap, ties are broken by grid order
+            return score != other.score ? score < other.score : grid > other.grid;
+        }
+    };
+
+    utils::CountedVector<Candidate> rows_;
+    utils::CountedVector<Candidate> columns_;
+    utils::CountedVector<Grid> grids_;
+    utils::CountedVector<Cell> heap_;
+
+    void PushCell(uint grid_index, uint row, uint column) {
+        const Grid &grid = grids_[grid_index];
+        heap_.push_back({rows_[grid.rows_begin + row].score +
+                             columns_[grid.columns_begin + column].score,
+                         grid_index, row, column});
+        std::push_heap(heap_.begin(), heap_.end());
+    }
+
+  public:
+    void Clear() {
+        rows_.clear();
+        columns_.clear();
+        grids_.clear();
+    }
+
+    // starts a new grid, its rows and columns are added by AddRow() and AddColumn()
+    void NewGrid() {
+        grids_.push_back({static_cast<uint>(rows_.size()), 0,
+                          static_cast<uint>(columns_.size()), 0});
+    }
+
+    void AddRow(uint position, float score) {
+        rows_.push_back({score, position});
+        ++grids_.back().num_rows;
+    }
+
+    void AddColumn(uint position, float score) {
+        columns_.push_back({score, position});
+        ++grids_.back().num_columns;
+    }
+
+    // Calls merge(row, column) for the pairs of all grids, best first, until `beam_width` items
+    // are produced. merge() returns whether it produced an item. The pairs left over are pruned,
+    // so every update of an agenda produces at most `beam_width` items.
+    template <typename Function> void Run(uint beam_width, Function merge) {
+        auto by_score = [](const Candidate &x, const Candidate &y) { return x.score > y.score; };
+
+        heap_.clear();
+        for (uint i = 0; i < grids_.size(); ++i) {
+            const Grid &grid = grids_[i];
+            if (grid.num_rows == 0 || grid.num_columns == 0)
+                continue;
+            auto rows = rows_.begin() + grid.rows_begin;
+            auto columns = columns_.begin() + grid.columns_begin;
+            std::stable_sort(rows, rows + grid.num_rows, by_score);
+            std::stable_sort(columns, columns + grid.num_columns, by_score);
+            PushCell(i, 0, 0);
+        }
+
+        uint num_merged_items = 0;
+        while (num_merged_items < beam_width && !heap_.empty()) {
+            std::pop_heap(heap_.begin(), heap_.end());
+            Cell cell = heap_.back();
+            heap_.pop_back();
+
+            const Grid &grid = grids_[cell.grid];
+            if (merge(rows_[grid.rows_begin + cell.row].position,
+                      columns_[grid.columns_begin + cell.column].position))
+                ++num_merged_items;
+
+            // every cell is reached from exactly one predecessor: (row, column - 1), or
+            // (row - 1, 0) for the first column
+            if (cell.column + 1 < grid.num_columns)
+                PushCell(cell.grid, cell.row, cell.column + 1);
+            if (cell.column == 0 && cell.row + 1 < grid.num_rows)
+                PushCell(cell.grid, cell.row + 1, 0);
+        }
+    }
+};
+
+// positions of some items of an agenda (in ascending order), together with a copy of their edge
+// sets for the disjointness test
+struct ItemBlock {
+    utils::CountedVector<uint> positions;
+    EdgeSetBlock edge_sets;
+
+    void Push(uint position, const ChartItem *chart_item_ptr) {
+        positions.push_back(position);
+        edge_sets.Push(chart_item_ptr->edge_set);
+    }
+
+    // calls function(position) for every item from the first one at or after `begin_position` to
+    // the last one before `end_position` whose edge set is disjoint with `edge_set`
+    template <typename Function>
+    void ForEachDisjoint(const EdgeSet &edge_set, std::size_t begin_position,
+                         std::size_t end_position, Function function) const {
+        auto first = std::lower_bound(positions.begin(), positions.end(), begin_position);
+        auto last = std::lower_bound(first, positions.end(), end_position);
+        edge_sets.ForEachDisjoint(edge_set, first - positions.begin(), last - positions.begin(),
+                                  [&](std::size_t i) { function(positions[i]); });
+    }
+
+    void Clear() {
+        positions.clear();
+        edge_sets.Clear();
+    }
+};
+
+// items of both children of a binary node that have the same signature
+struct SignatureBucket {
+    ItemBlock left_items;
+    ItemBlock right_items;
+
+    void Clear() {
+        left_items.Clear();
+        right_items.Clear();
+    }
+
+    // whether the bucket has an item at or after the given positions, i.e. an unvisited pair
+    bool HasNewItems(std::size_t num_left_visited, std::size_t num_right_visited) const {
+        const auto &left = left_items.positions;
+        const auto &right = right_items.positions;
+        return (!left.empty() && left.back() >= num_left_visited) ||
+               (!right.empty() && right.back() >= num_right_visited);
+    }
+
+    // adds the unvisited pairs of the bucket to `cube`: new left items <=> all right items, and
+    // old left items <=> new right items
+    template <typename LeftScore, typename RightScore>
+    void AddNewGrids(MergeCube &cube, std::size_t num_left_visited, std::size_t num_right_visited,
+                     LeftScore left_score, RightScore right_score) const {
+        const auto &left = left_items.positions;
+        const auto &right = right_items.positions;
+        auto left_new = std::lower_bound(left.begin(), left.end(), num_left_visited);
+        auto right_new = std::lower_bound(right.begin(), right.end(), num_right_visited);
+
+        cube.NewGrid();
+        for (auto it = left_new; it != left.end(); ++it)
+            cube.AddRow(*it, left_score(*it));
+        for (auto it = right.begin(); it != right.end(); ++it)
+            cube.AddColumn(*it, right_score(*it));
+
+        cube.NewGrid();
+        for (auto it = left.begin(); it != left_new; ++it)
+            cube.AddRow(*it, left_score(*it));
+        for (auto it = right_new; it != right.end(); ++it)
+            cube.AddColumn(*it, right_score(*it));
+    }
+};
+
+// Binary agenda whose items are bucketed by signature. The signature of an item is its mapping of
+// the nodes shared by the two children (TreeNodeBase::covered_mask). Two items can only be merged
+// if they map these nodes to the same EDS nodes, so only the pairs in a bucket are enumerated.
+template <typename AgendaBase> struct BucketedAgenda : public AgendaBase {
+    utils::FlatHashMap<NodeMapping, SignatureBucket> buckets;
+    // signatures of the buckets that got new items in the last BucketNewItems()
+    utils::CountedVector<NodeMapping> touched_signatures;
+
+    using AgendaBase::AgendaBase;
+
+    void Clear() override {
+        AgendaBase::Clear();
+        buckets.Clear();
+        touched_signatures.clear();
+    }
+
+    NodeMapping Signature(const ChartItem *chart_item_ptr) const {
+        return MaskedNodeMapping(chart_item_ptr->boundary_node_mapping,
+                                 this->node_ptr->covered_mask);
+    }
+
+    SignatureBucket &TouchBucket(const NodeMapping &signature) {
+        SignatureBucket &bucket = buckets[signature];
+        if (!bucket.HasNewItems(this->num_left_visited_items, this->num_right_visited_items))
+            touched_signatures.push_back(signature);
+        return bucket;
+    }
+
+    template <typename ItemList>
+    void BucketNewItems(const ItemList &left_items, std::size_t left_size,
+                        const ItemList &right_items, std::size_t right_size) {
+        touched_signatures.clear();
+        for (std::size_t i = this->num_left_visited_items; i < left_size; ++i)
+            TouchBucket(Signature(left_items[i])).left_items.Push(i, left_items[i]);
+        for (std::size_t j = this->num_right_visited_items; j < right_size; ++j)
+            TouchBucket(Signature(right_items[j])).right_items.Push(j, right_items[j]);
+    }
+
+    // Buckets the unvisited items, then calls merge(i, j) for every unvisited pair of the i-th
+    // left item and the j-th right item with the same signature and disjoint edge sets. The pairs
+    // come in the same order as in the plain nested loops over all unvisited pairs.
+    template <typename ItemList, typename Function>
+    void ForEachNewPair(const ItemList &left_items, std::size_t left_size,
+                        const ItemList &right_items, std::size_t right_size, Function merge) {
+        std::size_t num_left_visited = this->num_left_visited_items;
+        std::size_t num_right_visited = this->num_right_visited_items;
+
+        BucketNewItems(left_items, left_size, right_items, right_size);
+
+        // new items of left child <=> new+old items of right child
+        for (std::size_t i = num_left_visited; i < left_size; ++i)
+            buckets.Find(Signature(left_items[i]))
+                ->right_items.ForEachDisjoint(left_items[i]->edge_set, 0, right_size,
+                                              [&](uint j) { merge(i, j); });
+
+        // new items of right child <=> old items of left child
+        for (std::size_t j = num_right_visited; j < right_size; ++j)
+            buckets.Find(Signature(right_items[j]))
+                ->left_items.ForEachDisjoint(right_items[j]->edge_set, 0, num_left_visited,
+                                             [&](uint i) { merge(i, j); });
+    }
+
+    // pruned version of ForEachNewPair: the unvisited pairs of the buckets that got new items are
+    // tried best first by `cube` until this update has produced `beam_width` items
+    template <typename ItemList, typename Function>
+    void ForEachBestNewPair(const ItemList &left_items, std::size_t left_size,
+                            const ItemList &right_items, std::size_t right_size, MergeCube &cube,
+                            uint beam_width, Function merge) {
+        BucketNewItems(left_items, left_size, right_items, right_size);
+
+        cube.Clear();
+        for (const NodeMapping &signature : touched_signatures)
+            buckets.Find(signature)->AddNewGrids(
+                cube, this->num_left_visited_items, this->num_right_visited_items,
+                [&](uint i) { return left_items[i]->viterbi_score; },
+                [&](uint j) { return right_items[j]->viterbi_score; });
+        cube.Run(beam_width, merge);
+    }
+};
+
+// Unary agenda whose items are bucketed by signature. An active item can only be merged with the
+// passive items that map the nodes of the covered edge, which are already matched by the active
+// item, to the same EDS nodes. The unary nodes sharing an agenda may have matched different nodes
+// (TreeNodeBase::covered_mask), so the passive items are bucketed once for each mask.
+struct BucketedUnaryAgenda : public UnaryAgenda {
+    struct MaskIndex {
+        NodeMapping mask;
+        std::size_t num_passive_items; // passive items put into buckets so far
+        // left_items are positions of active items, right_items of passive items
+        utils::FlatHashMap<NodeMapping, SignatureBucket> buckets;
+    };
+
+    struct TouchedBucket {
+        uint mask_index;
+        NodeMapping signature;
+    };
+
+    utils::CountedVector<MaskIndex> mask_indices; // the first num_mask_indices ones are used
+    uint num_mask_indices = 0;
+    // buckets that got new items in the last BucketNewItems()
+    utils::CountedVector<TouchedBucket> touched_buckets;
+
+    void Clear() override {
+        UnaryAgenda::Clear();
+        num_mask_indices = 0;
+        touched_buckets.clear();
+    }
+
+    // position of the index of `mask` in mask_indices, which is added if not found
+    uint IndexOf(const NodeMapping &mask);
+
+    SignatureBucket &TouchBucket(uint mask_index, const NodeMapping &signature);
+
+    SignatureBucket *FindBucket(const ActiveItem &item);
+
+    void BucketNewItems();
+
+    // Buckets the unvisited items, then calls merge(i, j) for every unvisited pair of the i-th
+    // active item and the j-th passive item with the same signature. The pairs come in the same
+    // order as in the plain nested loops over all unvisited pairs.
+    template <typename Function> void ForEachNewPair(Function merge);
+
+    // pruned version of ForEachNewPair, see BucketedAgenda::ForEachBestNewPair
+    template <typename Function>
+    void ForEachBestNewPair(MergeCube &cube, uint beam_width, Function merge);
+};
+
+// Binary agenda of the indexed parsers. Its items already share the signature (the agendas are
+// keyed by it), so it only keeps the edge sets of both children to skip overlapping pairs.
+template <typename AgendaBase> struct ScreenedAgenda : public AgendaBase {
+    // edge sets of the items of both children, mirrored when the agenda is updated
+    EdgeSetBlock left_edge_sets;
+    EdgeSetBlock right_edge_sets;
+
+    using AgendaBase::AgendaBase;
+
+    void Clear() override {
+        AgendaBase::Clear();
+        left_edge_sets.Clear();
+        right_edge_sets.Clear();
+    }
+
+    // calls merge(i, j) for every unvisited pair of the i-th left item and the j-th right item
+    // with disjoint edge sets, in the same order as the plain nested loops
+    template <typename ItemList, typename Function>
+    void ForEachNewPair(const ItemList &left_items, std::size_t left_size,
+                        const ItemList &right_items, std::size_t right_size, Function merge) {
+        std::size_t num_left_visited = this->num_left_visited_items;
+
+        for (std::size_t i = left_edge_sets.Size(); i < left_size; ++i)
+            left_edge_sets.Push(left_items[i]->edge_set);
+        for (std::size_t j = right_edge_sets.Size(); j < right_size; ++j)
+            right_edge_sets.Push(right_items[j]->edge_set);
+
+        // new items of left child <=> new+old items of right child
+        for (std::size_t i = num_left_visited; i < left_size; ++i)
+            right_edge_sets.ForEachDisjoint(left_items[i]->edge_set, 0, right_size,
+                                            [&](std::size_t j) { merge(i, j); });
+
+        // new items of right child <=> old items of left child
+        for (std::size_t j = this->num_right_visited_items; j < right_size; ++j)
+            left_edge_sets.ForEachDisjoint(right_items[j]->edge_set, 0, num_left_visited,
+                                           [&](std::size_t i) { merge(i, j); });
+    }
+
+    // pruned version of ForEachNewPair, see BucketedAgenda::ForEachBestNewPair
+    template <typename ItemList, typename Function>
+    void ForEachBestNewPair(const ItemList &left_items, std::size_t left_size,
+                            const ItemList &right_items, std::size_t right_size, MergeCube &cube,
+                            uint beam_width, Function merge) {
+        uint num_left_visited = this->num_left_visited_items;
+        uint num_right_visited = this->num_right_visited_items;
+
+        cube.Clear();
+        cube.NewGrid(); // new items of left child <=> new+old items of right child
+        for (uint i = num_left_visited; i < left_size; ++i)
+            cube.AddRow(i, left_items[i]->viterbi_score);
+        for (uint j = 0; j < right_size; ++j)
+            cube.AddColumn(j, right_items[j]->viterbi_score);
+
+        cube.NewGrid(); // old items of left child <=> new items of right child
+        for (uint i = 0; i < num_left_visited; ++i)
+            cube.AddRow(i, left_items[i]->viterbi_score);
+        for (uint j = num_right_visited; j < right_size; ++j)
+            cube.AddColumn(j, right_items[j]->viterbi_score);
+
+        cube.Run(beam_width, merge);
+    }
+};
+
+// Unary agenda of the indexed parsers, see ScreenedAgenda
+struct ScreenedUnaryAgenda : public UnaryAgenda {
+    EdgeSetBlock passive_edge_sets;
+
+    void Clear() override {
+        UnaryAgenda::Clear();
+        passive_edge_sets.Clear();
+    }
+
+    // calls merge(i, j) for every unvisited pair of the i-th active item and the j-th passive item
+    // with disjoint edge sets, in the same order as the plain nested loops
+    template <typename Function> void ForEachNewPair(Function merge) {
+        std::size_t active_size = active_items.size();
+        std::size_t passive_size = passive_items.Size();
+
+        for (std::size_t j = passive_edge_sets.Size(); j < passive_size; ++j)
+            passive_edge_sets.Push(passive_items[j]->edge_set);
+
+        // new active_items <=> new+old passive_items
+        for (std::size_t i = num_visited_active_items; i < active_size; ++i)
+            passive_edge_sets.ForEachDisjoint(active_items[i].chart_item_ptr->edge_set, 0,
+                                              passive_size, [&](std::size_t j) { merge(i, j); });
+        // old active_items <=> new passive_items
+        for (std::size_t i = 0; i < num_visited_active_items; ++i)
+            passive_edge_sets.ForEachDisjoint(active_items[i].chart_item_ptr->edge_set,
+                                              num_visited_passive_items, passive_size,
+                                              [&](std::size_t j) { merge(i, j); });
+    }
+
+    // pruned version of ForEachNewPair, see BucketedAgenda::ForEachBestNewPair
+    template <typename Function>
+    void ForEachBestNewPair(MergeCube &cube, uint beam_width, Function merge) {
+        uint active_size = active_items.size();
+        uint passive_size = passive_items.Size();
+
+        cube.Clear();
+        cube.NewGrid(); // new active_items <=> new+old passive_items
+        for (uint i = num_visited_active_items; i < active_size; ++i)
+            cube.AddRow(i, active_items[i].chart_item_ptr->viterbi_score);
+        for (uint j = 0; j < passive_size; ++j)
+            cube.AddColumn(j, passive_items[j]->viterbi_score);
+
+        cube.NewGrid(); // old active_items <=> new passive_items
+        for (uint i = 0; i < num_visited_active_items; ++i)
+            cube.AddRow(i, active_items[i].chart_item_ptr->viterbi_score);
+        for (uint j = num_visited_passive_items; j < passive_size; ++j)
+            cube.AddColumn(j, passive_items[j]->viterbi_score);
+
+        cube.Run(beam_width, merge);
+    }
+};
+
+// Order in which the updated agendas are processed
+enum class SchedulingPolicy {
+    kFifo,          // in order of discovery
+    kSmallestFirst, // the agenda whose pending item covers the fewest edges first
+    kTreeDepth      // agendas of deeper tree nodes first, passive items are propagated last
+};
+
+// Queue of the agendas that have unprocessed items. An agenda is queued at most once: pushing a
+// queued agenda only raises its priority, so it collects more new items before it is updated.
+class AgendaScheduler {
+    struct Entry {
+        int priority;
+        uint64_t sequence; // keep FIFO order among agendas of the same priority
+        Agenda *agenda_ptr;
+
+        bool operator<(const Entry &other) const { // reversed for a min-heap
+            return priority != other.priority ? priority > other.priority
+                                              : sequence > other.sequence;
+        }
+    };
+
+    SchedulingPolicy policy_ = SchedulingPolicy::kFifo;
+    std::deque<Agenda *, utils::CountedAllocator<Agenda *>> fifo_;
+    // an agenda whose priority is raised is pushed again, the old entry is skipped by Pop()
+    utils::CountedVector<Entry> heap_;
+    uint64_t sequence_ = 0;
+    std::size_t size_ = 0; // number of queued agendas
+
+    int Priority(const ChartItem *chart_item_ptr, const TreeNodeBase *node_ptr) const;
+
+  public:
+    SchedulingPolicy Policy() const { return policy_; }
+
+    void SetPolicy(SchedulingPolicy policy) {
+        assert(Empty());
+        policy_ = policy;
+    }
+
+    bool Empty() const { return size_ == 0; }
+
+    // `chart_item_ptr` is the new item of `agenda_ptr`, `node_ptr` is the tree node that consumes
+    // it (nullptr for passive items)
+    void Push(Agenda *agenda_ptr, const ChartItem *chart_item_ptr, const TreeNodeBase *node_ptr);
+
+    Agenda *Pop();
+
+    void Clear();
+};
+
+// Sets TreeNodeBase::covered_mask for the subtree of `node_ptr`. Returns the nodes matched by the
+// subtree (UINT8_MAX at each of them).
+NodeMapping ComputeCoveredMasks(TreeNodeBase *node_ptr);
+
+template <typename Function> void BucketedUnaryAgenda::ForEachNewPair(Function merge) {
+    std::size_t active_size = active_items.size();
+    std::size_t passive_size = passive_items.Size();
+    std::size_t num_active_visited = num_visited_active_items;
+    std::size_t num_passive_visited = num_visited_passive_items;
+
+    BucketNewItems();
+
+    // new active_items <=> new+old passive_items
+    for (std::size_t i = num_active_visited; i < active_size; ++i)
+        FindBucket(active_items[i])
+            ->right_items.ForEachDisjoint(active_items[i].chart_item_ptr->edge_set, 0,
+                                          passive_size, [&](uint j) { merge(i, j); });
+
+    // old active_items <=> new passive_items
+    if (num_passive_visited == passive_size)
+        return;
+    for (std::size_t i = 0; i < num_active_visited; ++i)
+        FindBucket(active_items[i])
+            ->right_items.ForEachDisjoint(active_items[i].chart_item_ptr->edge_set,
+                                          num_passive_visited, passive_size,
+                                          [&](uint j) { merge(i, j); });
+}
+
+template <typename Function>
+void BucketedUnaryAgenda::ForEachBestNewPair(MergeCube &cube, uint beam_width, Function merge) {
+    BucketNewItems();
+
+    cube.Clear();
+    for (const TouchedBucket &touched : touched_buckets)
+        mask_indices[touched.mask_index].buckets.Find(touched.signature)->AddNewGrids(
+            cube, num_visited_active_items, num_visited_passive_items,
+            [&](uint i) { return active_items[i].chart_item_ptr->viterbi_score; },
+            [&](uint j) { return passive_items[j]->viterbi_score; });
+    cube.Run(beam_width, merge);
+}
+
 class TreeNode : public tree::TreeNodeBase {
   public:
     using tree::TreeNodeBase::TreeNodeBase;
+};
 
-    Agenda *agenda_ptr = nullptr;
+// Tree decompositions of all grammars. The nodes only carry read-only information, everything
+// that changes during parsing is kept by the parsers and addressed by `TreeNodeBase::index`.
+template <typename NodeType> class TreeGrammar : public CompiledGrammar {
+  protected:
+    utils::MemoryPool<NodeType> tree_nodes_pool_;
+    std::vector<Tree> tree_decompositions_;
+    uint num_tree_nodes_ = 0;
 
-    void Clear() override {
-        if (Right() && agenda_ptr) // binary node
-            agenda_ptr->Clear();
+  public:
+    template <typename DecomposerType>
+    TreeGrammar(const std::vector<SHRG> &grammars,
+                TreeDecomposerTpl<NodeType, DecomposerType> &decomposer)
+        : CompiledGrammar(grammars), tree_decompositions_(grammars.size()) {
+        decomposer.SetPool(&tree_nodes_pool_);
+        for (int i = grammars_.size() - 1; i >= 0; --i) {
+            const SHRG &grammar = grammars_[i];
+            if (!grammar.IsEmpty())
+                decomposer.Decompose(tree_decompositions_[i], grammar);
+        }
+
+        for (Tree &tree : tree_decompositions_)
+            for (TreeNodeBase *node_ptr : tree) {
+                node_ptr->index = num_tree_nodes_++;
+                for (auto ptr = node_ptr->Parent(); ptr; ptr = ptr->Parent())
+                    ++node_ptr->depth;
+            }
+
+        for (Tree &tree : tree_decompositions_)
+            if (!tree.empty())
+                ComputeCoveredMasks(tree[0]);
     }
+
+    const std::vector<Tree> &TreeDecompositions() const { return tree_decompositions_; }
+
+    uint NumTreeNodes() const { return num_tree_nodes_; }
 };
 
 class TreeGenerator : public Generator {
   public:
     using Generator::Generator;
 
-    ChartItem *FindChartItemByEdge(ChartItem *chart_item_ptr,
-                                   const SHRG::Edge *shrg_edge_ptr) override;
+    ChartItem *ResolveChartItemByEdge(ChartItem *chart_item_ptr,
+                                      const SHRG::Edge *shrg_edge_ptr) override;
 };
 
 template <typename NodeType> class TreeSHRGParserBase : public SHRGParserBase {
@@ -85,38 +624,47 @@ template <typename NodeType> class TreeSHRGParserBase : public SHRGParserBase {
     template <typename DecomposerType>
     using TreeDecomposer = tree::TreeDecomposerTpl<NodeType, DecomposerType>;
     using TreeNode = NodeType;
+    using Grammar = TreeGrammar<NodeType>;
 
   protected:
+    std::shared_ptr<const Grammar> compiled_grammar_;
     // tree decomposition of all SHRG grammars
-    std::vector<Tree> tree_decompositions_;
-    std::queue<Agenda *> updated_agendas_; // chart agenda
+    const std::vector<Tree> &tree_decompositions_;
+    AgendaScheduler updated_agendas_; // chart agenda
 
-    utils::MemoryPool<NodeType> tree_nodes_pool_;
+    // pruned parse mode: every agenda produces at most beam_width_ items, 0 for exact parsing
+    uint beam_width_ = 0;
+    MergeCube merge_cube_;
 
     TreeGenerator generator_;
 
-  public:
-    template <typename DecomposerType>
-    TreeSHRGParserBase(const char *parser_type, const std::vector<SHRG> &grammars,
-                       TreeDecomposer<DecomposerType> &decomposer, const TokenSet &label_set)
-        : SHRGParserBase(parser_type, grammars, label_set), //
-          tree_decompositions_(grammars.size()),            //
-          generator_(this) {
-        decomposer.SetPool(&tree_nodes_pool_);
-        for (int i = grammars_.size() - 1; i >= 0; --i) {
-            const SHRG &grammar = grammars_[i];
-            if (!grammar.IsEmpty())
-                decomposer.Decompose(tree_decompositions_[i], grammar);
-        }
+    // takes the next agenda to update
+    Agenda *PopAgenda() {
+        Agenda *agenda_ptr = updated_agendas_.Pop();
+        SHRG_DEBUG_INC(num_agenda_updates_);
+        if (agenda_ptr->num_updates++ > 0)
+            SHRG_DEBUG_INC(num_agenda_revisits_);
+        return agenda_ptr;
     }
 
-    // template <typename DecomposerType>
-    // TreeSHRGParserBase(const char *parser_type, const std::vector<SHRG> &grammars,
-    //                    TreeDecomposer<DecomposerType> &&decomposer, const TokenSet &label_set)
-    //     : TreeSHRGParserBase(parser_type, grammars, decomposer, label_set){};
+  public:
+    TreeSHRGParserBase(const char *parser_type, std::shared_ptr<const Grammar> compiled_grammar,
+                       const TokenSet &label_set)
+        : SHRGParserBase(parser_type, compiled_grammar->Grammars(), label_set), //
+          compiled_grammar_(std::move(compiled_grammar)),                       //
+          tree_decompositions_(compiled_grammar_->TreeDecompositions()),        //
+          generator_(this) {}
 
     const std::vector<Tree> &TreeDecompositions() const { return tree_decompositions_; }
 
+    const std::shared_ptr<const Grammar> &GetCompiledGrammar() const { return compiled_grammar_; }
+
+    void SetSchedulingPolicy(SchedulingPolicy policy) { updated_agendas_.SetPolicy(policy); }
+
+    uint BeamWidth() const { return beam_width_; }
+
+    void SetBeamWidth(uint beam_width) { beam_width_ = beam_width; }
+
     Generator *GetGenerator() override { return &generator_; }
 };
 
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <queue>
 #include <unordered_map>
 
 #include "parser_tree_v1.hpp"
@@ -12,33 +11,53 @@ using tree::Agenda;
 using tree::Tree;
 using tree::TreeGenerator;
 using tree::TreeNodeBase;
-using tree::UnaryAgenda;
-using tree_v1::BinaryAgenda;
+using BinaryAgenda = tree::ScreenedAgenda<tree_v1::BinaryAgenda>;
+using UnaryAgenda = tree::ScreenedUnaryAgenda;
 
 class TreeNode : public TreeNodeBase {
   public:
     using TreeNodeBase::TreeNodeBase;
 
-    std::unordered_map<NodeMapping, BinaryAgenda> agendas;
-
-    NodeMapping covered_mask{};
     const std::vector<NodeMapping> *required_masks = nullptr;
+};
+
+// tree decompositions together with the masks used to index agendas
+class IndexedTreeGrammar : public tree::TreeGrammar<TreeNode> {
+  protected:
+    std::unordered_map<EdgeHash, std::vector<NodeMapping>> all_required_masks_;
+
+    void ComputeAllMasks();
 
-    void Clear() override {
-        if (Right()) // binary node
-            agendas.clear();
+  public:
+    template <typename DecomposerType>
+    IndexedTreeGrammar(const std::vector<SHRG> &grammars,
+                       tree::TreeDecomposerTpl<TreeNode, DecomposerType> &decomposer)
+        : tree::TreeGrammar<TreeNode>(grammars, decomposer) {
+        ComputeAllMasks();
     }
 };
 
+// per-parse state of a binary tree node
+using BinaryAgendaMap =
+    std::unordered_map<NodeMapping, BinaryAgenda, std::hash<NodeMapping>, std::equal_to<NodeMapping>,
+                       utils::CountedAllocator<std::pair<const NodeMapping, BinaryAgenda>,
+                                               utils::MemoryKind::kTable>>;
+
 using ParserBase = tree::TreeSHRGParserBase<TreeNode>;
 
 class TreeSHRGParser : public ParserBase {
+  public:
+    using Grammar = IndexedTreeGrammar;
+
   protected:
-    std::unordered_map<EdgeHash, std::vector<NodeMapping>> all_required_masks_;
     // passive items grouped by edges and boundary_nodes
     ChartItemMap<UnaryAgenda> unary_agendas_;
+    // agendas of binary nodes, indexed by TreeNodeBase::index
+    std::vector<BinaryAgendaMap> node_agendas_;
 
-    void InitializeTree();
+    BinaryAgendaMap &AgendasOf(const TreeNodeBase *node_ptr) {
+        return node_agendas_[node_ptr->index];
+    }
 
     void ClearChart();
 
@@ -46,10 +65,10 @@ class TreeSHRGParser : public ParserBase {
 
     void MatchTerminalEdges();
 
-    void MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr, TreeNodeBase *node_ptr,
+    bool MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr, TreeNodeBase *node_ptr,
                     bool is_unary_node = false);
 
-    void MergeItems(UnaryAgenda::ActiveItem &item, ChartItem *external_subgraph_ptr) {
+    bool MergeItems(UnaryAgenda::ActiveItem &item, ChartItem *external_subgraph_ptr) {
         return MergeItems(external_subgraph_ptr, item.chart_item_ptr, item.node_ptr, true);
     }
 
@@ -73,12 +92,14 @@ class TreeSHRGParser : public ParserBase {
     void EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase *node_ptr, bool sumbit);
 
   public:
+    TreeSHRGParser(std::shared_ptr<const Grammar> compiled_grammar, const TokenSet &label_set)
+        : ParserBase("tree_index_v1", std::move(compiled_grammar), label_set),
+          node_agendas_(compiled_grammar_->NumTreeNodes()) {}
+
     template <typename DecomposerType>
     TreeSHRGParser(const std::vector<SHRG> &grammars, TreeDecomposer<DecomposerType> &decomposer,
                    const TokenSet &label_set)
-        : ParserBase("tree_index_v1", grammars, decomposer, label_set) {
-        InitializeTree();
-    }
+        : TreeSHRGParser(std::make_shared<const Grammar>(grammars, decomposer), label_set) {}
 
     template <typename DecomposerType>
     TreeSHRGParser(const std::vector<SHRG> &grammars, TreeDecomposer<DecomposerType> &&decomposer,
@@ -2,12 +2,6 @@
 
 #include "parser_tree_index_v2.hpp"
 
-#define PUSH_AGENDA(ptr)                                                                           \
-    if (!(ptr)->in_queue) {                                                                        \
-        (ptr)->in_queue = true;                                                                    \
-        updated_agendas_.push(ptr);                                                                \
-    }
-
 namespace shrg {
 
 namespace tree {
@@ -20,27 +14,21 @@ namespace tree_v2 {
 void ExpandActiveItem(ChartItem *chart_item_ptr, utils::MemoryPool<ChartItem> &items_pool);
 }
 
-namespace tree_index_v1 {
-NodeMapping ComputeMasks(TreeNode *tree_node, tree::MaskMap &activated_masks);
-} // namespace tree_index_v1
-
 namespace tree_index_v2 {
 
 using std::size_t;
 using tree::empty_item;
-using tree::MaskMap;
 using tree::masks_for_pred_edges;
 using tree::masks_for_structural_edges;
-using tree_index_v1::ComputeMasks;
 using tree_v2::ExpandActiveItem;
 
-void SummaryBinaryAgendas(const std::vector<Tree> &trees, const TokenSet &label_set,
-                          uint64_t stats[6]) {
+void SummaryBinaryAgendas(const std::vector<Tree> &trees, const std::vector<NodeState> &states,
+                          const TokenSet &label_set, uint64_t stats[6]) {
     for (auto &tree : trees) {
         for (auto node_ptr_ : tree) {
             if (!node_ptr_->Right())
                 continue; // binary node
-            for (auto &agenda : static_cast<TreeNode *>(node_ptr_)->agendas) {
+            for (auto &agenda : states[node_ptr_->index].agendas) {
                 uint64_t num_active1 = agenda.second.num_left_visited_items;
                 uint64_t num_active2 = agenda.second.num_right_visited_items;
                 uint64_t num_ops = num_active1 * num_active2;
@@ -82,33 +70,9 @@ void SummaryUnaryAgendas(const T &agendas, const TokenSet &label_set, uint64_t s
     }
 }
 
-void TreeSHRGParser::InitializeTree() {
-    MaskMap activated_masks;
-
-    for (size_t i = 0; i < grammars_.size(); ++i) {
-        const SHRG &grammar = grammars_[i];
-        Tree &tree = tree_decompositions_[i];
-
-        if (grammar.IsEmpty())
-            continue;
-
-        assert(!tree[0]->Parent()); // tree root;
-        TreeNode *tree_root = static_cast<TreeNode *>(tree[0]);
-        ComputeMasks(tree_root, activated_masks);
-
-        tree_root->required_masks = &all_required_masks_[grammar.label_hash];
-    }
-
-    for (auto &item : activated_masks) {
-        auto &required_masks = all_required_masks_[item.first];
-        for (auto &mask : item.second)
-            required_masks.push_back(mask);
-    }
-}
-
 void TreeSHRGParser::EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase *node_ptr,
                                          bool submit) {
-    if (!static_cast<TreeNode *>(node_ptr)->corresponding_items.TryInsert(chart_item_ptr))
+    if (!StateOf(node_ptr).corresponding_items.TryInsert(chart_item_ptr))
         return;
 
     // TODO: optimize for empty subgraph
@@ -119,7 +83,7 @@ void TreeSHRGParser::EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase
     Agenda *agenda_ptr;
     if (parent_ptr->Right()) { // parent is a binary node
         BinaryAgenda *binary_ptr =
-            &parent_ptr->agendas[MaskedNodeMapping(node_mapping, covered_mask)];
+            &StateOf(parent_ptr).agendas[MaskedNodeMapping(node_mapping, covered_mask)];
         agenda_ptr = binary_ptr;
         binary_ptr->node_ptr = parent_ptr;
 
@@ -141,7 +105,7 @@ void TreeSHRGParser::EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase
 
     if (submit) {
         SHRG_DEBUG_INC(num_active_items_);
-        PUSH_AGENDA(agenda_ptr);
+        updated_agendas_.Push(agenda_ptr, chart_item_ptr, parent_ptr);
     }
 }
 
@@ -157,7 +121,7 @@ void TreeSHRGParser::EmitCompleteSubGraph(ChartItem *chart_item_ptr, uint bounda
     if (!unary_ptr->passive_items.TryInsert(chart_item_ptr))
         return;
     SHRG_DEBUG_INC(num_passive_items_);
-    PUSH_AGENDA(unary_ptr);
+    updated_agendas_.Push(unary_ptr, chart_item_ptr, nullptr);
 
     for (auto &mask : *required_masks) {
         // !!! here `node_mapping` is computed by `MergeFinal`, so the `node_mapping[i]` is
@@ -169,7 +133,7 @@ void TreeSHRGParser::EmitCompleteSubGraph(ChartItem *chart_item_ptr, uint bounda
 
         bool success = unary_ptr->passive_items.TryInsert(chart_item_ptr);
         if (success)
-            PUSH_AGENDA(unary_ptr);
+            updated_agendas_.Push(unary_ptr, chart_item_ptr, nullptr);
     }
 }
 
@@ -182,7 +146,7 @@ void TreeSHRGParser::MatchTerminalEdges() {
         assert(edge.index < MAX_GRAPH_EDGE_COUNT); // Edge index out of range
 
         ChartItem *chart_item_ptr = items_pool_.Push();
-        chart_item_ptr->edge_set[edge.index] = true;
+        chart_item_ptr->AddEdge(edge.index);
 
         uint num_nodes = edge.linked_nodes.size();
         for (uint i = 0; i < num_nodes; ++i) { // should be less than 2
@@ -199,45 +163,53 @@ void TreeSHRGParser::MatchTerminalEdges() {
     }
 }
 
-void TreeSHRGParser::MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr,
+bool TreeSHRGParser::MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr,
                                 TreeNodeBase *node_ptr, bool is_unary_node) {
     SHRG_DEBUG_INC(num_total_merge_operations_);
     const SHRG *grammar_ptr = node_ptr->grammar_ptr;
     EdgeSet merged_edge_set;
+    uint64_t merged_edge_set_hash;
     NodeMapping merged_mapping{}; // initialization is very important
 
     int boundary_node_count =
         is_unary_node
-            ? MergeTwoChartItems(graph_ptr_, //
+            ? MergeTwoChartItems(incident_edges_, //
                                  left_item_ptr, right_item_ptr, node_ptr->covered_edge_ptr,
                                  grammar_ptr->fragment.nodes.size(), //
-                                 merged_edge_set, merged_mapping, node_ptr->boundary_nodes)
-            : MergeTwoChartItems(graph_ptr_, //
+                                 merged_edge_set, merged_edge_set_hash, merged_mapping,
+                                 node_ptr->boundary_nodes)
+            : MergeTwoChartItems(incident_edges_, //
                                  left_item_ptr, right_item_ptr,
                                  grammar_ptr->fragment.nodes.size(), //
-                                 merged_edge_set, merged_mapping, node_ptr->boundary_nodes);
+                                 merged_edge_set, merged_edge_set_hash, merged_mapping,
+                                 node_ptr->boundary_nodes);
 
     if (boundary_node_count == -1)
-        return;
+        return false;
 
     if (!node_ptr->Parent() &&
         !CheckAndChangeMappingFinally(grammar_ptr, boundary_node_count, merged_mapping))
-        return;
+        return false;
 
-    ChartItem *chart_item_ptr = items_pool_.Push(node_ptr, merged_edge_set, merged_mapping);
+    ChartItem *chart_item_ptr =
+        items_pool_.Push(node_ptr, merged_edge_set, merged_edge_set_hash, merged_mapping);
     chart_item_ptr->left_ptr = left_item_ptr;
     chart_item_ptr->right_ptr = right_item_ptr;
+    chart_item_ptr->viterbi_score = left_item_ptr->viterbi_score + right_item_ptr->viterbi_score;
     SHRG_DEBUG_INC(num_succ_merge_operations_);
 
     if (node_ptr->Parent())
         EmitPartialSubgraph(chart_item_ptr, node_ptr, true /* submit */);
-    else // node_ptr is the root of the tree decomposition, so the item is completed
+    else { // node_ptr is the root of the tree decomposition, so the item is completed
+        chart_item_ptr->viterbi_score += RuleScore(grammar_ptr);
         EmitCompleteSubGraph(chart_item_ptr, boundary_node_count, node_ptr);
+    }
+    return true;
 }
 
 void TreeSHRGParser::ClearChart() {
     SHRG_DEBUG_START_TIMER();
-    assert(updated_agendas_.empty());
+    assert(updated_agendas_.Empty());
 
     unary_agendas_.Clear();
 
@@ -249,23 +221,21 @@ void TreeSHRGParser::ClearChart() {
 void TreeSHRGParser::InitializeChart() {
     SHRG_DEBUG_START_TIMER();
 
-    // all terminal edges of current graph;
-    std::unordered_set<EdgeHash> terminal_edges_set;
-    for (const EdsGraph::Edge &edge : graph_ptr_->edges)
-        if (edge.is_terminal)
-            terminal_edges_set.insert(edge.Hash());
-
-    for (size_t i = 0; i < grammars_.size(); ++i) {
+    // grammars whose terminal edges all occur in current graph
+    for (uint i : grammar_selector_.Select(compiled_grammar_->LabelIndex(), *graph_ptr_)) {
         const SHRG &grammar = grammars_[i];
 
-        if (grammar.IsEmpty() || !IsGrammarCompatiable(grammar, terminal_edges_set))
+        if (grammar.IsEmpty())
             continue;
 
         SHRG_DEBUG_INC(num_grammars_available_);
 
-        Tree &tree = tree_decompositions_[i];
+        const Tree &tree = tree_decompositions_[i];
         for (TreeNodeBase *node_ptr : tree) {
-            node_ptr->Clear();
+            NodeState &state = StateOf(node_ptr);
+            if (node_ptr->Right()) // binary node
+                state.agendas.clear();
+            state.corresponding_items.Clear();
 
             if (node_ptr->Left())
                 continue;
@@ -292,14 +262,11 @@ void TreeSHRGParser::UpdateUnaryNode(UnaryAgenda *agenda_ptr) {
     if (passive_item_size == 0 || active_item_size == 0)
         return;
 
-    // new active_items <=> new+old passive_items
-    for (size_t i = agenda_ptr->num_visited_active_items; i < active_item_size; ++i)
-        for (size_t j = 0; j < passive_item_size; ++j)
-            MergeItems(active_items[i], passive_items[j]);
-    // old active_items <=> new passive_items
-    for (size_t i = 0; i < agenda_ptr->num_visited_active_items; ++i)
-        for (size_t j = agenda_ptr->num_visited_passive_items; j < passive_item_size; ++j)
-            MergeItems(active_items[i], passive_items[j]);
+    auto merge = [&](size_t i, size_t j) { return MergeItems(active_items[i], passive_items[j]); };
+    if (beam_width_ > 0)
+        agenda_ptr->ForEachBestNewPair(merge_cube_, beam_width_, merge);
+    else
+        agenda_ptr->ForEachNewPair(merge);
 
     agenda_ptr->num_visited_active_items = active_item_size;
     agenda_ptr->num_visited_passive_items = passive_item_size;
@@ -317,21 +284,21 @@ void TreeSHRGParser::UpdateBinaryNode(BinaryAgenda *agenda_ptr) {
     if (left_size == 0 || right_size == 0)
         return;
 
-    // new chart_items of left item <=> new+old chart_items of right item
-    for (size_t i = agenda_ptr->num_left_visited_items; i < left_size; ++i)
-        for (size_t j = 0; j < right_size; ++j)
-            MergeItems(left_items[i], right_items[j], node_ptr);
-
-    // new chart_items of right item <=> old chart_items of left item
-    for (size_t i = agenda_ptr->num_right_visited_items; i < right_size; ++i)
-        for (size_t j = 0; j < agenda_ptr->num_left_visited_items; ++j)
-            MergeItems(left_items[j], right_items[i], node_ptr);
+    auto merge = [&](size_t i, size_t j) {
+        return MergeItems(left_items[i], right_items[j], node_ptr);
+    };
+    if (beam_width_ > 0)
+        agenda_ptr->ForEachBestNewPair(left_items, left_size, right_items, right_size,
+                                       merge_cube_, beam_width_, merge);
+    else
+        agenda_ptr->ForEachNewPair(left_items, left_size, right_items, right_size, merge);
 
     agenda_ptr->num_left_visited_items = left_size;   // set all items as visited
     agenda_ptr->num_right_visited_items = right_size; // set all items as visited
 }
 
 ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
+    utils::MemoryAccount::Scope memory_scope(memory_);
     auto code = SHRGParserBase::BeforeParse(graph);
     if (code != ParserError::kNone)
         return code;
@@ -340,16 +307,14 @@ ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
     InitializeChart();
 
     SHRG_DEBUG_START_TIMER();
-    while (!updated_agendas_.empty()) {
-        if (items_pool_.PoolSize() > max_pool_size_) {
-            std::queue<Agenda *> empty;
-            updated_agendas_.swap(empty);
-            return ParserError::kOutOfMemory;
+    while (!updated_agendas_.Empty()) {
+        code = CheckLimits();
+        if (code != ParserError::kNone) {
+            updated_agendas_.Clear();
+            return code;
         }
 
-        Agenda *agenda_ptr = updated_agendas_.front();
-        updated_agendas_.pop();
-        agenda_ptr->in_queue = false;
+        Agenda *agenda_ptr = PopAgenda();
 
         if (agenda_ptr->is_binary)
             UpdateBinaryNode(static_cast<BinaryAgenda *>(agenda_ptr));
@@ -357,11 +322,9 @@ ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
             UpdateUnaryNode(static_cast<UnaryAgenda *>(agenda_ptr));
     }
 
-    SetCompleteItem(unary_agendas_.Small(), 40 /* label_offset */);
+    SetCompleteItem(unary_agendas_.Find(MakeLabelHash(start_symbol_, 0, false), NodeMapping{}, 0));
 
-    num_indexing_keys_ = unary_agendas_.Small().size() +  //
-                         unary_agendas_.Medium().size() + //
-                         unary_agendas_.Large().size();
+    num_indexing_keys_ = unary_agendas_.Size();
     if (verbose_) {
         SHRG_DEBUG_REPORT_TIMER("Parsing");
         PRINT_EXPR(num_active_items_);
@@ -369,10 +332,15 @@ ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
         PRINT_EXPR(num_indexing_keys_);
         PRINT_EXPR(num_succ_merge_operations_);
         PRINT_EXPR(num_total_merge_operations_);
+        PRINT_EXPR(num_agenda_updates_);
+        PRINT_EXPR(num_agenda_revisits_);
     }
 
     if (matched_item_ptr_) {
         ExpandActiveItem(matched_item_ptr_, items_pool_);
+        // items share their active parts until the expansion, so children are recorded after it
+        if (record_children_)
+            RecordForestChildren(matched_item_ptr_);
         return ParserError::kNone;
     }
 
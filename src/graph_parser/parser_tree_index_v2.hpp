@@ -1,6 +1,5 @@
 #pragma once
 
-#include <queue>
 #include <unordered_map>
 
 #include "parser_tree_index_v1.hpp"
@@ -13,31 +12,31 @@ using tree::Agenda;
 using tree::Tree;
 using tree::TreeGenerator;
 using tree::TreeNodeBase;
-using tree::UnaryAgenda;
 using tree_index_v1::BinaryAgenda;
+using tree_index_v1::UnaryAgenda;
 
-class TreeNode : public tree_index_v1::TreeNode {
-  public:
-    using tree_index_v1::TreeNode::TreeNode;
+using tree_index_v1::IndexedTreeGrammar;
+using tree_index_v1::TreeNode;
 
+// per-parse state of a tree node
+struct NodeState {
+    tree_index_v1::BinaryAgendaMap agendas;
     ChartItemSet corresponding_items;
-
-    void Clear() override {
-        tree_index_v1::TreeNode::Clear();
-        corresponding_items.Clear();
-    }
 };
 
 using ParserBase = tree::TreeSHRGParserBase<TreeNode>;
 
 class TreeSHRGParser : public ParserBase {
-  protected:
-    std::unordered_map<EdgeHash, std::vector<NodeMapping>> all_required_masks_;
+  public:
+    using Grammar = IndexedTreeGrammar;
 
+  protected:
     // passive items grouped by edges and boundary_nodes
     ChartItemMap<UnaryAgenda> unary_agendas_;
+    // indexed by TreeNodeBase::index
+    std::vector<NodeState> node_states_;
 
-    void InitializeTree();
+    NodeState &StateOf(const TreeNodeBase *node_ptr) { return node_states_[node_ptr->index]; }
 
     void ClearChart();
 
@@ -45,10 +44,10 @@ class TreeSHRGParser : public ParserBase {
 
     void MatchTerminalEdges();
 
-    void MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr, TreeNodeBase *node_ptr,
+    bool MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr, TreeNodeBase *node_ptr,
                     bool is_unary_node = false);
 
-    void MergeItems(UnaryAgenda::ActiveItem &item, ChartItem *external_subgraph_ptr) {
+    bool MergeItems(UnaryAgenda::ActiveItem &item, ChartItem *external_subgraph_ptr) {
         return MergeItems(external_subgraph_ptr, item.chart_item_ptr, item.node_ptr, true);
     }
 
@@ -72,12 +71,14 @@ class TreeSHRGParser : public ParserBase {
     void EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase *node_ptr, bool sumbit);
 
   public:
+    TreeSHRGParser(std::shared_ptr<const Grammar> compiled_grammar, const TokenSet &label_set)
+        : ParserBase("tree_index_v2", std::move(compiled_grammar), label_set),
+          node_states_(compiled_grammar_->NumTreeNodes()) {}
+
     template <typename DecomposerType>
     TreeSHRGParser(const std::vector<SHRG> &grammars, TreeDecomposer<DecomposerType> &decomposer,
                    const TokenSet &label_set)
-        : ParserBase("tree_index_v2", grammars, decomposer, label_set) {
-        InitializeTree();
-    }
+        : TreeSHRGParser(std::make_shared<const Grammar>(grammars, decomposer), label_set) {}
 
     template <typename DecomposerType>
     TreeSHRGParser(const std::vector<SHRG> &grammars, TreeDecomposer<DecomposerType> &&decomposer,
@@ -90,7 +91,6 @@ class TreeSHRGParser : public ParserBase {
 } // namespace tree_index_v2
 } // namespace shrg
 
-REGISTER_TYPE_NAME(shrg::tree_index_v2::TreeNode);
 
 // Local Variables:
 // mode: c++
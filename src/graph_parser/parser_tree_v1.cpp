@@ -2,12 +2,6 @@
 
 #include "parser_tree_v1.hpp"
 
-#define PUSH_AGENDA(ptr)                                                                           \
-    if (!(ptr)->in_queue) {                                                                        \
-        (ptr)->in_queue = true;                                                                    \
-        updated_agendas_.push(ptr);                                                                \
-    }
-
 namespace shrg {
 
 namespace tree {
@@ -20,14 +14,14 @@ using std::size_t;
 using tree::empty_item;
 using tree::Tree;
 
-void SummaryBinaryAgendas(const std::vector<Tree> &trees, uint64_t stats[6]) {
+void SummaryBinaryAgendas(const std::vector<Tree> &trees, const std::vector<Agenda *> &agendas,
+                          uint64_t stats[6]) {
     for (auto &tree : trees) {
         for (auto node_ptr : tree) {
             if (!node_ptr->Right())
                 continue;
             // binary node
-            auto agenda_ptr =
-                static_cast<BinaryAgenda *>(static_cast<TreeNode *>(node_ptr)->agenda_ptr);
+            auto agenda_ptr = static_cast<BinaryAgenda *>(agendas[node_ptr->index]);
             uint64_t num_active1 = agenda_ptr->left_items.size();
             uint64_t num_active2 = agenda_ptr->right_items.size();
             uint64_t num_ops = num_active1 * num_active2;
@@ -66,23 +60,23 @@ void SummaryUnaryAgendas(const std::unordered_map<LabelHash, UnaryAgenda> &agend
 }
 
 void TreeSHRGParser::InitializeTree() {
+    node_agendas_.assign(compiled_grammar_->NumTreeNodes(), nullptr);
     for (int i = grammars_.size() - 1; i >= 0; --i) {
         const SHRG &grammar = grammars_[i];
         if (grammar.IsEmpty())
             continue;
 
-        Tree &tree = tree_decompositions_[i];
+        const Tree &tree = tree_decompositions_[i];
         assert(!tree[0]->Parent()); // tree root;
         for (auto node_ptr : tree) {
             if (!node_ptr->Left()) // skip leaf
                 continue;
 
             if (node_ptr->Right()) { // binary Node
-                TreeNode *node_ext_ptr = static_cast<TreeNode *>(node_ptr);
-                BinaryAgenda *agenda_ptr = binary_agendas_pool_.Push();
+                BucketedBinaryAgenda *agenda_ptr = binary_agendas_pool_.Push();
 
-                agenda_ptr->node_ptr = node_ext_ptr;
-                node_ext_ptr->agenda_ptr = agenda_ptr;
+                agenda_ptr->node_ptr = node_ptr;
+                AgendaOf(node_ptr) = agenda_ptr;
             }
         }
     }
@@ -93,13 +87,13 @@ void TreeSHRGParser::EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase
     // TODO: optimize for empty subgraph
     TreeNode *parent_ptr = static_cast<TreeNode *>(node_ptr->Parent());
     if (!parent_ptr->Right()) { // parent is a unary node
-        UnaryAgenda *agenda_ptr = static_cast<UnaryAgenda *>(parent_ptr->agenda_ptr);
+        UnaryAgenda *agenda_ptr = static_cast<UnaryAgenda *>(AgendaOf(parent_ptr));
         agenda_ptr->active_items.push_back({
             chart_item_ptr, /* chart_item_ptr */
             parent_ptr      /* node_ptr */
         });
     } else { // parent is binary NodeMapping
-        BinaryAgenda *agenda_ptr = static_cast<BinaryAgenda *>(parent_ptr->agenda_ptr);
+        BinaryAgenda *agenda_ptr = static_cast<BinaryAgenda *>(AgendaOf(parent_ptr));
         auto &active_items =
             (parent_ptr->Left() == node_ptr) ? agenda_ptr->left_items : agenda_ptr->right_items;
         active_items.push_back(chart_item_ptr);
@@ -107,7 +101,7 @@ void TreeSHRGParser::EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase
 
     if (submit) {
         SHRG_DEBUG_INC(num_active_items_);
-        PUSH_AGENDA(parent_ptr->agenda_ptr);
+        updated_agendas_.Push(AgendaOf(parent_ptr), chart_item_ptr, parent_ptr);
     }
 }
 
@@ -115,15 +109,15 @@ void TreeSHRGParser::EmitCompleteSubGraph(ChartItem *chart_item_ptr, EdgeHash ed
     UnaryAgenda *agenda_ptr = &unary_agendas_[edge_hash];
     if (agenda_ptr->passive_items.TryInsert(chart_item_ptr)) {
         SHRG_DEBUG_INC(num_passive_items_);
-        PUSH_AGENDA(agenda_ptr);
+        updated_agendas_.Push(agenda_ptr, chart_item_ptr, nullptr);
     }
 }
 
 void TreeSHRGParser::ClearChart() {
     SHRG_DEBUG_START_TIMER();
-    assert(updated_agendas_.empty());
+    assert(updated_agendas_.Empty());
 
-    unary_agendas_.clear();
+    unary_agendas_.Clear();
 
     SHRGParserBase::ClearChart();
     if (verbose_)
@@ -139,7 +133,7 @@ void TreeSHRGParser::MatchTerminalEdges() {
         assert(edge.index < MAX_GRAPH_EDGE_COUNT); // Edge index out of range
 
         ChartItem *chart_item_ptr = items_pool_.Push();
-        chart_item_ptr->edge_set[edge.index] = true;
+        chart_item_ptr->AddEdge(edge.index);
 
         uint num_nodes = edge.linked_nodes.size();
         for (uint i = 0; i < num_nodes; ++i) { // should be less than 2
@@ -157,28 +151,26 @@ void TreeSHRGParser::MatchTerminalEdges() {
 void TreeSHRGParser::InitializeChart() {
     SHRG_DEBUG_START_TIMER();
 
-    // all terminal edges of current graph;
-    std::unordered_set<EdgeHash> terminal_edges_set;
-    for (const EdsGraph::Edge &edge : graph_ptr_->edges)
-        if (edge.is_terminal)
-            terminal_edges_set.insert(edge.Hash());
-
-    for (size_t i = 0; i < grammars_.size(); ++i) {
+    // grammars whose terminal edges all occur in current graph
+    for (uint i : grammar_selector_.Select(compiled_grammar_->LabelIndex(), *graph_ptr_)) {
         const SHRG &grammar = grammars_[i];
 
-        if (grammar.IsEmpty() || !IsGrammarCompatiable(grammar, terminal_edges_set))
+        if (grammar.IsEmpty())
             continue;
 
         SHRG_DEBUG_INC(num_grammars_available_);
-        Tree &tree = tree_decompositions_[i];
+        const Tree &tree = tree_decompositions_[i];
         for (TreeNodeBase *node_ptr : tree) {
-            node_ptr->Clear(); // clear nodes
+            if (!node_ptr->Left()) // leaf nodes
+                continue;
 
-            if (node_ptr->Left() && !node_ptr->Right()) { // unary nodes
+            if (node_ptr->Right()) // binary nodes
+                AgendaOf(node_ptr)->Clear();
+            else { // unary nodes
                 const SHRG::Edge *edge_ptr = node_ptr->covered_edge_ptr;
                 assert(edge_ptr);
                 // precompute hash
-                static_cast<TreeNode *>(node_ptr)->agenda_ptr = &unary_agendas_[edge_ptr->Hash()];
+                AgendaOf(node_ptr) = &unary_agendas_[edge_ptr->Hash()];
             }
         }
 
@@ -198,45 +190,54 @@ void TreeSHRGParser::InitializeChart() {
     }
 }
 
-void TreeSHRGParser::MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr,
+bool TreeSHRGParser::MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr,
                                 TreeNodeBase *node_ptr, bool is_unary_node) {
     SHRG_DEBUG_INC(num_total_merge_operations_);
     const SHRG *grammar_ptr = node_ptr->grammar_ptr;
     EdgeSet merged_edge_set;
+    uint64_t merged_edge_set_hash;
     NodeMapping merged_mapping{}; // initialization is very important
     // when is_unary_node is true, external_graph is actually a subgraph of
     // node_ptr->covered_edge
 
     int boundary_node_count =
         is_unary_node
-            ? MergeTwoChartItems(graph_ptr_, //
+            ? MergeTwoChartItems(incident_edges_, //
                                  left_item_ptr, right_item_ptr, node_ptr->covered_edge_ptr,
                                  grammar_ptr->fragment.nodes.size(), //
-                                 merged_edge_set, merged_mapping, node_ptr->boundary_nodes)
-            : MergeTwoChartItems(graph_ptr_, //
+                                 merged_edge_set, merged_edge_set_hash, merged_mapping,
+                                 node_ptr->boundary_nodes)
+            : MergeTwoChartItems(incident_edges_, //
                                  left_item_ptr, right_item_ptr,
                                  grammar_ptr->fragment.nodes.size(), //
-                                 merged_edge_set, merged_mapping, node_ptr->boundary_nodes);
+                                 merged_edge_set, merged_edge_set_hash, merged_mapping,
+                                 node_ptr->boundary_nodes);
 
     if (boundary_node_count == -1)
-        return;
+        return false;
 
     if (!node_ptr->Parent() &&
         !CheckAndChangeMappingFinally(grammar_ptr, boundary_node_count, merged_mapping))
-        return;
+        return false;
 
-    ChartItem *chart_item_ptr = items_pool_.Push(node_ptr, merged_edge_set, merged_mapping);
+    ChartItem *chart_item_ptr =
+        items_pool_.Push(node_ptr, merged_edge_set, merged_edge_set_hash, merged_mapping);
     chart_item_ptr->left_ptr = left_item_ptr;
     chart_item_ptr->right_ptr = right_item_ptr;
+    chart_item_ptr->viterbi_score = left_item_ptr->viterbi_score + right_item_ptr->viterbi_score;
     SHRG_DEBUG_INC(num_succ_merge_operations_);
 
     if (node_ptr->Parent())
         EmitPartialSubgraph(chart_item_ptr, node_ptr, true /* submit */);
-    else // node_ptr is the root of the tree decomposition, so the recognization is completed
+    else { // node_ptr is the root of the tree decomposition, so the recognization is completed
+        chart_item_ptr->viterbi_score += RuleScore(grammar_ptr);
+        RecordChildren(chart_item_ptr);
         EmitCompleteSubGraph(chart_item_ptr, grammar_ptr->label_hash);
+    }
+    return true;
 }
 
-void TreeSHRGParser::UpdateUnaryNode(UnaryAgenda *agenda_ptr) {
+void TreeSHRGParser::UpdateUnaryNode(BucketedUnaryAgenda *agenda_ptr) {
     auto &active_items = agenda_ptr->active_items;
     auto &passive_items = agenda_ptr->passive_items;
 
@@ -246,20 +247,17 @@ void TreeSHRGParser::UpdateUnaryNode(UnaryAgenda *agenda_ptr) {
     if (passive_item_size == 0 || active_item_size == 0)
         return;
 
-    // new active_items <=> new+old passive_items
-    for (size_t i = agenda_ptr->num_visited_active_items; i < active_item_size; ++i)
-        for (size_t j = 0; j < passive_item_size; ++j)
-            MergeItems(active_items[i], passive_items[j]);
-    // old active_items <=> new passive_items
-    for (size_t i = 0; i < agenda_ptr->num_visited_active_items; ++i)
-        for (size_t j = agenda_ptr->num_visited_passive_items; j < passive_item_size; ++j)
-            MergeItems(active_items[i], passive_items[j]);
+    auto merge = [&](size_t i, size_t j) { return MergeItems(active_items[i], passive_items[j]); };
+    if (beam_width_ > 0)
+        agenda_ptr->ForEachBestNewPair(merge_cube_, beam_width_, merge);
+    else
+        agenda_ptr->ForEachNewPair(merge);
 
     agenda_ptr->num_visited_active_items = active_item_size;
     agenda_ptr->num_visited_passive_items = passive_item_size;
 }
 
-void TreeSHRGParser::UpdateBinaryNode(BinaryAgenda *agenda_ptr) {
+void TreeSHRGParser::UpdateBinaryNode(BucketedBinaryAgenda *agenda_ptr) {
     TreeNodeBase *node_ptr = agenda_ptr->node_ptr;
     assert(node_ptr && node_ptr->Right()); // node_ptr is a binary node
 
@@ -272,21 +270,21 @@ void TreeSHRGParser::UpdateBinaryNode(BinaryAgenda *agenda_ptr) {
     if (left_size == 0 || right_size == 0)
         return;
 
-    // new items of left child <=> new+old items of right child
-    for (size_t i = agenda_ptr->num_left_visited_items; i < left_size; ++i)
-        for (size_t j = 0; j < right_size; ++j)
-            MergeItems(left_items[i], right_items[j], node_ptr);
-
-    // new items of right child <=> old items of left child
-    for (size_t i = agenda_ptr->num_right_visited_items; i < right_size; ++i)
-        for (size_t j = 0; j < agenda_ptr->num_left_visited_items; ++j)
-            MergeItems(left_items[j], right_items[i], node_ptr);
+    auto merge = [&](size_t i, size_t j) {
+        return MergeItems(left_items[i], right_items[j], node_ptr);
+    };
+    if (beam_width_ > 0)
+        agenda_ptr->ForEachBestNewPair(left_items, left_size, right_items, right_size,
+                                       merge_cube_, beam_width_, merge);
+    else
+        agenda_ptr->ForEachNewPair(left_items, left_size, right_items, right_size, merge);
 
     agenda_ptr->num_left_visited_items = left_size;   // set all items as visited
     agenda_ptr->num_right_visited_items = right_size; // set all items as visited
 }
 
 ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
+    utils::MemoryAccount::Scope memory_scope(memory_);
     auto code = SHRGParserBase::BeforeParse(graph);
     if (code != ParserError::kNone)
         return code;
@@ -295,27 +293,24 @@ ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
     InitializeChart();
 
     SHRG_DEBUG_START_TIMER();
-    while (!updated_agendas_.empty()) {
-        if (items_pool_.PoolSize() > max_pool_size_) {
-            decltype(updated_agendas_) empty;
-            updated_agendas_.swap(empty);
-
-            return ParserError::kOutOfMemory;
+    while (!updated_agendas_.Empty()) {
+        code = CheckLimits();
+        if (code != ParserError::kNone) {
+            updated_agendas_.Clear();
+            return code;
         }
 
-        Agenda *agenda_ptr = updated_agendas_.front();
-        updated_agendas_.pop();
-        agenda_ptr->in_queue = false;
+        Agenda *agenda_ptr = PopAgenda();
 
         if (agenda_ptr->is_binary)
-            UpdateBinaryNode(static_cast<BinaryAgenda *>(agenda_ptr));
+            UpdateBinaryNode(static_cast<BucketedBinaryAgenda *>(agenda_ptr));
         else
-            UpdateUnaryNode(static_cast<UnaryAgenda *>(agenda_ptr));
+            UpdateUnaryNode(static_cast<BucketedUnaryAgenda *>(agenda_ptr));
     }
 
-    SetCompleteItem(unary_agendas_, 8 /* label_offset */);
+    SetCompleteItem(unary_agendas_.Find(MakeLabelHash(start_symbol_, 0, false)));
 
-    num_indexing_keys_ = unary_agendas_.size();
+    num_indexing_keys_ = unary_agendas_.Size();
     if (verbose_) {
         SHRG_DEBUG_REPORT_TIMER("Parsing");
         PRINT_EXPR(num_active_items_);
@@ -323,9 +318,11 @@ ParserError TreeSHRGParser::Parse(const EdsGraph &graph) {
         PRINT_EXPR(num_indexing_keys_);
         PRINT_EXPR(num_succ_merge_operations_);
         PRINT_EXPR(num_total_merge_operations_);
+        PRINT_EXPR(num_agenda_updates_);
+        PRINT_EXPR(num_agenda_revisits_);
 
         // uint64_t stats1[6]{0, 0, 0, 0, 0, 0};
-        // SummaryBinaryAgendas(tree_decompositions_, stats1);
+        // SummaryBinaryAgendas(tree_decompositions_, node_agendas_, stats1);
 
         // uint64_t stats2[6]{0, 0, 0, 0, 0, 0};
         // SummaryUnaryAgendas(unary_agendas_, label_set_, stats2);
@@ -1,8 +1,5 @@
 #pragma once
 
-#include <queue>
-#include <unordered_map>
-
 #include "parser_tree_base.hpp"
 
 namespace shrg {
@@ -11,6 +8,7 @@ namespace tree_v1 {
 using tree::Agenda;
 using tree::TreeNode;
 using tree::TreeNodeBase;
+using tree::BucketedUnaryAgenda;
 using tree::UnaryAgenda;
 using ParserBase = tree::TreeSHRGParserBase<TreeNode>;
 
@@ -28,11 +26,18 @@ struct BinaryAgenda : public tree::BinaryAgenda {
     }
 };
 
+// binary agenda of TreeSHRGParser, the indexed parsers use the plain BinaryAgenda
+using BucketedBinaryAgenda = tree::BucketedAgenda<BinaryAgenda>;
+
 class TreeSHRGParser : public ParserBase {
   protected:
-    std::unordered_map<EdgeHash, UnaryAgenda> unary_agendas_;
+    utils::FlatHashMap<EdgeHash, BucketedUnaryAgenda> unary_agendas_;
 
-    utils::MemoryPool<BinaryAgenda> binary_agendas_pool_;
+    utils::MemoryPool<BucketedBinaryAgenda> binary_agendas_pool_;
+    // agenda of every tree node, indexed by TreeNodeBase::index
+    std::vector<Agenda *> node_agendas_;
+
+    Agenda *&AgendaOf(const TreeNodeBase *node_ptr) { return node_agendas_[node_ptr->index]; }
 
     void ClearChart();
 
@@ -42,26 +47,29 @@ class TreeSHRGParser : public ParserBase {
 
     void MatchTerminalEdges();
 
-    void MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr, TreeNodeBase *node_ptr,
+    bool MergeItems(ChartItem *left_item_ptr, ChartItem *right_item_ptr, TreeNodeBase *node_ptr,
                     bool is_unary_node = false);
 
-    void MergeItems(UnaryAgenda::ActiveItem &item, ChartItem *external_item_ptr) {
+    bool MergeItems(UnaryAgenda::ActiveItem &item, ChartItem *external_item_ptr) {
         return MergeItems(external_item_ptr, item.chart_item_ptr, item.node_ptr, true);
     }
 
-    void UpdateUnaryNode(UnaryAgenda *agenda_ptr);
-    void UpdateBinaryNode(BinaryAgenda *agenda_ptr);
+    void UpdateUnaryNode(BucketedUnaryAgenda *agenda_ptr);
+    void UpdateBinaryNode(BucketedBinaryAgenda *agenda_ptr);
 
     void EmitCompleteSubGraph(ChartItem *chart_item_ptr, EdgeHash edge_hash);
     void EmitPartialSubgraph(ChartItem *chart_item_ptr, TreeNodeBase *node_ptr, bool sumbit);
 
   public:
+    TreeSHRGParser(std::shared_ptr<const Grammar> compiled_grammar, const TokenSet &label_set)
+        : ParserBase("tree_v1", std::move(compiled_grammar), label_set) {
+        InitializeTree();
+    }
+
     template <typename DecomposerType>
     TreeSHRGParser(const std::vector<SHRG> &grammars, TreeDecomposer<DecomposerType> &decomposer,
                    const TokenSet &label_set)
-        : ParserBase("tree_v1", grammars, decomposer, label_set) {
-        InitializeTree();
-    }
+        : TreeSHRGParser(std::make_shared<const Grammar>(grammars, decomposer), label_set) {}
 
     template <typename DecomposerType>
     TreeSHRGParser(const std::vector<SHRG> &grammars, TreeDecomposer<DecomposerType> &&decomposer,
@@ -71,10 +79,8 @@ class TreeSHRGParser : public ParserBase {
     ParserError Parse(const EdsGraph &graph) override;
 
     const ChartItemList *GetItemsByLabelHash(LabelHash label_hash) override {
-        auto it = unary_agendas_.find(label_hash);
-        if (it != unary_agendas_.end())
-            return &it->second.passive_items.AsList();
-        return nullptr;
+        const UnaryAgenda *agenda_ptr = unary_agendas_.Find(label_hash);
+        return agenda_ptr ? &agenda_ptr->passive_items.AsList() : nullptr;
     }
 };
 
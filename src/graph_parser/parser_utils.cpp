@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <iostream>
 #include <random>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "parser_utils.hpp"
 
 namespace shrg {
@@ -11,6 +16,80 @@ int RandomRange(int start, int end) {
     return std::uniform_int_distribution<>(start, end - 1)(gen);
 }
 
+GrammarLabelIndex::GrammarLabelIndex(const std::vector<SHRG> &grammars)
+    : num_required_labels_(grammars.size()), label_free_grammars_((grammars.size() + 63) / 64) {
+    std::vector<std::vector<uint>> grammars_of_label;
+    for (uint i = 0; i < grammars.size(); ++i) {
+        const SHRG &grammar = grammars[i];
+        num_required_labels_[i] = grammar.terminal_edges_set.size();
+        if (grammar.terminal_edges_set.empty())
+            label_free_grammars_[i / 64] |= uint64_t(1) << (i % 64);
+
+        for (EdgeHash edge_hash : grammar.terminal_edges_set) {
+            auto result = label_ids_.emplace(edge_hash, grammars_of_label.size());
+            if (result.second)
+                grammars_of_label.emplace_back();
+            grammars_of_label[result.first->second].push_back(i);
+        }
+    }
+
+    label_offsets_.reserve(grammars_of_label.size() + 1);
+    label_offsets_.push_back(0);
+    for (auto &ids : grammars_of_label) {
+        grammar_ids_.insert(grammar_ids_.end(), ids.begin(), ids.end());
+        label_offsets_.push_back(grammar_ids_.size());
+    }
+}
+
+const std::vector<uint> &GrammarSelector::Select(const GrammarLabelIndex &index,
+                                                 const EdsGraph &graph) {
+    if (hits_.size() != index.NumGrammars()) {
+        hits_.assign(index.NumGrammars(), 0);
+        label_epochs_.assign(index.NumLabels(), 0);
+        epoch_ = 0;
+    }
+    if (++epoch_ == 0) { // the stamps wrapped around
+        std::fill(label_epochs_.begin(), label_epochs_.end(), 0);
+        epoch_ = 1;
+    }
+
+    selected_ = index.label_free_grammars_;
+    for (const EdsGraph::Edge &edge : graph.edges) {
+        if (!edge.is_terminal)
+            continue;
+        auto it = index.label_ids_.find(edge.Hash());
+        if (it == index.label_ids_.end() || label_epochs_[it->second] == epoch_)
+            continue;
+        label_epochs_[it->second] = epoch_;
+
+        uint end = index.label_offsets_[it->second + 1];
+        for (uint k = index.label_offsets_[it->second]; k < end; ++k) {
+            uint grammar_index = index.grammar_ids_[k];
+            if (hits_[grammar_index]++ == 0)
+                hit_grammars_.push_back(grammar_index);
+            if (hits_[grammar_index] == index.num_required_labels_[grammar_index])
+                selected_[grammar_index / 64] |= uint64_t(1) << (grammar_index % 64);
+        }
+    }
+    for (uint grammar_index : hit_grammars_)
+        hits_[grammar_index] = 0;
+    hit_grammars_.clear();
+
+    grammar_indices_.clear();
+    for (std::size_t w = 0; w < selected_.size(); ++w)
+        for (uint64_t word = selected_[w]; word; word &= word - 1)
+            grammar_indices_.push_back(w * 64 + __builtin_ctzll(word));
+    return grammar_indices_;
+}
+
+void ComputeIncidenceMasks(const EdsGraph &graph, IncidenceMasks &incident_edges) {
+    std::size_t node_count = graph.nodes.size();
+    incident_edges.assign(node_count, EdgeSet());
+    for (std::size_t i = 0; i < node_count; ++i)
+        for (const EdsGraph::Edge *edge_ptr : graph.nodes[i].linked_edges)
+            incident_edges[i].set(edge_ptr->index);
+}
+
 bool CheckAndChangeMappingFinally(const SHRG *grammar_ptr, uint boundary_node_count,
                                   NodeMapping &merged_mapping) {
     const std::vector<SHRG::Node *> &external_nodes = grammar_ptr->external_nodes;
@@ -41,10 +120,10 @@ bool CheckAndChangeMappingFinally(const SHRG *grammar_ptr, uint boundary_node_co
     return true;
 }
 
-inline int MergeMappings(const EdsGraph *graph_ptr, uint shrg_node_count, //
-                         const NodeMapping &right_mapping,                //
-                         NodeMapping &merged_mapping, const EdgeSet &merged_edge_set,
-                         const NodeMapping &boundary_nodes_of_hrg) {
+inline int MergeMappingsScalar(const IncidenceMasks &incident_edges, //
+                               uint shrg_node_count, const NodeMapping &right_mapping,
+                               NodeMapping &merged_mapping, const EdgeSet &merged_edge_set,
+                               const NodeMapping &boundary_nodes_of_hrg) {
     // TODO: optimize for empty graph
     NodeSet node_set = 0;
     int boundary_node_count = 0;
@@ -57,7 +136,7 @@ inline int MergeMappings(const EdsGraph *graph_ptr, uint shrg_node_count, //
                 if (merged_eds_index != right_eds_index) // the two bijection is not compatible
                     return -1;
                 // check whether current node is a boundary node of merged subgraph
-                if (!IsBoundaryNode(graph_ptr->nodes[merged_eds_index - 1], merged_edge_set)) {
+                if (!IsBoundaryNode(incident_edges[merged_eds_index - 1], merged_edge_set)) {
                     // current node is a internal node of merged subgraph, remove it from
                     // node_mapping
                     if (boundary_nodes_of_hrg[node_index])
@@ -89,9 +168,116 @@ inline int MergeMappings(const EdsGraph *graph_ptr, uint shrg_node_count, //
     return boundary_node_count;
 }
 
-int MergeTwoChartItems(const EdsGraph *graph_ptr,                                       //
+#ifdef __SSE2__
+// Same as MergeMappingsScalar, but all 16 slots are handled at once. Only the slots mapped on both
+// sides need a graph lookup (IsBoundaryNode), everything else is a handful of byte compares.
+inline int MergeMappingsSSE2(const IncidenceMasks &incident_edges, //
+                             uint shrg_node_count, const NodeMapping &right_mapping,
+                             NodeMapping &merged_mapping, const EdgeSet &merged_edge_set,
+                             const NodeMapping &boundary_nodes_of_hrg) {
+    static_assert(sizeof(NodeMapping) == sizeof(__m128i), "NodeMapping should be 16 bytes");
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i slots = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    // slots of SHRG nodes; the others are left untouched
+    const __m128i valid = _mm_cmplt_epi8(slots, _mm_set1_epi8(static_cast<char>(shrg_node_count)));
+
+    __m128i merged = _mm_loadu_si128(reinterpret_cast<const __m128i *>(merged_mapping.m1.data()));
+    __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i *>(right_mapping.m1.data()));
+    __m128i not_boundary = _mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(boundary_nodes_of_hrg.m1.data())), zero);
+
+    // case #1: both sides are mapped, the two bijection should be compatible
+    __m128i both = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(merged, zero), //
+                                                 _mm_cmpeq_epi8(right, zero)),
+                                    valid);
+    if (_mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(merged, right), both)))
+        return -1;
+
+    // nodes covered by both sides may become internal nodes of the merged subgraph
+    uint internal = 0;
+    for (uint mask = _mm_movemask_epi8(both); mask; mask &= mask - 1) {
+        uint node_index = __builtin_ctz(mask);
+        if (!IsBoundaryNode(incident_edges[merged_mapping[node_index] - 1], merged_edge_set))
+            internal |= 1u << node_index;
+    }
+    if (internal & ~_mm_movemask_epi8(not_boundary))
+        return -1; // but this node is a boundary node in SHRG Grammar
+
+    // case #2 and #3: the slot is taken from whichever side is mapped
+    __m128i result = _mm_or_si128(merged, right);
+    if (internal) {
+        // pick the low byte of `internal` for slots 0-7 and the high byte for slots 8-15
+        __m128i internal_mask = _mm_cmpeq_epi8(
+            _mm_and_si128(_mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(internal)),
+                                             _mm_set1_epi8(static_cast<char>(internal >> 8))),
+                          _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64,
+                                        -128)),
+            zero);
+        result = _mm_and_si128(result, internal_mask);
+    }
+    result = _mm_or_si128(_mm_and_si128(valid, result), _mm_andnot_si128(valid, merged));
+
+    __m128i mapped = _mm_andnot_si128(_mm_cmpeq_epi8(result, zero), valid);
+    if (_mm_movemask_epi8(_mm_and_si128(mapped, not_boundary)))
+        return -1; // this node should not be a boundary anymore
+
+    // two different SHRG nodes map to a same Eds node. Comparing against the rotations by 1..8
+    // covers every pair of slots
+    __m128i targets = _mm_and_si128(result, mapped);
+    __m128i duplicated = zero;
+#define SHRG_ROTATE_COMPARE(k)                                                                   \
+    duplicated = _mm_or_si128(                                                                   \
+        duplicated,                                                                              \
+        _mm_cmpeq_epi8(targets, _mm_or_si128(_mm_srli_si128(targets, k),                         \
+                                             _mm_slli_si128(targets, 16 - (k)))))
+    SHRG_ROTATE_COMPARE(1);
+    SHRG_ROTATE_COMPARE(2);
+    SHRG_ROTATE_COMPARE(3);
+    SHRG_ROTATE_COMPARE(4);
+    SHRG_ROTATE_COMPARE(5);
+    SHRG_ROTATE_COMPARE(6);
+    SHRG_ROTATE_COMPARE(7);
+    SHRG_ROTATE_COMPARE(8);
+#undef SHRG_ROTATE_COMPARE
+    uint mapped_mask = _mm_movemask_epi8(mapped);
+    if (_mm_movemask_epi8(duplicated) & mapped_mask)
+        return -1;
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(merged_mapping.m1.data()), result);
+    return __builtin_popcount(mapped_mask);
+}
+#endif
+
+inline int MergeMappings(const IncidenceMasks &incident_edges, //
+                         uint shrg_node_count, const NodeMapping &right_mapping,
+                         NodeMapping &merged_mapping, const EdgeSet &merged_edge_set,
+                         const NodeMapping &boundary_nodes_of_hrg) {
+#ifdef __SSE2__
+#ifdef SHRG_PARSER_CHECK
+    NodeMapping expected_mapping = merged_mapping;
+    int expected_count = MergeMappingsScalar(incident_edges, shrg_node_count, right_mapping,
+                                             expected_mapping, merged_edge_set,
+                                             boundary_nodes_of_hrg);
+#endif
+    int boundary_node_count = MergeMappingsSSE2(incident_edges, shrg_node_count, right_mapping,
+                                                merged_mapping, merged_edge_set,
+                                                boundary_nodes_of_hrg);
+#ifdef SHRG_PARSER_CHECK
+    assert(boundary_node_count == expected_count);
+    assert(boundary_node_count < 0 || merged_mapping == expected_mapping);
+#endif
+    return boundary_node_count;
+#else
+    return MergeMappingsScalar(incident_edges, shrg_node_count, right_mapping, merged_mapping,
+                               merged_edge_set, boundary_nodes_of_hrg);
+#endif
+}
+
+int MergeTwoChartItems(const IncidenceMasks &incident_edges,                            //
                        const ChartItem *left_item_ptr, const ChartItem *right_item_ptr, //
-                       uint shrg_node_count, EdgeSet &merged_edge_set, NodeMapping &merged_mapping,
+                       uint shrg_node_count, EdgeSet &merged_edge_set,
+                       uint64_t &merged_edge_set_hash, NodeMapping &merged_mapping,
                        const NodeMapping &boundary_nodes_of_hrg) {
     // *IMPORTANT*
     // boundary_node_mapping of left/right subgraph is index-of-SHRG-node => index-of-EDS-node
@@ -101,16 +287,19 @@ int MergeTwoChartItems(const EdsGraph *graph_ptr,
     // merge subgraphs in a grammar, so the index of SHRG node is the same
     merged_mapping = left_item_ptr->boundary_node_mapping;
     merged_edge_set = left_item_ptr->edge_set | right_item_ptr->edge_set;
+    // the two edge sets are disjoint
+    merged_edge_set_hash = left_item_ptr->edge_set_hash ^ right_item_ptr->edge_set_hash;
 
-    return MergeMappings(graph_ptr, shrg_node_count, //
+    return MergeMappings(incident_edges, shrg_node_count, //
                          right_item_ptr->boundary_node_mapping, merged_mapping, merged_edge_set,
                          boundary_nodes_of_hrg);
 }
 
-int MergeTwoChartItems(const EdsGraph *graph_ptr,      //
-                       const ChartItem *left_item_ptr, //
+int MergeTwoChartItems(const IncidenceMasks &incident_edges, //
+                       const ChartItem *left_item_ptr,              //
                        const ChartItem *right_item_ptr, const SHRG::Edge *left_edge_ptr,
-                       uint shrg_node_count, EdgeSet &merged_edge_set, NodeMapping &merged_mapping,
+                       uint shrg_node_count, EdgeSet &merged_edge_set,
+                       uint64_t &merged_edge_set_hash, NodeMapping &merged_mapping,
                        const NodeMapping &boundary_nodes_of_hrg) {
     // *IMPORTANT*
     // boundary_node_mapping of left subgraph is index-of-external-node => index-of-EDS-node
@@ -127,8 +316,10 @@ int MergeTwoChartItems(const EdsGraph *graph_ptr,      //
         merged_mapping[external_node_ptr->index] = left_mapping[external_node_index++];
 
     merged_edge_set = left_item_ptr->edge_set | right_item_ptr->edge_set;
+    // the two edge sets are disjoint
+    merged_edge_set_hash = left_item_ptr->edge_set_hash ^ right_item_ptr->edge_set_hash;
 
-    return MergeMappings(graph_ptr, shrg_node_count, //
+    return MergeMappings(incident_edges, shrg_node_count, //
                          right_item_ptr->boundary_node_mapping, merged_mapping, merged_edge_set,
                          boundary_nodes_of_hrg);
 }
@@ -1,5 +1,15 @@
 #pragma once
 
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../include/flat_hash_table.hpp"
+
 #include "parser_chart_item.hpp"
 #include "synchronous_hyperedge_replacement_grammar.hpp"
 
@@ -72,23 +82,154 @@ inline NodeMapping MaskedNodeMapping(const NodeMapping &node_mapping, const Node
                    node_mapping.m8[1] & mask.m8[1]}};
 }
 
-template <typename NodeType>
-inline bool IsBoundaryNode(const NodeType &node, const EdgeSet &edge_set) {
-    for (auto *eds_edge_ptr : node.linked_edges)
-        if (!edge_set[eds_edge_ptr->index])
-            return true;
-    return false;
+// log score of applying `grammar_ptr`: the weight of the SHRG rule (trained by EM) plus the score
+// of its best CFG rule (what the generator maximizes)
+inline float RuleScore(const SHRG *grammar_ptr) {
+    return grammar_ptr->log_rule_weight +
+           (grammar_ptr->best_cfg_ptr ? grammar_ptr->best_cfg_ptr->score : 0.0f);
+}
+
+// incident_edges[i] is the set of edges linked to the i-th node of an EdsGraph
+using IncidenceMasks = std::vector<EdgeSet>;
+
+void ComputeIncidenceMasks(const EdsGraph &graph, IncidenceMasks &incident_edges);
+
+// a node is a boundary node of a subgraph if some of its edges are outside the subgraph
+inline bool IsBoundaryNode(const EdgeSet &incident_edges, const EdgeSet &edge_set) {
+    return (incident_edges & ~edge_set).any();
 }
 
-template <typename Set>
-inline bool IsGrammarCompatiable(const SHRG &grammar, const Set &terminal_edges_set) {
-    // terminal_edges_set of grammar is much smaller than the one of input graph
-    for (EdgeHash edge_hash : grammar.terminal_edges_set)
-        if (terminal_edges_set.find(edge_hash) == terminal_edges_set.end()) {
-            // there is a terminal edge in grammar but not in edsgraph
-            return false; // this grammar won't be used in this graph
+// Edge sets stored row after row in one contiguous buffer. Agendas keep a copy of the edge sets
+// of their items here, so that one edge set can be screened against a run of others without
+// touching the scattered pooled items.
+class EdgeSetBlock {
+  public:
+    static const std::size_t kWords = MAX_GRAPH_EDGE_COUNT / 64;
+
+  private:
+    static_assert(sizeof(EdgeSet) == kWords * sizeof(uint64_t) &&
+                      std::is_trivially_copyable<EdgeSet>::value,
+                  "EdgeSet should be an array of 64-bit words");
+
+    utils::CountedVector<uint64_t> words_;
+
+  public:
+    std::size_t Size() const { return words_.size() / kWords; }
+
+    void Clear() { words_.clear(); }
+
+    void Push(const EdgeSet &edge_set) {
+        std::size_t size = words_.size();
+        words_.resize(size + kWords);
+        std::memcpy(words_.data() + size, &edge_set, sizeof(EdgeSet));
+    }
+
+    // calls function(i) for every row i in [begin, end) which is disjoint with `edge_set`
+    template <typename Function>
+    void ForEachDisjoint(const EdgeSet &edge_set, std::size_t begin, std::size_t end,
+                         Function function) const {
+        uint64_t query[kWords];
+        std::memcpy(query, &edge_set, sizeof(EdgeSet));
+
+        const uint64_t *row = words_.data() + begin * kWords;
+        for (std::size_t i = begin; i < end; ++i, row += kWords) {
+#if defined(__SSE2__)
+            __m128i overlap = _mm_setzero_si128();
+            for (std::size_t k = 0; k < kWords; k += 2)
+                overlap = _mm_or_si128(
+                    overlap,
+                    _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + k)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(query + k))));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(overlap, _mm_setzero_si128())) == 0xffff)
+                function(i);
+#else
+            uint64_t overlap = 0;
+            for (std::size_t k = 0; k < kWords; ++k)
+                overlap |= row[k] & query[k];
+            if (overlap == 0)
+                function(i);
+#endif
+        }
+    }
+};
+
+// Inverted index from the labels of terminal edges to the grammars that contain them. A grammar
+// can be used for a graph only if all its terminal edge labels occur in the graph, which is
+// decided by counting the hits of the labels of the graph instead of testing every grammar.
+class GrammarLabelIndex {
+    friend class GrammarSelector;
+
+    std::unordered_map<EdgeHash, uint> label_ids_; // dense ids of terminal edge labels
+    // grammars containing label i (ascending) are the ones in grammar_ids_ between
+    // label_offsets_[i] and label_offsets_[i + 1]
+    std::vector<uint> label_offsets_;
+    std::vector<uint> grammar_ids_;
+    std::vector<uint> num_required_labels_; // distinct terminal edge labels of each grammar
+    // bitset of the grammars without terminal edges, which are compatible with every graph
+    std::vector<uint64_t> label_free_grammars_;
+
+  public:
+    explicit GrammarLabelIndex(const std::vector<SHRG> &grammars);
+
+    std::size_t NumLabels() const { return label_ids_.size(); }
+    std::size_t NumGrammars() const { return num_required_labels_.size(); }
+};
+
+// Per-parser state of the grammar selection, reused by every graph
+class GrammarSelector {
+    std::vector<uint> hits_;         // labels of each grammar found in current graph
+    std::vector<uint> hit_grammars_; // grammars with nonzero hits_
+    std::vector<uint> label_epochs_; // epoch in which each label was seen, to skip duplicates
+    uint epoch_ = 0;
+    std::vector<uint64_t> selected_; // bitset of the selected grammars
+    std::vector<uint> grammar_indices_;
+
+  public:
+    // indices (ascending) of the grammars whose terminal_edges_set is contained in the hashes of
+    // the terminal edges of `graph`
+    const std::vector<uint> &Select(const GrammarLabelIndex &index, const EdsGraph &graph);
+};
+
+// Orders the terminal edges of `grammar` for matching against a graph, VF2-style: the next edge is
+// always one with the most nodes bound by the edges before it (an edge with all nodes bound has
+// at most one candidate, an edge with a bound node is looked up by it), and among those the one
+// whose label has the fewest candidates in the graph, `num_candidates(edge_ptr)`. Ties keep the
+// order of grammar.terminal_edges.
+template <typename CountFunction>
+void PlanTerminalMatch(const SHRG &grammar, CountFunction num_candidates,
+                       std::vector<const SHRG::Edge *> &plan) {
+    const std::vector<SHRG::Edge *> &edges = grammar.terminal_edges;
+    std::size_t edge_count = edges.size();
+    std::size_t counts[MAX_SHRG_EDGE_COUNT];
+    for (std::size_t i = 0; i < edge_count; ++i)
+        counts[i] = num_candidates(edges[i]);
+
+    std::bitset<MAX_SHRG_EDGE_COUNT> planned_edges;
+    std::bitset<MAX_SHRG_NODE_COUNT> bound_nodes;
+    plan.clear();
+    while (plan.size() < edge_count) {
+        std::size_t best = edge_count;
+        std::pair<int, std::size_t> best_key;
+        for (std::size_t i = 0; i < edge_count; ++i) {
+            if (planned_edges[i])
+                continue;
+            std::size_t node_count = edges[i]->linked_nodes.size();
+            std::size_t num_bound_nodes = 0;
+            for (const SHRG::Node *node_ptr : edges[i]->linked_nodes)
+                num_bound_nodes += bound_nodes[node_ptr->index];
+            // 0: all nodes are bound, 1: some nodes are bound, 2: no node is bound
+            int rank = num_bound_nodes == node_count ? 0 : (num_bound_nodes > 0 ? 1 : 2);
+            std::pair<int, std::size_t> key(rank, counts[i]);
+            if (best == edge_count || key < best_key) {
+                best = i;
+                best_key = key;
+            }
         }
-    return true;
+        planned_edges[best] = true;
+        for (const SHRG::Node *node_ptr : edges[best]->linked_nodes)
+            bound_nodes[node_ptr->index] = true;
+        plan.push_back(edges[best]);
+    }
 }
 
 int RandomRange(int start, int end);
@@ -101,30 +242,33 @@ bool CheckAndChangeMappingFinally(const SHRG *grammar_ptr, uint boundary_node_co
 
 // *IMPORTANT*
 // boundary_node_mapping of left/right chart_item is index-of-SHRG-node => index-of-EDS-node
-int MergeTwoChartItems(const EdsGraph *graph_ptr,                                       //
+int MergeTwoChartItems(const IncidenceMasks &incident_edges,                            //
                        const ChartItem *left_item_ptr, const ChartItem *right_item_ptr, //
-                       uint shrg_node_count, EdgeSet &merged_edge_set, NodeMapping &merged_mapping,
+                       uint shrg_node_count, EdgeSet &merged_edge_set,
+                       uint64_t &merged_edge_set_hash, NodeMapping &merged_mapping,
                        const NodeMapping &boundary_nodes_of_hrg);
 
 // *IMPORTANT*
 // boundary_node_mapping of left chart_item is index-of-external-node => index-of-EDS-node
 // boundary_node_mapping of right chart_item is index-of-SHRG-node => index-of-EDS-node
 // return the count of boundary nodes or -1 if failed
-int MergeTwoChartItems(const EdsGraph *graph_ptr, //
+int MergeTwoChartItems(const IncidenceMasks &incident_edges, //
                        const ChartItem *left_item_ptr,
                        const ChartItem *right_item_ptr, //
                        const SHRG::Edge *left_edge_ptr, //
-                       uint shrg_node_count, EdgeSet &merged_edge_set, NodeMapping &merged_mapping,
+                       uint shrg_node_count, EdgeSet &merged_edge_set,
+                       uint64_t &merged_edge_set_hash, NodeMapping &merged_mapping,
                        const NodeMapping &boundary_nodes_of_hrg);
 
 template <typename ValueType> class ChartItemMap {
     static_assert(sizeof(EdgeHash) == 8, "EdgeHash should be 64-bit long");
 
   public:
+    // O(1), the slots and values of the maps are reused by the next graph
     void Clear() {
-        small_map_.clear();
-        medium_map_.clear();
-        large_map_.clear();
+        small_map_.Clear();
+        medium_map_.Clear();
+        large_map_.Clear();
     }
 
     ValueType &At(const SHRG::Edge *edge_ptr, const NodeMapping &node_mapping) {
@@ -144,14 +288,27 @@ template <typename ValueType> class ChartItemMap {
         return large_map_[{edge_hash, node_mapping}];
     }
 
-    const std::unordered_map<SmallKey, ValueType> &Small() const { return small_map_; };
-    const std::unordered_map<MediumKey, ValueType> &Medium() const { return medium_map_; };
-    const std::unordered_map<LargeKey, ValueType> &Large() const { return large_map_; };
+    // nullptr if there is no such value
+    const ValueType *Find(EdgeHash edge_hash, const NodeMapping &node_mapping,
+                          uint boundary_node_count) const {
+        if (boundary_node_count <= 4)
+            return small_map_.Find((edge_hash << 32) | node_mapping.m4[0]);
+
+        if (boundary_node_count <= 12) {
+            NodeMapping key = node_mapping; // copy
+            key.m4[3] = edge_hash;
+            return medium_map_.Find(key);
+        }
+
+        return large_map_.Find({edge_hash, node_mapping});
+    }
+
+    std::size_t Size() const { return small_map_.Size() + medium_map_.Size() + large_map_.Size(); }
 
   private:
-    std::unordered_map<SmallKey, ValueType> small_map_;
-    std::unordered_map<MediumKey, ValueType> medium_map_;
-    std::unordered_map<LargeKey, ValueType> large_map_;
+    utils::FlatHashMap<SmallKey, ValueType> small_map_;
+    utils::FlatHashMap<MediumKey, ValueType> medium_map_;
+    utils::FlatHashMap<LargeKey, ValueType> large_map_;
 };
 
 } // namespace shrg
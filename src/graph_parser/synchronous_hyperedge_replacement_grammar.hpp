@@ -49,10 +49,10 @@ class SHRG {
     std::vector<CFGRule> cfg_rules; // A HRG rule can be aligned to multiple CFG rules
 
     // below two fields are used in selection of the best SHRG rule in a weighted model
-    const CFGRule *best_cfg_ptr;
+    const CFGRule *best_cfg_ptr = nullptr;
     int num_occurences;
 
-    double log_rule_weight;
+    double log_rule_weight = 0.0;
     double log_count = -std::numeric_limits<double>::infinity();
 //    double log_count = 0;
     double prev_rule_weight = 0.0;
@@ -17,13 +17,20 @@ class TreeNodeBase : public GrammarAttributes {
 
     NodeMapping boundary_nodes;
 
+    // position of the node among all nodes of a compiled grammar, used to address per-parse state
+    uint index = 0;
+    // distance to the root of the tree decomposition
+    uint depth = 0;
+    // unary node: UINT8_MAX at the i-th slot if the i-th node of covered edge is already matched
+    //             by the subtree
+    // binary node: UINT8_MAX at the nodes matched by both subtrees and on the boundary of both
+    NodeMapping covered_mask{};
+
   public:
     TreeNodeBase(const SHRG::Edge *edge = nullptr) : covered_edge_ptr(edge) {}
 
     virtual ~TreeNodeBase() {}
 
-    virtual void Clear(){};
-
     TreeNodeBase *Parent() { return parent_; }
     TreeNodeBase *Left() { return left_; }
     TreeNodeBase *Right() { return right_; }
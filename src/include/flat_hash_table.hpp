@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "memory_utils.hpp"
+
+namespace utils {
+
+// Open addressing hash table (linear probing) which maps keys to dense indices 0, 1, 2, ... in
+// order of insertion. Every slot is stamped with the epoch in which it was written, and only slots
+// of the current epoch are alive, so Clear() is O(1) and keeps the slots for the next round.
+//
+// Trim policy: a table whose capacity exceeds kTrimCapacity is released by Clear() if less than
+// 1/kTrimRatio of it was used since the last Clear(). One outlier graph therefore holds on to its
+// memory for at most one more graph. Slots are charged to the current MemoryAccount as table bytes.
+template <typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class FlatIndexTable {
+  public:
+    static const std::uint32_t kInitialCapacity = 8;
+    static const std::uint32_t kTrimCapacity = 1 << 12;
+    static const std::uint32_t kTrimRatio = 8;
+
+  private:
+    struct Slot {
+        std::uint32_t epoch;
+        std::uint32_t index;
+        std::size_t hash;
+        Key key;
+    };
+
+    using Slots = std::vector<Slot, CountedAllocator<Slot, MemoryKind::kTable>>;
+
+    Slots slots_;
+    std::uint32_t capacity_ = 0; // 0 or a power of 2
+    std::uint32_t shift_ = 64;   // 64 - log2(capacity_)
+    std::uint32_t size_ = 0;
+    std::uint32_t epoch_ = 1; // slots are value-initialized with epoch 0
+
+    Hash hasher_;
+    KeyEqual key_equal_;
+
+    // std::hash of integers is the identity, so spread the bits before taking the position
+    std::uint32_t Position(std::size_t hash) const {
+        return static_cast<std::uint32_t>((hash * 0x9e3779b97f4a7c15ULL) >> shift_);
+    }
+
+    void Rehash(std::uint32_t new_capacity) {
+        Slots old_slots(new_capacity);
+        std::swap(slots_, old_slots);
+        std::uint32_t old_capacity = capacity_;
+        capacity_ = new_capacity;
+        shift_ = 64 - __builtin_ctz(new_capacity);
+
+        std::uint32_t mask = capacity_ - 1;
+        for (std::uint32_t i = 0; i < old_capacity; ++i) {
+            Slot &old_slot = old_slots[i];
+            if (old_slot.epoch != epoch_)
+                continue;
+            std::uint32_t pos = Position(old_slot.hash);
+            while (slots_[pos].epoch == epoch_)
+                pos = (pos + 1) & mask;
+            slots_[pos] = std::move(old_slot);
+        }
+    }
+
+  public:
+    std::uint32_t Size() const { return size_; }
+    std::uint32_t Capacity() const { return capacity_; }
+    bool Empty() const { return size_ == 0; }
+
+    // index of `key`, or -1 if `key` is absent
+    int Find(const Key &key) const {
+        if (size_ == 0)
+            return -1;
+        std::size_t hash = hasher_(key);
+        std::uint32_t mask = capacity_ - 1;
+        for (std::uint32_t pos = Position(hash);; pos = (pos + 1) & mask) {
+            const Slot &slot = slots_[pos];
+            if (slot.epoch != epoch_)
+                return -1;
+            if (slot.hash == hash && key_equal_(slot.key, key))
+                return slot.index;
+        }
+    }
+
+    // Maps `key` to index Size() if it is absent. Returns the index of `key` and whether it was
+    // inserted.
+    std::pair<int, bool> Insert(const Key &key) {
+        if ((size_ + 1) * 4 > capacity_ * 3) // keep the load factor under 3/4
+            Rehash(capacity_ == 0 ? kInitialCapacity : capacity_ * 2);
+
+        std::size_t hash = hasher_(key);
+        std::uint32_t mask = capacity_ - 1;
+        for (std::uint32_t pos = Position(hash);; pos = (pos + 1) & mask) {
+            Slot &slot = slots_[pos];
+            if (slot.epoch != epoch_) {
+                slot.epoch = epoch_;
+                slot.index = size_;
+                slot.hash = hash;
+                slot.key = key;
+                return {static_cast<int>(size_++), true};
+            }
+            if (slot.hash == hash && key_equal_(slot.key, key))
+                return {static_cast<int>(slot.index), false};
+        }
+    }
+
+    void Clear() {
+        if (capacity_ > kTrimCapacity && size_ * kTrimRatio < capacity_) {
+            Slots().swap(slots_);
+            capacity_ = 0;
+            shift_ = 64;
+        } else if (++epoch_ == 0) { // the stamps wrapped around
+            for (std::uint32_t i = 0; i < capacity_; ++i)
+                slots_[i].epoch = 0;
+            epoch_ = 1;
+        }
+        size_ = 0;
+    }
+};
+
+// Hash map built on FlatIndexTable. Values are stored in a deque, so their addresses are stable
+// (agendas are referenced by pointer while parsing). After Clear() the values are recycled: a
+// reused value is reset with Value::Clear(), which keeps the buffers it has already allocated.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap {
+    using Table = FlatIndexTable<Key, Hash, KeyEqual>;
+
+    Table table_;
+    std::deque<Value, CountedAllocator<Value, MemoryKind::kTable>> values_;
+
+  public:
+    std::size_t Size() const { return table_.Size(); }
+    bool Empty() const { return table_.Empty(); }
+
+    Value &operator[](const Key &key) {
+        auto result = table_.Insert(key);
+        std::size_t index = result.first;
+        if (result.second) {
+            if (index == values_.size())
+                values_.emplace_back();
+            else
+                values_[index].Clear();
+        }
+        return values_[index];
+    }
+
+    Value *Find(const Key &key) {
+        int index = table_.Find(key);
+        return index < 0 ? nullptr : &values_[index];
+    }
+
+    const Value *Find(const Key &key) const {
+        int index = table_.Find(key);
+        return index < 0 ? nullptr : &values_[index];
+    }
+
+    // live values in order of insertion
+    template <typename Function> void ForEach(Function function) const {
+        std::size_t size = table_.Size();
+        for (std::size_t i = 0; i < size; ++i)
+            function(values_[i]);
+    }
+
+    void Clear() {
+        // follow the trim policy of the table
+        if (values_.size() > Table::kTrimCapacity &&
+            table_.Size() * Table::kTrimRatio < values_.size())
+            values_.clear();
+        table_.Clear();
+    }
+};
+
+} // namespace utils
+
+// Local Variables:
+// mode: c++
+// End:
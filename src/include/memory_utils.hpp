@@ -1,13 +1,142 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <memory>
+#include <new>
 #include <vector>
 #include <cstdint>
 // #include "basic.hpp"
 
 namespace utils {
 
+enum class MemoryKind { kPool = 0, kTable = 1, kVector = 2 };
+
+// Live bytes of the memory paid by one owner (a parser), split by MemoryKind. Table and vector
+// bytes are charged by CountedAllocator while the account is active on the calling thread (see
+// Scope); pool bytes are assigned by the owner from the capacity of its pools. An account is
+// charged and credited by one thread at a time.
+class MemoryAccount {
+    static const int kNumKinds = 3;
+
+    std::size_t bytes_[kNumKinds] = {};
+    std::size_t total_bytes_ = 0;
+    std::size_t peak_bytes_ = 0;
+    std::size_t budget_ = 0; // 0 is unlimited
+
+    static MemoryAccount *&CurrentPtr() {
+        static thread_local MemoryAccount *current_ptr = nullptr;
+        return current_ptr;
+    }
+
+    void UpdatePeak() { peak_bytes_ = std::max(peak_bytes_, total_bytes_); }
+
+  public:
+    // makes `account` the one charged by CountedAllocator on this thread until destruction
+    class Scope {
+        MemoryAccount *previous_ptr_;
+
+      public:
+        explicit Scope(MemoryAccount &account) : previous_ptr_(CurrentPtr()) {
+            CurrentPtr() = &account;
+        }
+        ~Scope() { CurrentPtr() = previous_ptr_; }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+    MemoryAccount() = default;
+    MemoryAccount(const MemoryAccount &) = delete;
+    MemoryAccount &operator=(const MemoryAccount &) = delete;
+
+    static MemoryAccount *Current() { return CurrentPtr(); }
+
+    void Charge(MemoryKind kind, std::size_t bytes) {
+        bytes_[static_cast<int>(kind)] += bytes;
+        total_bytes_ += bytes;
+        UpdatePeak();
+    }
+
+    void Credit(MemoryKind kind, std::size_t bytes) {
+        assert(bytes_[static_cast<int>(kind)] >= bytes);
+        bytes_[static_cast<int>(kind)] -= bytes;
+        total_bytes_ -= bytes;
+    }
+
+    void Assign(MemoryKind kind, std::size_t bytes) {
+        std::size_t &kind_bytes = bytes_[static_cast<int>(kind)];
+        total_bytes_ = total_bytes_ - kind_bytes + bytes;
+        kind_bytes = bytes;
+        UpdatePeak();
+    }
+
+    std::size_t Bytes() const { return total_bytes_; }
+    std::size_t Bytes(MemoryKind kind) const { return bytes_[static_cast<int>(kind)]; }
+
+    // high-water mark of Bytes() since the last ResetPeak()
+    std::size_t PeakBytes() const { return peak_bytes_; }
+    void ResetPeak() { peak_bytes_ = total_bytes_; }
+
+    std::size_t Budget() const { return budget_; }
+    void SetBudget(std::size_t budget) { budget_ = budget; }
+    bool OverBudget() const { return budget_ != 0 && total_bytes_ > budget_; }
+};
+
+namespace detail {
+
+// Every counted allocation is prefixed with the account that paid for it, so the bytes are
+// credited to the right account wherever the buffer is freed.
+struct alignas(std::max_align_t) CountedHeader {
+    MemoryAccount *account_ptr;
+    std::size_t bytes; // including the header
+    MemoryKind kind;
+};
+
+inline void *AllocateCounted(std::size_t bytes, MemoryKind kind) {
+    bytes += sizeof(CountedHeader);
+    auto header_ptr = static_cast<CountedHeader *>(::operator new(bytes));
+    MemoryAccount *account_ptr = MemoryAccount::Current();
+    new (header_ptr) CountedHeader{account_ptr, bytes, kind};
+    if (account_ptr)
+        account_ptr->Charge(kind, bytes);
+    return header_ptr + 1;
+}
+
+inline void DeallocateCounted(void *ptr) {
+    CountedHeader *header_ptr = static_cast<CountedHeader *>(ptr) - 1;
+    if (header_ptr->account_ptr)
+        header_ptr->account_ptr->Credit(header_ptr->kind, header_ptr->bytes);
+    ::operator delete(header_ptr);
+}
+
+} // namespace detail
+
+// Stateless allocator that charges the current MemoryAccount of the thread (if any). Containers
+// of the parsers use it for the memory that grows with the graph being parsed.
+template <typename T, MemoryKind Kind = MemoryKind::kVector> class CountedAllocator {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+
+  public:
+    using value_type = T;
+
+    template <typename U> struct rebind { using other = CountedAllocator<U, Kind>; };
+
+    CountedAllocator() = default;
+    template <typename U> CountedAllocator(const CountedAllocator<U, Kind> &) {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(detail::AllocateCounted(n * sizeof(T), Kind));
+    }
+    void deallocate(T *ptr, std::size_t) { detail::DeallocateCounted(ptr); }
+
+    template <typename U> bool operator==(const CountedAllocator<U, Kind> &) const { return true; }
+    template <typename U> bool operator!=(const CountedAllocator<U, Kind> &) const { return false; }
+};
+
+template <typename T> using CountedVector = std::vector<T, CountedAllocator<T>>;
+
 namespace detail {
 
 template <typename T, bool = std::is_trivially_destructible<T>::value> struct DestroyAux {
@@ -96,6 +225,8 @@ template <typename T, int POOL_WIDTH = 18> class MemoryPool {
 
     std::size_t PoolSize() const { return pool_index_ + 1; }
     std::size_t Capacity() const { return pools_.size() << POOL_WIDTH; }
+    // bytes of the allocated blocks
+    std::size_t Bytes() const { return Capacity() * sizeof(Block); }
     std::size_t Size() const { return (pool_index_ << POOL_WIDTH) | pool_offset_; }
 
     T *operator[](std::size_t index) {
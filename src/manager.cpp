@@ -22,6 +22,10 @@ void Initialize() {
 }
 
 bool Manager::LoadGrammars(const std::string &input_file, const std::string &filter) {
+    {
+        std::lock_guard<std::mutex> lock(compiled_grammars_mutex_);
+        compiled_grammars_.clear();
+    }
     grammars.clear();
     shrg_rules.clear();
     label_set.Clear();
@@ -66,34 +70,60 @@ Manager::~Manager() {
         delete context_ptr;
 }
 
+tree::SchedulingPolicy ParseSchedulingPolicy(const std::string &scheduler) {
+    if (scheduler.empty() || scheduler == "fifo")
+        return tree::SchedulingPolicy::kFifo;
+    if (scheduler == "smallest_first")
+        return tree::SchedulingPolicy::kSmallestFirst;
+    if (scheduler == "tree_depth")
+        return tree::SchedulingPolicy::kTreeDepth;
+    throw std::runtime_error("Unknown scheduler type: " + scheduler);
+}
+
 template <typename Parser>
-std::unique_ptr<Parser> CreateTreeParser(const std::vector<SHRG> &grammars,
-                                         const std::string &decomposer_type,
-                                         const TokenSet &label_set) {
+std::unique_ptr<Parser> CreateTreeParser(const Manager &manager, const std::string &decomposer_type,
+                                         tree::SchedulingPolicy policy, uint beam_width) {
     using namespace tree;
+    using Grammar = typename Parser::Grammar;
     using Node = typename Parser::TreeNode;
 
-    if (decomposer_type.empty() || decomposer_type == "naive")
-        return std::make_unique<Parser>(grammars, TreeDecomposerTpl<Node, NaiveDecomposer>(),
-                                        label_set);
-    else if (decomposer_type == "terminal_first")
-        return std::make_unique<Parser>(grammars, //
-                                        TreeDecomposerTpl<Node, TerminalFirstDecomposer>(),
-                                        label_set);
-    else if (decomposer_type == "best")
-        return std::make_unique<Parser>(grammars, //
-                                        TreeDecomposerTpl<Node, MinimumWidthDecomposer>(),
-                                        label_set);
-
-    throw std::runtime_error("Unknown decomposer type: " + decomposer_type);
+    auto &grammars = manager.grammars;
+    auto compiled_grammar = manager.GetCompiledGrammar<Grammar>(decomposer_type, [&]() {
+        if (decomposer_type.empty() || decomposer_type == "naive") {
+            TreeDecomposerTpl<Node, NaiveDecomposer> decomposer;
+            return std::make_shared<const Grammar>(grammars, decomposer);
+        } else if (decomposer_type == "terminal_first") {
+            TreeDecomposerTpl<Node, TerminalFirstDecomposer> decomposer;
+            return std::make_shared<const Grammar>(grammars, decomposer);
+        } else if (decomposer_type == "best") {
+            TreeDecomposerTpl<Node, MinimumWidthDecomposer> decomposer;
+            return std::make_shared<const Grammar>(grammars, decomposer);
+        }
+        throw std::runtime_error("Unknown decomposer type: " + decomposer_type);
+    });
+
+    auto parser = std::make_unique<Parser>(std::move(compiled_grammar), manager.label_set);
+    parser->SetSchedulingPolicy(policy);
+    parser->SetBeamWidth(beam_width);
+    return parser;
 }
 
-void Context::Init(const std::string &type, bool verbose, uint max_pool_size) {
-    auto &grammars = manager_ptr->grammars;
-    auto &label_set = manager_ptr->label_set;
-    if (type == "linear")
-        parser = std::make_unique<linear::LinearSHRGParser>(grammars, label_set);
-    else {
+void Context::Init(const std::string &type, bool verbose, uint max_pool_size,
+                   const std::string &scheduler, uint beam_width, std::size_t max_memory_bytes) {
+    auto &manager = *manager_ptr;
+    auto policy = ParseSchedulingPolicy(scheduler);
+    if (type == "linear") {
+        if (policy != tree::SchedulingPolicy::kFifo)
+            throw std::runtime_error("Scheduler " + scheduler + " is not supported by " + type);
+        if (beam_width != 0)
+            throw std::runtime_error("Pruned parsing is not supported by " + type);
+
+        using Grammar = linear::LinearSHRGParser::Grammar;
+        auto compiled_grammar = manager.GetCompiledGrammar<Grammar>(
+            "", [&]() { return std::make_shared<const Grammar>(manager.grammars); });
+        parser = std::make_unique<linear::LinearSHRGParser>(std::move(compiled_grammar),
+                                                            manager.label_set);
+    } else {
         auto pos = type.find('/');
         std::string parser_type(type);
         std::string decomposer_type;
@@ -103,15 +133,17 @@ void Context::Init(const std::string &type, bool verbose, uint max_pool_size) {
         }
 
         if (parser_type == "tree_v1")
-            parser = CreateTreeParser<TreeSHRGParserV1>(grammars, decomposer_type, label_set);
+            parser = CreateTreeParser<TreeSHRGParserV1>(manager, decomposer_type, policy,
+                                                        beam_width);
         else if (parser_type == "tree_v2")
-            parser = CreateTreeParser<TreeSHRGParserV2>(grammars, decomposer_type, label_set);
+            parser = CreateTreeParser<TreeSHRGParserV2>(manager, decomposer_type, policy,
+                                                        beam_width);
         else if (parser_type == "tree_index_v1")
-            parser =
-                CreateTreeParser<IndexedTreeSHRGParserV1>(grammars, decomposer_type, label_set);
+            parser = CreateTreeParser<IndexedTreeSHRGParserV1>(manager, decomposer_type, policy,
+                                                               beam_width);
         else if (parser_type == "tree_index_v2")
-            parser =
-                CreateTreeParser<IndexedTreeSHRGParserV2>(grammars, decomposer_type, label_set);
+            parser = CreateTreeParser<IndexedTreeSHRGParserV2>(manager, decomposer_type, policy,
+                                                               beam_width);
         else {
             parser.release();
             throw std::runtime_error("Unknown parser type: " + type);
@@ -121,6 +153,7 @@ void Context::Init(const std::string &type, bool verbose, uint max_pool_size) {
     this->type = type;
     parser->SetVerbose(verbose);
     parser->SetPoolSize(max_pool_size);
+    parser->SetMemoryBudget(max_memory_bytes);
 }
 
 std::size_t Context::CountChartItems(ChartItem *chart_item_ptr) {
@@ -151,6 +184,22 @@ ParserError Context::Parse(const EdsGraph &graph) {
     return parser->Parse(graph);
 }
 
+ParserError Context::Parse(int index, const Deadline &deadline) {
+    return Parse(manager_ptr->edsgraphs[index], deadline);
+}
+
+ParserError Context::Parse(const EdsGraph &graph, const Deadline &deadline) {
+    if (!Check())
+        return ParserError::kUnInitialized;
+    // the deadline only applies to this parse, also if it throws
+    struct DeadlineScope {
+        SHRGParserBase *parser;
+        ~DeadlineScope() { parser->SetDeadline(Deadline()); }
+    } scope{parser.get()};
+    parser->SetDeadline(deadline);
+    return Parse(graph);
+}
+
 bool Context::Generate() {
     if (!Check())
         return false;
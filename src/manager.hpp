@@ -1,7 +1,11 @@
 #pragma once
 
+#include <mutex>
+#include <typeindex>
+
 #include "graph_parser/generator.hpp"
 #include "graph_parser/parser_base.hpp"
+#include "parse_engine.hpp"
 
 namespace shrg {
 
@@ -37,7 +41,13 @@ class Context {
         return true;
     }
 
-    void Init(const std::string &type, bool verbose = true, uint max_pool_size = 50);
+    // `scheduler` is the order of agendas used by tree parsers: fifo, smallest_first or tree_depth.
+    // A nonzero `beam_width` turns on the pruned parse mode of tree parsers (every agenda produces
+    // at most `beam_width` items, best first); 0 is exact parsing. A nonzero `max_memory_bytes`
+    // makes a parse fail with kOutOfMemory once its chart holds more bytes.
+    void Init(const std::string &type, bool verbose = true, uint max_pool_size = 50,
+              const std::string &scheduler = "fifo", uint beam_width = 0,
+              std::size_t max_memory_bytes = 0);
 
     void ReleaseMemory() {
         if (Check()) {
@@ -48,6 +58,8 @@ class Context {
 
     std::size_t PoolSize() const { return parser->MemoryPool().Size(); }
 
+    std::size_t PeakMemoryBytes() const { return parser->PeakMemoryBytes(); }
+
     const ChartItem *GetChartItem(std::size_t index) const {
         if (index >= PoolSize())
             throw std::runtime_error("Out of range");
@@ -58,6 +70,11 @@ class Context {
 
     ParserError Parse(const EdsGraph &edsgraph);
 
+    // gives up with kTimeout once `deadline` expires, or with kCancelled once it is cancelled
+    ParserError Parse(int index, const Deadline &deadline);
+
+    ParserError Parse(const EdsGraph &edsgraph, const Deadline &deadline);
+
     bool Generate();
 
     void SetChartItem(ChartItem &chart_item) { best_item_ptr = &chart_item; }
@@ -71,6 +88,11 @@ class Manager {
   private:
     Manager(){};
 
+    // compiled grammars shared by the parsers of all contexts, keyed by grammar type and options
+    mutable std::mutex compiled_grammars_mutex_;
+    mutable std::map<std::pair<std::type_index, std::string>, std::shared_ptr<const CompiledGrammar>>
+        compiled_grammars_;
+
   public:
     ~Manager();
 
@@ -90,10 +112,34 @@ class Manager {
 
     void Allocate(uint num_contexts = 1);
 
+    // returns the compiled grammar of type `Grammar` built with `options`; it is created by
+    // `compile` at the first request and then shared until the grammars are reloaded
+    template <typename Grammar, typename Function>
+    std::shared_ptr<const Grammar> GetCompiledGrammar(const std::string &options,
+                                                      Function compile) const {
+        std::lock_guard<std::mutex> lock(compiled_grammars_mutex_);
+        auto &compiled_grammar = compiled_grammars_[{std::type_index(typeid(Grammar)), options}];
+        if (!compiled_grammar)
+            compiled_grammar = compile();
+        return std::static_pointer_cast<const Grammar>(compiled_grammar);
+    }
+
     // init all context
-    void InitAll(const std::string &type, bool verbose = true, uint max_pool_size = 25) {
+    void InitAll(const std::string &type, bool verbose = true, uint max_pool_size = 25,
+                 const std::string &scheduler = "fifo", uint beam_width = 0,
+                 std::size_t max_memory_bytes = 0) {
         for (auto context_ptr : contexts)
-            context_ptr->Init(type, verbose, max_pool_size);
+            context_ptr->Init(type, verbose, max_pool_size, scheduler, beam_width,
+                              max_memory_bytes);
+    }
+
+    // parse graphs with all contexts, see ParseEngine
+    std::vector<ParserError> ParseAll(const std::vector<int> &graph_indices,
+                                      const ParseEngine::Callback &callback = nullptr,
+                                      double timeout_seconds = 0) {
+        ParseEngine engine(*this);
+        engine.SetTimeout(timeout_seconds);
+        return engine.Run(graph_indices, callback);
     }
 
     static Manager manager;
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+#include "manager.hpp"
+#include "parse_engine.hpp"
+
+namespace shrg {
+
+bool ParseEngine::PopTask(uint worker_index, int &task) {
+    WorkQueue &queue = queues_[worker_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ParseEngine::StealTask(uint worker_index, int &task) {
+    // steal from the most loaded worker; queues are sorted by graph size, so the victim hands
+    // over its largest pending graph and the tail of the batch stays balanced
+    uint num_workers = queues_.size();
+    while (true) {
+        uint victim = worker_index;
+        std::size_t max_size = 0;
+        for (uint i = 0; i < num_workers; ++i) {
+            if (i == worker_index)
+                continue;
+            std::lock_guard<std::mutex> lock(queues_[i].mutex);
+            if (queues_[i].tasks.size() > max_size) {
+                max_size = queues_[i].tasks.size();
+                victim = i;
+            }
+        }
+        if (victim == worker_index)
+            return false;
+        if (PopTask(victim, task))
+            return true;
+        // the victim drained its queue in the meantime, look again
+    }
+}
+
+void ParseEngine::Work(uint worker_index, const std::vector<int> &graph_indices,
+                       std::vector<ParserError> &codes, const Callback &callback) {
+    Context &context = *manager_.contexts[worker_index];
+    int task;
+    while (!stop_ && (PopTask(worker_index, task) || StealTask(worker_index, task))) {
+        try {
+            int graph_index = graph_indices[task];
+            codes[task] = context.Parse(graph_index, Deadline::After(timeout_seconds_, &stop_));
+            if (callback)
+                callback(context, graph_index, codes[task]);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+            stop_ = true;
+        }
+    }
+}
+
+std::vector<ParserError> ParseEngine::Run(const std::vector<int> &graph_indices,
+                                          const Callback &callback) {
+    uint num_workers = manager_.contexts.size();
+    if (num_workers == 0)
+        throw std::runtime_error("no context is allocated");
+
+    auto &edsgraphs = manager_.edsgraphs;
+    for (int graph_index : graph_indices)
+        if (graph_index < 0 || static_cast<std::size_t>(graph_index) >= edsgraphs.size())
+            throw std::out_of_range("graph index out of range: " + std::to_string(graph_index));
+
+    std::vector<ParserError> codes(graph_indices.size(), ParserError::kUnknown);
+
+    // largest graphs first, dealt round-robin so that every worker starts with a similar load
+    std::vector<int> order(graph_indices.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int i, int j) {
+        return edsgraphs[graph_indices[i]].edges.size() > edsgraphs[graph_indices[j]].edges.size();
+    });
+
+    queues_ = std::vector<WorkQueue>(num_workers);
+    for (std::size_t i = 0; i < order.size(); ++i)
+        queues_[i % num_workers].tasks.push_back(order[i]);
+
+    error_ = nullptr;
+    stop_ = false;
+
+    if (num_workers == 1)
+        Work(0, graph_indices, codes, callback);
+    else {
+        std::vector<std::thread> workers;
+        workers.reserve(num_workers);
+        for (uint i = 0; i < num_workers; ++i)
+            workers.emplace_back(
+                [&, i] { Work(i, graph_indices, codes, callback); });
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    queues_.clear();
+    if (error_)
+        std::rethrow_exception(error_);
+    return codes;
+}
+
+} // namespace shrg
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "graph_parser/parser_base.hpp"
+
+namespace shrg {
+
+class Context;
+class Manager;
+
+// Parses a batch of graphs on all contexts of a manager. Every context is driven by its own
+// worker thread which owns a deque of graph indices; an idle worker steals from the other
+// deques, so a few very large graphs never leave the remaining threads waiting at a barrier.
+class ParseEngine {
+  public:
+    // Called on the worker thread right after `context` has parsed `graph_index`. The chart of
+    // `context` stays valid until the callback returns, so results have to be consumed (or
+    // copied out) here. Callbacks run concurrently and must synchronize shared state.
+    using Callback = std::function<void(Context &context, int graph_index, ParserError code)>;
+
+    explicit ParseEngine(Manager &manager) : manager_(manager) {}
+
+    // Every graph gets at most `seconds` (no limit if it is not positive); a graph that takes
+    // longer is reported as kTimeout. A failing batch also cancels the parses in flight, they are
+    // reported as kCancelled.
+    void SetTimeout(double seconds) { timeout_seconds_ = seconds; }
+
+    // Parses all graphs in `graph_indices` and blocks until every one has been handled. The
+    // returned codes are in the order of `graph_indices`. An exception thrown by a parser or
+    // by `callback` stops the batch and is rethrown here.
+    std::vector<ParserError> Run(const std::vector<int> &graph_indices,
+                                 const Callback &callback = nullptr);
+
+  private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<int> tasks; // positions in `graph_indices`
+    };
+
+    bool PopTask(uint worker_index, int &task);
+    bool StealTask(uint worker_index, int &task);
+
+    void Work(uint worker_index, const std::vector<int> &graph_indices,
+              std::vector<ParserError> &codes, const Callback &callback);
+
+    Manager &manager_;
+    double timeout_seconds_ = 0;
+
+    std::vector<WorkQueue> queues_;
+
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+    std::atomic<bool> stop_{false};
+};
+
+} // namespace shrg
+
+// Local Variables:
+// mode: c++
+// End:
@@ -148,7 +148,7 @@ inline double Context_GetLogPartition(Context& context) {
     if (!root) {
         return -std::numeric_limits<double>::infinity();
     }
-    return root->log_inside_prob;
+    return root->Annotations().log_inside_prob;
 }
 
 } // namespace shrg
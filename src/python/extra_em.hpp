@@ -120,31 +120,31 @@ inline EMResult run_batch_em(
     std::function<void(ChartItem*, int)> addParentPointer = [&](ChartItem* root, int level) {
         ChartItem* ptr = root;
         do {
-            if (level > ptr->level) {
-                ptr->level = level;
+            if (level > ptr->Annotations().level) {
+                ptr->Annotations().level = level;
             }
 
             const SHRG* rule = ptr->attrs_ptr->grammar_ptr;
-            if (ptr->child_visited_status != em::EMBase::VISITED) {
+            if (ptr->Annotations().child_visited_status != em::EMBase::VISITED) {
                 for (auto* edge_ptr : rule->nonterminal_edges) {
                     ChartItem* child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                    ptr->children.push_back(child);
-                    addParentPointer(child, ptr->level + 1);
+                    ptr->Annotations().children.push_back(child);
+                    addParentPointer(child, ptr->Annotations().level + 1);
                 }
-                for (size_t i = 0; i < ptr->children.size(); i++) {
+                for (size_t i = 0; i < ptr->Annotations().children.size(); i++) {
                     std::vector<ChartItem*> sib;
-                    for (size_t j = 0; j < ptr->children.size(); j++) {
+                    for (size_t j = 0; j < ptr->Annotations().children.size(); j++) {
                         if (j != i) {
-                            sib.push_back(ptr->children[j]);
+                            sib.push_back(ptr->Annotations().children[j]);
                         }
                     }
                     auto res = std::make_tuple(ptr, sib);
-                    ptr->children[i]->parents_sib.push_back(res);
+                    ptr->Annotations().children[i]->Annotations().parents_sib.push_back(res);
                 }
-                ptr->child_visited_status = em::EMBase::VISITED;
+                ptr->Annotations().child_visited_status = em::EMBase::VISITED;
             } else {
-                for (auto* child : ptr->children) {
-                    addParentPointer(child, ptr->level + 1);
+                for (auto* child : ptr->Annotations().children) {
+                    addParentPointer(child, ptr->Annotations().level + 1);
                 }
             }
             ptr = ptr->next_ptr;
@@ -154,16 +154,16 @@ inline EMResult run_batch_em(
     // Helper function to add rule pointers
     // Use grammar object index (pointer arithmetic) instead of shrg_index for consistent indexing
     std::function<void(ChartItem*)> addRulePointer = [&](ChartItem* root) {
-        if (root->rule_visited == em::EMBase::VISITED) return;
+        if (root->Annotations().rule_visited == em::EMBase::VISITED) return;
 
         ChartItem* ptr = root;
         do {
             // Compute grammar object index using pointer arithmetic
             // This matches Python export_forest which uses: grammar_ptr - grammars.data()
-            ptr->rule_ptr = const_cast<SHRG*>(ptr->attrs_ptr->grammar_ptr);
-            ptr->rule_visited = em::EMBase::VISITED;
+            ptr->Annotations().rule_ptr = const_cast<SHRG*>(ptr->attrs_ptr->grammar_ptr);
+            ptr->Annotations().rule_visited = em::EMBase::VISITED;
 
-            for (ChartItem* child : ptr->children) {
+            for (ChartItem* child : ptr->Annotations().children) {
                 addRulePointer(child);
             }
             ptr = ptr->next_ptr;
@@ -172,16 +172,16 @@ inline EMResult run_batch_em(
 
     // Helper function to compute inside
     std::function<double(ChartItem*)> computeInside = [&](ChartItem* root) -> double {
-        if (root->inside_visited_status == em::EMBase::VISITED) {
-            return root->log_inside_prob;
+        if (root->Annotations().inside_visited_status == em::EMBase::VISITED) {
+            return root->Annotations().log_inside_prob;
         }
 
         ChartItem* ptr = root;
         double log_inside = ChartItem::log_zero;
 
         do {
-            double curr_log_inside = ptr->rule_ptr->log_rule_weight;
-            for (ChartItem* child : ptr->children) {
+            double curr_log_inside = ptr->Annotations().rule_ptr->log_rule_weight;
+            for (ChartItem* child : ptr->Annotations().children) {
                 curr_log_inside += computeInside(child);
             }
             log_inside = em_addLogs(log_inside, curr_log_inside);
@@ -189,8 +189,8 @@ inline EMResult run_batch_em(
         } while (ptr != root);
 
         do {
-            ptr->log_inside_prob = log_inside;
-            ptr->inside_visited_status = em::EMBase::VISITED;
+            ptr->Annotations().log_inside_prob = log_inside;
+            ptr->Annotations().inside_visited_status = em::EMBase::VISITED;
             ptr = ptr->next_ptr;
         } while (ptr != root);
 
@@ -200,7 +200,7 @@ inline EMResult run_batch_em(
     // Helper struct for priority queue
     struct LessThanByLevel {
         bool operator()(ChartItem* lhs, ChartItem* rhs) const {
-            return lhs->level > rhs->level;
+            return lhs->Annotations().level > rhs->Annotations().level;
         }
     };
     using NodeLevelPQ = std::priority_queue<ChartItem*, std::vector<ChartItem*>, LessThanByLevel>;
@@ -211,7 +211,7 @@ inline EMResult run_batch_em(
         ChartItem* ptr = root_ptr;
 
         do {
-            ptr->log_outside_prob = 0.0;
+            ptr->Annotations().log_outside_prob = 0.0;
             ptr = ptr->next_ptr;
         } while (ptr != root_ptr);
 
@@ -220,37 +220,37 @@ inline EMResult run_batch_em(
         auto computeOutsideNode = [&](ChartItem* root, NodeLevelPQ& queue) {
             ChartItem* p = root;
             do {
-                if (p->parents_sib.empty()) {
+                if (p->Annotations().parents_sib.empty()) {
                     p = p->next_ptr;
                     continue;
                 }
 
                 double log_outside = ChartItem::log_zero;
-                for (auto& parent_sib : p->parents_sib) {
+                for (auto& parent_sib : p->Annotations().parents_sib) {
                     ChartItem* parent = std::get<0>(parent_sib);
                     auto& siblings = std::get<1>(parent_sib);
 
-                    double curr_log_outside = parent->rule_ptr->log_rule_weight;
-                    curr_log_outside += parent->log_outside_prob;
+                    double curr_log_outside = parent->Annotations().rule_ptr->log_rule_weight;
+                    curr_log_outside += parent->Annotations().log_outside_prob;
 
                     for (auto* sib : siblings) {
-                        curr_log_outside += sib->log_inside_prob;
+                        curr_log_outside += sib->Annotations().log_inside_prob;
                     }
                     log_outside = em_addLogs(log_outside, curr_log_outside);
                 }
-                p->log_outside_prob = log_outside;
-                p->outside_visited_status = em::EMBase::VISITED;
+                p->Annotations().log_outside_prob = log_outside;
+                p->Annotations().outside_visited_status = em::EMBase::VISITED;
                 p = p->next_ptr;
             } while (p != root);
 
-            double root_log_outside = root->log_outside_prob;
+            double root_log_outside = root->Annotations().log_outside_prob;
 
             do {
-                if (p->outside_visited_status != em::EMBase::VISITED) {
-                    p->log_outside_prob = root_log_outside;
-                    p->outside_visited_status = em::EMBase::VISITED;
+                if (p->Annotations().outside_visited_status != em::EMBase::VISITED) {
+                    p->Annotations().log_outside_prob = root_log_outside;
+                    p->Annotations().outside_visited_status = em::EMBase::VISITED;
                 }
-                for (ChartItem* child : p->children) {
+                for (ChartItem* child : p->Annotations().children) {
                     queue.push(child);
                 }
                 p = p->next_ptr;
@@ -266,22 +266,22 @@ inline EMResult run_batch_em(
 
     // Helper function to compute expected counts
     std::function<void(ChartItem*, double)> computeExpectedCount = [&](ChartItem* root, double pw) {
-        if (root->count_visited_status == em::EMBase::VISITED) return;
+        if (root->Annotations().count_visited_status == em::EMBase::VISITED) return;
 
         ChartItem* ptr = root;
         do {
-            double curr_log_count = ptr->rule_ptr->log_rule_weight;
-            curr_log_count += ptr->log_outside_prob;
+            double curr_log_count = ptr->Annotations().rule_ptr->log_rule_weight;
+            curr_log_count += ptr->Annotations().log_outside_prob;
             curr_log_count -= pw;
 
-            for (ChartItem* child : ptr->children) {
-                curr_log_count += child->log_inside_prob;
+            for (ChartItem* child : ptr->Annotations().children) {
+                curr_log_count += child->Annotations().log_inside_prob;
             }
 
-            ptr->rule_ptr->log_count = em_addLogs(ptr->rule_ptr->log_count, curr_log_count);
-            ptr->count_visited_status = em::EMBase::VISITED;
+            ptr->Annotations().rule_ptr->log_count = em_addLogs(ptr->Annotations().rule_ptr->log_count, curr_log_count);
+            ptr->Annotations().count_visited_status = em::EMBase::VISITED;
 
-            for (ChartItem* child : ptr->children) {
+            for (ChartItem* child : ptr->Annotations().children) {
                 computeExpectedCount(child, pw);
             }
             ptr = ptr->next_ptr;
@@ -431,7 +431,8 @@ inline OptimizedEMResult run_em_optimized(
     int timeout_seconds = 5,
     const std::vector<std::string>& skip_graphs = {},
     bool verbose = true,
-    bool parser_verbose = false  // Detailed parser stats (usually too noisy)
+    bool parser_verbose = false,  // Detailed parser stats (usually too noisy)
+    int num_threads = 1           // Threads of parsing and the E-step, results do not depend on it
 ) {
     OptimizedEMResult result;
     result.converged = false;
@@ -458,10 +459,9 @@ inline OptimizedEMResult run_em_optimized(
         grammar_ptrs.push_back(&g);
     }
 
-    // Allocate and initialize context
-    if (manager.contexts.empty()) {
-        manager.Allocate(1);
-    }
+    // Allocate and initialize contexts, one per parse thread
+    num_threads = std::max(num_threads, 1);
+    manager.Allocate(num_threads);
     manager.InitAll("linear", parser_verbose);  // Use parser_verbose for detailed parser stats
 
     Context* context = manager.contexts[0];
@@ -479,6 +479,9 @@ inline OptimizedEMResult run_em_optimized(
     if (enable_profiling) {
         em_trainer.enableProfiling(true);
     }
+    em_trainer.setNumThreads(num_threads);
+    em_trainer.setParseContexts(std::vector<Context*>(manager.contexts.begin(),
+                                                      manager.contexts.begin() + num_threads));
 
     // Initialize weights
     em_trainer.initializeWeights();
@@ -581,6 +584,26 @@ public:
         profiling_enabled_ = enable;
     }
 
+    void set_num_threads(int num_threads) {
+        num_threads_ = std::max(num_threads, 1);
+        // one context per parse thread
+        if (manager_.contexts.size() < static_cast<size_t>(num_threads_)) {
+            manager_.Allocate(num_threads_);
+            manager_.InitAll("linear", false);
+        }
+        if (em_trainer_) {
+            em_trainer_->setNumThreads(num_threads_);
+            em_trainer_->setParseContexts(parseContexts());
+        }
+    }
+
+    void set_scaled_probabilities(bool enable) {
+        scaled_probabilities_ = enable;
+        if (em_trainer_) {
+            em_trainer_->setScaledProbabilities(enable);
+        }
+    }
+
     // Parse all graphs and cache derivation forests (Phase 1)
     int cache_forests(bool verbose = true) {
         if (em_trainer_) {
@@ -602,6 +625,9 @@ public:
         if (profiling_enabled_) {
             em_trainer_->enableProfiling(true);
         }
+        em_trainer_->setNumThreads(num_threads_);
+        em_trainer_->setParseContexts(parseContexts());
+        em_trainer_->setScaledProbabilities(scaled_probabilities_);
 
         em_trainer_->initializeWeights();
 
@@ -638,6 +664,9 @@ public:
             if (profiling_enabled_) {
                 em_trainer_->enableProfiling(true);
             }
+            em_trainer_->setNumThreads(num_threads_);
+            em_trainer_->setParseContexts(parseContexts());
+            em_trainer_->setScaledProbabilities(scaled_probabilities_);
 
             em_trainer_->initializeWeights();
         }
@@ -728,6 +757,14 @@ private:
     em::EM* em_trainer_;
     bool forests_cached_;
     bool profiling_enabled_ = false;
+    int num_threads_ = 1;
+    bool scaled_probabilities_ = false;
+
+    // the contexts run() parses on
+    std::vector<Context*> parseContexts() const {
+        return std::vector<Context*>(manager_.contexts.begin(),
+                                     manager_.contexts.begin() + num_threads_);
+    }
 };
 
 // Result of safe graph index checking
@@ -203,7 +203,9 @@ PYBIND11_MODULE(pyshrg, m) {
         .value("kOutOfMemory", ParserError::kOutOfMemory)
         .value("kTooLarge", ParserError::kTooLarge)
         .value("kUnInitialized", ParserError::kUnInitialized)
-        .value("KUnknown", ParserError::kUnknown);
+        .value("KUnknown", ParserError::kUnknown)
+        .value("kTimeout", ParserError::kTimeout)
+        .value("kCancelled", ParserError::kCancelled);
 
     class_<Context>(m, "Context") //
         .def_readonly("manager", &Context::manager_ptr)
@@ -226,11 +228,21 @@ PYBIND11_MODULE(pyshrg, m) {
                                LAMBDA_EXPR(Context, self.parser->GetNumTotalMergeOps()))
         .def_property_readonly("num_indexing_keys",
                                LAMBDA_EXPR(Context, self.parser->GetNumIndexingKeys()))
+        .def_property_readonly("num_agenda_updates",
+                               LAMBDA_EXPR(Context, self.parser->GetNumAgendaUpdates()))
+        .def_property_readonly("num_agenda_revisits",
+                               LAMBDA_EXPR(Context, self.parser->GetNumAgendaRevisits()))
         .def_property_readonly("result_item", &Context::Result, return_value_policy::reference)
         .def("set_best_item", &Context::SetChartItem)
-        .def("init", &Context::Init, "type"_a, "verbose"_a = false, "max_pool_size"_a = 25)
+        .def("init", &Context::Init, "type"_a, "verbose"_a = false, "max_pool_size"_a = 25,
+             "scheduler"_a = "fifo", "beam_width"_a = 0, "max_memory_bytes"_a = 0)
         .def("parse", overload_cast<const EdsGraph &>(&Context::Parse))
         .def("parse", overload_cast<int>(&Context::Parse))
+        .def("parse",
+             [](Context &self, int index, double timeout_seconds) {
+                 return self.Parse(index, Deadline::After(timeout_seconds));
+             },
+             "index"_a, "timeout_seconds"_a)
         .def("generate", &Context::Generate)
         .def("split_item",
              overload_cast<const Context &, ChartItem &, const EdsGraph &>(&Context_SplitItem))
@@ -240,6 +252,12 @@ PYBIND11_MODULE(pyshrg, m) {
         .def("find_best_derivation", &Context_FindBestDerivation)
         .def("release_memory", &Context::ReleaseMemory)
         .def("pool_size", &Context::PoolSize)
+        .def("peak_memory_bytes", &Context::PeakMemoryBytes)
+        .def_property(
+            "record_children", LAMBDA_EXPR(Context, self.parser->IsRecordingChildren()),
+            [](Context &self, bool record_children) {
+                self.parser->SetRecordChildren(record_children);
+            })
         .def("get_item", &Context::GetChartItem, return_value_policy::reference)
         // Ambiguity metrics
         .def("compute_inside_outside", &Context_ComputeInsideOutside,
@@ -284,7 +302,10 @@ PYBIND11_MODULE(pyshrg, m) {
                                 const SHRG &grammar) { return &grammar - self.grammars.data(); })
         .def("load_grammars", &Manager::LoadGrammars, "input_file"_a, "filter"_a = "none")
         .def("load_graphs", &Manager::LoadGraphs)
-        .def("init_all", &Manager::InitAll, "type"_a, "verbose"_a = false, "max_pool_size"_a = 25)
+        .def("init_all", &Manager::InitAll, "type"_a, "verbose"_a = false, "max_pool_size"_a = 25,
+             "scheduler"_a = "fifo", "beam_width"_a = 0, "max_memory_bytes"_a = 0)
+        .def("parse_all", &ParseAll, "graph_indices"_a, "callback"_a = none(),
+             "timeout_seconds"_a = 0)
         .def("freeze_tokens", LAMBDA_EXPR(Manager, self.label_set.Freeze()));
 
     class_<Runner>(m, "Runner") //
@@ -329,9 +350,11 @@ PYBIND11_MODULE(pyshrg, m) {
         .def_readonly("max_chain_length", &em::GraphMetrics::max_chain_length)
         .def_readonly("max_children", &em::GraphMetrics::max_children)
         .def_readonly("max_parents", &em::GraphMetrics::max_parents)
+        .def_readonly("peak_parse_bytes", &em::GraphMetrics::peak_parse_bytes)
+        .def_readonly("forest_bytes", &em::GraphMetrics::forest_bytes)
+        .def_readonly("packed_forest_bytes", &em::GraphMetrics::packed_forest_bytes)
         .def_readonly("parse_time_ms", &em::GraphMetrics::parse_time_ms)
         .def_readonly("deep_copy_time_ms", &em::GraphMetrics::deep_copy_time_ms)
-        .def_readonly("reset_flags_time_ms", &em::GraphMetrics::reset_flags_time_ms)
         .def_readonly("inside_time_ms", &em::GraphMetrics::inside_time_ms)
         .def_readonly("outside_time_ms", &em::GraphMetrics::outside_time_ms)
         .def_readonly("expected_count_time_ms", &em::GraphMetrics::expected_count_time_ms)
@@ -365,7 +388,8 @@ PYBIND11_MODULE(pyshrg, m) {
           "timeout_seconds"_a = 5,
           "skip_graphs"_a = std::vector<std::string>{},
           "verbose"_a = true,
-          "parser_verbose"_a = false);
+          "parser_verbose"_a = false,
+          "num_threads"_a = 1);
 
     // OptimizedEMTrainer class for more control
     class_<OptimizedEMTrainer>(m, "OptimizedEMTrainer")
@@ -385,6 +409,12 @@ PYBIND11_MODULE(pyshrg, m) {
         .def("enable_profiling", &OptimizedEMTrainer::enable_profiling,
              "Enable per-graph profiling metrics",
              "enable"_a = true)
+        .def("set_num_threads", &OptimizedEMTrainer::set_num_threads,
+             "Set the number of threads of parsing and the E-step (results do not depend on it)",
+             "num_threads"_a)
+        .def("set_scaled_probabilities", &OptimizedEMTrainer::set_scaled_probabilities,
+             "Run the E-step in linear space on scaled probabilities instead of log space",
+             "enable"_a = true)
         .def("run", &OptimizedEMTrainer::run,
              "Run full EM training with forest caching",
              "use_safe_mode"_a = false,
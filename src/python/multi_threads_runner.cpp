@@ -89,4 +89,25 @@ py::list Runner::Run(const std::vector<int> &indices) {
     return codes;
 }
 
+py::list ParseAll(Manager &manager, const std::vector<int> &graph_indices, py::object callback,
+                  double timeout_seconds) {
+    ParseEngine::Callback on_parsed;
+    if (!callback.is_none())
+        on_parsed = [&callback](Context &context, int graph_index, ParserError code) {
+            py::gil_scoped_acquire acquire;
+            callback(py::cast(&context, py::return_value_policy::reference), graph_index, code);
+        };
+
+    std::vector<ParserError> results;
+    {
+        py::gil_scoped_release release;
+        results = manager.ParseAll(graph_indices, on_parsed, timeout_seconds);
+    }
+
+    py::list codes;
+    for (auto code : results)
+        codes.append(code);
+    return codes;
+}
+
 } // namespace shrg
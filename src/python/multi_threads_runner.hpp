@@ -32,4 +32,10 @@ class Runner {
     bool verbose_;
 };
 
+// Parses all graphs with the work-stealing engine of `manager`. `callback(context, graph_index,
+// code)` is invoked with the GIL held while the chart of `context` is still alive. A graph that
+// takes more than `timeout_seconds` (if positive) is reported as kTimeout.
+pybind11::list ParseAll(Manager &manager, const std::vector<int> &graph_indices,
+                        pybind11::object callback, double timeout_seconds);
+
 } // namespace shrg
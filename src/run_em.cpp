@@ -52,7 +52,7 @@ int main(int argc, char *argv[]) {
     auto *manager = &Manager::manager;
     manager->Allocate(1);
     if (argc < 5) {
-        LOG_ERROR("Usage: run_em <parser_type> <grammar_path> <graph_path> <output_dir> [--skip skip_file] [--profile] [--validate] [--timeout seconds]");
+        LOG_ERROR("Usage: run_em <parser_type> <grammar_path> <graph_path> <output_dir> [--skip skip_file] [--profile] [--validate] [--timeout seconds] [--threads n] [--scaled]");
         return 1;
     }
 
@@ -62,6 +62,8 @@ int main(int argc, char *argv[]) {
     bool validate_mode = false;
     bool safe_mode = false;
     int timeout_seconds = 10;
+    int num_threads = 1;
+    bool scaled_probabilities = false;
     for (int i = 5; i < argc; i++) {
         if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc) {
             skip_graphs = loadSkipList(argv[i + 1]);
@@ -74,18 +76,27 @@ int main(int argc, char *argv[]) {
             std::cout << "Validation mode - comparing computeOutside implementations\n";
         } else if (strcmp(argv[i], "--safe") == 0) {
             safe_mode = true;
-            std::cout << "Safe mode - fork-testing each parse before committing\n";
+            std::cout << "Safe mode - skipping the graphs that time out or run out of memory\n";
         } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
             timeout_seconds = std::atoi(argv[i + 1]);
             std::cout << "Parse timeout set to " << timeout_seconds << " seconds\n";
             i++;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = std::atoi(argv[i + 1]);
+            std::cout << "Parsing and E-step run on " << num_threads << " threads\n";
+            i++;
+        } else if (strcmp(argv[i], "--scaled") == 0) {
+            scaled_probabilities = true;
+            std::cout << "E-step runs on scaled probabilities in linear space\n";
         }
     }
 
     manager->LoadGrammars(argv[2]);
     manager->LoadGraphs(argv[3]);
+    // one context per parse thread
+    manager->Allocate(std::max(num_threads, 1));
+    manager->InitAll(argv[1], false, 100);
     auto &context = manager->contexts[0];
-    context->Init(argv[1], false , 100 );
 
 
     auto graphs = manager->edsgraphs;
@@ -101,6 +112,9 @@ int main(int argc, char *argv[]) {
     if (enable_profiling) {
         model.enableProfiling(true);
     }
+    model.setNumThreads(num_threads);
+    model.setParseContexts(manager->contexts);
+    model.setScaledProbabilities(scaled_probabilities);
 
     if (validate_mode) {
         model.runValidation();
@@ -54,12 +54,12 @@ void checkChildrenSizeAndRulePtr(ChartItem *root, std::vector<SHRG *> &rules){
 
     do{
         int non_terminal_size = ptr->attrs_ptr->grammar_ptr->nonterminal_edges.size();
-        assert(non_terminal_size == ptr->children.size());
+        assert(non_terminal_size == ptr->Annotations().children.size());
 
         int shrg_index = ptr->attrs_ptr->grammar_ptr->best_cfg_ptr->shrg_index;
-        assert(ptr->rule_ptr == rules[shrg_index]);
+        assert(ptr->Annotations().rule_ptr == rules[shrg_index]);
 
-        for(auto child:ptr->children){
+        for(auto child:ptr->Annotations().children){
             checkChildrenSizeAndRulePtr(child, rules);
         }
 
@@ -136,10 +136,10 @@ void printBT(const std::string& prefix, const ChartItem *root, bool isLeft)
         std::cout << (isLeft ? "├──" : "└──" );
 
         // print the value of the node
-        std::cout << root->shrg_index << std::endl;
+        std::cout << root->Annotations().shrg_index << std::endl;
 
         // enter the next tree level - left and right branch
-        std::vector<ChartItem*> children = root->children;
+        std::vector<ChartItem*> children = root->Annotations().children;
         if(children.size() == 0){
             return;
         }
@@ -159,39 +159,39 @@ void addParentPointer(ChartItem *root, int level, Generator *generator){
     ChartItem *ptr = root;
 
     do {
-        if (level > ptr->level) {
-            ptr->level = level;
+        if (level > ptr->Annotations().level) {
+            ptr->Annotations().level = level;
         }
 
         const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
-        if (ptr->child_visited_status !=VISITED_FLAG) {
+        if (ptr->Annotations().child_visited_status !=VISITED_FLAG) {
             for (auto edge_ptr : rule->nonterminal_edges) {
                 ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                ptr->children.push_back(child);
-                addParentPointer(child, ptr->level + 1, generator);
+                ptr->Annotations().children.push_back(child);
+                addParentPointer(child, ptr->Annotations().level + 1, generator);
             }
-            for (int i = 0; i < ptr->children.size(); i++) {
+            for (int i = 0; i < ptr->Annotations().children.size(); i++) {
                 std::vector<ChartItem *> sib;
                 std::tuple<ChartItem *, std::vector<ChartItem *>> res;
-                for (int j = 0; j < ptr->children.size(); j++) {
+                for (int j = 0; j < ptr->Annotations().children.size(); j++) {
                     if (j == i) {
                         continue;
                     }
-                    sib.push_back(ptr->children[j]);
+                    sib.push_back(ptr->Annotations().children[j]);
                 }
 
                 if (ptr) {
                     res = std::make_tuple(ptr, sib);
-                    ptr->children[i]->parents_sib.push_back(res);
+                    ptr->Annotations().children[i]->Annotations().parents_sib.push_back(res);
                 }
             }
-            ptr->child_visited_status = VISITED_FLAG;
+            ptr->Annotations().child_visited_status = VISITED_FLAG;
         } else {
-            for (auto child : ptr->children) {
-                addParentPointer(child, ptr->level + 1, generator);
+            for (auto child : ptr->Annotations().children) {
+                addParentPointer(child, ptr->Annotations().level + 1, generator);
             }
         }
-        assert(ptr->children.size() == rule->nonterminal_edges.size());
+        assert(ptr->Annotations().children.size() == rule->nonterminal_edges.size());
 
         ptr = ptr->next_ptr;
     } while (ptr != root);
@@ -209,63 +209,63 @@ void addParentPointerOptimized(ChartItem *root, int level, Generator *generator)
         queue.pop();
         auto ptr = ptr1;
         do{
-                if (level > ptr->level) {
-                    ptr->level = level;
+                if (level > ptr->Annotations().level) {
+                    ptr->Annotations().level = level;
                 }
 
                 const SHRG *rule = ptr->attrs_ptr->grammar_ptr;
 
-                if (ptr->child_visited_status != VISITED_FLAG) {
-                    ptr->children.reserve(rule->nonterminal_edges.size());
+                if (ptr->Annotations().child_visited_status != VISITED_FLAG) {
+                    ptr->Annotations().children.reserve(rule->nonterminal_edges.size());
 
                     for (auto edge_ptr : rule->nonterminal_edges) {
                         ChartItem *child = generator->FindChartItemByEdge(ptr, edge_ptr);
-                        ptr->children.push_back(child);
-                        queue.push({child, ptr->level + 1});
+                        ptr->Annotations().children.push_back(child);
+                        queue.push({child, ptr->Annotations().level + 1});
                     }
 
-                    size_t childCount = ptr->children.size();
+                    size_t childCount = ptr->Annotations().children.size();
                     std::vector<std::vector<ChartItem*>> siblings(childCount);
 
                     for (size_t i = 0; i < childCount; ++i) {
                         for (size_t j = 0; j < childCount; ++j) {
                             if (i != j) {
-                                siblings[i].push_back(ptr->children[j]);
+                                siblings[i].push_back(ptr->Annotations().children[j]);
                             }
                         }
                     }
 
                     // Assign parent and sibling information
                     for (size_t i = 0; i < childCount; ++i) {
-                        ptr->children[i]->parents_sib.push_back({ptr, std::move(siblings[i])});
+                        ptr->Annotations().children[i]->Annotations().parents_sib.push_back({ptr, std::move(siblings[i])});
                     }
 
-                    ptr->child_visited_status = VISITED_FLAG;
+                    ptr->Annotations().child_visited_status = VISITED_FLAG;
                 } else {
-                    for (auto child : ptr->children) {
-                        queue.push({child, ptr->level + 1});
+                    for (auto child : ptr->Annotations().children) {
+                        queue.push({child, ptr->Annotations().level + 1});
                     }
                 }
 
-                assert(ptr->children.size() == rule->nonterminal_edges.size());
+                assert(ptr->Annotations().children.size() == rule->nonterminal_edges.size());
                 ptr = ptr->next_ptr;
         }while(ptr1 != ptr);
     }
 }
 
 void addRulePointer_test(ChartItem *root, std::vector<SHRG*> &shrg_rules) {
-    if (root->rule_visited == VISITED_FLAG) {
+    if (root->Annotations().rule_visited == VISITED_FLAG) {
         return;
     }
 
     ChartItem *ptr = root;
     do {
         auto grammar_index = ptr->attrs_ptr->grammar_ptr->best_cfg_ptr->shrg_index;
-        ptr->rule_ptr = shrg_rules[grammar_index];
-        ptr->shrg_index = grammar_index;
+        ptr->Annotations().rule_ptr = shrg_rules[grammar_index];
+        ptr->Annotations().shrg_index = grammar_index;
 
-        ptr->rule_visited = VISITED_FLAG;
-        for (ChartItem *child : ptr->children) {
+        ptr->Annotations().rule_visited = VISITED_FLAG;
+        for (ChartItem *child : ptr->Annotations().children) {
             addRulePointer_test(child, shrg_rules);
         }
         ptr = ptr->next_ptr;
@@ -275,7 +275,7 @@ void addRulePointer_test(ChartItem *root, std::vector<SHRG*> &shrg_rules) {
 void print_chartitem_list(ChartItem *root) {
     ChartItem *ptr = root;
     do {
-        std::cout << ptr->shrg_index << " ";
+        std::cout << ptr->Annotations().shrg_index << " ";
         ptr = ptr->next_ptr;
     }while (ptr != root);
     std::cout << std::endl;
@@ -11,6 +11,7 @@
 #include <iomanip>
 #include <chrono>
 #include <cstring>
+#include <sys/stat.h>
 
 using namespace shrg;
 
@@ -202,6 +203,94 @@ int main(int argc, char* argv[]) {
     std::cout << "\nPhase 2 complete: loaded " << cache_hits << " forests in "
               << std::fixed << std::setprecision(2) << phase2_sec << "s\n\n";
 
+    // ========================================
+    // Phase 3: Re-save, compact and reload
+    // ========================================
+    std::cout << "=== Phase 3: Re-save and Compact ===\n";
+
+    auto graph_hash_of = [&](int i) {
+        std::string graph_content = manager->edsgraphs[i].sentence_id + ":" +
+            std::to_string(manager->edsgraphs[i].nodes.size()) + ":" +
+            std::to_string(manager->edsgraphs[i].edges.size());
+        for (const auto& edge : manager->edsgraphs[i].edges) {
+            graph_content += std::to_string(edge.label) + ",";
+        }
+        return forest_cache::ForestCache::compute_hash(graph_content);
+    };
+    auto pack_size = [&]() {
+        struct stat buffer;
+        std::string pack_path = cache_dir + "/forests.pack";
+        return stat(pack_path.c_str(), &buffer) == 0 ? static_cast<long long>(buffer.st_size) : -1;
+    };
+
+    // Save every loaded forest again, leaving its first record stale
+    utils::MemoryPool<ChartItem> resave_pool;
+    for (int i : parsed_graph_indices) {
+        ChartItem* loaded_root = cache.load(manager->edsgraphs[i].sentence_id, graph_hash_of(i),
+                                            resave_pool);
+        if (loaded_root) {
+            forest_cache::ForestCache::restore_rule_pointers(loaded_root, shrg_rules);
+            cache.save(manager->edsgraphs[i].sentence_id, graph_hash_of(i), loaded_root);
+        }
+    }
+    long long resaved_size = pack_size();
+
+    // A reader that only looks forests up, opened before the compaction
+    forest_cache::ForestCache reader(cache_dir);
+    reader.set_grammar_hash(grammar_hash);
+
+    // Compact through another instance, as another process would, then save through the first,
+    // which has to move to the new pack
+    {
+        forest_cache::ForestCache other(cache_dir);
+        other.compact();
+    }
+    long long compacted_size = pack_size();
+    if (!parsed_graph_indices.empty()) {
+        int i = parsed_graph_indices[0];
+        ChartItem* loaded_root = cache.load(manager->edsgraphs[i].sentence_id, graph_hash_of(i),
+                                            resave_pool);
+        if (loaded_root) {
+            forest_cache::ForestCache::restore_rule_pointers(loaded_root, shrg_rules);
+            cache.save(manager->edsgraphs[i].sentence_id, graph_hash_of(i), loaded_root);
+            cache.save(manager->edsgraphs[i].sentence_id + "/after_compaction", graph_hash_of(i),
+                       loaded_root);
+        }
+    }
+    // The reader finds the forest saved into the new pack only if it moved to it
+    bool reader_moved = parsed_graph_indices.empty() ||
+                        reader.load(manager->edsgraphs[parsed_graph_indices[0]].sentence_id +
+                                        "/after_compaction",
+                                    graph_hash_of(parsed_graph_indices[0]), resave_pool) != nullptr;
+    if (!reader_moved) {
+        std::cout << "  Reader did not see the forest saved after the compaction\n";
+    }
+    std::cout << "  Pack size: " << resaved_size << " bytes re-saved, " << compacted_size
+              << " bytes compacted\n";
+    bool compacted = compacted_size > 0 && (parsed_graph_indices.empty() ||
+                                            compacted_size < resaved_size);
+
+    // A fresh instance reads the compacted pack
+    forest_cache::ForestCache reopened(cache_dir);
+    reopened.set_grammar_hash(grammar_hash);
+    utils::MemoryPool<ChartItem> reload_pool;
+    int reloaded = 0;
+    for (size_t idx = 0; idx < parsed_graph_indices.size(); idx++) {
+        int i = parsed_graph_indices[idx];
+        ChartItem* loaded_root = reopened.load(manager->edsgraphs[i].sentence_id, graph_hash_of(i),
+                                               reload_pool);
+        if (loaded_root && em_helper.countForestSize(loaded_root) == original_forest_sizes[idx]) {
+            reloaded++;
+        } else {
+            std::cout << "  Graph " << i << " (" << manager->edsgraphs[i].sentence_id
+                      << "): NOT RELOADED\n";
+        }
+    }
+    bool round_trip = compacted && reader_moved && reloaded == static_cast<int>(parsed_graph_indices.size());
+
+    std::cout << "\nPhase 3 complete: reloaded " << reloaded << "/" << parsed_graph_indices.size()
+              << " forests after compaction\n\n";
+
     // ========================================
     // Summary
     // ========================================
@@ -211,9 +300,11 @@ int main(int argc, char* argv[]) {
     std::cout << "Cache hits: " << cache_hits << "\n";
     std::cout << "Cache misses: " << cache_misses << "\n";
     std::cout << "Verified correct: " << verified << "/" << cache_hits << "\n";
+    std::cout << "Reloaded after compaction: " << reloaded << "/" << parsed_graph_indices.size()
+              << "\n";
     std::cout << "\n";
 
-    if (cache_hits > 0 && cache_misses == 0 && verified == cache_hits) {
+    if (cache_hits > 0 && cache_misses == 0 && verified == cache_hits && round_trip) {
         std::cout << "SUCCESS: Forest cache is working correctly!\n";
         return 0;
     } else {
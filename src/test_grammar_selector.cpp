@@ -0,0 +1,180 @@
+//
+// Test program for the selection of the grammars of a graph
+// Compares GrammarSelector with a brute-force containment test on random grammars and graphs
+//
+
+#include "graph_parser/edsgraph.hpp"
+#include "graph_parser/parser_utils.hpp"
+#include "graph_parser/synchronous_hyperedge_replacement_grammar.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace shrg;
+
+namespace {
+
+const char* kNodeLabels[] = {"_a_n_1", "_b_n_1", "_c_n_1", "_d_n_1", "_e_n_1", "_f_n_1"};
+const char* kEdgeLabels[] = {"ARG1", "ARG2"};
+
+// Random rules over a few labels, in the format of SHRG::Load. Some rules have only nonterminal
+// edges or no semantic part, so that they are compatible with every graph.
+std::string make_grammars(std::mt19937& rng, int num_rules) {
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> node_label(0, 5);
+    std::uniform_int_distribution<int> edge_label(0, 1);
+    std::uniform_int_distribution<int> node_count_of(1, 3);
+
+    std::ostringstream os;
+    os << num_rules << "\n";
+    for (int r = 0; r < num_rules; r++) {
+        if (percent(rng) < 5) {
+            os << "0\n1\n" << r << " 5 10 X 1 x -1\n";
+            continue;
+        }
+        int node_count = node_count_of(rng);
+        std::vector<std::string> edges;
+        for (int n = 0; n < node_count; n++) {
+            if (percent(rng) < 70) {
+                edges.push_back(std::string(kNodeLabels[node_label(rng)]) + " 1 " +
+                                std::to_string(n) + " Y");
+            }
+            if (n > 0) {
+                bool terminal = percent(rng) < 70;
+                edges.push_back((terminal ? std::string(kEdgeLabels[edge_label(rng)]) : "X") +
+                                " 2 " + std::to_string(n - 1) + " " + std::to_string(n) +
+                                (terminal ? " Y" : " N"));
+            }
+        }
+        if (edges.empty()) {
+            edges.push_back("X 1 0 N");
+        }
+        os << "1\n" << node_count << " " << edges.size() << "\n";
+        for (const std::string& edge : edges) {
+            os << edge << "\n";
+        }
+        os << "1 0\n1\n" << r << " 5 10 X 1 x -1\n";
+    }
+    return os.str();
+}
+
+// Random chains in the format of EdsGraph::Load, with a node label and an edge label that no rule
+// contains
+std::string make_graphs(std::mt19937& rng, int num_graphs) {
+    std::uniform_int_distribution<int> node_label(0, 6);
+    std::uniform_int_distribution<int> edge_label(0, 2);
+    std::uniform_int_distribution<int> node_count_of(1, 8);
+
+    std::ostringstream os;
+    os << num_graphs << "\n";
+    for (int g = 0; g < num_graphs; g++) {
+        int node_count = node_count_of(rng);
+        os << "s" << g << "\nw\nw\n" << node_count << "\n";
+        for (int n = 0; n < node_count; n++) {
+            int label = node_label(rng);
+            os << n << " e" << n << " " << (label < 6 ? kNodeLabels[label] : "_z_n_1")
+               << " w n 1 _ _ _ _ _ _\n";
+        }
+        os << "0 " << node_count - 1 << "\n";
+        for (int n = 1; n < node_count; n++) {
+            int label = edge_label(rng);
+            os << n - 1 << " " << n << " " << (label < 2 ? kEdgeLabels[label] : "ARG3") << "\n";
+        }
+    }
+    return os.str();
+}
+
+// The grammars whose terminal edges all occur in the graph, tested one by one
+std::vector<uint> brute_force_select(const std::vector<SHRG>& grammars, const EdsGraph& graph) {
+    std::unordered_set<EdgeHash> terminal_edges_set;
+    for (const EdsGraph::Edge& edge : graph.edges) {
+        if (edge.is_terminal) {
+            terminal_edges_set.insert(edge.Hash());
+        }
+    }
+    std::vector<uint> selected;
+    for (uint i = 0; i < grammars.size(); i++) {
+        bool compatible = true;
+        for (EdgeHash edge_hash : grammars[i].terminal_edges_set) {
+            compatible = compatible && terminal_edges_set.count(edge_hash) > 0;
+        }
+        if (compatible) {
+            selected.push_back(i);
+        }
+    }
+    return selected;
+}
+
+bool write_file(const std::string& path, const std::string& content) {
+    std::ofstream os(path);
+    os << content;
+    return static_cast<bool>(os);
+}
+
+}  // namespace
+
+int main() {
+    std::mt19937 rng(20240611);
+
+    char dir_template[] = "/tmp/test_grammar_selector_XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::cerr << "Cannot create a temporary directory\n";
+        return 1;
+    }
+    std::string grammar_path = std::string(dir_template) + "/grammars.txt";
+    std::string graph_path = std::string(dir_template) + "/graphs.txt";
+
+    // More than 64 grammars, so the selection spans several bitset words
+    std::vector<SHRG> grammars;
+    std::vector<EdsGraph> graphs;
+    TokenSet label_set;
+    bool loaded = write_file(grammar_path, make_grammars(rng, 300)) &&
+                  write_file(graph_path, make_graphs(rng, 200)) &&
+                  SHRG::Load(grammar_path, grammars, label_set) > 0 &&
+                  EdsGraph::Load(graph_path, graphs, label_set);
+    unlink(grammar_path.c_str());
+    unlink(graph_path.c_str());
+    rmdir(dir_template);
+    if (!loaded) {
+        std::cerr << "Cannot load the test grammars and graphs\n";
+        return 1;
+    }
+
+    // One selector is reused for every graph, as in a parser, and the graphs are selected twice
+    GrammarLabelIndex index(grammars);
+    GrammarSelector selector;
+    int mismatches = 0;
+    size_t total_selected = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (const EdsGraph& graph : graphs) {
+            const std::vector<uint>& selected = selector.Select(index, graph);
+            std::vector<uint> expected = brute_force_select(grammars, graph);
+            total_selected += selected.size();
+            if (selected != expected) {
+                if (mismatches < 10) {
+                    std::cout << "  Graph " << graph.sentence_id << ": selected "
+                              << selected.size() << " grammars, expected " << expected.size()
+                              << "\n";
+                }
+                mismatches++;
+            }
+        }
+    }
+
+    std::cout << "Grammars: " << grammars.size() << ", graphs: " << graphs.size()
+              << ", selected: " << total_selected << ", mismatches: " << mismatches << "\n";
+    if (mismatches == 0) {
+        std::cout << "SUCCESS: GrammarSelector selects the compatible grammars!\n";
+        return 0;
+    } else {
+        std::cout << "FAILURE: GrammarSelector differs from brute force.\n";
+        return 1;
+    }
+}
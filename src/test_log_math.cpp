@@ -0,0 +1,151 @@
+//
+// Test program for the log-space kernels
+// Checks ExpNonPositive, LogSumExp and ScaledProb against long double references, in particular
+// where plain doubles underflow
+//
+
+#include "graph_parser/log_math.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace shrg;
+
+namespace {
+
+const double kLogZero = -std::numeric_limits<double>::infinity();
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        if (failures < 20) {
+            std::cout << "  " << what << " FAILED\n";
+        }
+        failures++;
+    }
+}
+
+// Whether two log values agree, -inf only with -inf
+bool log_close(double a, double b, double tolerance = 1e-12) {
+    if (std::isinf(a) || std::isinf(b)) {
+        return a == b;
+    }
+    return std::abs(a - b) <= tolerance * std::max(1.0, std::abs(a));
+}
+
+// log(sum exp(values)) in long double, shifted by the maximum
+double reference_log_sum_exp(const std::vector<double>& values) {
+    long double max_value = kLogZero;
+    for (double value : values) {
+        max_value = std::max<long double>(max_value, value);
+    }
+    if (std::isinf(max_value)) {
+        return kLogZero;
+    }
+    long double sum = 0.0L;
+    for (double value : values) {
+        sum += std::exp(static_cast<long double>(value) - max_value);
+    }
+    return static_cast<double>(max_value + std::log(sum));
+}
+
+}  // namespace
+
+int main() {
+    std::mt19937 rng(20240623);
+
+    // ExpNonPositive: a few ulp from std::exp down to -708, 0 below
+    double max_relative_error = 0.0;
+    std::uniform_real_distribution<double> exponent_of(-708.0, 0.0);
+    for (int i = 0; i < 100000; i++) {
+        double x = i < 1000 ? -i * 0.708 : exponent_of(rng);
+        double expected = std::exp(x);
+        max_relative_error = std::max(max_relative_error,
+                                      std::abs(ExpNonPositive(x) - expected) / expected);
+    }
+    check(max_relative_error < 1e-15, "ExpNonPositive precision");
+    check(ExpNonPositive(-708.5) == 0.0 && ExpNonPositive(-1e6) == 0.0 &&
+              ExpNonPositive(kLogZero) == 0.0,
+          "ExpNonPositive underflow to 0");
+    check(ExpNonPositive(0.0) == 1.0, "ExpNonPositive(0)");
+
+    // LogSumExp: empty, all -inf, values whose exps underflow, and addends far below the maximum
+    check(LogSumExp(nullptr, 0) == kLogZero, "LogSumExp of nothing");
+    std::vector<std::vector<double>> cases = {
+        {kLogZero, kLogZero, kLogZero},
+        {-1000.0},
+        {-1000.0, -1000.0},
+        {-5000.0, kLogZero, -5000.0, -5001.0, -4999.5},
+        {0.0, -800.0},
+        {-800.0, 0.0, kLogZero, -30.0, -1e300},
+        {-745.0, -745.0, -745.0, -745.0, -745.0, -745.0, -745.0},
+    };
+    std::uniform_real_distribution<double> value_of(-3000.0, -2000.0);
+    for (int n = 1; n <= 17; n++) {
+        std::vector<double> values;
+        for (int i = 0; i < n; i++) {
+            values.push_back(i % 5 == 3 ? kLogZero : value_of(rng));
+        }
+        cases.push_back(values);
+    }
+    for (size_t c = 0; c < cases.size(); c++) {
+        check(log_close(LogSumExp(cases[c].data(), cases[c].size()),
+                        reference_log_sum_exp(cases[c])),
+              "LogSumExp case " + std::to_string(c));
+    }
+
+    // ScaledProb: conversions, and sums and products far below the smallest double
+    check(ScaledProb().IsZero() && ScaledProb::FromLog(kLogZero).IsZero() &&
+              ScaledProb().Log() == kLogZero,
+          "ScaledProb zero");
+    check(ScaledProb::One().Log() == 0.0, "ScaledProb one");
+    for (double log_value : {0.0, -1.0, -0.5, -700.0, -745.5, -5000.0, -1e6, 3.0, 2000.0}) {
+        check(log_close(ScaledProb::FromLog(log_value).Log(), log_value),
+              "ScaledProb round trip of " + std::to_string(log_value));
+        check(log_close(ScaledProb::FromLog(log_value).Inverse().Log(), -log_value),
+              "ScaledProb inverse of " + std::to_string(log_value));
+    }
+
+    // A product of 1000 factors e^-3 is e^-3000, a double would be 0 after about 250 of them
+    ScaledProb product = ScaledProb::One();
+    for (int i = 0; i < 1000; i++) {
+        product *= ScaledProb::FromLog(-3.0);
+    }
+    check(log_close(product.Log(), -3000.0), "ScaledProb product");
+    check((product * ScaledProb()).IsZero(), "ScaledProb product with zero");
+
+    // Sums of addends far below a double, in any order of magnitude
+    ScaledProb tiny = ScaledProb::FromLog(-2000.0);
+    check(log_close((tiny + tiny).Log(), -2000.0 + std::log(2.0)), "ScaledProb sum of equals");
+    check(log_close((tiny + ScaledProb()).Log(), -2000.0) &&
+              log_close((ScaledProb() + tiny).Log(), -2000.0),
+          "ScaledProb sum with zero");
+    check(log_close((ScaledProb::FromLog(-2000.0) + ScaledProb::FromLog(-2030.0)).Log(),
+                    reference_log_sum_exp({-2000.0, -2030.0})),
+          "ScaledProb sum of different magnitudes");
+    check(log_close((ScaledProb::One() + ScaledProb::FromLog(-800.0)).Log(), 0.0),
+          "ScaledProb sum with a negligible addend");
+
+    std::vector<double> log_values;
+    ScaledProb sum;
+    for (int i = 0; i < 1000; i++) {
+        log_values.push_back(value_of(rng));
+        sum += ScaledProb::FromLog(log_values.back());
+    }
+    check(log_close(sum.Log(), reference_log_sum_exp(log_values)), "ScaledProb long sum");
+
+    std::cout << "Failures: " << failures << "\n";
+    if (failures == 0) {
+        std::cout << "SUCCESS: Log-space kernels are accurate!\n";
+        return 0;
+    } else {
+        std::cout << "FAILURE: Log-space kernels are inaccurate.\n";
+        return 1;
+    }
+}
@@ -0,0 +1,124 @@
+//
+// Test program for the cube-pruned merge order of the tree parsers
+// Runs MergeCube on random grids and compares the merged pairs with a brute-force best-K
+//
+
+#include "graph_parser/parser_tree_base.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace shrg;
+
+namespace {
+
+struct Pair {
+    uint row, column;
+    float score;
+};
+
+// whether merging a pair produces an item; about a third of the pairs fail, as merges whose edge
+// sets overlap or whose boundaries do not match would
+bool Accepts(uint row, uint column) {
+    return (row * 7 + column * 13) % 3 != 0;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(20240605);
+    const int num_trials = 2000;
+    int failures = 0;
+
+    tree::MergeCube cube;
+    for (int trial = 0; trial < num_trials; ++trial) {
+        // Scores are multiples of 0.5, so there are ties and every sum is exact
+        std::uniform_int_distribution<int> num_grids_of(0, 4);
+        std::uniform_int_distribution<int> size_of(0, 6);
+        std::uniform_int_distribution<int> score_of(-8, 0);
+        std::uniform_int_distribution<int> beam_of(1, 24);
+
+        std::vector<Pair> all_pairs;
+        cube.Clear();
+        int num_grids = num_grids_of(rng);
+        for (int g = 0; g < num_grids; ++g) {
+            cube.NewGrid();
+            // Positions are unique to a grid, so a pair of positions names one cell
+            std::vector<std::pair<uint, float>> rows, columns;
+            int num_rows = size_of(rng), num_columns = size_of(rng);
+            for (int r = 0; r < num_rows; ++r)
+                rows.emplace_back(g * 100 + r, score_of(rng) * 0.5f);
+            for (int c = 0; c < num_columns; ++c)
+                columns.emplace_back(g * 100 + c, score_of(rng) * 0.5f);
+            for (const auto &row : rows)
+                cube.AddRow(row.first, row.second);
+            for (const auto &column : columns)
+                cube.AddColumn(column.first, column.second);
+            for (const auto &row : rows)
+                for (const auto &column : columns)
+                    all_pairs.push_back({row.first, column.first, row.second + column.second});
+        }
+        uint beam_width = trial % 10 == 0 ? 1000 : beam_of(rng);
+
+        // Brute force: the scores of the best `beam_width` pairs that merge
+        std::vector<float> expected;
+        for (const Pair &pair : all_pairs)
+            if (Accepts(pair.row, pair.column))
+                expected.push_back(pair.score);
+        std::sort(expected.begin(), expected.end(), std::greater<float>());
+        if (expected.size() > beam_width)
+            expected.resize(beam_width);
+
+        std::vector<Pair> tried;
+        std::vector<float> merged;
+        auto score_of_pair = [&](uint row, uint column) {
+            for (const Pair &pair : all_pairs)
+                if (pair.row == row && pair.column == column)
+                    return pair.score;
+            return 1.0f; // not a cell of any grid
+        };
+        cube.Run(beam_width, [&](uint row, uint column) {
+            float score = score_of_pair(row, column);
+            tried.push_back({row, column, score});
+            if (!Accepts(row, column))
+                return false;
+            merged.push_back(score);
+            return true;
+        });
+
+        // Every pair is a cell, tried at most once, best first
+        bool ok = true;
+        std::set<std::pair<uint, uint>> seen;
+        for (std::size_t i = 0; i < tried.size(); ++i) {
+            ok = ok && tried[i].score <= 0.0f;
+            ok = ok && seen.emplace(tried[i].row, tried[i].column).second;
+            ok = ok && (i == 0 || tried[i].score <= tried[i - 1].score);
+        }
+        // The merged pairs score as the best ones, and all pairs are tried if the beam is not full
+        ok = ok && merged == expected;
+        ok = ok && (merged.size() == beam_width || tried.size() == all_pairs.size());
+
+        if (!ok) {
+            if (failures < 10)
+                std::cout << "  Trial " << trial << ": " << num_grids << " grids, beam "
+                          << beam_width << ", " << merged.size() << " merged of "
+                          << expected.size() << " expected, " << tried.size() << " tried of "
+                          << all_pairs.size() << "\n";
+            ++failures;
+        }
+    }
+
+    std::cout << "Trials: " << num_trials << ", failed: " << failures << "\n";
+    if (failures == 0) {
+        std::cout << "SUCCESS: MergeCube merges the best pairs first!\n";
+        return 0;
+    } else {
+        std::cout << "FAILURE: MergeCube order differs from brute force.\n";
+        return 1;
+    }
+}
@@ -0,0 +1,330 @@
+//
+// Test program for the passes over packed derivation forests
+// Compares PackedForest::Inside/Outside and the expected counts, in log and in scaled linear
+// space, with the recursive ChartItem passes of EM on small ambiguous forests, and the ambiguity
+// metrics over packed forests with the ones over chart items
+//
+
+#include "manager.hpp"
+#include "ambiguity_metrics/ambiguity_metrics.hpp"
+#include "em_framework/em.hpp"
+#include "graph_parser/packed_forest.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace shrg;
+
+namespace {
+
+// Chains of x and y nodes are derived by the prefixes S and the suffixes T of the chain in every
+// order, so their forests share many nodes and have many hyperedges per node
+const char* kGrammars = R"(10
+1
+1 1
+_x_n_1 1 0 Y
+1 0
+2
+0 5 10 X 1 x -1
+1 5 10 X 1 ex -1
+1
+1 1
+_y_n_1 1 0 Y
+1 0
+1
+2 5 10 X 1 y -1
+1
+2 3
+X 1 0 N
+ARG1 2 0 1 Y
+X 1 1 N
+1 1
+1
+3 3 3 S 2 X 0 X 2
+1
+3 3
+S 1 0 N
+ARG1 2 0 1 Y
+X 1 1 N
+1 1
+2
+4 2 3 S 2 S 0 X 2
+5 1 3 S 2 X 2 S 0
+1
+2 3
+X 1 0 N
+ARG1 2 0 1 Y
+X 1 1 N
+1 0
+1
+6 3 3 T 2 X 0 X 2
+1
+3 3
+X 1 0 N
+ARG1 2 0 1 Y
+T 1 1 N
+1 0
+1
+7 3 3 T 2 X 0 T 2
+1
+2 3
+S 1 0 N
+ARG1 2 0 1 Y
+T 1 1 N
+0
+1
+8 1 1 ROOT 2 S 0 T 2
+1
+2 3
+S 1 0 N
+ARG1 2 0 1 Y
+X 1 1 N
+0
+1
+9 1 1 ROOT 2 S 0 X 2
+1
+2 3
+X 1 0 N
+ARG1 2 0 1 Y
+T 1 1 N
+0
+1
+10 1 1 ROOT 2 X 0 T 2
+1
+2 3
+X 1 0 N
+ARG1 2 0 1 Y
+X 1 1 N
+0
+1
+11 1 1 ROOT 2 X 0 X 2
+)";
+
+std::string make_graphs(std::mt19937& rng, const std::vector<int>& lengths) {
+    std::ostringstream os;
+    os << lengths.size() << "\n";
+    for (size_t g = 0; g < lengths.size(); g++) {
+        int n = lengths[g];
+        std::vector<std::string> tokens;
+        for (int i = 0; i < n; i++) {
+            tokens.push_back(rng() % 2 ? "x" : "y");
+        }
+        std::string sentence;
+        for (const std::string& token : tokens) {
+            sentence += (sentence.empty() ? "" : " ") + token;
+        }
+        os << "s" << g << "\n" << sentence << "\n" << sentence << "\n" << n << "\n";
+        for (int i = 0; i < n; i++) {
+            os << i << " e" << i << " _" << tokens[i] << "_n_1 " << tokens[i]
+               << " n 1 _ _ _ _ _ _\n";
+        }
+        os << "0 " << n - 1 << "\n";
+        for (int i = 0; i + 1 < n; i++) {
+            os << i << " " << i + 1 << " ARG1\n";
+        }
+    }
+    return os.str();
+}
+
+bool write_file(const std::string& path, const std::string& content) {
+    std::ofstream os(path);
+    os << content;
+    return static_cast<bool>(os);
+}
+
+// Whether two log values agree, -inf only with -inf
+bool log_close(double a, double b, double tolerance = 1e-9) {
+    if (std::isinf(a) || std::isinf(b)) {
+        return a == b;
+    }
+    return std::abs(a - b) <= tolerance * std::max(1.0, std::abs(a));
+}
+
+// Exposes the ChartItem expected counts of EM
+struct ReferenceEM : public em::EM {
+    using em::EM::EM;
+    using em::EM::computeExpectedCount;
+};
+
+}  // namespace
+
+int main() {
+    std::mt19937 rng(20240617);
+
+    char dir_template[] = "/tmp/test_packed_forest_XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        std::cerr << "Cannot create a temporary directory\n";
+        return 1;
+    }
+    std::string grammar_path = std::string(dir_template) + "/grammars.txt";
+    std::string graph_path = std::string(dir_template) + "/graphs.txt";
+
+    auto* manager = &Manager::manager;
+    manager->Allocate(1);
+    bool loaded = write_file(grammar_path, kGrammars) &&
+                  write_file(graph_path, make_graphs(rng, {2, 3, 4, 5, 6, 7, 8, 9, 10})) &&
+                  manager->LoadGrammars(grammar_path) && manager->LoadGraphs(graph_path);
+    unlink(grammar_path.c_str());
+    unlink(graph_path.c_str());
+    rmdir(dir_template);
+    if (!loaded) {
+        std::cerr << "Cannot load the test grammars and graphs\n";
+        return 1;
+    }
+
+    auto& context = manager->contexts[0];
+    context->Init("tree_v2", false, 100);
+    std::vector<SHRG*> shrg_rules = manager->shrg_rules;
+    ReferenceEM em(shrg_rules, manager->edsgraphs, context, 0.01, "N", 5);
+
+    auto rule_weight = [](const SHRG* rule_ptr) { return rule_ptr->log_rule_weight; };
+    int num_forests = 0;
+    int mismatches = 0;
+    auto check = [&](bool ok, const std::string& graph_id, const char* what) {
+        if (!ok) {
+            if (mismatches < 10) {
+                std::cout << "  Graph " << graph_id << ": " << what << " MISMATCH\n";
+            }
+            mismatches++;
+        }
+    };
+
+    // Rule weights of order 1, then of order e^-400, whose products underflow in linear space
+    std::uniform_real_distribution<double> weight_of(0.05, 1.0);
+    for (double log_scale : {0.0, -400.0}) {
+        for (SHRG& grammar : manager->grammars) {
+            grammar.log_rule_weight = std::log(weight_of(rng)) + log_scale;
+        }
+
+        for (size_t i = 0; i < manager->edsgraphs.size(); i++) {
+            const std::string& graph_id = manager->edsgraphs[i].sentence_id;
+            if (context->Parse(i) != ParserError::kNone || !context->parser->Result()) {
+                std::cout << "  Graph " << graph_id << ": parse failed\n";
+                mismatches++;
+                continue;
+            }
+            ChartItem* root = context->parser->Result();
+            em.addParentPointerOptimized(root, 0);
+            em.addRulePointer(root);
+            num_forests++;
+
+            // The reference: recursive passes over the chart items
+            for (SHRG& grammar : manager->grammars) {
+                grammar.log_count = ChartItem::log_zero;
+            }
+            em.beginPass();
+            double pw = em.computeInside(root);
+            em.computeOutside(root);
+            em.computeExpectedCount(root, pw);
+            std::unordered_map<const SHRG*, double> reference_counts;
+            for (SHRG& grammar : manager->grammars) {
+                reference_counts[&grammar] = grammar.log_count;
+            }
+
+            PackedForest forest;
+            forest.Build(root, em.getGenerator());
+            std::unordered_map<const ChartItem*, uint32_t> node_of;
+            for (uint32_t e = 0; e < forest.NumEdges(); e++) {
+                node_of[forest.Item(e)] = forest.GetEdge(e).head;
+            }
+
+            // Log space
+            std::vector<double> log_inside, log_outside;
+            double log_partition = forest.Inside(rule_weight, log_inside);
+            forest.Outside(rule_weight, log_inside, log_outside);
+            check(log_close(log_partition, pw), graph_id, "partition");
+            bool inside_ok = true, outside_ok = true;
+            for (uint32_t e = 0; e < forest.NumEdges(); e++) {
+                const ChartItem* item = forest.Item(e);
+                inside_ok = inside_ok && log_close(log_inside[forest.GetEdge(e).head],
+                                                   item->Annotations().log_inside_prob);
+                for (const ChartItem* child : item->Annotations().children) {
+                    outside_ok = outside_ok && node_of.count(child) &&
+                                 log_close(log_outside[node_of[child]],
+                                           child->Annotations().log_outside_prob);
+                }
+            }
+            check(inside_ok, graph_id, "inside");
+            check(outside_ok, graph_id, "outside");
+
+            std::unordered_map<const SHRG*, double> log_counts;
+            forest.ForEachEdgeCount(rule_weight, log_inside, log_outside, log_partition,
+                                    [&](uint32_t e, double log_count) {
+                                        const SHRG* rule_ptr = forest.GetEdge(e).rule_ptr;
+                                        auto it = log_counts.emplace(rule_ptr, ChartItem::log_zero);
+                                        it.first->second =
+                                            PackedForest::LogAdd(it.first->second, log_count);
+                                    });
+            bool counts_ok = true;
+            for (const auto& kv : reference_counts) {
+                auto it = log_counts.find(kv.first);
+                counts_ok = counts_ok && log_close(it == log_counts.end() ? ChartItem::log_zero
+                                                                          : it->second,
+                                                   kv.second);
+            }
+            check(counts_ok, graph_id, "expected count");
+
+            // Entropy and derivation count, over a forest built from the annotations as the
+            // evaluation tools build it
+            PackedForest annotated_forest;
+            annotated_forest.BuildFromAnnotations(root);
+            double log_Z = 0.0, entropy = 0.0, reference_log_Z = 0.0, reference_entropy = 0.0;
+            lexcxg::ComputePartitionAndEntropyDP(annotated_forest, log_Z, entropy);
+            lexcxg::ComputePartitionAndEntropyDP(root, reference_log_Z, reference_entropy);
+            // the entropy is a difference of terms of the size of log Z, so it is only as exact
+            bool entropy_close = std::abs(entropy - reference_entropy) <=
+                                 1e-9 * std::max(1.0, std::abs(reference_log_Z));
+            check(log_close(log_Z, reference_log_Z) && entropy_close, graph_id, "entropy");
+            check(log_close(lexcxg::ComputeLogDerivationCount(forest),
+                            lexcxg::ComputeLogDerivationCount(root)),
+                  graph_id, "derivation count");
+
+            // Linear space on scaled probabilities, which must not underflow
+            auto edge_weight = [&](uint32_t e) {
+                return ScaledProb::FromLog(forest.GetEdge(e).rule_ptr->log_rule_weight);
+            };
+            std::vector<ScaledProb> inside, outside;
+            ScaledProb partition = forest.ScaledInside(edge_weight, inside);
+            forest.ScaledOutside(edge_weight, inside, outside);
+            check(log_close(partition.Log(), pw), graph_id, "scaled partition");
+            bool scaled_ok = true;
+            for (uint32_t n = 0; n < forest.NumNodes(); n++) {
+                scaled_ok = scaled_ok && log_close(inside[n].Log(), log_inside[n]) &&
+                            log_close(outside[n].Log(), log_outside[n]);
+            }
+            check(scaled_ok, graph_id, "scaled inside/outside");
+
+            std::unordered_map<const SHRG*, ScaledProb> counts;
+            forest.ForEachScaledEdgeCount(edge_weight, inside, outside, partition,
+                                          [&](uint32_t e, const ScaledProb& count) {
+                                              counts[forest.GetEdge(e).rule_ptr] += count;
+                                          });
+            bool scaled_counts_ok = true;
+            for (const auto& kv : reference_counts) {
+                auto it = counts.find(kv.first);
+                scaled_counts_ok =
+                    scaled_counts_ok &&
+                    log_close(it == counts.end() ? ChartItem::log_zero : it->second.Log(),
+                              kv.second);
+            }
+            check(scaled_counts_ok, graph_id, "scaled expected count");
+        }
+    }
+
+    std::cout << "Forests checked: " << num_forests << ", mismatches: " << mismatches << "\n";
+    if (num_forests > 0 && mismatches == 0) {
+        std::cout << "SUCCESS: PackedForest passes match the ChartItem passes!\n";
+        return 0;
+    } else {
+        std::cout << "FAILURE: PackedForest passes differ from the ChartItem passes.\n";
+        return 1;
+    }
+}